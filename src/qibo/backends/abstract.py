@@ -340,13 +340,17 @@ class AbstractBackend(ABC):
         raise_error(NotImplementedError)
 
     @abstractmethod
-    def sample_frequencies(self, probs, nshots): # pragma: no cover
+    def sample_frequencies(self, probs, nshots, exact=False): # pragma: no cover
         """Samples measurement frequencies from a given probability distribution.
 
         Args:
             probs (Tensor): Tensor with the probability distribution on the
                 measured bitsrings.
             nshots (int): Number of measurement shots to sample.
+            exact (bool): If ``True`` the custom backend uses the exact
+                chunked sampler of the ``measure_frequencies`` operator
+                instead of its default Metropolis sampler. The other
+                backends always sample exactly and ignore this flag.
 
         Returns:
             Frequencies of measurements as a ``collections.Counter``.
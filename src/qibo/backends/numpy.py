@@ -206,7 +206,7 @@ class NumpyBackend(abstract.AbstractBackend):
     def sample_shots(self, probs, nshots):
         return self.random.choice(range(len(probs)), size=nshots, p=probs)
 
-    def sample_frequencies(self, probs, nshots):
+    def sample_frequencies(self, probs, nshots, exact=False):
         from qibo.config import SHOT_BATCH_SIZE
         def update_frequencies(nsamples, frequencies):
             samples = self.random.choice(range(len(probs)), size=nsamples, p=probs)
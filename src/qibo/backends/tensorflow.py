@@ -166,7 +166,7 @@ class TensorflowBackend(numpy.NumpyBackend):
                 dtype=self.dtypes('DTYPEINT'))[0])
         return self.concatenate(samples, axis=0)
 
-    def sample_frequencies(self, probs, nshots):
+    def sample_frequencies(self, probs, nshots, exact=False):
         logits = self.log(probs)[self.newaxis]
         samples = self.random.categorical(logits, nshots, dtype=self.dtypes('DTYPEINT'))[0]
         res, counts = self.unique(samples, return_counts=True)
@@ -209,6 +209,16 @@ class TensorflowCustomBackend(TensorflowBackend):
         from qibo.config import get_threads
         self.get_threads = get_threads
 
+    def host_cast(self, x, dtype="int32"):
+        """Casts ``x`` to a tensor in host memory.
+
+        The GPU kernels of the custom operators read the qubit indices on the
+        host, so creating them there avoids a device to host copy, which
+        synchronizes the device, on every gate application.
+        """
+        with self.backend.device(self.cpu_devices[0].name):
+            return self.cast(x, dtype)
+
     def initial_state(self, nqubits, is_matrix=False):
         return self.op.initial_state(nqubits, self.dtypes('DTYPECPX'),
                                     is_matrix=is_matrix,
@@ -218,7 +228,7 @@ class TensorflowCustomBackend(TensorflowBackend):
         return self.op.transpose_state(pieces, state, nqubits, order,
                                        self.get_threads())
 
-    def sample_frequencies(self, probs, nshots):
+    def sample_frequencies(self, probs, nshots, exact=False):
         from qibo.config import SHOT_CUSTOM_OP_THREASHOLD
         if nshots < SHOT_CUSTOM_OP_THREASHOLD:
             return super().sample_frequencies(probs, nshots)
@@ -230,7 +240,8 @@ class TensorflowCustomBackend(TensorflowBackend):
         shape = self.cast(2 ** nqubits, dtype='DTYPEINT')
         frequencies = self.zeros(shape, dtype='DTYPEINT')
         frequencies = self.op.measure_frequencies(
-            frequencies, probs, nshots, nqubits, seed, self.get_threads())
+            frequencies, probs, nshots, nqubits, seed, self.get_threads(),
+            exact=exact)
         return frequencies
 
     def create_einsum_cache(self, qubits, nqubits, ncontrol=None): # pragma: no cover
@@ -243,8 +254,10 @@ class TensorflowCustomBackend(TensorflowBackend):
         cache = self.GateCache()
         qubits = [gate.nqubits - q - 1 for q in gate.control_qubits]
         qubits.extend(gate.nqubits - q - 1 for q in gate.target_qubits)
-        cache.qubits_tensor = self.cast(sorted(qubits), "int32")
+        cache.qubits_tensor = self.host_cast(sorted(qubits))
         if gate.density_matrix:
+            cache.qubits_tensor_dm = self.host_cast(
+                sorted(q + gate.nqubits for q in qubits))
             cache.target_qubits_dm = [q + gate.nqubits for q in gate.target_qubits]
         return cache
 
@@ -257,8 +270,238 @@ class TensorflowCustomBackend(TensorflowBackend):
                             gate.nqubits, *gate.target_qubits,
                             self.get_threads())
 
+    def _target_matrix(self, gate):
+        """Matrix of ``gate`` on its target qubits as a numpy array.
+
+        The controls of ``gate`` are not included. Returns ``None`` for gates
+        with more than two targets or without such a matrix.
+        """
+        if len(gate.target_qubits) > 2:
+            return None
+        op = getattr(gate, "gate_op", None)
+        if op is self.op.apply_swap:
+            return self.np.array(self.matrices.SWAP)
+        if op is self.op.apply_z:
+            return self.np.diag([1, -1])
+        if op is self.op.apply_z_pow:
+            return self.np.diag([1, self.np.array(gate.matrix)])
+        if op is self.op.apply_x:
+            return self.np.array(self.matrices.X)
+        if op is self.op.apply_y:
+            return self.np.array(self.matrices.Y)
+        if op is self.op.apply_fsim:
+            # the custom fSim matrix holds the 2x2 block and the phase
+            elements = self.np.array(gate.matrix)
+            matrix = self.np.eye(4, dtype=elements.dtype)
+            matrix[1:3, 1:3] = self.np.reshape(elements[:4], (2, 2))
+            matrix[3, 3] = elements[4]
+            return matrix
+        if op is self.op.apply_gate or op is self.op.apply_two_qubit_gate:
+            return self.np.array(gate.matrix)
+        return None
+
+    def _density_matrix_gate_call(self, gate, state):
+        """Applies ``gate`` to a density matrix with a single-pass operator.
+
+        Returns ``None`` if ``gate`` has no such operator, which is the case
+        for gates with more than two targets.
+        """
+        matrix = self._target_matrix(gate)
+        if matrix is None:
+            return None
+        args = (gate.cache.qubits_tensor, gate.nqubits, gate.target_qubits,
+                self.get_threads())
+        op = gate.gate_op
+        if op is self.op.apply_swap:
+            return self.op.apply_density_matrix_swap(state, *args)
+        if op is self.op.apply_z or op is self.op.apply_z_pow:
+            diagonal = self.cast(self.np.diag(matrix))
+            return self.op.apply_density_matrix_diagonal_gate(state, diagonal,
+                                                              *args)
+        return self.op.apply_density_matrix_gate(state, self.cast(matrix),
+                                                 *args)
+
+    def execute_circuit(self, circuit, state):
+        """Applies all gates of ``circuit`` to ``state`` with a single operator.
+
+        The gate queue is serialized for the ``execute_circuit`` operator,
+        which applies the gates in a single call instead of dispatching one
+        operator per gate. Returns ``None`` if the circuit contains gates that
+        the operator does not support (channels, measurements, callbacks and
+        other special gates, density matrices or gates with unset symbols) or
+        gates whose parameters are tensors or variables, so that the gate
+        operators are applied one by one and their gradients are available.
+        Batches of states are also applied gate by gate.
+
+        The serialized queue is cached on the circuit and it is created again
+        only when the queue changes. On repeated executions only the matrices
+        of the parametrized gates are written again, and only if the gate
+        matrices were updated, for example by ``circuit.set_parameters``.
+        """
+        nqubits = circuit.nqubits
+        if tuple(state.shape) != (2 ** nqubits,):
+            return None
+        cache = circuit._serialized_queue
+        if (cache is None or cache["queue"] is not circuit.queue or
+                cache["ngates"] != len(circuit.queue)):
+            cache = self._serialize_queue(circuit)
+            circuit._serialized_queue = cache
+        if cache is None or cache["qubits"] is None:
+            return None
+        if not all(self._serializable_parameters(gate)
+                   for gate in cache["parametrized"]):
+            return None
+        for slot in cache["slots"]:
+            gate, start, stop, matrix = slot
+            if matrix is not gate.matrix:
+                slot[3] = gate.matrix
+                cache["elements"][start:stop] = self.np.reshape(
+                    self.np.array(slot[3]), (-1,))
+                cache["matrices"] = None
+        if cache["matrices"] is None:
+            cache["matrices"] = self.cast(cache["elements"])
+
+        return self.op.execute_circuit(
+            state, cache["matrices"], cache["qubits"], cache["gate_info"],
+            nqubits, self.get_threads())
+
+    def _serializable_parameters(self, gate):
+        """Checks that the matrix of a parametrized gate can be serialized."""
+        return gate.well_defined and not any(
+            isinstance(p, self.native_types) for p in gate._parameters)
+
+    def _serialize_queue(self, circuit):
+        """Serializes the gate queue of ``circuit`` for ``execute_circuit``.
+
+        Returns:
+            Dictionary with the cast qubits and gate information, the
+            concatenated gate matrix elements, the parametrized gates and the
+            ``[gate, start, stop, matrix]`` slots of the parametrized gate
+            matrices in the elements. The qubits are ``None`` if the queue
+            contains gates that the operator does not support. ``None`` is
+            returned instead of the dictionary, so that nothing is cached, if
+            the queue contains parametrized gates that cannot be serialized
+            with their current parameters.
+        """
+        from qibo.abstractions.abstract_gates import ParametrizedGate
+        from qibo.core import gates
+        types = {self.op.apply_gate: 0, self.op.apply_two_qubit_gate: 0,
+                 gates.Unitary._multi_qubit_gate_op: 0, self.op.apply_x: 1,
+                 self.op.apply_y: 2, self.op.apply_z: 3,
+                 self.op.apply_z_pow: 4, self.op.apply_fsim: 5,
+                 self.op.apply_swap: 6}
+        calls = (gates.BackendGate.state_vector_call,
+                 gates.MatrixGate.state_vector_call)
+        nqubits = circuit.nqubits
+        cache = {"queue": circuit.queue, "ngates": len(circuit.queue),
+                 "qubits": None, "parametrized": [], "slots": []}
+        matrices, qubits, gate_info, offset = [], [], [], 0
+        for gate in circuit.queue:
+            op = getattr(gate, "gate_op", None)
+            if (gate.density_matrix or op not in types or
+                    type(gate).state_vector_call not in calls):
+                return cache
+            targets = list(gate.target_qubits)
+            controls = list(gate.control_qubits)
+            qubits.extend(sorted(nqubits - q - 1 for q in controls + targets))
+            gate_info.append([types[op], len(targets), len(controls), offset] +
+                             targets + (5 - len(targets)) * [0])
+            if isinstance(gate, ParametrizedGate):
+                if not self._serializable_parameters(gate):
+                    return None
+                cache["parametrized"].append(gate)
+            if isinstance(gate, gates.MatrixGate):
+                matrix = self.np.reshape(self.np.array(gate.matrix), (-1,))
+                if isinstance(gate, ParametrizedGate):
+                    cache["slots"].append(
+                        [gate, offset, offset + len(matrix), gate.matrix])
+                matrices.append(matrix)
+                offset += len(matrix)
+
+        cache["elements"] = self.np.concatenate(
+            matrices + [self.np.zeros(0, dtype="complex128")])
+        cache["matrices"] = None
+        cache["qubits"] = self.host_cast(qubits)
+        cache["gate_info"] = self.host_cast(self.np.reshape(
+            self.np.array(gate_info, dtype="int32"), (-1, 9)))
+        return cache
+
+    def trajectory_samples(self, circuit, nshots, initial_state=None):
+        """Samples the measurements of a noisy circuit using trajectories.
+
+        The ``nshots`` trajectories are simulated by the
+        ``simulate_trajectories`` operator, which samples one Kraus operator
+        of each channel per trajectory. Returns ``None`` if the circuit
+        contains gates that the operator does not support (gates with more
+        than two targets, collapse measurements, callbacks, reset and thermal
+        relaxation channels or measurements with bitflip noise). The seed of
+        the operator is drawn from the numpy random state, which is set by
+        the seeds of the channels, so that seeded circuits give reproducible
+        samples.
+
+        Returns:
+            Shuffled measurement shots in decimal form, as the ones of the
+            repeated execution.
+        """
+        from qibo.abstractions import gates
+        mgate = circuit.measurement_gate
+        if sum(sum(x.values()) for x in mgate.bitflip_map) > 0:
+            return None
+        nqubits = circuit.nqubits
+        matrices, qubits, gate_info = [], [], []
+        for gate in circuit.queue:
+            if isinstance(gate, (gates.ResetChannel,
+                                 gates._ThermalRelaxationChannelB)):
+                return None
+            if isinstance(gate, gates.KrausChannel):
+                fused = gate._fused_kraus_channel()
+                if fused is None:
+                    return None
+                targets, matrix = fused
+                controls, nops = (), len(matrix)
+            else:
+                matrix = self._target_matrix(gate)
+                if matrix is None:
+                    return None
+                targets, controls, nops = (gate.target_qubits,
+                                           gate.control_qubits, 0)
+            targets = list(targets)
+            qubits.extend(sorted(nqubits - q - 1
+                                 for q in list(controls) + targets))
+            gate_info.append([nops, len(targets), len(controls), targets[0],
+                              targets[-1]])
+            matrices.append(self.np.reshape(matrix, (-1,)))
+
+        measured = list(mgate.target_qubits)
+        order = sorted(measured)
+        seed = int(self.np.random.randint(0, 2 ** 31 - 1))
+        frequencies = self.op.simulate_trajectories(
+            circuit.get_initial_state(initial_state),
+            self.host_cast(self.np.concatenate(matrices + [self.np.zeros(0)]),
+                           "DTYPECPX"),
+            self.host_cast(qubits),
+            self.host_cast(self.np.reshape(
+                self.np.array(gate_info, dtype="int32"), (-1, 5))),
+            self.host_cast(sorted(nqubits - q - 1 for q in measured)),
+            nqubits, nshots, seed, self.get_threads())
+        frequencies = self.np.array(frequencies)
+
+        # the operator orders the results by qubit id
+        nmeasured = len(measured)
+        results = self.np.arange(2 ** nmeasured)
+        decimal = self.np.zeros_like(results)
+        for i, q in enumerate(order):
+            bit = (results >> (nmeasured - i - 1)) & 1
+            decimal += bit << (nmeasured - measured.index(q) - 1)
+        samples = self.np.repeat(decimal, frequencies)
+        samples = self.np.random.permutation(samples)
+        return self.cast(samples, "DTYPEINT")
+
     def density_matrix_call(self, gate, state):
-        state = gate.gate_op(state, gate.cache.qubits_tensor + gate.nqubits,
+        new_state = self._density_matrix_gate_call(gate, state)
+        if new_state is not None:
+            return new_state
+        state = gate.gate_op(state, gate.cache.qubits_tensor_dm,
                              2 * gate.nqubits, *gate.target_qubits,
                              self.get_threads())
         state = gate.gate_op(state, gate.cache.qubits_tensor, 2 * gate.nqubits,
@@ -266,7 +509,10 @@ class TensorflowCustomBackend(TensorflowBackend):
         return state
 
     def density_matrix_matrix_call(self, gate, state):
-        state = gate.gate_op(state, gate.matrix, gate.cache.qubits_tensor + gate.nqubits, # pylint: disable=E1121
+        new_state = self._density_matrix_gate_call(gate, state)
+        if new_state is not None:
+            return new_state
+        state = gate.gate_op(state, gate.matrix, gate.cache.qubits_tensor_dm, # pylint: disable=E1121
                              2 * gate.nqubits, *gate.target_qubits,
                              self.get_threads())
         adjmatrix = self.conj(gate.matrix)
@@ -280,7 +526,7 @@ class TensorflowCustomBackend(TensorflowBackend):
                             gate.nqubits, True, self.get_threads())
 
     def density_matrix_collapse(self, gate, state, result):
-        state = gate.gate_op(state, gate.cache.qubits_tensor + gate.nqubits, result,
+        state = gate.gate_op(state, gate.cache.qubits_tensor_dm, result,
                              2 * gate.nqubits, False, self.get_threads())
         state = gate.gate_op(state, gate.cache.qubits_tensor, result,
                              2 * gate.nqubits, False, self.get_threads())
@@ -29,6 +29,8 @@ class Circuit(circuit.AbstractCircuit):
         super(Circuit, self).__init__(nqubits)
         self.param_tensor_types = K.tensor_types
         self._compiled_execute = None
+        # queue serialized by ``K.execute_circuit`` for the custom backend
+        self._serialized_queue = None
         self.state_cls = states.VectorState
 
     def set_nqubits(self, gate):
@@ -103,8 +105,21 @@ class Circuit(circuit.AbstractCircuit):
                 new_circuit.queue.append(gate)
         return new_circuit
 
+    def set_parameters(self, parameters):
+        super(Circuit, self).set_parameters(parameters)
+        if self._serialized_queue:
+            # matrices of parametrized gates are serialized again on execution
+            self._serialized_queue["matrices"] = None
+            for slot in self._serialized_queue["slots"]:
+                slot[3] = None
+
     def _eager_execute(self, state):
         """Simulates the circuit gates in eager mode."""
+        if K.name == "custom" and self.queue:
+            # circuits of supported gates are applied by a single operator
+            new_state = K.execute_circuit(self, state)
+            if new_state is not None:
+                return new_state
         for gate in self.queue:
             state = gate(state)
         return state
@@ -163,6 +178,30 @@ class Circuit(circuit.AbstractCircuit):
                                        "different one using ``qibo.set_device``.")
         return state
 
+    def _trajectory_execute(self, nshots, initial_state=None):
+        """Samples the measurements with trajectories on the specified device."""
+        if K.name != "custom":
+            raise_error(NotImplementedError, "Trajectories are only sampled "
+                                             "by the custom backend.")
+        if self.measurement_gate is None:
+            raise_error(ValueError, "Cannot sample trajectories of a circuit "
+                                    "without measurements.")
+        device = K.default_device
+        try:
+            with K.device(device):
+                samples = K.trajectory_samples(self, nshots, initial_state)
+        except K.oom_error:
+            raise_error(RuntimeError, f"State does not fit in {device} memory."
+                                       "Please switch the execution device to a "
+                                       "different one using ``qibo.set_device``.")
+        if samples is None:
+            raise_error(ValueError, "Circuit contains gates or measurements "
+                                    "that cannot be sampled with trajectories.")
+        state = self.state_cls(self.nqubits)
+        state.set_measurements(self.measurement_gate.qubits, samples,
+                               self.measurement_tuples)
+        return state
+
     def _repeated_execute(self, nreps, initial_state=None):
         results = []
         for _ in range(nreps):
@@ -181,7 +220,7 @@ class Circuit(circuit.AbstractCircuit):
         state.set_measurements(self.measurement_gate.qubits, results, self.measurement_tuples)
         return state
 
-    def execute(self, initial_state=None, nshots=None):
+    def execute(self, initial_state=None, nshots=None, trajectories=False):
         """Propagates the state through the circuit applying the corresponding gates.
 
         If channels are found within the circuits gates then Qibo will perform
@@ -206,6 +245,15 @@ class Circuit(circuit.AbstractCircuit):
             nshots (int): Number of shots to sample if the circuit contains
                 measurement gates.
                 If ``nshots`` is ``None`` the measurement gates will be ignored.
+            trajectories (bool): If ``True`` the ``nshots`` measurements of a
+                noisy circuit are sampled by a single custom operator, which
+                applies one Kraus operator of each channel per shot sampled
+                with probability ``||K_k psi||^2``. This agrees with the
+                density matrix simulation, so general
+                :class:`qibo.abstractions.gates.KrausChannel` are supported,
+                while the repeated execution samples each unitary of a
+                :class:`qibo.abstractions.gates.UnitaryChannel` independently.
+                Requires the custom backend.
 
         Returns:
             A :class:`qibo.abstractions.states.AbstractState` object which
@@ -215,6 +263,9 @@ class Circuit(circuit.AbstractCircuit):
             If ``nshots`` is given and the circuit contains measurements
             the returned circuit object also contains the measured bitstrings.
         """
+        if nshots is not None and trajectories:
+            self._final_state = None
+            return self._trajectory_execute(nshots, initial_state)
         if nshots is not None and self.repeated_execution:
             self._final_state = None
             return self._repeated_execute(nshots, initial_state)
@@ -2,6 +2,7 @@
 # @authors: S. Efthymiou
 import math
 import joblib
+from concurrent.futures import ThreadPoolExecutor
 from qibo import K
 from qibo import gates as gate_module
 from qibo.abstractions import gates
@@ -43,7 +44,19 @@ class DistributedCircuit(circuit.Circuit):
             times each device will be used.
             The total number of logical devices must be a power of 2.
         memory_device (str): Name of the device where the full state will be
-            saved (usually the CPU).
+            saved (usually the CPU). If it is a GPU the state pieces, the
+            global-local qubit swaps and the reconstruction of the full
+            state stay on that GPU and the pieces are copied directly
+            between the GPUs.
+
+    Setting the ``asynchronous`` attribute to ``True`` executes the circuit
+    as a pipeline over the state pieces: the swaps of global qubits are
+    scheduled per pair of pieces, so that a swap starts as soon as the
+    gates of its two pieces are applied and the next gates of these pieces
+    start as soon as the swap is done, while the other pieces are still
+    being processed. The gates of each accelerator are still applied one
+    piece at a time, so that memory usage is the same as in the default
+    execution.
     """
 
     def __init__(self,
@@ -63,6 +76,7 @@ class DistributedCircuit(circuit.Circuit):
 
         self.memory_device = memory_device
         self.calc_devices = accelerators
+        self.asynchronous = False
         self.queues = DistributedQueues(self, gate_module)
 
     def set_nqubits(self, gate):
@@ -139,16 +153,24 @@ class DistributedCircuit(circuit.Circuit):
         pool(joblib.delayed(device_job)(ids, device)
              for device, ids in self.queues.device_to_ids.items())
 
-    def _swap(self, state, global_qubit: int, local_qubit: int):
+    def _swap_pairs(self, global_qubit: int):
+        """Indices of the pairs of pieces exchanged when ``global_qubit`` is swapped."""
         m = self.queues.qubits.reduced_global[global_qubit]
         m = self.nglobal - m - 1
         t = 1 << m
         for g in range(self.ndevices // 2):
             i = ((g >> m) << (m + 1)) + (g & (t - 1))
-            local_eff = self.queues.qubits.reduced_local[local_qubit]
-            with K.device(self.memory_device):
-                K.op.swap_pieces(state.pieces[i], state.pieces[i + t],
-                                 local_eff, self.nlocal, get_threads())
+            yield i, i + t
+
+    def _swap_pieces(self, state, i: int, j: int, local_qubit: int):
+        local_eff = self.queues.qubits.reduced_local[local_qubit]
+        with K.device(self.memory_device):
+            K.op.swap_pieces(state.pieces[i], state.pieces[j],
+                             local_eff, self.nlocal, get_threads())
+
+    def _swap(self, state, global_qubit: int, local_qubit: int):
+        for i, j in self._swap_pairs(global_qubit):
+            self._swap_pieces(state, i, j, local_qubit)
 
     def _revert_swaps(self, state, swap_pairs: List[Tuple[int, int]]):
         for q1, q2 in swap_pairs:
@@ -198,9 +220,77 @@ class DistributedCircuit(circuit.Circuit):
         self._final_state = state
         return state
 
+    def _async_execute(self, initial_state=None):
+        """Performs all circuit gates as a pipeline over the state pieces.
+
+        Each task applies the gates of a group to one piece or swaps a pair
+        of pieces and waits only for the previous tasks of the same pieces
+        and, for gates, for the previous gate task of the same accelerator in
+        any group, so that swaps overlap with the gates applied to other
+        pieces. Special gates wait for all pieces.
+        """
+        self._final_state = None
+        state = self.get_initial_state(initial_state)
+        if self.measurement_gate is not None:
+            self.measurement_gate.device = self.memory_device
+
+        def wait(*dependencies):
+            for future in dependencies:
+                if future is not None:
+                    future.result()
+
+        def device_job(i, device, queue, *dependencies):
+            wait(*dependencies)
+            with K.device(device):
+                piece = self._device_job(state.pieces[i], queue)
+                state.pieces[i].assign(piece)
+                del(piece)
+
+        def swap_job(i, j, local_qubit, *dependencies):
+            wait(*dependencies)
+            self._swap_pieces(state, i, j, local_qubit)
+
+        # tasks are started in submission order, so a task never waits for
+        # a task that has not started yet
+        futures = self.ndevices * [None]
+        # the last task of each accelerator, which is chained across groups
+        # so that an accelerator holds a single piece at a time
+        last = {device: None for device in self.queues.device_to_ids}
+        special_gates = iter(self.queues.special_queue)
+        with ThreadPoolExecutor(max_workers=self.ndevices) as pool:
+            for queues in self.queues.queues:
+                if queues:  # standard gate
+                    for device, ids in self.queues.device_to_ids.items():
+                        for i in ids:
+                            last[device] = pool.submit(
+                                device_job, i, device, queues[i], futures[i],
+                                last[device])
+                            futures[i] = last[device]
+                else: # special gate
+                    gate = next(special_gates)
+                    if isinstance(gate, tuple): # SWAP global-local qubit
+                        global_qubit, local_qubit = gate
+                        for i, j in self._swap_pairs(global_qubit):
+                            future = pool.submit(swap_job, i, j, local_qubit,
+                                                 futures[i], futures[j])
+                            futures[i], futures[j] = future, future
+                    else:
+                        wait(*futures)
+                        futures = self.ndevices * [None]
+                        last = {device: None for device in last}
+                        self._special_gate_execute(state, gate)
+            wait(*futures)
+        for gate in special_gates: # pragma: no cover
+            self._special_gate_execute(state, gate)
+
+        self._final_state = state
+        return state
+
     def _device_execute(self, initial_state=None):
         """Executes circuit and checks for OOM errors."""
         try:
+            if self.asynchronous:
+                return self._async_execute(initial_state)
             return self._execute(initial_state)
         except K.oom_error:
             raise_error(RuntimeError, "State does not fit in memory during distributed "
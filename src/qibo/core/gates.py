@@ -103,21 +103,10 @@ class Y(BackendGate, abstract_gates.Y):
         abstract_gates.Y.__init__(self, q)
         if self.gate_op:
             self.gate_op = K.op.apply_y
-            self.density_matrix_call = lambda state: self._custom_density_matrix_call(state)
 
     def construct_unitary(self):
         return K.matrices.Y
 
-    def _custom_density_matrix_call(self, state):
-        state = self.gate_op(state, self.cache.qubits_tensor + self.nqubits,
-                             2 * self.nqubits, *self.target_qubits,
-                             K.get_threads())
-        matrix = K.conj(K.matrices.Y)
-        state = K.op.apply_gate(state, matrix, self.cache.qubits_tensor,
-                                2 * self.nqubits, *self.cache.target_qubits_dm,
-                                K.get_threads())
-        return state
-
 
 class Z(BackendGate, abstract_gates.Z):
 
@@ -599,14 +588,27 @@ class Unitary(MatrixGate, abstract_gates.Unitary):
                 self.gate_op = K.op.apply_gate
             elif rank == 2:
                 self.gate_op = K.op.apply_two_qubit_gate
+            elif rank <= 5:
+                self.gate_op = self._multi_qubit_gate_op
             else:
                 n = len(self.target_qubits)
-                raise_error(NotImplementedError, "Unitary gate supports one or two-"
-                                                 "qubit gates when using custom "
-                                                 "operators, but {} target qubits "
-                                                 "were given. Please switch to a "
-                                                 "different backend to execute "
-                                                 "this operation.".format(n))
+                raise_error(NotImplementedError, "Unitary gate supports up to "
+                                                 "five-qubit gates when using "
+                                                 "custom operators, but {} target "
+                                                 "qubits were given. Please switch "
+                                                 "to a different backend to "
+                                                 "execute this operation."
+                                                 "".format(n))
+
+    @staticmethod
+    def _multi_qubit_gate_op(state, matrix, qubits, nqubits, *args):
+        """Calls ``apply_multi_qubit_gate`` with the signature of the two-qubit operators.
+
+        ``args`` contains the target qubits followed by the number of threads.
+        """
+        targets, threads = args[:-1], args[-1]
+        return K.op.apply_multi_qubit_gate(state, matrix, qubits, nqubits,
+                                           targets, threads)
 
     def construct_unitary(self):
         unitary = self.parameters
@@ -868,7 +870,52 @@ class KrausChannel(BackendGate, abstract_gates.KrausChannel):
         raise_error(ValueError, "`KrausChannel` cannot be applied to state "
                                 "vectors. Please switch to density matrices.")
 
+    def _kraus_operators(self):
+        """Kraus operators of the channel as ``(qubits, matrix)`` pairs."""
+        return [(gate.target_qubits, K.np.array(gate.construct_unitary()))
+                for gate in self.gates]
+
+    def _fused_kraus_channel(self):
+        """Kraus operators expanded to the union of their target qubits.
+
+        Used by the custom backend to apply the channel to density matrices
+        with a single ``apply_kraus_channel`` pass. Returns ``None`` if the
+        operators act on more than two qubits.
+        """
+        if getattr(self, "_fused_kraus_cache", None) is None:
+            operators = self._kraus_operators()
+            targets = sorted(set(q for qubits, _ in operators for q in qubits))
+            if len(targets) > 2:
+                self._fused_kraus_cache = False
+                return None
+            nt = len(targets)
+            fused = []
+            for qubits, matrix in operators:
+                # the identity acts on the targets that the operator skips
+                order = list(qubits) + [q for q in targets if q not in qubits]
+                matrix = K.np.kron(matrix, K.np.eye(2 ** (nt - len(qubits))))
+                perm = [order.index(q) for q in targets]
+                matrix = K.np.reshape(matrix, 2 * nt * (2,))
+                matrix = K.np.transpose(matrix, perm + [p + nt for p in perm])
+                fused.append(K.np.reshape(matrix, (2 ** nt, 2 ** nt)))
+            self._fused_kraus_cache = (targets, K.cast(K.np.stack(fused)))
+        return self._fused_kraus_cache or None
+
+    def _custom_density_matrix_call(self, state):
+        """Applies the fused channel if possible, otherwise returns ``None``."""
+        if K.name != "custom":
+            return None
+        fused = self._fused_kraus_channel()
+        if fused is None:
+            return None
+        targets, ops = fused
+        return K.op.apply_kraus_channel(state, ops, self.nqubits, targets,
+                                        K.get_threads())
+
     def density_matrix_call(self, state):
+        new_state = self._custom_density_matrix_call(state)
+        if new_state is not None:
+            return new_state
         new_state = K.zeros_like(state)
         for gate, inv_gate in zip(self.gates, self.inverse_gates):
             new_state += gate(state)
@@ -899,7 +946,20 @@ class UnitaryChannel(KrausChannel, abstract_gates.UnitaryChannel):
                 state = gate(state)
         return state
 
+    def _kraus_operators(self):
+        operators = [(gate.target_qubits,
+                      K.np.sqrt(p) * K.np.array(gate.construct_unitary()))
+                     for p, gate in zip(self.probs, self.gates)]
+        if self.psum < 1:
+            qubit = self.gates[0].target_qubits[0]
+            operators.append(((qubit,),
+                              K.np.sqrt(1 - self.psum) * K.np.eye(2)))
+        return operators
+
     def density_matrix_call(self, state):
+        new_state = self._custom_density_matrix_call(state)
+        if new_state is not None:
+            return new_state
         new_state = (1 - self.psum) * state
         for p, gate, inv_gate in zip(self.probs, self.gates, self.inverse_gates):
             state = gate(state)
@@ -1022,7 +1082,11 @@ class _ThermalRelaxationChannelB(MatrixGate, abstract_gates._ThermalRelaxationCh
             cache = K.create_gate_cache(self)
 
             qubits = sorted(self.nqubits - q - 1 for q in self.target_qubits)
-            cache.qubits_tensor = qubits + [q + self.nqubits for q in qubits]
+            qubits = qubits + [q + self.nqubits for q in qubits]
+            if K.name == "custom":
+                cache.qubits_tensor = K.host_cast(qubits)
+            else:
+                cache.qubits_tensor = qubits
             cache.target_qubits_dm = self.qubits + tuple(q + self.nqubits for q in self.qubits)
 
             if K.name != "custom":
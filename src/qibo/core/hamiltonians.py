@@ -327,6 +327,40 @@ class SymbolicHamiltonian:
         eye = K.np.eye(matrix.shape[0], dtype=matrix.dtype)
         return matrix + self.constant * eye
 
+    def pauli_strings(self):
+        """Decomposes the Hamiltonian to a weighted sum of Pauli strings.
+
+        Useful for calculating expectation values with the
+        ``pauli_expectation`` custom operator without creating the
+        Hamiltonian matrix.
+
+        Returns:
+            Integer array of shape ``(nterms, nqubits)`` with the Pauli matrix
+            of each string on each qubit (0, 1, 2, 3 for I, X, Y, Z), the
+            array of coefficients of the strings and the constant term.
+        """
+        paulis = (self.matrices.I, self.matrices.X, self.matrices.Y,
+                  self.matrices.Z)
+        codes, coefficients = [], []
+        for targets, matrices in self.terms.items():
+            if len(set(targets)) != len(targets):
+                raise_error(ValueError, "Term acting on {} contains products "
+                                        "on the same qubit.".format(targets))
+            n = len(targets)
+            for i in range(0, len(matrices), n + 1):
+                code = self.nqubits * [0]
+                for t, m in zip(targets, matrices[i + 1: i + n + 1]):
+                    ids = [j for j, p in enumerate(paulis)
+                           if K.np.array_equal(m, p)]
+                    if not ids:
+                        raise_error(ValueError, "Term acting on {} is not a "
+                                                "Pauli string.".format(targets))
+                    code[t] = ids[0]
+                codes.append(code)
+                coefficients.append(matrices[i])
+        return (K.np.array(codes, dtype=K.np.int32).reshape((-1, self.nqubits)),
+                K.np.array(coefficients), self.constant)
+
     def reduce_pairs(self, pair_sets, pair_map, free_targets):
         """Helper method for ``merge_one_qubit``.
 
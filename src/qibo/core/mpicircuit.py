@@ -0,0 +1,353 @@
+# -*- coding: utf-8 -*-
+import math
+from qibo import K
+from qibo import gates as gate_module
+from qibo.abstractions import gates
+from qibo.config import raise_error, get_threads
+from qibo.core import circuit, states
+from qibo.core.distcircuit import DistributedCircuit
+from qibo.core.distutils import DistributedQueues
+from typing import Dict
+
+
+class MPIDistributedCircuit(DistributedCircuit):
+    """Distributed circuit whose state pieces are owned by the ranks of an MPI communicator.
+
+    Uses the same piece layout as :class:`qibo.core.distcircuit.DistributedCircuit`
+    but each rank holds only the pieces of its own accelerators, so that the
+    total memory is not limited by a single node. The pieces are numbered
+    in rank order, so rank ``r`` owns the pieces that follow the pieces of
+    ranks ``0, ..., r - 1``. Global-local qubit swaps between pieces of
+    different ranks are pairwise exchanges of half of each piece, in messages
+    of at most ``chunk_size`` amplitudes (``MPI.Sendrecv_replace``), and
+    swaps between pieces of the same rank use the ``swap_pieces`` operator.
+    Norms, probabilities and expectation
+    values of the final :class:`qibo.core.mpicircuit.MPIDistributedState`
+    are computed on each rank and reduced with ``MPI.Allreduce``, and
+    measurement shots are sampled from the reduced probabilities.
+
+    All ranks must create and execute the same circuit. Special gates, which
+    require the full state vector, are not supported. The ``asynchronous``
+    mode requires MPI to be initialized with ``MPI_THREAD_MULTIPLE``.
+
+    Example:
+        ::
+
+            # run with ``mpirun -n 2 python script.py`` on two nodes
+            # with two GPUs each
+            from qibo.core.mpicircuit import MPIDistributedCircuit
+            c = MPIDistributedCircuit(34, {'/GPU:0': 1, '/GPU:1': 1})
+
+    Args:
+        nqubits (int): Total number of qubits in the circuit.
+        accelerators (dict): Dictionary that maps the devices of this rank to
+            the number of times each device will be used. The total number of
+            logical devices of all ranks must be a power of 2.
+        memory_device (str): Device where the pieces of this rank are saved.
+        comm: MPI communicator of the ranks. Defaults to ``MPI.COMM_WORLD``.
+    """
+
+    # maximum number of amplitudes in each message of a global swap
+    chunk_size = 2 ** 24
+
+    def __init__(self,
+                 nqubits: int,
+                 accelerators: Dict[str, int],
+                 memory_device: str = "/CPU:0",
+                 comm=None):
+        if comm is None:
+            try:
+                from mpi4py import MPI
+            except ModuleNotFoundError: # pragma: no cover
+                raise_error(ModuleNotFoundError,
+                            "Cannot create MPI distributed circuit because "
+                            "mpi4py is not installed.")
+            comm = MPI.COMM_WORLD
+        self.comm = comm
+        self.rank = comm.Get_rank()
+        counts = comm.allgather(sum(accelerators.values()))
+        self.first_piece = sum(counts[:self.rank])
+        self.piece_ranks = [r for r, n in enumerate(counts) for _ in range(n)]
+
+        circuit.Circuit.__init__(self, nqubits)
+        self.init_kwargs.update({"accelerators": accelerators,
+                                 "memory_device": memory_device,
+                                 "comm": comm})
+        self.ndevices = sum(counts)
+        self.nglobal = float(math.log2(self.ndevices))
+        if not (self.nglobal.is_integer() and self.nglobal > 0):
+            raise_error(ValueError, "Number of calculation devices of all ranks "
+                                    "should be a power of 2 but is {}."
+                                    "".format(self.ndevices))
+        self.nglobal = int(self.nglobal)
+        self.nlocal = self.nqubits - self.nglobal
+
+        self.memory_device = memory_device
+        self.calc_devices = accelerators
+        self.asynchronous = False
+        self.queues = DistributedQueues(self, gate_module)
+        # the devices of this rank update the pieces that it owns
+        self.queues.device_to_ids = {
+            device: [i + self.first_piece for i in ids]
+            for device, ids in self.queues.device_to_ids.items()}
+        self.queues.ids_to_device = self.ndevices * [None]
+        for device, ids in self.queues.device_to_ids.items():
+            for i in ids:
+                self.queues.ids_to_device[i] = device
+
+    @property
+    def local_pieces(self):
+        """Indices of the pieces owned by this rank."""
+        return range(self.first_piece,
+                     self.first_piece + sum(self.calc_devices.values()))
+
+    def _add(self, gate: gates.Gate):
+        if not gate.target_qubits or (isinstance(gate, gates.M) and
+                                      gate.collapse):
+            raise_error(NotImplementedError, "MPI distributed circuits do "
+                                             "not support special gates.")
+        return super()._add(gate)
+
+    def _swap_pieces(self, state, i: int, j: int, local_qubit: int):
+        ri, rj = self.piece_ranks[i], self.piece_ranks[j]
+        if ri == rj:
+            if ri == self.rank:
+                super()._swap_pieces(state, i, j, local_qubit)
+            return
+        if self.rank not in (ri, rj):
+            return
+        # piece ``i`` sends the half where the local qubit is 1 and piece
+        # ``j`` the half where it is 0, which is what ``swap_pieces`` exchanges
+        own, partner = (i, rj) if self.rank == ri else (j, ri)
+        bit = int(own == i)
+        m = self.nlocal - self.queues.qubits.reduced_local[local_qubit] - 1
+        # the tag identifies the swap so that concurrent swaps between the
+        # same ranks in the ``asynchronous`` mode are not mixed
+        tag = ((i * self.ndevices + j) * self.nlocal + local_qubit) % 32768
+        piece = state.pieces[own]
+        n, rowsize = int(piece.shape[0]), 2 ** m
+        # only the half that moves is read from the piece, exchanged in a
+        # preallocated host buffer of at most ``chunk_size`` amplitudes and
+        # written back, so that the half that stays is never copied and the
+        # count of a message does not overflow
+        whole_rows = 2 * rowsize <= self.chunk_size
+        if whole_rows:
+            nrows = min(self.chunk_size, n) // (2 * rowsize)
+            step = 2 * rowsize * nrows
+            ranges = ((start, min(start + step, n))
+                      for start in range(0, n, step))
+            # positions of the moving half in a block of ``nrows`` row pairs
+            index = (2 * rowsize * K.np.arange(nrows)[:, K.np.newaxis] +
+                     bit * rowsize + K.np.arange(rowsize)).reshape((-1, 1))
+            buffer = K.np.empty(step // 2, dtype=piece.dtype.as_numpy_dtype)
+        else:
+            ranges = ((start, min(start + self.chunk_size, row + rowsize))
+                      for row in range(bit * rowsize, n, 2 * rowsize)
+                      for start in range(row, row + rowsize, self.chunk_size))
+            buffer = K.np.empty(self.chunk_size,
+                                dtype=piece.dtype.as_numpy_dtype)
+        with K.device(self.memory_device):
+            for start, stop in ranges:
+                size = (stop - start) // 2 if whole_rows else stop - start
+                half = buffer[:size]
+                # the tensors read from ``piece`` are temporaries, released
+                # before the update, which otherwise copies the whole piece
+                if whole_rows:
+                    rows = slice(start // (2 * rowsize), stop // (2 * rowsize))
+                    half[:] = K.np.ravel(
+                        K.reshape(piece, (-1, 2, rowsize))[rows, bit])
+                else:
+                    half[:] = piece[start:stop]
+                self.comm.Sendrecv_replace(half, dest=partner, sendtag=tag,
+                                           source=partner, recvtag=tag)
+                if whole_rows:
+                    piece.scatter_nd_update(index[:size] + start, half)
+                else:
+                    piece[start:stop].assign(half)
+
+    def _special_gate_execute(self, state, gate): # pragma: no cover
+        raise_error(NotImplementedError, "MPI distributed circuits do not "
+                                         "support special gates.")
+
+    def get_initial_state(self, state=None):
+        """"""
+        if not self.queues.queues and self.queue:
+            self.queues.set(self.queue)
+
+        if state is None:
+            return MPIDistributedState.zero_state(self)
+        elif isinstance(state, MPIDistributedState):
+            state.circuit = self
+            return state
+        elif isinstance(state, K.tensor_types):
+            state = circuit.Circuit.get_initial_state(self, state)
+            return MPIDistributedState.from_tensor(state, self)
+
+        raise_error(TypeError, "Initial state type {} is not supported by "
+                               "MPI distributed circuits.".format(type(state)))
+
+
+class MPIDistributedState(states.DistributedState):
+    """Distributed state whose pieces are owned by the ranks of an MPI communicator.
+
+    Entries of ``pieces`` that belong to other ranks are ``None``. The full
+    state vector, which is gathered to all ranks, is available through the
+    ``tensor`` property only for states that fit in the memory of one rank.
+    """
+
+    @property
+    def comm(self):
+        return self.circuit.comm
+
+    @property
+    def local_pieces(self):
+        return self.circuit.local_pieces
+
+    def _allreduce(self, x):
+        from mpi4py import MPI
+        x = K.np.array(x)
+        result = K.np.zeros_like(x)
+        self.comm.Allreduce(x, result, op=MPI.SUM)
+        return result
+
+    def create_pieces(self):
+        n = 2 ** (self.nqubits - self.nglobal)
+        self.pieces = self.ndevices * [None]
+        with K.device(self.device):
+            for i in self.local_pieces:
+                self.pieces[i] = K.optimization.Variable(K.zeros(n))
+
+    def assign_pieces(self, full_state):
+        if self.pieces is None:
+            self.create_pieces()
+        with K.device(self.device):
+            full_state = K.reshape(full_state, self.shapes["device"])
+            pieces = [full_state[i] for i in range(self.ndevices)]
+            new_state = K.zeros(self.shapes["device"])
+            new_state = K.transpose_state(pieces, new_state, self.nqubits,
+                                          self.qubits.transpose_order)
+            for i in self.local_pieces:
+                self.pieces[i].assign(new_state[i])
+
+    @property
+    def tensor(self):
+        """Returns the full state vector gathered to all ranks."""
+        owned = {i: K.np.array(self.pieces[i]) for i in self.local_pieces}
+        pieces = {}
+        for gathered in self.comm.allgather(owned):
+            pieces.update(gathered)
+        with K.device(self.device):
+            pieces = [K.cast(pieces[i]) for i in range(self.ndevices)]
+            state = K.zeros(self.shapes["full"])
+            state = K.transpose_state(pieces, state, self.nqubits,
+                                      self.qubits.reverse_transpose_order)
+        return state
+
+    def __getitem__(self, key):
+        if not isinstance(key, int):
+            return super().__getitem__(key)
+        binary_index = bin(key)[2:].zfill(self.nqubits)
+        binary_index = K.np.array([int(x) for x in binary_index],
+                                  dtype=K.np.int64)
+        global_ids = binary_index[self.qubits.list].dot(self.bintodec["global"])
+        local_ids = binary_index[self.qubits.local].dot(self.bintodec["local"])
+        root = self.circuit.piece_ranks[global_ids]
+        value = None
+        if root == self.comm.Get_rank():
+            value = K.np.array(self.pieces[global_ids][local_ids])
+        return self.comm.bcast(value, root=root)
+
+    @classmethod
+    def zero_state(cls, circuit):
+        state = cls(circuit)
+        state.create_pieces()
+        if 0 in state.local_pieces:
+            with K.device(state.device):
+                piece = K.initial_state(nqubits=state.nlocal)
+                state.pieces[0] = K.optimization.Variable(piece, dtype=piece.dtype)
+        return state
+
+    @classmethod
+    def plus_state(cls, circuit):
+        state = cls(circuit)
+        state.create_pieces()
+        with K.device(state.device):
+            norm = K.cast(2 ** float(state.nqubits / 2.0), dtype=state.dtype)
+            for i in state.local_pieces:
+                state.pieces[i] = K.optimization.Variable(
+                    K.ones_like(state.pieces[i]) / norm)
+        return state
+
+    @property
+    def dtype(self):
+        return self.pieces[self.local_pieces[0]].dtype
+
+    def norm(self):
+        """Norm of the state reduced over all ranks."""
+        norm = sum(K.np.sum(K.np.abs(K.np.array(self.pieces[i])) ** 2)
+                   for i in self.local_pieces)
+        return K.np.sqrt(self._allreduce(norm))
+
+    @states.VectorState.check_measured_qubits
+    def probabilities(self, qubits=None, measurement_gate=None):
+        """Probabilities of the measured qubits reduced over all ranks.
+
+        Returns an array of shape ``len(qubits) * (2,)`` with the qubits in
+        increasing order.
+        """
+        return self._allreduce(
+            self._pieces_probabilities(qubits, self.local_pieces))
+
+    def measure(self, gate, nshots, registers=None):
+        """Samples measurement shots from the probabilities reduced over all ranks.
+
+        The shots are sampled on rank 0 and broadcast, so that all ranks
+        hold the same measurement results without gathering the state.
+        """
+        qubits = gate.target_qubits
+        probs = self.probabilities(qubits=qubits)
+        order = sorted(qubits)
+        probs = K.np.transpose(probs, [order.index(q) for q in qubits])
+        samples = None
+        if self.comm.Get_rank() == 0:
+            probs = K.cast(K.np.ravel(probs), dtype="DTYPE")
+            samples = K.np.array(K.cpu_fallback(K.sample_shots, probs, nshots))
+        samples = self.comm.bcast(samples, root=0)
+        self.set_measurements(qubits, K.cast(samples, dtype="DTYPEINT"),
+                              registers)
+
+    def expectation(self, hamiltonian, normalize=False):
+        """Expectation value of a :class:`qibo.core.hamiltonians.SymbolicHamiltonian`.
+
+        The Hamiltonian is decomposed to Pauli strings which are evaluated
+        on each piece with the ``pauli_expectation`` operator. Z on a global
+        qubit gives the sign of the piece. Strings with X or Y on global
+        qubits require amplitudes of other pieces and are not supported;
+        such qubits should be made local with a SWAP first.
+        """
+        codes, coefficients, constant = hamiltonian.pauli_strings()
+        global_ids = self.qubits.list
+        if K.np.any(K.np.isin(codes[:, global_ids], (1, 2))):
+            raise_error(NotImplementedError, "Expectation values of Pauli "
+                                             "strings that flip global qubits "
+                                             "are not supported by MPI "
+                                             "distributed states.")
+        local_codes = K.np.ascontiguousarray(codes[:, self.qubits.local])
+        ev = 0
+        for i in self.local_pieces:
+            bits = self._global_bits(i)
+            signs = K.np.ones(len(codes))
+            for q, b in bits.items():
+                if b:
+                    signs[codes[:, q] == 3] *= -1
+            values = K.op.pauli_expectation(self.pieces[i], local_codes,
+                                            self.nlocal,
+                                            omp_num_threads=get_threads())
+            ev += K.np.sum(K.np.real(coefficients) * signs *
+                           K.np.array(values))
+        ev = self._allreduce(ev)
+        if normalize:
+            return ev / self.norm() ** 2 + K.np.real(constant)
+        if constant:
+            ev = ev + K.np.real(constant) * self.norm() ** 2
+        return ev
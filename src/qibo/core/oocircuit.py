@@ -0,0 +1,219 @@
+# -*- coding: utf-8 -*-
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+from qibo import K
+from qibo.config import raise_error
+from qibo.core import circuit, states
+from qibo.core.distcircuit import DistributedCircuit
+from typing import List, Optional
+
+
+class OutOfCoreCircuit(DistributedCircuit):
+    """Circuit whose state vector is held in a memory-mapped file on disk.
+
+    Allows the simulation of states that do not fit in memory. The state is
+    split to ``nchunks`` chunks using the piece layout of
+    :class:`qibo.core.distcircuit.DistributedCircuit`, so that the qubits
+    that select the chunk play the role of the global qubits and the gate
+    queue is scheduled with :class:`qibo.core.distutils.DistributedQueues`.
+    The gates of each group act on local qubits and are applied one chunk
+    at a time: while the gates are applied to a chunk, the next chunk is
+    read from disk and the previous one is written back, so that at most
+    three chunks are held in memory, and a fourth one while a gate copies
+    its input chunk to its output (see
+    :meth:`qibo.tensorflow.custom_operators.set_copy_shared_states`).
+    Global-local qubit swaps exchange half
+    of each pair of chunks directly in the file.
+
+    Special gates and the ``tensor`` of the final
+    :class:`qibo.core.oocircuit.OutOfCoreState` require the full state
+    vector, so they are only available for states that fit in memory.
+    Norms and probabilities are computed chunk by chunk.
+
+    Example:
+        ::
+
+            from qibo.core.oocircuit import OutOfCoreCircuit
+            # 36 qubits in 64 chunks of 16GB on a local NVMe disk
+            c = OutOfCoreCircuit(36, 64, directory="/scratch")
+
+    Args:
+        nqubits (int): Total number of qubits in the circuit.
+        nchunks (int): Number of chunks of the state, a power of 2. Each chunk
+            holds ``2 ** nqubits / nchunks`` amplitudes and should fit in a
+            quarter of the available memory.
+        directory (str): Directory of the file that holds the state. Defaults
+            to the temporary directory of the system. The file is removed
+            when the state is released.
+        device (str): Device where the gates are applied to the chunks.
+    """
+
+    def __init__(self,
+                 nqubits: int,
+                 nchunks: int,
+                 directory: Optional[str] = None,
+                 device: str = "/CPU:0"):
+        super().__init__(nqubits, {device: nchunks}, memory_device=device)
+        self.init_kwargs = {"nqubits": nqubits, "nchunks": nchunks,
+                            "directory": directory, "device": device}
+        self.directory = directory
+
+    def _joblib_execute(self, state, queues: List[List["BackendGate"]]):
+        """Applies the gates of a group to the chunks of the state.
+
+        Reads and writes of the chunks run in a separate thread, overlapped
+        with the gates applied to the current chunk.
+        """
+        ids = [i for i in range(self.ndevices) if queues[i]]
+        if not ids:
+            return
+
+        # chunks are converted from the memory map to tensors and written
+        # back from views of the tensors, without intermediate copies
+        def read(i):
+            with K.device(self.memory_device):
+                return K.cast(state.pieces[i])
+
+        def write(i, piece):
+            state.pieces[i][:] = K.np.asarray(piece)
+
+        with ThreadPoolExecutor(max_workers=2) as pool:
+            reading, writing = pool.submit(read, ids[0]), None
+            for k, i in enumerate(ids):
+                piece = reading.result()
+                if k + 1 < len(ids):
+                    reading = pool.submit(read, ids[k + 1])
+                with K.device(self.memory_device):
+                    piece = self._device_job(piece, queues[i])
+                if writing is not None:
+                    writing.result()
+                writing = pool.submit(write, i, piece)
+                del(piece)
+            writing.result()
+
+    def _swap_pieces(self, state, i: int, j: int, local_qubit: int):
+        # exchanges the half of chunk ``i`` where the local qubit is 1 with
+        # the half of chunk ``j`` where it is 0, as ``swap_pieces`` does
+        m = self.nlocal - self.queues.qubits.reduced_local[local_qubit] - 1
+        piece_i = state.pieces[i].reshape((-1, 2, 2 ** m))
+        piece_j = state.pieces[j].reshape((-1, 2, 2 ** m))
+        half = K.np.array(piece_i[:, 1])
+        piece_i[:, 1] = piece_j[:, 0]
+        piece_j[:, 0] = half
+
+    def _swap(self, state, global_qubit: int, local_qubit: int):
+        # pairs of chunks are disjoint, so the reads of one pair overlap
+        # with the writes of the other
+        with ThreadPoolExecutor(max_workers=2) as pool:
+            futures = [pool.submit(self._swap_pieces, state, i, j, local_qubit)
+                       for i, j in self._swap_pairs(global_qubit)]
+            for future in futures:
+                future.result()
+
+    def _device_execute(self, initial_state=None):
+        """Executes circuit and checks for OOM errors.
+
+        The chunks are always pipelined, so ``asynchronous`` has no effect.
+        """
+        try:
+            return self._execute(initial_state)
+        except K.oom_error:
+            raise_error(RuntimeError, "State chunk does not fit in memory "
+                                      "during out-of-core execution. Please "
+                                      "create a new circuit with more chunks "
+                                      "and try again.")
+
+    def get_initial_state(self, state=None):
+        """"""
+        if not self.queues.queues and self.queue:
+            self.queues.set(self.queue)
+
+        if state is None:
+            return OutOfCoreState.zero_state(self)
+        elif isinstance(state, OutOfCoreState):
+            state.circuit = self
+            return state
+        elif isinstance(state, K.tensor_types):
+            state = circuit.Circuit.get_initial_state(self, state)
+            return OutOfCoreState.from_tensor(state, self)
+
+        raise_error(TypeError, "Initial state type {} is not supported by "
+                               "out-of-core circuits.".format(type(state)))
+
+
+class OutOfCoreState(states.DistributedState):
+    """Distributed state whose pieces are held in a memory-mapped file.
+
+    ``pieces`` are the rows of a ``numpy.memmap`` of shape
+    ``(nchunks, 2 ** nlocal)``, backed by an unnamed temporary file in the
+    directory of the circuit. The chunks are contiguous in the file, so that
+    each chunk is read and written sequentially.
+    """
+
+    def create_pieces(self):
+        n = 2 ** (self.nqubits - self.nglobal)
+        with tempfile.TemporaryFile(dir=self.circuit.directory) as file:
+            # the mapping keeps the file open until it is released
+            self.buffer = K.np.memmap(file, dtype=K.qnp.dtypes("DTYPECPX"),
+                                      mode="w+", shape=(self.ndevices, n))
+        self.pieces = [self.buffer[i] for i in range(self.ndevices)]
+
+    def assign_pieces(self, full_state):
+        if self.pieces is None:
+            self.create_pieces()
+        with K.device(self.device):
+            full_state = K.reshape(full_state, self.shapes["device"])
+            pieces = [full_state[i] for i in range(self.ndevices)]
+            new_state = K.zeros(self.shapes["device"])
+            new_state = K.transpose_state(pieces, new_state, self.nqubits,
+                                          self.qubits.transpose_order)
+            self.buffer[:] = K.np.array(new_state)
+
+    @property
+    def tensor(self):
+        """Returns the full state vector, which has to fit in memory."""
+        with K.device(self.device):
+            pieces = [K.cast(piece) for piece in self.pieces]
+            state = K.zeros(self.shapes["full"])
+            state = K.transpose_state(pieces, state, self.nqubits,
+                                      self.qubits.reverse_transpose_order)
+        return state
+
+    @property
+    def dtype(self):
+        return self.buffer.dtype
+
+    @classmethod
+    def zero_state(cls, circuit):
+        state = cls(circuit)
+        state.create_pieces()
+        state.pieces[0][0] = 1
+        return state
+
+    @classmethod
+    def plus_state(cls, circuit):
+        state = cls(circuit)
+        state.create_pieces()
+        norm = 2 ** float(state.nqubits / 2.0)
+        for piece in state.pieces:
+            piece[:] = 1 / norm
+        return state
+
+    def copy(self):
+        new = super().copy()
+        new.buffer = self.buffer
+        return new
+
+    def norm(self):
+        """Norm of the state computed chunk by chunk."""
+        norm = sum(K.np.sum(K.np.abs(piece) ** 2) for piece in self.pieces)
+        return K.np.sqrt(norm)
+
+    @states.VectorState.check_measured_qubits
+    def probabilities(self, qubits=None, measurement_gate=None):
+        """Probabilities of the measured qubits computed chunk by chunk.
+
+        Returns an array of shape ``len(qubits) * (2,)`` with the qubits in
+        increasing order.
+        """
+        return self._pieces_probabilities(qubits, range(self.ndevices))
@@ -266,6 +266,36 @@ class DistributedState(VectorState):
             self.pieces = [K.optimization.Variable(K.zeros(n))
                            for _ in range(self.ndevices)]
 
+    def _global_bits(self, i: int):
+        """Values of the global qubits that correspond to piece ``i``."""
+        return {q: (i >> (self.nglobal - k - 1)) & 1
+                for k, q in enumerate(self.qubits.list)}
+
+    def _pieces_probabilities(self, qubits, ids):
+        """Probabilities of ``qubits`` summed over the pieces ``ids``.
+
+        Each piece is reduced to the measured local qubits separately, so
+        that the full state vector is not needed, and its measured global
+        qubits select the entry of the probabilities that it contributes to.
+
+        Returns:
+            Array of shape ``len(qubits) * (2,)`` with the qubits in
+            increasing order.
+        """
+        qubits = sorted(qubits)
+        local_axes = tuple(k for k, q in enumerate(self.qubits.local)
+                           if q not in qubits)
+        probs = K.np.zeros(len(qubits) * (2,))
+        for i in ids:
+            piece = K.np.abs(K.np.asarray(self.pieces[i])) ** 2
+            piece = K.np.sum(K.np.reshape(piece, self.nlocal * (2,)),
+                             axis=local_axes)
+            bits = self._global_bits(i)
+            slicer = tuple(bits[q] if q in bits else slice(None)
+                           for q in qubits)
+            probs[slicer] += piece
+        return probs
+
     def assign_pieces(self, full_state):
         """Splits a full state vector and assigns it to the ``tf.Variable`` pieces.
 
@@ -6,6 +6,11 @@ try:
     import tensorflow as tf
     try:
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import initial_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import basis_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import product_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import reset_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import to_half_precision
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import from_half_precision
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import transpose_state
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import swap_pieces
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_gate
@@ -16,8 +21,28 @@ try:
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_two_qubit_gate
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_fsim
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_swap
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_multi_qubit_gate
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_diagonal_layer
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_gate_sequence
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import execute_circuit
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import simulate_trajectories
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_density_matrix_gate
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_density_matrix_diagonal_gate
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_density_matrix_swap
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import apply_kraus_channel
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import collapse_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import collapse_state_compact
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import renormalize_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import pauli_expectation
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import measure_frequencies
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import measure_frequencies_sparse
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import measure_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import state_buffer_counters
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import set_copy_shared_states
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import copy_shared_states
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import clear_state_pool
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import save_state
+        from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import load_state
         # Import gradients
         from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators_grads import _initial_state_grad
         _custom_operators_loaded = True
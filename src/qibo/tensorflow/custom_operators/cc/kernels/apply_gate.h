@@ -18,11 +18,30 @@
  *    - @struct ApplySwapFunctor
  *        Applies the SWAP gate by swapping the |...0...1...> subspace with
  *        the |...1...0...> subspace.
+ *    - @struct ApplyMultiQubitGateFunctor
+ *        Applies a general gate acting on three to five target qubits using
+ *        matrix multiplication. The number of targets is resolved at compile
+ *        time so that the 2^k amplitudes that are mixed by the gate are kept
+ *        in a local buffer.
+ *    - @struct ApplyDiagonalLayerFunctor
+ *        Applies a product of diagonal one- and two-qubit gates (phases) in a
+ *        single pass over the state. The phase of each amplitude is computed
+ *        from the bits of its index that correspond to the target qubits.
+ *    - @struct ApplyGateSequenceFunctor
+ *        Applies a sequence of (controlled) one- and two-qubit gates using
+ *        a single sweep over the state for each block of consecutive gates
+ *        that act on local qubits only (see below).
+ *    - @struct ExecuteCircuitFunctor
+ *        Applies a whole circuit of the gates above, serialized once, in a
+ *        single kernel call (see below).
  *
- * All functors (except @struct ApplySwapFunctor) inherit the
- * @struct BaseApplyGateFunctor which defines BaseApplyGateFunctor::operator.
- * Each specialized functor definces the corresponding
- * BaseApplyGateFunctor::apply method that handles how the gate acts on states.
+ * One-qubit functors inherit @struct BaseOneQubitGateFunctor and two-qubit
+ * functors inherit @struct BaseTwoQubitGateFunctor which define the loop over
+ * the state in their ``operator()``. The base is templated on the derived
+ * functor (CRTP) and each specialized functor defines a static ``apply``
+ * method that handles how the gate acts on the corresponding amplitudes, so
+ * that the gate body is resolved at compile time and inlined in the loop
+ * (or in the GPU kernel) instead of being called virtually for every index.
  *
  * Gates applied by kernels defined here support a single target qubit but can
  * also be controlled to an arbitrary number of qubits. When a gate is controlled
@@ -33,29 +52,104 @@
  * qubits. These are numbers whose binary representation has length \f$n_q-n_c\f$.
  * Each of these numbers is then transformed to one with binary representation
  * of length \f$n_q\f$ by adding ones in the positions of control qubits. This
- * is done using C++ binary operators.
+ * is done using the masks of @struct IndexMasks which are precomputed once
+ * for each gate (see index_masks.h).
+ *
+ * @struct ApplyGateSequenceFunctor splits the state in contiguous slices of
+ * \f$2^{n_l}\f$ amplitudes, where \f$n_l\f$ is the number of "local" qubits.
+ * A gate is local if all its target and control qubits are among the last
+ * \f$n_l\f$ qubits (the least significant bits of the state index), so that
+ * it acts independently on each slice. Consecutive local gates are applied
+ * slice by slice so that each slice stays in cache while the whole block is
+ * applied. On GPU each slice is loaded once to the shared memory of a thread
+ * block, so that a whole block of local gates costs a single kernel launch
+ * and a single read and write of the state. Gates that are not local are
+ * applied using a full pass over the state.
+ * The gates of the sequence are described by the ``gate_info`` array which
+ * holds four integers per gate: the number of targets (1 or 2), the number
+ * of controls and the ids of the two targets (the second is ignored for
+ * one-qubit gates). The ``qubits`` and ``gates`` arrays contain the sorted
+ * qubits and the matrices of all gates concatenated in the same order.
+ *
+ * One- and two-qubit gates and the collapse gate also act on batches of
+ * states of shape (nbatch, 2^nqubits). The batch index occupies the bits of
+ * the flat index above the \f$n_q\f$ state qubits, so that the loops run over
+ * all states of the batch at once and the same index generation is used
+ * (the masks are built with @fn BatchQubits additional qubits). Gates either
+ * share a single matrix or use a different matrix for each state, given by
+ * ``gatestride`` (zero for shared matrices).
+ *
+ * @struct ExecuteCircuitFunctor receives ``ngates`` rows of
+ * ``CIRCUIT_INFO_SIZE`` integers in ``gate_info``: the gate type
+ * (@enum CircuitGateType), the number of targets, the number of controls,
+ * the offset of the gate elements in ``gates`` and up to
+ * ``CIRCUIT_MAX_TARGETS`` target ids. ``CIRCUIT_MATRIX`` gates act on one
+ * to five targets with a \f$2^t \times 2^t\f$ matrix, the other types
+ * use the elements of the corresponding functor above (none for the Pauli
+ * and SWAP gates). Gates with equal matrices may share their offset. The
+ * ``qubits`` array holds the sorted qubits of all gates concatenated. Each
+ * gate dispatches to @fn ApplyCircuitGate, so the per-gate overhead is a
+ * switch instead of an op launch. On CPU states of at most
+ * ``DEFAULT_SERIAL_QUBITS`` qubits are simulated by a single thread, because
+ * opening a parallel region for each gate costs more than the gate itself,
+ * and blocks of local gates of larger states are applied slice by slice as
+ * in @struct ApplyGateSequenceFunctor. On GPU the host loop launches the
+ * kernel of each gate.
+ *
+ * @struct CollapseStateFunctor writes the probability of the measured result
+ * of each state, which is the squared norm of the kept amplitudes computed
+ * before the normalization, to ``probabilities`` (if it is not NULL).
+ * @struct CompactCollapseStateFunctor does not zero the other results.
+ * It copies the kept amplitudes to ``out``, which holds states of
+ * \f$n_q - n_t\f$ qubits where the measured qubits are removed and the
+ * other qubits keep their order, so that the following gates act on a
+ * smaller state.
+ *
+ * @struct ApplyDiagonalLayerFunctor receives the number of targets of each
+ * diagonal term (1 or 2), the concatenated target ids and the concatenated
+ * diagonals (2 or 4 elements per term, ordered with the first target as the
+ * most significant bit).
+ *
+ * @struct GateGradientFunctor implements the backward pass of the ApplyGate,
+ * ApplyZPow, ApplyTwoQubitGate and ApplyFsim ops using adjoint
+ * differentiation (see gate_gradients.h). It receives either the state
+ * before the gate, which is only read, or the state after the gate, which is
+ * restored to the state before the gate in ``undone`` (the same buffer), and
+ * the gradient with respect to the state after the gate, which is replaced by
+ * the gradient with respect to the state before the gate. The gradient of the gate elements is written to
+ * ``gategrad``, which has the shape of the ``gate`` input so that the
+ * gradients of a shared matrix are summed over the batch. ``target2`` is
+ * ignored for one-qubit gates.
+ *
+ * @struct KrausNormsFunctor and @struct TrajectoryProbabilitiesFunctor are
+ * used by the SimulateTrajectories op, which samples noisy circuits with
+ * Monte Carlo wavefunction trajectories. The trajectories are simulated as
+ * a batch of states, so that the gate functors above act on all of them in
+ * a single pass. For each channel the squared norms \f$\|K_k\psi\|^2\f$ of
+ * all its Kraus operators are computed with a single pass over the states
+ * (the operators act on one or two uncontrolled targets, the first being the
+ * most significant bit of their matrices), then each trajectory samples a
+ * branch with its own Philox stream and the normalized operators of the
+ * branches are applied as per-state gate matrices (``gatestride``).
+ * @struct TrajectoryProbabilitiesFunctor computes the probabilities of the
+ * measured qubits of each state in the end, as @struct
+ * MarginalProbabilitiesFunctor does for a single state. Both functors write
+ * their results to host memory because the branches and the measurements
+ * are sampled by the host.
  ***********************************************/
 #ifndef KERNEL_APPLY_GATE_H_
 #define KERNEL_APPLY_GATE_H_
 
+#include "gate_gradients.h"
+#include "index_masks.h"
 #include "tensorflow/core/framework/op_kernel.h"
 
 namespace tensorflow {
 
 namespace functor {
 
-template <typename Device, typename T>
+template <typename Device, typename T, typename Derived>
 struct BaseOneQubitGateFunctor {
-  virtual void apply(T& state1, T& state2, const T* gate = NULL) const;
-
-  virtual void nocontrolwork(const Device& d, int numBlocks, int blockSize,
-                             T* state, const T* gate, long tk, int m) const;
-
-  virtual void multicontrolwork(const Device& d, int numBlocks, int blockSize,
-                                T* state, const T* gate, long tk, int m,
-                                int ncontrols, const int* qubits, int nqubits,
-                                int target) const;
-
   void operator()(
       const OpKernelContext* context, const Device& d,
       T* state,       //!< Total state vector.
@@ -64,59 +158,235 @@ struct BaseOneQubitGateFunctor {
       int ncontrols,  //!< Number of qubits that the gate is controlled on.
       const int32*
           qubits,  //!< List of control and target qubits in increasing order.
-      const T* gate = NULL  //!< Gate matrix (used only by)
+      const T* gate = NULL,  //!< Gate matrix (used only by)
+      int64 nbatch = 1,      //!< Number of states in the batch.
+      int64 gatestride = 0   //!< Gate matrix offset between batch states.
   ) const;
 };
 
 template <typename Device, typename T>
-struct ApplyGateFunctor : BaseOneQubitGateFunctor<Device, T> {};
+struct ApplyGateFunctor
+    : BaseOneQubitGateFunctor<Device, T, ApplyGateFunctor<Device, T>> {};
 
 template <typename Device, typename T>
-struct ApplyXFunctor : BaseOneQubitGateFunctor<Device, T> {};
+struct ApplyXFunctor
+    : BaseOneQubitGateFunctor<Device, T, ApplyXFunctor<Device, T>> {};
 
 template <typename Device, typename T>
-struct ApplyYFunctor : BaseOneQubitGateFunctor<Device, T> {};
+struct ApplyYFunctor
+    : BaseOneQubitGateFunctor<Device, T, ApplyYFunctor<Device, T>> {};
 
 template <typename Device, typename T>
-struct ApplyZFunctor : BaseOneQubitGateFunctor<Device, T> {};
+struct ApplyZFunctor
+    : BaseOneQubitGateFunctor<Device, T, ApplyZFunctor<Device, T>> {};
 
 template <typename Device, typename T>
-struct ApplyZPowFunctor : BaseOneQubitGateFunctor<Device, T> {};
+struct ApplyZPowFunctor
+    : BaseOneQubitGateFunctor<Device, T, ApplyZPowFunctor<Device, T>> {};
 
-template <typename Device, typename T>
+template <typename Device, typename T, typename Derived>
 struct BaseTwoQubitGateFunctor {
-  virtual void apply(T* state, int64 i, int64 tk1, int64 tk2,
-                     const T* gate = NULL) const;
+  void operator()(const OpKernelContext* context, const Device& d, T* state,
+                  int nqubits, int target1, int target2, int ncontrols,
+                  const int32* qubits, const T* gate = NULL, int64 nbatch = 1,
+                  int64 gatestride = 0) const;
+};
+
+template <typename Device, typename T>
+struct ApplyTwoQubitGateFunctor
+    : BaseTwoQubitGateFunctor<Device, T, ApplyTwoQubitGateFunctor<Device, T>> {
+};
 
-  virtual void nocontrolwork(const Device& d, int numBlocks, int blockSize,
-                             T* state, const T* gate, long ctk1, long ctk2,
-                             long tk1, long tk2, int m1, int m2) const;
+template <typename Device, typename T>
+struct ApplyFsimFunctor
+    : BaseTwoQubitGateFunctor<Device, T, ApplyFsimFunctor<Device, T>> {};
 
-  virtual void multicontrolwork(const Device& d, int numBlocks, int blockSize,
-                                T* state, const T* gate, long ctk1, long ctk2,
-                                long tk1, long tk2, int m1, int m2,
-                                int ncontrols, const int* qubits, int nqubits,
-                                int t1, int t2) const;
+template <typename Device, typename T>
+struct ApplySwapFunctor
+    : BaseTwoQubitGateFunctor<Device, T, ApplySwapFunctor<Device, T>> {};
 
+template <typename Device, typename T>
+struct ApplyMultiQubitGateFunctor {
   void operator()(const OpKernelContext* context, const Device& d, T* state,
-                  int nqubits, int target1, int target2, int ncontrols,
-                  const int32* qubits, const T* gate = NULL) const;
+                  int nqubits, int ntargets, const int32* targets,
+                  int ncontrols, const int32* qubits, const T* gate) const;
 };
 
 template <typename Device, typename T>
-struct ApplyTwoQubitGateFunctor : BaseTwoQubitGateFunctor<Device, T> {};
+struct ApplyDiagonalLayerFunctor {
+  void operator()(OpKernelContext* context, const Device& d, T* state,
+                  int nqubits, int nterms, const int32* ntargets,
+                  const int32* targets, const T* phases) const;
+};
 
 template <typename Device, typename T>
-struct ApplyFsimFunctor : BaseTwoQubitGateFunctor<Device, T> {};
+struct ApplyGateSequenceFunctor {
+  void operator()(OpKernelContext* context, const Device& d, T* state,
+                  int nqubits, int ngates, const int32* gate_info,
+                  const int32* qubits, const T* gates) const;
+};
+
+// Maximum number of targets and size of the description of circuit gates
+#define CIRCUIT_MAX_TARGETS 5
+#define CIRCUIT_INFO_SIZE (4 + CIRCUIT_MAX_TARGETS)
+
+enum CircuitGateType {
+  CIRCUIT_MATRIX = 0,
+  CIRCUIT_X,
+  CIRCUIT_Y,
+  CIRCUIT_Z,
+  CIRCUIT_ZPOW,
+  CIRCUIT_FSIM,
+  CIRCUIT_SWAP
+};
+
+// Applies the circuit gate described by the row ``info`` of ``gate_info``
+// using a full pass over the state.
+template <typename Device, typename T>
+void ApplyCircuitGate(const OpKernelContext* context, const Device& d,
+                      T* state, int nqubits, const int32* info,
+                      const int32* qubits, const T* gate) {
+  const int ncontrols = info[2];
+  const int32* targets = info + 4;
+  switch (info[0]) {
+    case CIRCUIT_MATRIX:
+      if (info[1] == 1) {
+        ApplyGateFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                      ncontrols, qubits, gate);
+      } else if (info[1] == 2) {
+        ApplyTwoQubitGateFunctor<Device, T>()(context, d, state, nqubits,
+                                              targets[0], targets[1],
+                                              ncontrols, qubits, gate);
+      } else {
+        ApplyMultiQubitGateFunctor<Device, T>()(context, d, state, nqubits,
+                                                info[1], targets, ncontrols,
+                                                qubits, gate);
+      }
+      break;
+    case CIRCUIT_X:
+      ApplyXFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                 ncontrols, qubits);
+      break;
+    case CIRCUIT_Y:
+      ApplyYFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                 ncontrols, qubits);
+      break;
+    case CIRCUIT_Z:
+      ApplyZFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                 ncontrols, qubits);
+      break;
+    case CIRCUIT_ZPOW:
+      ApplyZPowFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                    ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_FSIM:
+      ApplyFsimFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                    targets[1], ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_SWAP:
+      ApplySwapFunctor<Device, T>()(context, d, state, nqubits, targets[0],
+                                    targets[1], ncontrols, qubits);
+      break;
+  }
+}
 
 template <typename Device, typename T>
-struct ApplySwapFunctor : BaseTwoQubitGateFunctor<Device, T> {};
+struct ExecuteCircuitFunctor {
+  void operator()(OpKernelContext* context, const Device& d, T* state,
+                  int nqubits, int ngates, const int32* gate_info,
+                  const int32* qubits, const T* gates) const;
+};
 
 template <typename Device, typename T, typename NormType>
 struct CollapseStateFunctor {
   void operator()(OpKernelContext* context, const Device& d, T* state,
                   int nqubits, bool normalize, int ntargets,
-                  const int32* qubits, const int64* result) const;
+                  const int32* qubits, const int64* result, int64 nbatch = 1,
+                  int64 resultstride = 0,
+                  double* probabilities = NULL) const;
+};
+
+template <typename Device, typename T, typename NormType>
+struct CompactCollapseStateFunctor {
+  void operator()(OpKernelContext* context, const Device& d, const T* state,
+                  T* out, int nqubits, bool normalize, int ntargets,
+                  const int32* qubits, const int64* result, int64 nbatch = 1,
+                  int64 resultstride = 0,
+                  double* probabilities = NULL) const;
+};
+
+// Maximum number of Kraus operators of each channel of a trajectory
+#define TRAJECTORY_MAX_OPS 16
+
+// Masks of the groups of amplitudes that are mixed by a Kraus operator of
+// a batch of states. ``offsets[a]`` holds the bits of the value ``a`` of the
+// targets, where the first target is the most significant bit.
+struct KrausMasks {
+  IndexMasks masks;
+  int64_t offsets[4];
+
+  KrausMasks(int nqubits, int64_t nbatch, int ntargets, const int32_t* targets,
+             const int32_t* qubits)
+      : masks(nqubits + BatchQubits(nbatch), ntargets, qubits) {
+    for (int a = 0; a < (1 << ntargets); a++) {
+      offsets[a] = 0;
+      for (int it = 0; it < ntargets; it++) {
+        if ((a >> (ntargets - it - 1)) & 1) {
+          offsets[a] |= (int64_t)1 << (nqubits - targets[it] - 1);
+        }
+      }
+    }
+  }
+};
+
+// Adds the squared norms of the ``nops`` operators ``ops`` applied to the
+// group of amplitudes of ``state`` that starts at index ``i``.
+template <int NT, typename T, typename NormType>
+INDEX_MASKS_FUNC void AccumulateKrausNorms(const T* state, int64_t i,
+                                           const KrausMasks& m, int nops,
+                                           const T* ops, NormType* norms) {
+  const int NS = 1 << NT;
+  T x[NS];
+  for (int a = 0; a < NS; a++) x[a] = state[i + m.offsets[a]];
+  for (int k = 0; k < nops; k++) {
+    const T* op = ops + k * NS * NS;
+    NormType norm = 0;
+    for (int a = 0; a < NS; a++) {
+      NormType re = 0, im = 0;
+      for (int c = 0; c < NS; c++) {
+        const T u = op[a * NS + c];
+        re += u.real() * x[c].real() - u.imag() * x[c].imag();
+        im += u.real() * x[c].imag() + u.imag() * x[c].real();
+      }
+      norm += re * re + im * im;
+    }
+    norms[k] += norm;
+  }
+}
+
+template <typename Device, typename T>
+struct KrausNormsFunctor {
+  // ``norms`` holds ``nbatch * nops`` values in host memory
+  void operator()(OpKernelContext* context, const Device& d, const T* state,
+                  int nqubits, int ntargets, const int32* targets,
+                  const int32* qubits, int nops, const T* ops, int64 nbatch,
+                  double* norms) const;
+};
+
+template <typename Device, typename T>
+struct TrajectoryProbabilitiesFunctor {
+  // ``probs`` holds ``nbatch * 2 ** ntargets`` values in host memory
+  void operator()(OpKernelContext* context, const Device& d, const T* state,
+                  int nqubits, int ntargets, const int32* qubits, int64 nbatch,
+                  double* probs) const;
+};
+
+template <typename Device, typename T, int Gate>
+struct GateGradientFunctor {
+  void operator()(OpKernelContext* context, const Device& d, const T* state,
+                  T* undone, T* grad, T* gategrad, int nqubits, int target1, int target2,
+                  int ncontrols, const int32* qubits, const T* gate,
+                  int64 nbatch = 1, int64 gatestride = 0) const;
 };
 
 }  // namespace functor
@@ -3,6 +3,11 @@
 #endif  // GOOGLE_CUDA
 
 #include "apply_gate.h"
+#include "complex_half.h"
+#include "forward_state.h"
+#include "measurements.h"
+#include "simd.h"
+#include "state_pool.h"
 
 namespace tensorflow {
 
@@ -11,6 +16,27 @@ typedef Eigen::GpuDevice GPUDevice;
 
 namespace functor {
 
+namespace simd {
+
+// Half precision states are updated by the scalar loops.
+inline bool ApplyGate(Eigen::half* state, const Eigen::half* gate,
+                      int64_t nstates, int64_t tk, int m) {
+  return false;
+}
+
+inline bool ApplyZPow(Eigen::half* state, const Eigen::half* gate,
+                      int64_t nstates, int64_t tk, int m) {
+  return false;
+}
+
+inline bool ApplyTwoQubitGate(Eigen::half* state, const Eigen::half* gate,
+                              int64_t nstates, int64_t ctk1, int64_t ctk2,
+                              int64_t tk1, int64_t tk2, int m1, int m2) {
+  return false;
+}
+
+}  // namespace simd
+
 // Helper methods for complex numbers
 template <typename T>
 T cmult(T a, T b) {
@@ -23,35 +49,72 @@ T cadd(T a, T b) {
   return T(a.real() + b.real(), a.imag() + b.imag());
 }
 
-template <typename T>
-struct BaseOneQubitGateFunctor<CPUDevice, T> {
-  virtual void apply(T& state1, T& state2, const T* gate = NULL) const {}
+// Number of consecutive amplitude pairs that are updated by the same thread
+// in the blocked loops used for targets with large strides
+#define DEFAULT_CACHE_BLOCK 1024
+
+template <typename T, typename Derived>
+struct BaseOneQubitGateFunctor<CPUDevice, T, Derived> {
+  // Vectorized implementation for gates without controls.
+  // Returns ``false`` if it cannot be used so that the scalar loop is used.
+  // Its rounding may differ from the scalar loop (see simd.h).
+  static inline bool vectorizedwork(T* state, const T* gate, int64 nstates,
+                                    int64 tk, int m) {
+    return false;
+  }
 
   void operator()(const OpKernelContext* context, const CPUDevice& d, T* state,
                   int nqubits, int target, int ncontrols, const int32* qubits,
-                  const T* gate = NULL) const {
+                  const T* gate = NULL, int64 nbatch = 1,
+                  int64 gatestride = 0) const {
     const int m = nqubits - target - 1;
     const int64 tk = (int64)1 << m;
-    int64 nstates = (int64)1 << (nqubits - ncontrols - 1);
+    // pairs of each state of the batch; the batch index of pair ``g`` is
+    // ``g >> nbits`` and selects the gate matrix of the corresponding state
+    const int nbits = nqubits - ncontrols - 1;
+    const int64 nstates = (int64)1 << nbits;
+    const int64 ntotal = nbatch * nstates;
 
     // Apply gate
     if (ncontrols == 0) {
-      #pragma omp parallel for
-      for (int64 g = 0; g < nstates; g += 1) {
+      if (gatestride == 0) {
+        if (Derived::vectorizedwork(state, gate, ntotal, tk, m)) return;
+      } else if (Derived::vectorizedwork(state, gate, nstates, tk, m)) {
+        // support of the vectorized loop depends only on ``tk``
+        for (int64 b = 1; b < nbatch; b++) {
+          Derived::vectorizedwork(state + (b << nqubits),
+                                  gate + b * gatestride, nstates, tk, m);
+        }
+        return;
+      }
+      if (tk >= DEFAULT_CACHE_BLOCK) {
+        // each block is a contiguous stretch in both halves of the pairs
+        const int64 nblocks = ntotal / DEFAULT_CACHE_BLOCK;
+        #pragma omp parallel for schedule(static)
+        for (int64 b = 0; b < nblocks; b++) {
+          const int64 g = b * DEFAULT_CACHE_BLOCK;
+          const int64 i0 = ((int64)((int64)g >> m) << (m + 1)) + (g & (tk - 1));
+          const T* bgate = gate + (g >> nbits) * gatestride;
+          for (int64 i = i0; i < i0 + DEFAULT_CACHE_BLOCK; i++) {
+            Derived::apply(state[i], state[i + tk], bgate);
+          }
+        }
+        return;
+      }
+      #pragma omp parallel for schedule(static)
+      for (int64 g = 0; g < ntotal; g += 1) {
         int64 i = ((int64)((int64)g >> m) << (m + 1)) + (g & (tk - 1));
-        apply(state[i], state[i + tk], gate);
+        Derived::apply(state[i], state[i + tk],
+                       gate + (g >> nbits) * gatestride);
       }
     } else {
-      const int N = ncontrols + 1;
+      const IndexMasks masks(nqubits + BatchQubits(nbatch), ncontrols + 1,
+                             qubits);
       #pragma omp parallel for
-      for (int64 g = 0; g < nstates; g += 1) {
-        int64 i = g;
-        for (auto iq = 0; iq < N; iq++) {
-          const auto n = qubits[iq];
-          int64 k = (int64)1 << n;
-          i = ((int64)((int64)i >> n) << (n + 1)) + (i & (k - 1)) + k;
-        }
-        apply(state[i - tk], state[i], gate);
+      for (int64 g = 0; g < ntotal; g += 1) {
+        const int64 i = masks.controlled(g);
+        Derived::apply(state[i - tk], state[i],
+                       gate + (g >> nbits) * gatestride);
       }
     }
   }
@@ -59,26 +122,35 @@ struct BaseOneQubitGateFunctor<CPUDevice, T> {
 
 // Apply general one-qubit gate via gate matrix
 template <typename T>
-struct ApplyGateFunctor<CPUDevice, T> : BaseOneQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T& state1, T& state2, const T* gate = NULL) const override {
+struct ApplyGateFunctor<CPUDevice, T>
+    : BaseOneQubitGateFunctor<CPUDevice, T, ApplyGateFunctor<CPUDevice, T>> {
+  static inline void apply(T& state1, T& state2, const T* gate = NULL) {
     const auto buffer = state1;
     state1 = cadd(cmult(gate[0], state1), cmult(gate[1], state2));
     state2 = cadd(cmult(gate[2], buffer), cmult(gate[3], state2));
   }
+
+  static inline bool vectorizedwork(T* state, const T* gate, int64 nstates,
+                                    int64 tk, int m) {
+    typedef typename T::value_type real;
+    return simd::ApplyGate((real*)state, (const real*)gate, nstates, tk, m);
+  }
 };
 
 // Apply X gate via swap
 template <typename T>
-struct ApplyXFunctor<CPUDevice, T> : BaseOneQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T& state1, T& state2, const T* gate = NULL) const override {
+struct ApplyXFunctor<CPUDevice, T>
+    : BaseOneQubitGateFunctor<CPUDevice, T, ApplyXFunctor<CPUDevice, T>> {
+  static inline void apply(T& state1, T& state2, const T* gate = NULL) {
     std::swap(state1, state2);
   }
 };
 
 // Apply Y gate via swap
 template <typename T>
-struct ApplyYFunctor<CPUDevice, T> : BaseOneQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T& state1, T& state2, const T* gate = NULL) const override {
+struct ApplyYFunctor<CPUDevice, T>
+    : BaseOneQubitGateFunctor<CPUDevice, T, ApplyYFunctor<CPUDevice, T>> {
+  static inline void apply(T& state1, T& state2, const T* gate = NULL) {
     state1 = cmult(state1, T(0, 1));
     state2 = cmult(state2, T(0, -1));
     std::swap(state1, state2);
@@ -87,35 +159,51 @@ struct ApplyYFunctor<CPUDevice, T> : BaseOneQubitGateFunctor<CPUDevice, T> {
 
 // Apply Z gate
 template <typename T>
-struct ApplyZFunctor<CPUDevice, T> : BaseOneQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T& state1, T& state2, const T* gate = NULL) const override {
-    state2 = cmult(state2, T(-1));
+struct ApplyZFunctor<CPUDevice, T>
+    : BaseOneQubitGateFunctor<CPUDevice, T, ApplyZFunctor<CPUDevice, T>> {
+  static inline void apply(T& state1, T& state2, const T* gate = NULL) {
+    state2 = T(-state2.real(), -state2.imag());
   }
 };
 
 // Apply ZPow gate
 template <typename T>
-struct ApplyZPowFunctor<CPUDevice, T> : BaseOneQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T& state1, T& state2, const T* gate = NULL) const override {
+struct ApplyZPowFunctor<CPUDevice, T>
+    : BaseOneQubitGateFunctor<CPUDevice, T, ApplyZPowFunctor<CPUDevice, T>> {
+  static inline void apply(T& state1, T& state2, const T* gate = NULL) {
     state2 = cmult(state2, gate[0]);
   }
+
+  static inline bool vectorizedwork(T* state, const T* gate, int64 nstates,
+                                    int64 tk, int m) {
+    typedef typename T::value_type real;
+    return simd::ApplyZPow((real*)state, (const real*)gate, nstates, tk, m);
+  }
 };
 
-template <typename T>
-struct BaseTwoQubitGateFunctor<CPUDevice, T> {
-  virtual void apply(T* state, int64 i, int64 tk1, int64 tk2,
-                     const T* gate = NULL) const {}
+template <typename T, typename Derived>
+struct BaseTwoQubitGateFunctor<CPUDevice, T, Derived> {
+  // Vectorized implementation for gates without controls.
+  // Returns ``false`` if it cannot be used so that the scalar loop is used.
+  static inline bool vectorizedwork(T* state, const T* gate, int64 nstates,
+                                    int64 ctk1, int64 ctk2, int64 tk1,
+                                    int64 tk2, int m1, int m2) {
+    return false;
+  }
 
   void operator()(const OpKernelContext* context, const CPUDevice& d, T* state,
                   int nqubits, int target1, int target2, int ncontrols,
-                  const int32* qubits, const T* gate = NULL) const {
+                  const int32* qubits, const T* gate = NULL, int64 nbatch = 1,
+                  int64 gatestride = 0) const {
     const int t1 = std::max(target1, target2);
     const int t2 = std::min(target1, target2);
     int m1 = nqubits - t1 - 1;
     int m2 = nqubits - t2 - 1;
     const int64 tk1 = (int64)1 << m1;
     const int64 tk2 = (int64)1 << m2;
-    const int64 nstates = (int64)1 << (nqubits - 2 - ncontrols);
+    const int nbits = nqubits - 2 - ncontrols;
+    const int64 nstates = (int64)1 << nbits;
+    const int64 ntotal = nbatch * nstates;
 
     int64 targetk1 = tk1;
     int64 targetk2 = tk2;
@@ -124,23 +212,52 @@ struct BaseTwoQubitGateFunctor<CPUDevice, T> {
     }
 
     if (ncontrols == 0) {
-      #pragma omp parallel for
-      for (int64 g = 0; g < nstates; g += 1) {
+      if (gatestride == 0) {
+        if (Derived::vectorizedwork(state, gate, ntotal, tk1, tk2, targetk1,
+                                    targetk2, m1, m2)) {
+          return;
+        }
+      } else if (Derived::vectorizedwork(state, gate, nstates, tk1, tk2,
+                                         targetk1, targetk2, m1, m2)) {
+        // support of the vectorized loop depends only on the strides
+        for (int64 b = 1; b < nbatch; b++) {
+          Derived::vectorizedwork(state + (b << nqubits),
+                                  gate + b * gatestride, nstates, tk1, tk2,
+                                  targetk1, targetk2, m1, m2);
+        }
+        return;
+      }
+      if (tk1 >= DEFAULT_CACHE_BLOCK) {
+        // each block is a contiguous stretch in the four quarters of the
+        // amplitudes that are mixed
+        const int64 nblocks = ntotal / DEFAULT_CACHE_BLOCK;
+        #pragma omp parallel for schedule(static)
+        for (int64 b = 0; b < nblocks; b++) {
+          const int64 g = b * DEFAULT_CACHE_BLOCK;
+          int64 i0 = ((int64)((int64)g >> m1) << (m1 + 1)) + (g & (tk1 - 1));
+          i0 = ((int64)((int64)i0 >> m2) << (m2 + 1)) + (i0 & (tk2 - 1));
+          const T* bgate = gate + (g >> nbits) * gatestride;
+          for (int64 i = i0; i < i0 + DEFAULT_CACHE_BLOCK; i++) {
+            Derived::apply(state, i, targetk1, targetk2, bgate);
+          }
+        }
+        return;
+      }
+      #pragma omp parallel for schedule(static)
+      for (int64 g = 0; g < ntotal; g += 1) {
         int64 i = ((int64)((int64)g >> m1) << (m1 + 1)) + (g & (tk1 - 1));
         i = ((int64)((int64)i >> m2) << (m2 + 1)) + (i & (tk2 - 1));
-        apply(state, i, targetk1, targetk2, gate);
+        Derived::apply(state, i, targetk1, targetk2,
+                       gate + (g >> nbits) * gatestride);
       }
     } else {
-      const int N = ncontrols + 2;
+      const IndexMasks masks(nqubits + BatchQubits(nbatch), ncontrols + 2,
+                             qubits);
       #pragma omp parallel for
-      for (int64 g = 0; g < nstates; g += 1) {
-        int64 i = g;
-        for (auto iq = 0; iq < N; iq++) {
-          const auto m = qubits[iq];
-          int64 k = (int64)1 << m;
-          i = ((int64)((int64)i >> m) << (m + 1)) + (i & (k - 1)) + k;
-        }
-        apply(state, i - tk1 - tk2, targetk1, targetk2, gate);
+      for (int64 g = 0; g < ntotal; g += 1) {
+        const int64 i = masks.controlled(g);
+        Derived::apply(state, i - tk1 - tk2, targetk1, targetk2,
+                       gate + (g >> nbits) * gatestride);
       }
     }
   }
@@ -149,9 +266,10 @@ struct BaseTwoQubitGateFunctor<CPUDevice, T> {
 // Apply general one-qubit gate via gate matrix
 template <typename T>
 struct ApplyTwoQubitGateFunctor<CPUDevice, T>
-    : BaseTwoQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T* state, int64 i, int64 tk1, int64 tk2,
-                    const T* gate = NULL) const {
+    : BaseTwoQubitGateFunctor<CPUDevice, T,
+                              ApplyTwoQubitGateFunctor<CPUDevice, T>> {
+  static inline void apply(T* state, int64 i, int64 tk1, int64 tk2,
+                           const T* gate = NULL) {
     const int64 i1 = i + tk1;
     const int64 i2 = i + tk2;
     const int64 i3 = i1 + tk2;
@@ -168,13 +286,22 @@ struct ApplyTwoQubitGateFunctor<CPUDevice, T>
     state[i3] = cadd(cadd(cmult(gate[12], buffer), cmult(gate[13], buffer1)),
                     cadd(cmult(gate[14], buffer2), cmult(gate[15], state[i3])));
   }
+
+  static inline bool vectorizedwork(T* state, const T* gate, int64 nstates,
+                                    int64 ctk1, int64 ctk2, int64 tk1,
+                                    int64 tk2, int m1, int m2) {
+    typedef typename T::value_type real;
+    return simd::ApplyTwoQubitGate((real*)state, (const real*)gate, nstates,
+                                   ctk1, ctk2, tk1, tk2, m1, m2);
+  }
 };
 
 // Apply fSim gate from https://arxiv.org/abs/2001.08343
 template <typename T>
-struct ApplyFsimFunctor<CPUDevice, T> : BaseTwoQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T* state, int64 i, int64 tk1, int64 tk2,
-                    const T* gate = NULL) const {
+struct ApplyFsimFunctor<CPUDevice, T>
+    : BaseTwoQubitGateFunctor<CPUDevice, T, ApplyFsimFunctor<CPUDevice, T>> {
+  static inline void apply(T* state, int64 i, int64 tk1, int64 tk2,
+                           const T* gate = NULL) {
     const int64 i1 = i + tk1;
     const int64 i2 = i + tk2;
     const int64 i3 = i1 + tk2;
@@ -187,62 +314,589 @@ struct ApplyFsimFunctor<CPUDevice, T> : BaseTwoQubitGateFunctor<CPUDevice, T> {
 
 // Apply SWAP gate
 template <typename T>
-struct ApplySwapFunctor<CPUDevice, T> : BaseTwoQubitGateFunctor<CPUDevice, T> {
-  inline void apply(T* state, int64 i, int64 tk1, int64 tk2,
-                    const T* gate = NULL) const {
+struct ApplySwapFunctor<CPUDevice, T>
+    : BaseTwoQubitGateFunctor<CPUDevice, T, ApplySwapFunctor<CPUDevice, T>> {
+  static inline void apply(T* state, int64 i, int64 tk1, int64 tk2,
+                           const T* gate = NULL) {
     std::swap(state[i + tk1], state[i + tk2]);
   }
 };
 
+// Apply general gate acting on ``NT`` target qubits via gate matrix
+// (serially if ``parallel`` is false)
+template <typename T, int NT>
+void ApplyMultiQubitGate(T* state, int nqubits, const int32* targets,
+                         int ncontrols, const int32* qubits, const T* gate,
+                         bool parallel = true) {
+  constexpr int64 NS = (int64)1 << NT;
+  // offsets of the amplitudes that are mixed, in the order of the matrix
+  int64 tk[NS];
+  for (int64 j = 0; j < NS; j++) {
+    tk[j] = 0;
+    for (int it = 0; it < NT; it++) {
+      if ((j >> (NT - it - 1)) & 1) {
+        tk[j] += (int64)1 << (nqubits - targets[it] - 1);
+      }
+    }
+  }
+  const int64 nstates = (int64)1 << (nqubits - NT - ncontrols);
+  const IndexMasks masks(nqubits, ncontrols + NT, qubits);
+
+  #pragma omp parallel for if (parallel)
+  for (int64 g = 0; g < nstates; g += 1) {
+    const int64 i = masks.controlled(g) - tk[NS - 1];
+
+    T buffer[NS];
+    for (int64 j = 0; j < NS; j++) {
+      buffer[j] = state[i + tk[j]];
+    }
+    for (int64 j = 0; j < NS; j++) {
+      T res = T(0, 0);
+      for (int64 l = 0; l < NS; l++) {
+        res = cadd(res, cmult(gate[j * NS + l], buffer[l]));
+      }
+      state[i + tk[j]] = res;
+    }
+  }
+}
+
+template <typename T>
+struct ApplyMultiQubitGateFunctor<CPUDevice, T> {
+  void operator()(const OpKernelContext* context, const CPUDevice& d, T* state,
+                  int nqubits, int ntargets, const int32* targets,
+                  int ncontrols, const int32* qubits, const T* gate) const {
+    switch (ntargets) {
+      case 3:
+        ApplyMultiQubitGate<T, 3>(state, nqubits, targets, ncontrols, qubits,
+                                  gate);
+        break;
+      case 4:
+        ApplyMultiQubitGate<T, 4>(state, nqubits, targets, ncontrols, qubits,
+                                  gate);
+        break;
+      case 5:
+        ApplyMultiQubitGate<T, 5>(state, nqubits, targets, ncontrols, qubits,
+                                  gate);
+        break;
+    }
+  }
+};
+
+// Apply product of diagonal one- and two-qubit gates
+template <typename T>
+struct ApplyDiagonalLayerFunctor<CPUDevice, T> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, T* state,
+                  int nqubits, int nterms, const int32* ntargets,
+                  const int32* targets, const T* phases) const {
+    // bit of each target in the state index (-1 for one-qubit terms)
+    // and offset of each term in the ``phases`` array
+    std::vector<int> m1(nterms), m2(nterms);
+    std::vector<int64> offsets(nterms);
+    int64 nt = 0, np = 0;
+    for (int it = 0; it < nterms; it++) {
+      m1[it] = nqubits - targets[nt] - 1;
+      m2[it] = ntargets[it] == 2 ? nqubits - targets[nt + 1] - 1 : -1;
+      offsets[it] = np;
+      nt += ntargets[it];
+      np += (int64)1 << ntargets[it];
+    }
+    const int* bits1 = m1.data();
+    const int* bits2 = m2.data();
+    const int64* poffsets = offsets.data();
+
+    const int64 nstates = (int64)1 << nqubits;
+    #pragma omp parallel for
+    for (int64 i = 0; i < nstates; i++) {
+      T phase = T(1, 0);
+      for (int it = 0; it < nterms; it++) {
+        int64 j = (i >> bits1[it]) & 1;
+        if (bits2[it] >= 0) {
+          j = (j << 1) + ((i >> bits2[it]) & 1);
+        }
+        phase = cmult(phase, phases[poffsets[it] + j]);
+      }
+      state[i] = cmult(state[i], phase);
+    }
+  }
+};
+
+// Number of qubits that define the state slices used by gate sequences
+// (2^14 amplitudes of complex128 occupy 256KB which fits in L2 cache)
+#define DEFAULT_LOCAL_QUBITS 14
+
+// Number of amplitudes of the batch of states that simulates trajectories
+// (2^22 amplitudes of complex128 occupy 64MB)
+#define DEFAULT_TRAJECTORY_AMPLITUDES (1 << 22)
+
+// Applies a one-qubit gate serially on a slice of ``nqubits`` qubits
+template <typename F, typename T>
+void ApplyOneQubitGateSlice(T* state, int nqubits, int target, int ncontrols,
+                            const int32* qubits, const T* gate) {
+  const int m = nqubits - target - 1;
+  const int64 tk = (int64)1 << m;
+  const int64 nstates = (int64)1 << (nqubits - ncontrols - 1);
+  const IndexMasks masks(nqubits, ncontrols + 1, qubits);
+  for (int64 g = 0; g < nstates; g += 1) {
+    const int64 i = masks.controlled(g);
+    F::apply(state[i - tk], state[i], gate);
+  }
+}
+
+// Applies a two-qubit gate serially on a slice of ``nqubits`` qubits
+template <typename F, typename T>
+void ApplyTwoQubitGateSlice(T* state, int nqubits, int target1, int target2,
+                            int ncontrols, const int32* qubits,
+                            const T* gate) {
+  const int64 tk1 = (int64)1 << (nqubits - std::max(target1, target2) - 1);
+  const int64 tk2 = (int64)1 << (nqubits - std::min(target1, target2) - 1);
+  const int64 nstates = (int64)1 << (nqubits - 2 - ncontrols);
+  int64 targetk1 = tk1;
+  int64 targetk2 = tk2;
+  if (target1 > target2) {
+    std::swap(targetk1, targetk2);
+  }
+  const IndexMasks masks(nqubits, ncontrols + 2, qubits);
+  for (int64 g = 0; g < nstates; g += 1) {
+    const int64 i = masks.controlled(g);
+    F::apply(state, i - tk1 - tk2, targetk1, targetk2, gate);
+  }
+}
+
+// Apply sequence of gates
+template <typename T>
+struct ApplyGateSequenceFunctor<CPUDevice, T> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, T* state,
+                  int nqubits, int ngates, const int32* gate_info,
+                  const int32* qubits, const T* gates) const {
+    // states that fit in cache are not split in slices
+    const bool sliced = nqubits > DEFAULT_LOCAL_QUBITS;
+    const int nlocal = DEFAULT_LOCAL_QUBITS;
+    const int nglobal = nqubits - nlocal;
+
+    // offsets of each gate in the ``qubits`` and ``gates`` arrays
+    std::vector<int64> qoffsets(ngates + 1, 0), goffsets(ngates + 1, 0);
+    std::vector<bool> local(ngates);
+    for (int ig = 0; ig < ngates; ig++) {
+      const int ntargets = gate_info[4 * ig];
+      qoffsets[ig + 1] = qoffsets[ig] + ntargets + gate_info[4 * ig + 1];
+      goffsets[ig + 1] = goffsets[ig] + ((int64)1 << (2 * ntargets));
+      local[ig] = sliced && qubits[qoffsets[ig + 1] - 1] < nlocal;
+    }
+
+    int ig = 0;
+    while (ig < ngates) {
+      if (!local[ig]) {
+        const int32* info = gate_info + 4 * ig;
+        if (info[0] == 1) {
+          ApplyGateFunctor<CPUDevice, T>()(
+              context, d, state, nqubits, info[2], info[1],
+              qubits + qoffsets[ig], gates + goffsets[ig]);
+        } else {
+          ApplyTwoQubitGateFunctor<CPUDevice, T>()(
+              context, d, state, nqubits, info[2], info[3], info[1],
+              qubits + qoffsets[ig], gates + goffsets[ig]);
+        }
+        ig++;
+        continue;
+      }
+
+      // block of consecutive local gates is applied slice by slice
+      int last = ig;
+      while (last < ngates && local[last]) last++;
+      const int64 nslices = (int64)1 << nglobal;
+      #pragma omp parallel for
+      for (int64 s = 0; s < nslices; s++) {
+        T* slice = state + (s << nlocal);
+        for (int jg = ig; jg < last; jg++) {
+          const int32* info = gate_info + 4 * jg;
+          if (info[0] == 1) {
+            ApplyOneQubitGateSlice<ApplyGateFunctor<CPUDevice, T>, T>(
+                slice, nlocal, info[2] - nglobal, info[1],
+                qubits + qoffsets[jg], gates + goffsets[jg]);
+          } else {
+            ApplyTwoQubitGateSlice<ApplyTwoQubitGateFunctor<CPUDevice, T>, T>(
+                slice, nlocal, info[2] - nglobal, info[3] - nglobal, info[1],
+                qubits + qoffsets[jg], gates + goffsets[jg]);
+          }
+        }
+      }
+      ig = last;
+    }
+  }
+};
+
+// Number of qubits of the states whose circuits are simulated serially
+// (a gate on 2^10 amplitudes is faster than opening a parallel region)
+#define DEFAULT_SERIAL_QUBITS 10
+
+// Applies a circuit gate serially on a slice of ``nqubits`` qubits, where
+// ``targets`` are the target ids within the slice
+template <typename T>
+void ApplyCircuitGateSlice(T* state, int nqubits, const int32* info,
+                           const int32* targets, const int32* qubits,
+                           const T* gate) {
+  const int ncontrols = info[2];
+  switch (info[0]) {
+    case CIRCUIT_MATRIX:
+      switch (info[1]) {
+        case 1:
+          ApplyOneQubitGateSlice<ApplyGateFunctor<CPUDevice, T>, T>(
+              state, nqubits, targets[0], ncontrols, qubits, gate);
+          break;
+        case 2:
+          ApplyTwoQubitGateSlice<ApplyTwoQubitGateFunctor<CPUDevice, T>, T>(
+              state, nqubits, targets[0], targets[1], ncontrols, qubits, gate);
+          break;
+        case 3:
+          ApplyMultiQubitGate<T, 3>(state, nqubits, targets, ncontrols,
+                                    qubits, gate, false);
+          break;
+        case 4:
+          ApplyMultiQubitGate<T, 4>(state, nqubits, targets, ncontrols,
+                                    qubits, gate, false);
+          break;
+        case 5:
+          ApplyMultiQubitGate<T, 5>(state, nqubits, targets, ncontrols,
+                                    qubits, gate, false);
+          break;
+      }
+      break;
+    case CIRCUIT_X:
+      ApplyOneQubitGateSlice<ApplyXFunctor<CPUDevice, T>, T>(
+          state, nqubits, targets[0], ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_Y:
+      ApplyOneQubitGateSlice<ApplyYFunctor<CPUDevice, T>, T>(
+          state, nqubits, targets[0], ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_Z:
+      ApplyOneQubitGateSlice<ApplyZFunctor<CPUDevice, T>, T>(
+          state, nqubits, targets[0], ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_ZPOW:
+      ApplyOneQubitGateSlice<ApplyZPowFunctor<CPUDevice, T>, T>(
+          state, nqubits, targets[0], ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_FSIM:
+      ApplyTwoQubitGateSlice<ApplyFsimFunctor<CPUDevice, T>, T>(
+          state, nqubits, targets[0], targets[1], ncontrols, qubits, gate);
+      break;
+    case CIRCUIT_SWAP:
+      ApplyTwoQubitGateSlice<ApplySwapFunctor<CPUDevice, T>, T>(
+          state, nqubits, targets[0], targets[1], ncontrols, qubits, gate);
+      break;
+  }
+}
+
+// Apply serialized circuit
+template <typename T>
+struct ExecuteCircuitFunctor<CPUDevice, T> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, T* state,
+                  int nqubits, int ngates, const int32* gate_info,
+                  const int32* qubits, const T* gates) const {
+    // small states are a single slice that is simulated serially, larger
+    // states are split in slices of at most ``DEFAULT_LOCAL_QUBITS`` qubits
+    // (at least 16 slices, so that all threads take part)
+    const bool serial = nqubits <= DEFAULT_SERIAL_QUBITS;
+    const int nlocal = serial ? nqubits
+                              : std::min(nqubits - 4, DEFAULT_LOCAL_QUBITS);
+    const int nglobal = nqubits - nlocal;
+
+    // offsets of each gate in the ``qubits`` array and targets of the local
+    // gates within the slices
+    std::vector<int64> qoffsets(ngates + 1, 0);
+    std::vector<int32> targets(CIRCUIT_MAX_TARGETS * ngates);
+    std::vector<bool> local(ngates);
+    for (int ig = 0; ig < ngates; ig++) {
+      const int32* info = gate_info + CIRCUIT_INFO_SIZE * ig;
+      qoffsets[ig + 1] = qoffsets[ig] + info[1] + info[2];
+      local[ig] = qubits[qoffsets[ig + 1] - 1] < nlocal;
+      for (int it = 0; it < info[1]; it++) {
+        targets[CIRCUIT_MAX_TARGETS * ig + it] = info[4 + it] - nglobal;
+      }
+    }
+
+    int ig = 0;
+    while (ig < ngates) {
+      if (!local[ig]) {
+        const int32* info = gate_info + CIRCUIT_INFO_SIZE * ig;
+        ApplyCircuitGate<CPUDevice, T>(context, d, state, nqubits, info,
+                                       qubits + qoffsets[ig], gates + info[3]);
+        ig++;
+        continue;
+      }
+
+      // block of consecutive local gates is applied slice by slice
+      int last = ig;
+      while (last < ngates && local[last]) last++;
+      const int64 nslices = (int64)1 << nglobal;
+      #pragma omp parallel for if (!serial)
+      for (int64 s = 0; s < nslices; s++) {
+        T* slice = state + (s << nlocal);
+        for (int jg = ig; jg < last; jg++) {
+          const int32* info = gate_info + CIRCUIT_INFO_SIZE * jg;
+          ApplyCircuitGateSlice<T>(slice, nlocal, info,
+                                   targets.data() + CIRCUIT_MAX_TARGETS * jg,
+                                   qubits + qoffsets[jg], gates + info[3]);
+        }
+      }
+      ig = last;
+    }
+  }
+};
+
+// Squared norms of the Kraus operators of a channel for each trajectory
+template <typename T>
+struct KrausNormsFunctor<CPUDevice, T> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, const T* state,
+                  int nqubits, int ntargets, const int32* targets,
+                  const int32* qubits, int nops, const T* ops, int64 nbatch,
+                  double* norms) const {
+    const KrausMasks m(nqubits, nbatch, ntargets, targets, qubits);
+    const int64 ngroups = (int64)1 << (nqubits - ntargets);
+    auto Accumulate = [&](int64 g, double* pnorms) {
+      const int64 i = m.masks.insert(g);
+      if (ntargets == 1) {
+        AccumulateKrausNorms<1>(state, i, m, nops, ops, pnorms);
+      } else {
+        AccumulateKrausNorms<2>(state, i, m, nops, ops, pnorms);
+      }
+    };
+
+    for (int64 k = 0; k < nbatch * nops; k++) norms[k] = 0;
+    if (nbatch >= omp_get_max_threads()) {
+      // enough trajectories to give at least one to each thread
+      #pragma omp parallel for
+      for (int64 b = 0; b < nbatch; b++) {
+        for (int64 g = b * ngroups; g < (b + 1) * ngroups; g++) {
+          Accumulate(g, norms + b * nops);
+        }
+      }
+    } else {
+      for (int64 b = 0; b < nbatch; b++) {
+        double* pnorms = norms + b * nops;
+        #pragma omp parallel for reduction(+: pnorms[:nops])
+        for (int64 g = b * ngroups; g < (b + 1) * ngroups; g++) {
+          Accumulate(g, pnorms);
+        }
+      }
+    }
+  }
+};
+
+// Probabilities of the measured qubits for each trajectory
+template <typename T>
+struct TrajectoryProbabilitiesFunctor<CPUDevice, T> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, const T* state,
+                  int nqubits, int ntargets, const int32* qubits, int64 nbatch,
+                  double* probs) const {
+    const int64 nresults = (int64)1 << ntargets;
+    const int64 nstates = (int64)1 << (nqubits - ntargets);
+    const IndexMasks masks(nqubits, ntargets, qubits);
+    auto Probability = [&](int64 j, int64 g) {
+      const T* bstate = state + ((j >> ntargets) << nqubits);
+      const int64 resbits = DepositBits(j & (nresults - 1), masks.qubitmask);
+      const auto x = bstate[masks.insert(g) | resbits];
+      return (double)(x.real() * x.real() + x.imag() * x.imag());
+    };
+
+    const int64 ntotal = nbatch * nresults;
+    if (ntotal >= omp_get_max_threads()) {
+      #pragma omp parallel for
+      for (int64 j = 0; j < ntotal; j++) {
+        double p = 0;
+        for (int64 g = 0; g < nstates; g++) {
+          p += Probability(j, g);
+        }
+        probs[j] = p;
+      }
+    } else {
+      for (int64 j = 0; j < ntotal; j++) {
+        double p = 0;
+        #pragma omp parallel for reduction(+: p)
+        for (int64 g = 0; g < nstates; g++) {
+          p += Probability(j, g);
+        }
+        probs[j] = p;
+      }
+    }
+  }
+};
+
 // Apply Collapse gate
 template <typename T, typename NormType>
 struct CollapseStateFunctor<CPUDevice, T, NormType> {
   void operator()(OpKernelContext* context, const CPUDevice& d, T* state,
                   int nqubits, bool normalize, int ntargets,
-                  const int32* qubits, const int64* result) const {
-    int64 nstates = (int64)1 << (nqubits - ntargets);
-    int64 nsubstates = (int64)1 << ntargets;
-    const int64 res = result[0];
-
-    auto GetIndex = [&](int64 g, int64 h) {
-      int64 i = g;
-      for (auto iq = 0; iq < ntargets; iq++) {
-        const auto n = qubits[iq];
-        int64 k = (int64)1 << n;
-        i = ((int64)((int64)i >> n) << (n + 1)) + (i & (k - 1));
-        i += ((int64)((int)(h >> iq) % 2) * k);
-      }
-      return i;
-    };
+                  const int32* qubits, const int64* result, int64 nbatch = 1,
+                  int64 resultstride = 0,
+                  double* probabilities = NULL) const {
+    const int64 nstates = (int64)1 << (nqubits - ntargets);
+    const IndexMasks masks(nqubits + BatchQubits(nbatch), ntargets, qubits);
+    std::vector<int64> resbits(nbatch);
+    for (int64 b = 0; b < nbatch; b++) {
+      resbits[b] = DepositBits(result[b * resultstride], masks.qubitmask);
+    }
+    const int64* presbits = resbits.data();
 
-    NormType norms = 0;
-    #pragma omp parallel for shared(state) reduction(+: norms)
-    for (int64 g = 0; g < nstates; g++) {
-      for (int64 h = 0; h < res; h++) {
-        state[GetIndex(g, h)] = 0;
+    // single pass that keeps the amplitudes of the measured result
+    const int64 ntotal = nbatch << nqubits;
+    std::vector<NormType> norms(nbatch, 0);
+    NormType* pnorms = norms.data();
+    #pragma omp parallel for shared(state) reduction(+: pnorms[:nbatch])
+    for (int64 i = 0; i < ntotal; i++) {
+      const int64 b = i >> nqubits;
+      if ((i & masks.qubitmask) == presbits[b]) {
+        const auto x = state[i];
+        pnorms[b] += x.real() * x.real() + x.imag() * x.imag();
+      } else {
+        state[i] = 0;
       }
-      auto x = state[GetIndex(g, res)];
-      norms += x.real() * x.real() + x.imag() * x.imag();
-      for (auto h = res + 1; h < nsubstates; h++) {
-        state[GetIndex(g, h)] = 0;
+    }
+
+    if (probabilities != NULL) {
+      for (int64 b = 0; b < nbatch; b++) {
+        probabilities[b] = pnorms[b];
       }
     }
 
     if (normalize) {
-      auto norm = std::sqrt(norms);
-      auto NormalizeComponent = [&](T& x) {
+      for (int64 b = 0; b < nbatch; b++) {
+        pnorms[b] = std::sqrt(pnorms[b]);
+      }
+      auto NormalizeComponent = [&](T& x, NormType norm) {
         x = T(x.real() / norm, x.imag() / norm);
       };
+      // the batch index of ``g`` is inserted above the state qubits
+      const int nbits = nqubits - ntargets;
+      #pragma omp parallel for
+      for (int64 g = 0; g < nbatch * nstates; g++) {
+        const int64 b = g >> nbits;
+        NormalizeComponent(state[masks.insert(g) | presbits[b]], pnorms[b]);
+      }
+    }
+  }
+};
+
+// Apply Collapse gate and remove the measured qubits
+template <typename T, typename NormType>
+struct CompactCollapseStateFunctor<CPUDevice, T, NormType> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, const T* state,
+                  T* out, int nqubits, bool normalize, int ntargets,
+                  const int32* qubits, const int64* result, int64 nbatch = 1,
+                  int64 resultstride = 0,
+                  double* probabilities = NULL) const {
+    const int nbits = nqubits - ntargets;
+    const int64 nstates = (int64)1 << nbits;
+    const IndexMasks masks(nqubits + BatchQubits(nbatch), ntargets, qubits);
+    std::vector<int64> resbits(nbatch);
+    for (int64 b = 0; b < nbatch; b++) {
+      resbits[b] = DepositBits(result[b * resultstride], masks.qubitmask);
+    }
+    const int64* presbits = resbits.data();
+
+    // single pass that gathers the amplitudes of the measured result
+    std::vector<NormType> norms(nbatch, 0);
+    NormType* pnorms = norms.data();
+    #pragma omp parallel for reduction(+: pnorms[:nbatch])
+    for (int64 g = 0; g < nbatch * nstates; g++) {
+      const int64 b = g >> nbits;
+      const auto x = state[masks.insert(g) | presbits[b]];
+      out[g] = x;
+      pnorms[b] += x.real() * x.real() + x.imag() * x.imag();
+    }
+
+    if (probabilities != NULL) {
+      for (int64 b = 0; b < nbatch; b++) {
+        probabilities[b] = pnorms[b];
+      }
+    }
+
+    if (normalize) {
+      for (int64 b = 0; b < nbatch; b++) {
+        pnorms[b] = std::sqrt(pnorms[b]);
+      }
       #pragma omp parallel for
-      for (int64 g = 0; g < nstates; g++) {
-        NormalizeComponent(state[GetIndex(g, res)]);
+      for (int64 g = 0; g < nbatch * nstates; g++) {
+        const NormType norm = pnorms[g >> nbits];
+        out[g] = T(out[g].real() / norm, out[g].imag() / norm);
       }
     }
   }
 };
 
 
-template <typename Device, typename T, typename F, bool UseMatrix>
+// Backward pass of the gates that support gradients
+template <typename T, int Gate>
+struct GateGradientFunctor<CPUDevice, T, Gate> {
+  void operator()(OpKernelContext* context, const CPUDevice& d,
+                  const T* state, T* undone, T* grad, T* gategrad, int nqubits, int target1, int target2,
+                  int ncontrols, const int32* qubits, const T* gate,
+                  int64 nbatch = 1, int64 gatestride = 0) const {
+    typedef GradientGateTraits<Gate> traits;
+    const int ntargets = traits::ntargets;
+    const int64 tk1 = (int64)1 << (nqubits - target1 - 1);
+    const int64 tk2 = ntargets > 1 ? (int64)1 << (nqubits - target2 - 1) : 0;
+    // offsets of the mixed amplitudes in the order of the gate matrix
+    // (the first target is the most significant bit)
+    const int64_t offsets[4] = {0, ntargets > 1 ? tk2 : tk1, tk1, tk1 + tk2};
+    const int nbits = nqubits - ncontrols - ntargets;
+    const IndexMasks masks(nqubits + BatchQubits(nbatch), ncontrols + ntargets,
+                           qubits);
+
+    // the groups of each matrix are reduced separately so that the
+    // gradients of a shared matrix are summed over the batch; each thread
+    // accumulates its partial sums locally and writes them to its own row
+    // of ``partial``, which are summed in order after the loop
+    const int64 ngates = gatestride > 0 ? nbatch : 1;
+    const int64 ngroups = (nbatch << nbits) / ngates;
+    const int nthreads = omp_get_max_threads();
+    std::vector<T> partial(nthreads * traits::gatesize);
+    for (int64 b = 0; b < ngates; b++) {
+      T u[traits::namplitudes * traits::namplitudes];
+      GradientMatrix<Gate>(gate + b * gatestride, u);
+      std::fill(partial.begin(), partial.end(), T(0, 0));
+      #pragma omp parallel num_threads(nthreads) shared(grad, undone, partial)
+      {
+        T acc[traits::gatesize];
+        std::fill(acc, acc + traits::gatesize, T(0, 0));
+        #pragma omp for
+        for (int64 g = b * ngroups; g < (b + 1) * ngroups; g++) {
+          const int64 i = masks.controlled(g) - tk1 - tk2;
+          GradientUpdate<Gate>(state, undone, grad, i, offsets, u, acc);
+        }
+        std::copy(acc, acc + traits::gatesize,
+                  partial.begin() + omp_get_thread_num() * traits::gatesize);
+      }
+      T* bgrad = gategrad + b * traits::gatesize;
+      for (int k = 0; k < traits::gatesize; k++) {
+        T sum(0, 0);
+        for (int t = 0; t < nthreads; t++) {
+          sum += partial[t * traits::gatesize + k];
+        }
+        bgrad[k] = sum;
+      }
+    }
+  }
+};
+
+// Number of states in ``state``, which holds either a single state or a
+// batch of states of shape (nbatch, 2^nqubits). Density matrices of shape
+// (2^n, 2^n) are passed with ``nqubits = 2n`` and form a batch of one.
+template <typename T>
+inline int64 BatchSize(const Tensor& state, int nqubits) {
+  return StateSize<T>(state) >> nqubits;
+}
+
+// Offset between the gate matrices of consecutive states of a batch.
+// The same matrix (of ``gatesize`` elements) is used for all states unless
+// ``gate`` contains one matrix per state.
+template <typename T>
+inline int64 GateStride(const Tensor& gate, int64 nbatch, int64 gatesize) {
+  return nbatch > 1 && StateSize<T>(gate) == nbatch * gatesize ? gatesize : 0;
+}
+
+template <typename Device, typename T, typename F, int GateSize>
 class OneQubitGateOp : public OpKernel {
  public:
   explicit OneQubitGateOp(OpKernelConstruction* context) : OpKernel(context) {
@@ -253,28 +907,38 @@ class OneQubitGateOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* context) override {
-    // grabe the input tensor
-    Tensor state = context->input(0);
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const int64 nbatch = BatchSize<T>(state, nqubits_);
+    OP_REQUIRES(context,
+                nbatch > 0 && StateSize<T>(state) == nbatch << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
 
-    if (UseMatrix) {
+    if (GateSize > 0) {
       const Tensor& gate = context->input(1);
       const Tensor& qubits = context->input(2);
+      const int64 gatestride = GateStride<T>(gate, nbatch, GateSize);
+      OP_REQUIRES(context, nbatch == 1 || gatestride > 0 ||
+                               StateSize<T>(gate) == GateSize,
+                  errors::InvalidArgument("Batched states require a single "
+                                          "gate matrix or one per state."));
 
       // call the implementation
       F()
-      (context, context->eigen_device<Device>(), state.flat<T>().data(),
+      (context, context->eigen_device<Device>(), StateData<T>(state),
        nqubits_, target_, qubits.flat<int32>().size() - 1,
-       qubits.flat<int32>().data(), gate.flat<T>().data());
+       qubits.flat<int32>().data(), StateData<T>(gate), nbatch, gatestride);
     } else {
       const Tensor& qubits = context->input(1);
 
       // call the implementation
       F()
-      (context, context->eigen_device<Device>(), state.flat<T>().data(),
+      (context, context->eigen_device<Device>(), StateData<T>(state),
        nqubits_, target_, qubits.flat<int32>().size() - 1,
-       qubits.flat<int32>().data());
+       qubits.flat<int32>().data(), NULL, nbatch);
     }
-    context->set_output(0, state);
   }
 
  private:
@@ -283,7 +947,7 @@ class OneQubitGateOp : public OpKernel {
   int threads_;
 };
 
-template <typename Device, typename T, typename F, bool UseMatrix>
+template <typename Device, typename T, typename F, int GateSize>
 class TwoQubitGateOp : public OpKernel {
  public:
   explicit TwoQubitGateOp(OpKernelConstruction* context) : OpKernel(context) {
@@ -295,28 +959,38 @@ class TwoQubitGateOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* context) override {
-    // grabe the input tensor
-    Tensor state = context->input(0);
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const int64 nbatch = BatchSize<T>(state, nqubits_);
+    OP_REQUIRES(context,
+                nbatch > 0 && StateSize<T>(state) == nbatch << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
 
-    if (UseMatrix) {
+    if (GateSize > 0) {
       const Tensor& gate = context->input(1);
       const Tensor& qubits = context->input(2);
+      const int64 gatestride = GateStride<T>(gate, nbatch, GateSize);
+      OP_REQUIRES(context, nbatch == 1 || gatestride > 0 ||
+                               StateSize<T>(gate) == GateSize,
+                  errors::InvalidArgument("Batched states require a single "
+                                          "gate matrix or one per state."));
 
       // call the implementation
       F()
-      (context, context->eigen_device<Device>(), state.flat<T>().data(),
+      (context, context->eigen_device<Device>(), StateData<T>(state),
        nqubits_, target1_, target2_, qubits.flat<int32>().size() - 2,
-       qubits.flat<int32>().data(), gate.flat<T>().data());
+       qubits.flat<int32>().data(), StateData<T>(gate), nbatch, gatestride);
     } else {
       const Tensor& qubits = context->input(1);
 
       // call the implementation
       F()
-      (context, context->eigen_device<Device>(), state.flat<T>().data(),
+      (context, context->eigen_device<Device>(), StateData<T>(state),
        nqubits_, target1_, target2_, qubits.flat<int32>().size() - 2,
-       qubits.flat<int32>().data());
+       qubits.flat<int32>().data(), NULL, nbatch);
     }
-    context->set_output(0, state);
   }
 
  private:
@@ -325,6 +999,426 @@ class TwoQubitGateOp : public OpKernel {
   int threads_;
 };
 
+template <typename Device, typename T>
+class MultiQubitGateOp : public OpKernel {
+ public:
+  explicit MultiQubitGateOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("targets", &targets_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    OP_REQUIRES(context, targets_.size() >= 3 && targets_.size() <= 5,
+                errors::InvalidArgument("Multi-qubit gates support three to "
+                                        "five target qubits."));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const Tensor& gate = context->input(1);
+    const Tensor& qubits = context->input(2);
+    const int ntargets = targets_.size();
+    const int ncontrols = qubits.flat<int32>().size() - ntargets;
+
+    // call the implementation
+    ApplyMultiQubitGateFunctor<Device, T>()(
+        context, context->eigen_device<Device>(), state.flat<T>().data(),
+        nqubits_, ntargets, targets_.data(), ncontrols,
+        qubits.flat<int32>().data(), gate.flat<T>().data());
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+  std::vector<int32> targets_;
+};
+
+template <typename Device, typename T>
+class DiagonalLayerOp : public OpKernel {
+ public:
+  explicit DiagonalLayerOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const Tensor& phases = context->input(1);
+    const Tensor& targets = context->input(2);
+    const Tensor& ntargets = context->input(3);
+
+    const int nterms = ntargets.flat<int32>().size();
+    const int32* nt = ntargets.flat<int32>().data();
+    int64 ntargets_total = 0, nphases_total = 0;
+    for (int it = 0; it < nterms; it++) {
+      OP_REQUIRES(context, nt[it] == 1 || nt[it] == 2,
+                  errors::InvalidArgument("Diagonal layers support only one- "
+                                          "and two-qubit terms."));
+      ntargets_total += nt[it];
+      nphases_total += (int64)1 << nt[it];
+    }
+    OP_REQUIRES(context, targets.flat<int32>().size() == ntargets_total,
+                errors::InvalidArgument("Number of targets does not agree "
+                                        "with ntargets."));
+    OP_REQUIRES(context, phases.flat<T>().size() == nphases_total,
+                errors::InvalidArgument("Number of phases does not agree "
+                                        "with ntargets."));
+
+    // call the implementation
+    ApplyDiagonalLayerFunctor<Device, T>()(
+        context, context->eigen_device<Device>(), state.flat<T>().data(),
+        nqubits_, nterms, nt, targets.flat<int32>().data(),
+        phases.flat<T>().data());
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+};
+
+template <typename Device, typename T>
+class GateSequenceOp : public OpKernel {
+ public:
+  explicit GateSequenceOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const Tensor& gates = context->input(1);
+    const Tensor& qubits = context->input(2);
+    const Tensor& gate_info = context->input(3);
+
+    OP_REQUIRES(context, gate_info.flat<int32>().size() % 4 == 0,
+                errors::InvalidArgument("gate_info must contain four "
+                                        "integers per gate."));
+    const int ngates = gate_info.flat<int32>().size() / 4;
+    const int32* info = gate_info.flat<int32>().data();
+    int64 nqubits_total = 0, nelements_total = 0;
+    for (int ig = 0; ig < ngates; ig++) {
+      OP_REQUIRES(context, info[4 * ig] == 1 || info[4 * ig] == 2,
+                  errors::InvalidArgument("Gate sequences support only one- "
+                                          "and two-qubit gates."));
+      nqubits_total += info[4 * ig] + info[4 * ig + 1];
+      nelements_total += (int64)1 << (2 * info[4 * ig]);
+    }
+    OP_REQUIRES(context, qubits.flat<int32>().size() == nqubits_total,
+                errors::InvalidArgument("Number of qubits does not agree "
+                                        "with gate_info."));
+    OP_REQUIRES(context, gates.flat<T>().size() == nelements_total,
+                errors::InvalidArgument("Number of matrix elements does not "
+                                        "agree with gate_info."));
+
+    // call the implementation
+    ApplyGateSequenceFunctor<Device, T>()(
+        context, context->eigen_device<Device>(), state.flat<T>().data(),
+        nqubits_, ngates, info, qubits.flat<int32>().data(),
+        gates.flat<T>().data());
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+};
+
+template <typename Device, typename T>
+class ExecuteCircuitOp : public OpKernel {
+ public:
+  explicit ExecuteCircuitOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const Tensor& gates = context->input(1);
+    const Tensor& qubits = context->input(2);
+    const Tensor& gate_info = context->input(3);
+
+    OP_REQUIRES(context, state.NumElements() == (int64)1 << nqubits_,
+                errors::InvalidArgument("Circuits are executed on a single "
+                                        "state vector of ", nqubits_,
+                                        " qubits."));
+    OP_REQUIRES(context,
+                gate_info.flat<int32>().size() % CIRCUIT_INFO_SIZE == 0,
+                errors::InvalidArgument("gate_info must contain ",
+                                        CIRCUIT_INFO_SIZE,
+                                        " integers per gate."));
+    const int ngates = gate_info.flat<int32>().size() / CIRCUIT_INFO_SIZE;
+    const int32* info = gate_info.flat<int32>().data();
+    const int64 nelements = gates.flat<T>().size();
+    int64 nqubits_total = 0;
+    // the gates are validated once so that the loop of the functor does not
+    // check them
+    for (int ig = 0; ig < ngates; ig++) {
+      const int32* ginfo = info + CIRCUIT_INFO_SIZE * ig;
+      const int type = ginfo[0], ntargets = ginfo[1];
+      int expected = 1;
+      int64 gatesize = 0;
+      switch (type) {
+        case CIRCUIT_MATRIX:
+          expected = std::min(std::max(ntargets, 1), CIRCUIT_MAX_TARGETS);
+          gatesize = (int64)1 << (2 * expected);
+          break;
+        case CIRCUIT_X:
+        case CIRCUIT_Y:
+        case CIRCUIT_Z:
+          break;
+        case CIRCUIT_ZPOW:
+          gatesize = 1;
+          break;
+        case CIRCUIT_FSIM:
+          expected = 2;
+          gatesize = 5;
+          break;
+        case CIRCUIT_SWAP:
+          expected = 2;
+          break;
+        default:
+          OP_REQUIRES(context, false,
+                      errors::InvalidArgument("Gate ", ig, " has unknown "
+                                              "type ", type, "."));
+      }
+      OP_REQUIRES(context, ntargets == expected && ginfo[2] >= 0,
+                  errors::InvalidArgument("Gate ", ig, " has invalid number "
+                                          "of targets or controls."));
+      OP_REQUIRES(context, gatesize == 0 ||
+                               (ginfo[3] >= 0 &&
+                                ginfo[3] + gatesize <= nelements),
+                  errors::InvalidArgument("Elements of gate ", ig,
+                                          " are out of range."));
+      for (int it = 0; it < ntargets; it++) {
+        OP_REQUIRES(context, ginfo[4 + it] >= 0 && ginfo[4 + it] < nqubits_,
+                    errors::InvalidArgument("Gate ", ig, " has invalid "
+                                            "target."));
+      }
+      nqubits_total += ntargets + ginfo[2];
+    }
+    OP_REQUIRES(context, qubits.flat<int32>().size() == nqubits_total,
+                errors::InvalidArgument("Number of qubits does not agree "
+                                        "with gate_info."));
+
+    // call the implementation
+    ExecuteCircuitFunctor<Device, T>()(
+        context, context->eigen_device<Device>(), state.flat<T>().data(),
+        nqubits_, ngates, info, qubits.flat<int32>().data(),
+        gates.flat<T>().data());
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+};
+
+// Index sampled from the ``n`` non-negative ``weights`` for a uniform ``u``
+// in (0, 1]. Indices with zero weight are never sampled.
+static int64 SampleWeighted(const double* weights, int64 n, double u) {
+  double total = 0;
+  for (int64 i = 0; i < n; i++) total += weights[i];
+  const double target = u * total;
+  double cumulative = 0;
+  int64 last = 0;
+  for (int64 i = 0; i < n; i++) {
+    if (weights[i] > 0) {
+      cumulative += weights[i];
+      last = i;
+      if (cumulative >= target) return i;
+    }
+  }
+  // rounding of the cumulative sum
+  return last;
+}
+
+template <typename Device, typename T>
+class SimulateTrajectoriesOp : public OpKernel {
+ public:
+  explicit SimulateTrajectoriesOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("ntrajectories",
+                                             &ntrajectories_));
+    OP_REQUIRES_OK(context, context->GetAttr("seed", &seed_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& initial_state = context->input(0);
+    const Tensor& gates = context->input(1);
+    const Tensor& qubits = context->input(2);
+    const Tensor& gate_info = context->input(3);
+    const Tensor& measured = context->input(4);
+    const int64 nstates = (int64)1 << nqubits_;
+    OP_REQUIRES(context, initial_state.NumElements() == nstates,
+                errors::InvalidArgument("The initial state must have 2 ** "
+                                        "nqubits elements."));
+
+    OP_REQUIRES(context, gate_info.flat<int32>().size() % 5 == 0,
+                errors::InvalidArgument("gate_info must contain five "
+                                        "integers per gate."));
+    const int ngates = gate_info.flat<int32>().size() / 5;
+    const int32* info = gate_info.flat<int32>().data();
+    // offsets of each gate in the ``qubits`` and ``gates`` arrays
+    std::vector<int64> qoffsets(ngates + 1, 0), goffsets(ngates + 1, 0);
+    for (int ig = 0; ig < ngates; ig++) {
+      const int32* ginfo = info + 5 * ig;
+      OP_REQUIRES(context, ginfo[1] == 1 || ginfo[1] == 2,
+                  errors::InvalidArgument("Trajectories support only one- "
+                                          "and two-qubit gates."));
+      OP_REQUIRES(context, ginfo[0] >= 0 && ginfo[0] <= TRAJECTORY_MAX_OPS,
+                  errors::InvalidArgument("Channels can have at most ",
+                                          TRAJECTORY_MAX_OPS,
+                                          " Kraus operators."));
+      OP_REQUIRES(context, ginfo[0] == 0 || ginfo[2] == 0,
+                  errors::InvalidArgument("Channels cannot be controlled."));
+      OP_REQUIRES(context, ginfo[2] >= 0,
+                  errors::InvalidArgument("Gate ", ig, " has invalid number "
+                                          "of controls."));
+      OP_REQUIRES(context, ginfo[3] >= 0 && ginfo[3] < nqubits_ &&
+                               ginfo[4] >= 0 && ginfo[4] < nqubits_,
+                  errors::InvalidArgument("Gate ", ig, " has invalid "
+                                          "target."));
+      OP_REQUIRES(context, ginfo[1] == 1 || ginfo[3] != ginfo[4],
+                  errors::InvalidArgument("Targets of gate ", ig,
+                                          " must be distinct."));
+      qoffsets[ig + 1] = qoffsets[ig] + ginfo[1] + ginfo[2];
+      goffsets[ig + 1] = goffsets[ig] +
+                         ((int64)std::max(ginfo[0], 1) << (2 * ginfo[1]));
+    }
+    OP_REQUIRES(context, qubits.flat<int32>().size() == qoffsets[ngates],
+                errors::InvalidArgument("Number of qubits does not agree "
+                                        "with gate_info."));
+    OP_REQUIRES(context, gates.flat<T>().size() == goffsets[ngates],
+                errors::InvalidArgument("Number of matrix elements does not "
+                                        "agree with gate_info."));
+    const int nmeasured = measured.flat<int32>().size();
+    OP_REQUIRES(context, nmeasured > 0 && nmeasured <= nqubits_,
+                errors::InvalidArgument("Invalid number of measured "
+                                        "qubits."));
+
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(
+        0, TensorShape({(int64)1 << nmeasured}), &output));
+    int64* frequencies = output->flat<int64>().data();
+    std::fill(frequencies, frequencies + ((int64)1 << nmeasured), 0);
+
+    // the matrices are used by the host to prepare the sampled branches
+    // and are copied once to the device
+    const auto& d = context->eigen_device<Device>();
+    const T* host_gates = gates.flat<T>().data();
+    Tensor device_gates;
+    OP_REQUIRES_OK(context, context->allocate_temp(
+        DataTypeToEnum<T>::value, gates.shape(), &device_gates));
+    d.memcpyHostToDevice(device_gates.flat<T>().data(), host_gates,
+                         goffsets[ngates] * sizeof(T));
+
+    // the trajectories are simulated in batches of states and the sampled
+    // branches hold one (at most two-qubit) matrix per state
+    const int64 maxgatesize = 16;
+    const int64 nbatch = std::max((int64)1, std::min(
+        ntrajectories_, (int64)DEFAULT_TRAJECTORY_AMPLITUDES >> nqubits_));
+    Tensor states, branches;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DataTypeToEnum<T>::value, TensorShape({nbatch, nstates}),
+        &states));
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DataTypeToEnum<T>::value,
+        TensorShape({nbatch * maxgatesize}), &branches));
+    T* state = states.flat<T>().data();
+    std::vector<T> host_branches(nbatch * maxgatesize);
+    std::vector<double> norms(nbatch * TRAJECTORY_MAX_OPS);
+    std::vector<double> probs(nbatch << nmeasured);
+
+    for (int64 start = 0; start < ntrajectories_; start += nbatch) {
+      const int64 nb = std::min(nbatch, ntrajectories_ - start);
+      for (int64 b = 0; b < nb; b++) {
+        d.memcpy(state + b * nstates, initial_state.flat<T>().data(),
+                 nstates * sizeof(T));
+      }
+      // each trajectory samples from its own Philox stream so that the
+      // result does not depend on the batches and the number of threads
+      std::vector<PhiloxEngine> engines;
+      engines.reserve(nb);
+      for (int64 b = 0; b < nb; b++) engines.emplace_back(seed_, start + b);
+
+      for (int ig = 0; ig < ngates; ig++) {
+        const int32* ginfo = info + 5 * ig;
+        const int32* gqubits = qubits.flat<int32>().data() + qoffsets[ig];
+        const int nops = ginfo[0];
+        const T* gate = device_gates.flat<T>().data() + goffsets[ig];
+        int64 gatestride = 0;
+        if (nops > 0) {
+          KrausNormsFunctor<Device, T>()(context, d, state, nqubits_, ginfo[1],
+                                         ginfo + 3, gqubits, nops, gate, nb,
+                                         norms.data());
+          if (!context->status().ok()) return;
+          // the sampled operator is normalized by the norm of its branch
+          const int64 gatesize = (int64)1 << (2 * ginfo[1]);
+          for (int64 b = 0; b < nb; b++) {
+            const double* bnorms = norms.data() + b * nops;
+            const int64 k = SampleWeighted(bnorms, nops, engines[b].Uniform());
+            OP_REQUIRES(context, bnorms[k] > 0,
+                        errors::InvalidArgument("The Kraus operators of a "
+                                                "channel vanish on a "
+                                                "trajectory."));
+            const double scale = 1.0 / std::sqrt(bnorms[k]);
+            const T* op = host_gates + goffsets[ig] + k * gatesize;
+            for (int64 e = 0; e < gatesize; e++) {
+              host_branches[b * gatesize + e] = T(op[e].real() * scale,
+                                                  op[e].imag() * scale);
+            }
+          }
+          d.memcpyHostToDevice(branches.flat<T>().data(),
+                               host_branches.data(),
+                               nb * gatesize * sizeof(T));
+          gate = branches.flat<T>().data();
+          gatestride = gatesize;
+        }
+        if (ginfo[1] == 1) {
+          ApplyGateFunctor<Device, T>()(context, d, state, nqubits_, ginfo[3],
+                                        ginfo[2], gqubits, gate, nb,
+                                        gatestride);
+        } else {
+          ApplyTwoQubitGateFunctor<Device, T>()(
+              context, d, state, nqubits_, ginfo[3], ginfo[4], ginfo[2],
+              gqubits, gate, nb, gatestride);
+        }
+      }
+
+      // every trajectory gives a single shot of the measured qubits
+      TrajectoryProbabilitiesFunctor<Device, T>()(
+          context, d, state, nqubits_, nmeasured,
+          measured.flat<int32>().data(), nb, probs.data());
+      if (!context->status().ok()) return;
+      const int64 nresults = (int64)1 << nmeasured;
+      for (int64 b = 0; b < nb; b++) {
+        const int64 r = SampleWeighted(probs.data() + b * nresults, nresults,
+                                       engines[b].Uniform());
+        frequencies[r]++;
+      }
+    }
+  }
+
+ private:
+  int nqubits_;
+  int64 ntrajectories_;
+  int64 seed_;
+  int threads_;
+};
+
 template <typename Device, typename T, typename NormType>
 class CollapseStateOp : public OpKernel {
  public:
@@ -336,17 +1430,87 @@ class CollapseStateOp : public OpKernel {
   }
 
   void Compute(OpKernelContext* context) override {
-    // grab the input tensor
-    Tensor state = context->input(0);
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
     const Tensor& qubits = context->input(1);
     const Tensor& result = context->input(2);
+    const int64 nbatch = BatchSize<T>(state, nqubits_);
+    OP_REQUIRES(context,
+                nbatch > 0 && StateSize<T>(state) == nbatch << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
+    // batched states are collapsed to the same or to one result per state
+    const int64 resultstride = GateStride<int64>(result, nbatch, 1);
+    OP_REQUIRES(context, nbatch == 1 || resultstride > 0 ||
+                             result.NumElements() == 1,
+                errors::InvalidArgument("Batched states require a single "
+                                        "result or one per state."));
+    Tensor* probability = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(
+        1, TensorShape({nbatch}), &probability));
     // call the implementation
     CollapseStateFunctor<Device, T, NormType>()(
-      context, context->eigen_device<Device>(), state.flat<T>().data(),
+      context, context->eigen_device<Device>(), StateData<T>(state),
       nqubits_, normalize_, qubits.flat<int32>().size(),
-      qubits.flat<int32>().data(), result.flat<int64>().data());
+      qubits.flat<int32>().data(), result.flat<int64>().data(), nbatch,
+      resultstride, probability->flat<double>().data());
+  }
 
-    context->set_output(0, state);
+ private:
+   int nqubits_, threads_;
+   bool normalize_;
+};
+
+template <typename Device, typename T, typename NormType>
+class CompactCollapseStateOp : public OpKernel {
+ public:
+  explicit CompactCollapseStateOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("normalize", &normalize_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // grab the input tensor
+    const Tensor& state = context->input(0);
+    const Tensor& qubits = context->input(1);
+    const Tensor& result = context->input(2);
+    const int64 nbatch = BatchSize<T>(state, nqubits_);
+    OP_REQUIRES(context,
+                nbatch > 0 && StateSize<T>(state) == nbatch << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
+    const int ntargets = qubits.flat<int32>().size();
+    OP_REQUIRES(context, ntargets > 0 && ntargets < nqubits_,
+                errors::InvalidArgument("At least one qubit must be kept "
+                                        "after the collapse."));
+    const int64 resultstride = GateStride<int64>(result, nbatch, 1);
+    OP_REQUIRES(context, nbatch == 1 || resultstride > 0 ||
+                             result.NumElements() == 1,
+                errors::InvalidArgument("Batched states require a single "
+                                        "result or one per state."));
+
+    // the reduced states keep the batch dimension of ``state``
+    TensorShape shape({(int64)1 << (nqubits_ - ntargets)});
+    if (state.dims() > StateShape<T>(TensorShape()).dims() + 1) {
+      shape.InsertDim(0, nbatch);
+    }
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, StateShape<T>(shape),
+                                                     &output));
+    Tensor* probability = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(
+        1, TensorShape({nbatch}), &probability));
+
+    // call the implementation
+    CompactCollapseStateFunctor<Device, T, NormType>()(
+      context, context->eigen_device<Device>(), StateData<T>(state),
+      StateData<T>(*output), nqubits_, normalize_, ntargets,
+      qubits.flat<int32>().data(), result.flat<int64>().data(), nbatch,
+      resultstride, probability->flat<double>().data());
   }
 
  private:
@@ -355,79 +1519,350 @@ class CollapseStateOp : public OpKernel {
 };
 
 
+template <typename Device, typename T, int Gate>
+class GateGradientOp : public OpKernel {
+ public:
+  explicit GateGradientOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    if (GradientGateTraits<Gate>::ntargets > 1) {
+      OP_REQUIRES_OK(context, context->GetAttr("target1", &target1_));
+      OP_REQUIRES_OK(context, context->GetAttr("target2", &target2_));
+    } else {
+      OP_REQUIRES_OK(context, context->GetAttr("target", &target1_));
+      target2_ = -1;
+    }
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    OP_REQUIRES_OK(context, context->GetAttr("undo", &undo_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // if the gate is undone the state after the gate is updated in-place
+    // (see forward_state.h), otherwise it is the state before the gate,
+    // which is only read and returned unchanged
+    Tensor state;
+    if (undo_) {
+      OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    } else {
+      state = context->input(0);
+      context->set_output(0, state);
+    }
+    Tensor grad;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 1, 1, &grad));
+    const Tensor& gate = context->input(2);
+    const Tensor& qubits = context->input(3);
+    const int64 nbatch = BatchSize<T>(state, nqubits_);
+    OP_REQUIRES(context, nbatch > 0 && state.NumElements() == nbatch << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
+    OP_REQUIRES(context, grad.NumElements() == state.NumElements(),
+                errors::InvalidArgument("Gradient shape does not agree with "
+                                        "the state shape."));
+    const int gatesize = GradientGateTraits<Gate>::gatesize;
+    const int64 gatestride = GateStride<T>(gate, nbatch, gatesize);
+    OP_REQUIRES(context, nbatch == 1 || gatestride > 0 ||
+                             gate.NumElements() == gatesize,
+                errors::InvalidArgument("Batched states require a single "
+                                        "gate matrix or one per state."));
+    const int ncontrols = qubits.flat<int32>().size() -
+                          GradientGateTraits<Gate>::ntargets;
+    Tensor* gategrad = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(2, gate.shape(),
+                                                     &gategrad));
+
+    // call the implementation
+    T* undone = undo_ ? state.flat<T>().data() : nullptr;
+    GateGradientFunctor<Device, T, Gate>()(
+        context, context->eigen_device<Device>(),
+        (const T*)state.flat<T>().data(), undone, grad.flat<T>().data(), gategrad->flat<T>().data(), nqubits_,
+        target1_, target2_, ncontrols, qubits.flat<int32>().data(),
+        gate.flat<T>().data(), nbatch, gatestride);
+  }
+
+ private:
+  int nqubits_;
+  int target1_, target2_;
+  int threads_;
+  bool undo_;
+};
+
 // Register the CPU kernels.
-#define REGISTER_CPU(T, NAME, OP, FUNCTOR, USEMATRIX)       \
-  REGISTER_KERNEL_BUILDER(                                  \
-      Name(NAME).Device(DEVICE_CPU).TypeConstraint<T>("T"), \
-      OP<CPUDevice, T, FUNCTOR<CPUDevice, T>, USEMATRIX>);
+// ``GATESIZE`` is the number of elements of the gate matrix (zero for gates
+// without matrix). Half precision states are registered for ``float16``
+// tensors (see complex_half.h).
+#define REGISTER_CPU(T, NAME, OP, FUNCTOR, GATESIZE)                          \
+  REGISTER_KERNEL_BUILDER(Name(NAME)                                          \
+                              .Device(DEVICE_CPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>("T"), \
+                          OP<CPUDevice, T, FUNCTOR<CPUDevice, T>, GATESIZE>);
 
 // Register Collapse state CPU kernel.
-#define REGISTER_COLLAPSE_CPU(T, NT)                                   \
-  REGISTER_KERNEL_BUILDER(                                             \
-      Name("CollapseState").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
-      CollapseStateOp<CPUDevice, T, NT>);
+#define REGISTER_COLLAPSE_CPU(T, NT)                                          \
+  REGISTER_KERNEL_BUILDER(Name("CollapseState")                               \
+                              .Device(DEVICE_CPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>("T"), \
+                          CollapseStateOp<CPUDevice, T, NT>);                 \
+  REGISTER_KERNEL_BUILDER(Name("CompactCollapseState")                        \
+                              .Device(DEVICE_CPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>("T"), \
+                          CompactCollapseStateOp<CPUDevice, T, NT>);
+
+// Register multi-qubit gate CPU kernel.
+#define REGISTER_MULTIQUBIT_CPU(T)                                            \
+  REGISTER_KERNEL_BUILDER(                                                    \
+      Name("ApplyMultiQubitGate").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      MultiQubitGateOp<CPUDevice, T>);
+
+// Register diagonal layer CPU kernel.
+#define REGISTER_DIAGONAL_CPU(T)                                            \
+  REGISTER_KERNEL_BUILDER(                                                  \
+      Name("ApplyDiagonalLayer").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      DiagonalLayerOp<CPUDevice, T>);
+
+// Register gate sequence CPU kernel.
+#define REGISTER_SEQUENCE_CPU(T)                                           \
+  REGISTER_KERNEL_BUILDER(                                                 \
+      Name("ApplyGateSequence").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      GateSequenceOp<CPUDevice, T>);
+
+// Register circuit execution CPU kernel.
+#define REGISTER_CIRCUIT_CPU(T)                                         \
+  REGISTER_KERNEL_BUILDER(                                              \
+      Name("ExecuteCircuit").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      ExecuteCircuitOp<CPUDevice, T>);
+
+// Register trajectory simulation CPU kernel.
+#define REGISTER_TRAJECTORIES_CPU(T)                                 \
+  REGISTER_KERNEL_BUILDER(Name("SimulateTrajectories")               \
+                              .Device(DEVICE_CPU)                    \
+                              .TypeConstraint<T>("T"),               \
+                          SimulateTrajectoriesOp<CPUDevice, T>);
+
+// Register gate gradient CPU kernel.
+#define REGISTER_GRADIENT_CPU(T, NAME, GATE)                \
+  REGISTER_KERNEL_BUILDER(                                  \
+      Name(NAME).Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      GateGradientOp<CPUDevice, T, GATE>);
 
 // Register one-qubit gate kernels.
 #if GOOGLE_CUDA
 
 // Register the GPU kernels.
-#define REGISTER_GPU(T, NAME, OP, FUNCTOR, USEMATRIX)       \
-  extern template struct FUNCTOR<GPUDevice, T>;             \
-  REGISTER_KERNEL_BUILDER(                                  \
-      Name(NAME).Device(DEVICE_GPU).TypeConstraint<T>("T"), \
-      OP<GPUDevice, T, FUNCTOR<GPUDevice, T>, USEMATRIX>);
+// The qubits are used by the host to compute the index masks. The backend
+// creates the qubit tensors in host memory (``K.host_cast``), so that no
+// device to host copy is needed when a gate is applied.
+#define REGISTER_GPU(T, NAME, OP, FUNCTOR, GATESIZE)                         \
+  extern template struct FUNCTOR<GPUDevice, T>;                              \
+  REGISTER_KERNEL_BUILDER(Name(NAME)                                         \
+                              .Device(DEVICE_GPU)                            \
+                              .TypeConstraint<StateTensorType<T>::type>("T") \
+                              .HostMemory("qubits"),                         \
+                          OP<GPUDevice, T, FUNCTOR<GPUDevice, T>, GATESIZE>);
 
 // Register Collapse state GPU kernel.
-#define REGISTER_COLLAPSE_GPU(T, NT)                                    \
-  extern template struct CollapseStateFunctor<GPUDevice, T, NT>;        \
-    REGISTER_KERNEL_BUILDER(                                            \
-      Name("CollapseState").Device(DEVICE_GPU).TypeConstraint<T>("T"),  \
-      CollapseStateOp<GPUDevice, T, NT>);
-
-#define REGISTER_ONEQUBIT(NAME, FUNCTOR, USEMATRIX)                   \
-  REGISTER_CPU(complex64, NAME, OneQubitGateOp, FUNCTOR, USEMATRIX);  \
-  REGISTER_CPU(complex128, NAME, OneQubitGateOp, FUNCTOR, USEMATRIX); \
-  REGISTER_GPU(complex64, NAME, OneQubitGateOp, FUNCTOR, USEMATRIX);  \
-  REGISTER_GPU(complex128, NAME, OneQubitGateOp, FUNCTOR, USEMATRIX);
+#define REGISTER_COLLAPSE_GPU(T, NT)                                         \
+  extern template struct CollapseStateFunctor<GPUDevice, T, NT>;             \
+  REGISTER_KERNEL_BUILDER(Name("CollapseState")                              \
+                              .Device(DEVICE_GPU)                            \
+                              .TypeConstraint<StateTensorType<T>::type>("T") \
+                              .HostMemory("qubits"),                         \
+                          CollapseStateOp<GPUDevice, T, NT>);                \
+  extern template struct CompactCollapseStateFunctor<GPUDevice, T, NT>;      \
+  REGISTER_KERNEL_BUILDER(Name("CompactCollapseState")                       \
+                              .Device(DEVICE_GPU)                            \
+                              .TypeConstraint<StateTensorType<T>::type>("T") \
+                              .HostMemory("qubits"),                         \
+                          CompactCollapseStateOp<GPUDevice, T, NT>);
+
+// Register multi-qubit gate GPU kernel.
+#define REGISTER_MULTIQUBIT_GPU(T)                                 \
+  extern template struct ApplyMultiQubitGateFunctor<GPUDevice, T>; \
+  REGISTER_KERNEL_BUILDER(Name("ApplyMultiQubitGate")              \
+                              .Device(DEVICE_GPU)                  \
+                              .TypeConstraint<T>("T")              \
+                              .HostMemory("qubits"),               \
+                          MultiQubitGateOp<GPUDevice, T>);
+
+// Register diagonal layer GPU kernel.
+// The term description is used by the host to compute the target bits.
+#define REGISTER_DIAGONAL_GPU(T)                                  \
+  extern template struct ApplyDiagonalLayerFunctor<GPUDevice, T>; \
+  REGISTER_KERNEL_BUILDER(Name("ApplyDiagonalLayer")              \
+                              .Device(DEVICE_GPU)                 \
+                              .TypeConstraint<T>("T")             \
+                              .HostMemory("targets")              \
+                              .HostMemory("ntargets"),            \
+                          DiagonalLayerOp<GPUDevice, T>);
+
+// Register gate sequence GPU kernel.
+// The gate description is used by the host to schedule the kernel launches.
+#define REGISTER_SEQUENCE_GPU(T)                                 \
+  extern template struct ApplyGateSequenceFunctor<GPUDevice, T>; \
+  REGISTER_KERNEL_BUILDER(Name("ApplyGateSequence")              \
+                              .Device(DEVICE_GPU)                \
+                              .TypeConstraint<T>("T")            \
+                              .HostMemory("qubits")              \
+                              .HostMemory("gate_info"),          \
+                          GateSequenceOp<GPUDevice, T>);
+
+// Register circuit execution GPU kernel.
+// The gate description is used by the host to dispatch the gate kernels.
+#define REGISTER_CIRCUIT_GPU(T)                               \
+  extern template struct ExecuteCircuitFunctor<GPUDevice, T>; \
+  REGISTER_KERNEL_BUILDER(Name("ExecuteCircuit")              \
+                              .Device(DEVICE_GPU)             \
+                              .TypeConstraint<T>("T")         \
+                              .HostMemory("qubits")           \
+                              .HostMemory("gate_info"),       \
+                          ExecuteCircuitOp<GPUDevice, T>);
+
+// Register trajectory simulation GPU kernel.
+// The gate description and the matrices are used by the host to sample the
+// branches and the frequencies are counted by the host.
+#define REGISTER_TRAJECTORIES_GPU(T)                                   \
+  extern template struct KrausNormsFunctor<GPUDevice, T>;              \
+  extern template struct TrajectoryProbabilitiesFunctor<GPUDevice, T>; \
+  REGISTER_KERNEL_BUILDER(Name("SimulateTrajectories")                 \
+                              .Device(DEVICE_GPU)                      \
+                              .TypeConstraint<T>("T")                  \
+                              .HostMemory("gates")                     \
+                              .HostMemory("qubits")                    \
+                              .HostMemory("gate_info")                 \
+                              .HostMemory("measured")                  \
+                              .HostMemory("frequencies"),              \
+                          SimulateTrajectoriesOp<GPUDevice, T>);
+
+// Register gate gradient GPU kernel.
+#define REGISTER_GRADIENT_GPU(T, NAME, GATE)                      \
+  extern template struct GateGradientFunctor<GPUDevice, T, GATE>; \
+  REGISTER_KERNEL_BUILDER(Name(NAME)                              \
+                              .Device(DEVICE_GPU)                 \
+                              .TypeConstraint<T>("T")             \
+                              .HostMemory("qubits"),              \
+                          GateGradientOp<GPUDevice, T, GATE>);
+
+#define REGISTER_ONEQUBIT(NAME, FUNCTOR, GATESIZE)                    \
+  REGISTER_CPU(complex32, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_CPU(complex64, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_CPU(complex128, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);  \
+  REGISTER_GPU(complex32, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_GPU(complex64, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_GPU(complex128, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);
 
 // Register two-qubit gate kernels.
-#define REGISTER_TWOQUBIT(NAME, FUNCTOR, USEMATRIX)                   \
-  REGISTER_CPU(complex64, NAME, TwoQubitGateOp, FUNCTOR, USEMATRIX);  \
-  REGISTER_CPU(complex128, NAME, TwoQubitGateOp, FUNCTOR, USEMATRIX); \
-  REGISTER_GPU(complex64, NAME, TwoQubitGateOp, FUNCTOR, USEMATRIX);  \
-  REGISTER_GPU(complex128, NAME, TwoQubitGateOp, FUNCTOR, USEMATRIX);
+#define REGISTER_TWOQUBIT(NAME, FUNCTOR, GATESIZE)                    \
+  REGISTER_CPU(complex32, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_CPU(complex64, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_CPU(complex128, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);  \
+  REGISTER_GPU(complex32, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_GPU(complex64, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);   \
+  REGISTER_GPU(complex128, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);
 
 #define REGISTER_COLLAPSE()                   \
+  REGISTER_COLLAPSE_CPU(complex32, float);    \
   REGISTER_COLLAPSE_CPU(complex64, float);    \
   REGISTER_COLLAPSE_CPU(complex128, double);  \
+  REGISTER_COLLAPSE_GPU(complex32, float);    \
   REGISTER_COLLAPSE_GPU(complex64, float);    \
   REGISTER_COLLAPSE_GPU(complex128, double);
 
+#define REGISTER_MULTIQUBIT()          \
+  REGISTER_MULTIQUBIT_CPU(complex64);  \
+  REGISTER_MULTIQUBIT_CPU(complex128); \
+  REGISTER_MULTIQUBIT_GPU(complex64);  \
+  REGISTER_MULTIQUBIT_GPU(complex128);
+
+#define REGISTER_DIAGONAL()           \
+  REGISTER_DIAGONAL_CPU(complex64);   \
+  REGISTER_DIAGONAL_CPU(complex128);  \
+  REGISTER_DIAGONAL_GPU(complex64);   \
+  REGISTER_DIAGONAL_GPU(complex128);
+
+#define REGISTER_SEQUENCE()           \
+  REGISTER_SEQUENCE_CPU(complex64);   \
+  REGISTER_SEQUENCE_CPU(complex128);  \
+  REGISTER_SEQUENCE_GPU(complex64);   \
+  REGISTER_SEQUENCE_GPU(complex128);
+
+#define REGISTER_CIRCUIT()          \
+  REGISTER_CIRCUIT_CPU(complex64);  \
+  REGISTER_CIRCUIT_CPU(complex128); \
+  REGISTER_CIRCUIT_GPU(complex64);  \
+  REGISTER_CIRCUIT_GPU(complex128);
+
+#define REGISTER_TRAJECTORIES()           \
+  REGISTER_TRAJECTORIES_CPU(complex64);   \
+  REGISTER_TRAJECTORIES_CPU(complex128);  \
+  REGISTER_TRAJECTORIES_GPU(complex64);   \
+  REGISTER_TRAJECTORIES_GPU(complex128);
+
+#define REGISTER_GRADIENT(NAME, GATE)            \
+  REGISTER_GRADIENT_CPU(complex64, NAME, GATE);  \
+  REGISTER_GRADIENT_CPU(complex128, NAME, GATE); \
+  REGISTER_GRADIENT_GPU(complex64, NAME, GATE);  \
+  REGISTER_GRADIENT_GPU(complex128, NAME, GATE);
+
 #else
 
-#define REGISTER_ONEQUBIT(NAME, FUNCTOR, USEMATRIX)                  \
-  REGISTER_CPU(complex64, NAME, OneQubitGateOp, FUNCTOR, USEMATRIX); \
-  REGISTER_CPU(complex128, NAME, OneQubitGateOp, FUNCTOR, USEMATRIX);
+#define REGISTER_ONEQUBIT(NAME, FUNCTOR, GATESIZE)                   \
+  REGISTER_CPU(complex32, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);  \
+  REGISTER_CPU(complex64, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);  \
+  REGISTER_CPU(complex128, NAME, OneQubitGateOp, FUNCTOR, GATESIZE);
 
 // Register two-qubit gate kernels.
-#define REGISTER_TWOQUBIT(NAME, FUNCTOR, USEMATRIX)                  \
-  REGISTER_CPU(complex64, NAME, TwoQubitGateOp, FUNCTOR, USEMATRIX); \
-  REGISTER_CPU(complex128, NAME, TwoQubitGateOp, FUNCTOR, USEMATRIX);
+#define REGISTER_TWOQUBIT(NAME, FUNCTOR, GATESIZE)                   \
+  REGISTER_CPU(complex32, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);  \
+  REGISTER_CPU(complex64, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);  \
+  REGISTER_CPU(complex128, NAME, TwoQubitGateOp, FUNCTOR, GATESIZE);
 
 #define REGISTER_COLLAPSE()                    \
+  REGISTER_COLLAPSE_CPU(complex32, float);     \
   REGISTER_COLLAPSE_CPU(complex64, float);     \
   REGISTER_COLLAPSE_CPU(complex128, double);
 
+#define REGISTER_MULTIQUBIT()          \
+  REGISTER_MULTIQUBIT_CPU(complex64);  \
+  REGISTER_MULTIQUBIT_CPU(complex128);
+
+#define REGISTER_DIAGONAL()           \
+  REGISTER_DIAGONAL_CPU(complex64);   \
+  REGISTER_DIAGONAL_CPU(complex128);
+
+#define REGISTER_SEQUENCE()           \
+  REGISTER_SEQUENCE_CPU(complex64);   \
+  REGISTER_SEQUENCE_CPU(complex128);
+
+#define REGISTER_CIRCUIT()         \
+  REGISTER_CIRCUIT_CPU(complex64); \
+  REGISTER_CIRCUIT_CPU(complex128);
+
+#define REGISTER_TRAJECTORIES()           \
+  REGISTER_TRAJECTORIES_CPU(complex64);   \
+  REGISTER_TRAJECTORIES_CPU(complex128);
+
+#define REGISTER_GRADIENT(NAME, GATE)           \
+  REGISTER_GRADIENT_CPU(complex64, NAME, GATE); \
+  REGISTER_GRADIENT_CPU(complex128, NAME, GATE);
+
 #endif
 
-REGISTER_ONEQUBIT("ApplyGate", ApplyGateFunctor, true);
-REGISTER_ONEQUBIT("ApplyZPow", ApplyZPowFunctor, true);
-REGISTER_ONEQUBIT("ApplyX", ApplyXFunctor, false);
-REGISTER_ONEQUBIT("ApplyY", ApplyYFunctor, false);
-REGISTER_ONEQUBIT("ApplyZ", ApplyZFunctor, false);
-REGISTER_TWOQUBIT("ApplyTwoQubitGate", ApplyTwoQubitGateFunctor, true);
-REGISTER_TWOQUBIT("ApplyFsim", ApplyFsimFunctor, true);
-REGISTER_TWOQUBIT("ApplySwap", ApplySwapFunctor, false);
+REGISTER_ONEQUBIT("ApplyGate", ApplyGateFunctor, 4);
+REGISTER_ONEQUBIT("ApplyZPow", ApplyZPowFunctor, 1);
+REGISTER_ONEQUBIT("ApplyX", ApplyXFunctor, 0);
+REGISTER_ONEQUBIT("ApplyY", ApplyYFunctor, 0);
+REGISTER_ONEQUBIT("ApplyZ", ApplyZFunctor, 0);
+REGISTER_TWOQUBIT("ApplyTwoQubitGate", ApplyTwoQubitGateFunctor, 16);
+REGISTER_TWOQUBIT("ApplyFsim", ApplyFsimFunctor, 5);
+REGISTER_TWOQUBIT("ApplySwap", ApplySwapFunctor, 0);
+REGISTER_MULTIQUBIT();
+REGISTER_DIAGONAL();
 REGISTER_COLLAPSE();
+REGISTER_SEQUENCE();
+REGISTER_CIRCUIT();
+REGISTER_TRAJECTORIES();
+REGISTER_GRADIENT("ApplyGateGrad", GRADIENT_GATE);
+REGISTER_GRADIENT("ApplyZPowGrad", GRADIENT_ZPOW);
+REGISTER_GRADIENT("ApplyTwoQubitGateGrad", GRADIENT_TWO_QUBIT_GATE);
+REGISTER_GRADIENT("ApplyFsimGrad", GRADIENT_FSIM);
 }  // namespace functor
 }  // namespace tensorflow
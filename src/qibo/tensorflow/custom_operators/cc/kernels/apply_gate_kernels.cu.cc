@@ -1,9 +1,13 @@
 #if GOOGLE_CUDA
 #define EIGEN_USE_GPU
 
-#define DEFAULT_BLOCK_SIZE 1024  // default number of threads
+#define DEFAULT_LOCAL_QUBITS 11  // qubits of the shared memory tiles of gate
+                                 // sequences (32KB for complex128)
 
 #include "apply_gate.h"
+#include "complex_half.h"
+#include "gpu_launch.h"
+#include "state_pool.h"
 #include "tensorflow/core/framework/op_kernel.h"
 
 namespace tensorflow {
@@ -23,300 +27,144 @@ __device__ T cadd(T a, T b) {
 }
 
 
-template <typename T>
-struct BaseOneQubitGateFunctor<GPUDevice, T> {
-  virtual void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                             T* state, const T* gate, long tk, int m) const {}
+// The gate kernels loop over the pairs of all states of a batch. The matrix
+// of pair ``g`` is at ``gate + (g >> nbits) * gatestride`` where ``nbits``
+// is the number of bits of the pair index within a single state.
+template <typename F, typename T>
+__global__ void OneQubitGateKernel(long nstates, T* state, const T* gate,
+                                   long gatestride, int nbits, long tk,
+                                   int m) {
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    const long i = ((long)((long)g >> m) << (m + 1)) + (g & (tk - 1));
+    F::apply(state[i], state[i + tk], gate + (g >> nbits) * gatestride);
+  }
+}
 
-  virtual void multicontrolwork(const GPUDevice& d, int numBlocks,
-                                int blockSize, T* state, const T* gate, long tk,
-                                int m, int ncontrols, const int* qubits,
-                                int nqubits, int target) const {}
+template <typename F, typename T>
+__global__ void OneQubitGateMultiControlKernel(long nstates, T* state,
+                                               const T* gate, long gatestride,
+                                               int nbits, long tk,
+                                               IndexMasks masks) {
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    const long i = masks.controlled(g);
+    F::apply(state[i - tk], state[i], gate + (g >> nbits) * gatestride);
+  }
+}
 
+template <typename T, typename Derived>
+struct BaseOneQubitGateFunctor<GPUDevice, T, Derived> {
   void operator()(const OpKernelContext* context, const GPUDevice& d, T* state,
                   int nqubits, int target, int ncontrols, const int32* qubits,
-                  const T* gate = NULL) const {
+                  const T* gate = NULL, int64 nbatch = 1,
+                  int64 gatestride = 0) const {
     const int m = nqubits - target - 1;
     const int64 tk = (int64)1 << m;
-    const int64 nstates = (int64)1 << (nqubits - ncontrols - 1);
-
-    int blockSize = DEFAULT_BLOCK_SIZE;
-    int numBlocks = (nstates + blockSize - 1) / blockSize;
-    if (nstates < blockSize) {
-      numBlocks = 1;
-      blockSize = nstates;
-    }
+    const int nbits = nqubits - ncontrols - 1;
+    const int64 ntotal = nbatch << nbits;
 
     if (ncontrols == 0) {
-      nocontrolwork(d, numBlocks, blockSize, state, gate, tk, m);
+      LaunchKernel(OneQubitGateKernel<Derived, T>, d, ntotal, state, gate,
+                   (long)gatestride, nbits, (long)tk, m);
     } else {
-      multicontrolwork(d, numBlocks, blockSize, state, gate, tk, m, ncontrols,
-                       qubits, nqubits, target);
+      // ``qubits`` are in host memory so that the masks are computed here
+      const IndexMasks masks(nqubits + BatchQubits(nbatch), ncontrols + 1,
+                             qubits);
+      LaunchKernel(OneQubitGateMultiControlKernel<Derived, T>, d, ntotal,
+                   state, gate, (long)gatestride, nbits, (long)tk, masks);
     }
   }
 };
 
-template <typename T>
-__device__ void apply_gate(T& state1, T& state2, const T* gate) {
-  const auto buffer = state1;
-  state1 = cadd(cmult(gate[0], state1), cmult(gate[1], state2));
-  state2 = cadd(cmult(gate[2], buffer), cmult(gate[3], state2));
-}
-
-template <typename T>
-__global__ void ApplyGateKernel(T* state, const T* gate, long tk, int m) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  const auto i = ((long)((long)g >> m) << (m + 1)) + (g & (tk - 1));
-  apply_gate(state[i], state[i + tk], gate);
-}
-
-template <typename T>
-__global__ void ApplyGateMultiControlKernel(T* state, const T* gate, long tk,
-                                            int m, int ncontrols,
-                                            const int* qubits, int nqubits,
-                                            int target) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 1; iq++) {
-    const auto n = qubits[iq];
-    long k = (long)1 << n;
-    i = ((long)((long)i >> n) << (n + 1)) + (i & (k - 1)) + k;
-  }
-  apply_gate(state[i - tk], state[i], gate);
-}
-
 // Apply general one-qubit gate via gate matrix
 template <typename T>
-struct ApplyGateFunctor<GPUDevice, T> : BaseOneQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long tk,
-                            int m) const override {
-    ApplyGateKernel<T>
-        <<<numBlocks, blockSize, 0, d.stream()>>>(state, gate, tk, m);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long tk, int m,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int target) const override {
-    ApplyGateMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, tk, m, ncontrols, qubits, nqubits, target);
+struct ApplyGateFunctor<GPUDevice, T>
+    : BaseOneQubitGateFunctor<GPUDevice, T, ApplyGateFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T& state1, T& state2, const T* gate) {
+    const auto buffer = state1;
+    state1 = cadd(cmult(gate[0], state1), cmult(gate[1], state2));
+    state2 = cadd(cmult(gate[2], buffer), cmult(gate[3], state2));
   }
 };
 
-template <typename T>
-__device__ void apply_x(T& state1, T& state2) {
-  const auto buffer = state1;
-  state1 = state2;
-  state2 = buffer;
-}
-
-template <typename T>
-__global__ void ApplyXKernel(T* state, const T* gate, long tk, int m) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  const auto i = ((long)((long)g >> m) << (m + 1)) + (g & (tk - 1));
-  apply_x(state[i], state[i + tk]);
-}
-
-template <typename T>
-__global__ void ApplyXMultiControlKernel(T* state, const T* gate, long tk,
-                                         int m, int ncontrols,
-                                         const int* qubits, int nqubits,
-                                         int target) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 1; iq++) {
-    const auto n = qubits[iq];
-    long k = (long)1 << n;
-    i = ((long)((long)i >> n) << (n + 1)) + (i & (k - 1)) + k;
-  }
-  apply_x(state[i - tk], state[i]);
-}
-
 // Apply X gate via swap
 template <typename T>
-struct ApplyXFunctor<GPUDevice, T> : BaseOneQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long tk,
-                            int m) const override {
-    ApplyXKernel<T>
-        <<<numBlocks, blockSize, 0, d.stream()>>>(state, gate, tk, m);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long tk, int m,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int target) const override {
-    ApplyXMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, tk, m, ncontrols, qubits, nqubits, target);
+struct ApplyXFunctor<GPUDevice, T>
+    : BaseOneQubitGateFunctor<GPUDevice, T, ApplyXFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T& state1, T& state2, const T* gate) {
+    const auto buffer = state1;
+    state1 = state2;
+    state2 = buffer;
   }
 };
 
-template <typename T>
-__device__ void apply_y(T& state1, T& state2) {
-  state1 = cmult(state1, T(0, 1));
-  state2 = cmult(state2, T(0, -1));
-  const auto buffer = state1;
-  state1 = state2;
-  state2 = buffer;
-}
-
-template <typename T>
-__global__ void ApplyYKernel(T* state, const T* gate, long tk, int m) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  const auto i = ((long)((long)g >> m) << (m + 1)) + (g & (tk - 1));
-  apply_y(state[i], state[i + tk]);
-}
-
-template <typename T>
-__global__ void ApplyYMultiControlKernel(T* state, const T* gate, long tk,
-                                         int m, int ncontrols,
-                                         const int* qubits, int nqubits,
-                                         int target) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 1; iq++) {
-    const auto n = qubits[iq];
-    long k = (long)1 << n;
-    i = ((long)((long)i >> n) << (n + 1)) + (i & (k - 1)) + k;
-  }
-  apply_y(state[i - tk], state[i]);
-}
-
 // Apply Y gate via swap
 template <typename T>
-struct ApplyYFunctor<GPUDevice, T> : BaseOneQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long tk,
-                            int m) const override {
-    ApplyYKernel<T>
-        <<<numBlocks, blockSize, 0, d.stream()>>>(state, gate, tk, m);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long tk, int m,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int target) const override {
-    ApplyYMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, tk, m, ncontrols, qubits, nqubits, target);
+struct ApplyYFunctor<GPUDevice, T>
+    : BaseOneQubitGateFunctor<GPUDevice, T, ApplyYFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T& state1, T& state2, const T* gate) {
+    const auto buffer = cmult(state1, T(0, 1));
+    state1 = cmult(state2, T(0, -1));
+    state2 = buffer;
   }
 };
 
-template <typename T>
-__device__ void apply_z(T& state) {
-  state = cmult(state, T(-1));
-}
-
-template <typename T>
-__global__ void ApplyZKernel(T* state, const T* gate, long tk, int m) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  const auto i = ((long)((long)g >> m) << (m + 1)) + (g & (tk - 1));
-  apply_z(state[i + tk]);
-}
-
-template <typename T>
-__global__ void ApplyZMultiControlKernel(T* state, const T* gate, long tk,
-                                         int m, int ncontrols,
-                                         const int* qubits, int nqubits,
-                                         int target) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 1; iq++) {
-    const auto n = qubits[iq];
-    long k = (long)1 << n;
-    i = ((long)((long)i >> n) << (n + 1)) + (i & (k - 1)) + k;
-  }
-  apply_z(state[i]);
-}
-
 // Apply Z gate
 template <typename T>
-struct ApplyZFunctor<GPUDevice, T> : BaseOneQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long tk,
-                            int m) const override {
-    ApplyZKernel<T>
-        <<<numBlocks, blockSize, 0, d.stream()>>>(state, gate, tk, m);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long tk, int m,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int target) const override {
-    ApplyZMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, tk, m, ncontrols, qubits, nqubits, target);
+struct ApplyZFunctor<GPUDevice, T>
+    : BaseOneQubitGateFunctor<GPUDevice, T, ApplyZFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T& state1, T& state2, const T* gate) {
+    state2 = T(-state2.real(), -state2.imag());
   }
 };
 
-template <typename T>
-__device__ void apply_zpow(T& state, T gate) {
-  state = cmult(state, gate);
-}
-
-template <typename T>
-__global__ void ApplyZPowKernel(T* state, const T* gate, long tk, int m) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  const auto i = ((long)((long)g >> m) << (m + 1)) + (g & (tk - 1));
-  apply_zpow(state[i + tk], gate[0]);
-}
-
-template <typename T>
-__global__ void ApplyZPowMultiControlKernel(T* state, const T* gate, long tk,
-                                            int m, int ncontrols,
-                                            const int* qubits, int nqubits,
-                                            int target) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 1; iq++) {
-    const auto n = qubits[iq];
-    long k = (long)1 << n;
-    i = ((long)((long)i >> n) << (n + 1)) + (i & (k - 1)) + k;
-  }
-  apply_zpow(state[i], gate[0]);
-}
-
 // Apply ZPow gate
 template <typename T>
-struct ApplyZPowFunctor<GPUDevice, T> : BaseOneQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long tk,
-                            int m) const override {
-    ApplyZPowKernel<T>
-        <<<numBlocks, blockSize, 0, d.stream()>>>(state, gate, tk, m);
+struct ApplyZPowFunctor<GPUDevice, T>
+    : BaseOneQubitGateFunctor<GPUDevice, T, ApplyZPowFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T& state1, T& state2, const T* gate) {
+    state2 = cmult(state2, gate[0]);
   }
+};
 
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long tk, int m,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int target) const override {
-    ApplyZPowMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, tk, m, ncontrols, qubits, nqubits, target);
+template <typename F, typename T>
+__global__ void TwoQubitGateKernel(long nstates, T* state, const T* gate,
+                                   long gatestride, int nbits, long ctk1,
+                                   long ctk2, long tk1, long tk2, int m1,
+                                   int m2) {
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    long i = ((long)((long)g >> m1) << (m1 + 1)) + (g & (ctk1 - 1));
+    i = ((long)((long)i >> m2) << (m2 + 1)) + (i & (ctk2 - 1));
+    F::apply(state, i, tk1, tk2, gate + (g >> nbits) * gatestride);
   }
-};
+}
 
-template <typename T>
-struct BaseTwoQubitGateFunctor<GPUDevice, T> {
-  virtual void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                             T* state, const T* gate, long ctk1, long ctk2,
-                             long tk1, long tk2, int m1, int m2) const {}
-
-  virtual void multicontrolwork(const GPUDevice& d, int numBlocks,
-                                int blockSize, T* state, const T* gate,
-                                long ctk1, long ctk2, long tk1, long tk2,
-                                int m1, int m2, int ncontrols,
-                                const int* qubits, int nqubits, int t1,
-                                int t2) const {}
+template <typename F, typename T>
+__global__ void TwoQubitGateMultiControlKernel(long nstates, T* state,
+                                               const T* gate, long gatestride,
+                                               int nbits, long ctk1,
+                                               long ctk2, long tk1, long tk2,
+                                               IndexMasks masks) {
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    const long i = masks.controlled(g);
+    F::apply(state, i - ctk1 - ctk2, tk1, tk2,
+             gate + (g >> nbits) * gatestride);
+  }
+}
 
+template <typename T, typename Derived>
+struct BaseTwoQubitGateFunctor<GPUDevice, T, Derived> {
   void operator()(const OpKernelContext* context, const GPUDevice& d, T* state,
                   int nqubits, int target1, int target2, int ncontrols,
-                  const int32* qubits, const T* gate = NULL) const {
+                  const int32* qubits, const T* gate = NULL, int64 nbatch = 1,
+                  int64 gatestride = 0) const {
     const int t1 = std::max(target1, target2);
     const int t2 = std::min(target1, target2);
     int m1 = nqubits - t1 - 1;
     int m2 = nqubits - t2 - 1;
     const int64 tk1 = (int64)1 << m1;
     const int64 tk2 = (int64)1 << m2;
-    const int64 nstates = (int64)1 << (nqubits - 2 - ncontrols);
+    const int nbits = nqubits - 2 - ncontrols;
+    const int64 ntotal = nbatch << nbits;
 
     int64 targetk1 = tk1;
     int64 targetk2 = tk2;
@@ -324,275 +172,406 @@ struct BaseTwoQubitGateFunctor<GPUDevice, T> {
       std::swap(targetk1, targetk2);
     }
 
-    int blockSize = DEFAULT_BLOCK_SIZE;
-    int numBlocks = (nstates + blockSize - 1) / blockSize;
-    if (nstates < blockSize) {
-      numBlocks = 1;
-      blockSize = nstates;
-    }
-
     if (ncontrols == 0) {
-      nocontrolwork(d, numBlocks, blockSize, state, gate, tk1, tk2, targetk1,
-                    targetk2, m1, m2);
+      LaunchKernel(TwoQubitGateKernel<Derived, T>, d, ntotal, state, gate,
+                   (long)gatestride, nbits, (long)tk1, (long)tk2,
+                   (long)targetk1, (long)targetk2, m1, m2);
     } else {
-      multicontrolwork(d, numBlocks, blockSize, state, gate, tk1, tk2, targetk1,
-                       targetk2, m1, m2, ncontrols, qubits, nqubits, t1, t2);
+      // ``qubits`` are in host memory so that the masks are computed here
+      const IndexMasks masks(nqubits + BatchQubits(nbatch), ncontrols + 2,
+                             qubits);
+      LaunchKernel(TwoQubitGateMultiControlKernel<Derived, T>, d, ntotal,
+                   state, gate, (long)gatestride, nbits, (long)tk1, (long)tk2,
+                   (long)targetk1, (long)targetk2, masks);
     }
   };
 };
 
+// Apply general two-qubit gate via gate matrix
 template <typename T>
-__device__ void apply_two_gate(T* state, long i, long tk1, long tk2,
-                               const T* gate = NULL) {
-  const auto i1 = i + tk1;
-  const auto i2 = i + tk2;
-  const auto i3 = i1 + tk2;
-  const auto buffer = state[i];
-  state[i] = cadd(cadd(cmult(gate[0], state[i]), cmult(gate[1], state[i1])),
-                  cadd(cmult(gate[2], state[i2]), cmult(gate[3], state[i3])));
-  const auto buffer1 = state[i1];
-  state[i1] = cadd(cadd(cmult(gate[4], buffer), cmult(gate[5], state[i1])),
-                   cadd(cmult(gate[6], state[i2]), cmult(gate[7], state[i3])));
-  const auto buffer2 = state[i2];
-  state[i2] =
-      cadd(cadd(cmult(gate[8], buffer), cmult(gate[9], buffer1)),
-           cadd(cmult(gate[10], state[i2]), cmult(gate[11], state[i3])));
-  state[i3] = cadd(cadd(cmult(gate[12], buffer), cmult(gate[13], buffer1)),
-                   cadd(cmult(gate[14], buffer2), cmult(gate[15], state[i3])));
-}
-
-template <typename T>
-__global__ void ApplyTwoQubitGateKernel(T* state, const T* gate, long ctk1,
-                                        long ctk2, long tk1, long tk2, int m1,
-                                        int m2) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = ((long)((long)g >> m1) << (m1 + 1)) + (g & (ctk1 - 1));
-  i = ((long)((long)i >> m2) << (m2 + 1)) + (i & (ctk2 - 1));
-  apply_two_gate(state, i, tk1, tk2, gate);
-}
+struct ApplyTwoQubitGateFunctor<GPUDevice, T>
+    : BaseTwoQubitGateFunctor<GPUDevice, T,
+                              ApplyTwoQubitGateFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T* state, long i, long tk1, long tk2,
+                                      const T* gate) {
+    const auto i1 = i + tk1;
+    const auto i2 = i + tk2;
+    const auto i3 = i1 + tk2;
+    const auto buffer = state[i];
+    state[i] = cadd(cadd(cmult(gate[0], state[i]), cmult(gate[1], state[i1])),
+                    cadd(cmult(gate[2], state[i2]), cmult(gate[3], state[i3])));
+    const auto buffer1 = state[i1];
+    state[i1] = cadd(cadd(cmult(gate[4], buffer), cmult(gate[5], state[i1])),
+                    cadd(cmult(gate[6], state[i2]), cmult(gate[7], state[i3])));
+    const auto buffer2 = state[i2];
+    state[i2] =
+        cadd(cadd(cmult(gate[8], buffer), cmult(gate[9], buffer1)),
+            cadd(cmult(gate[10], state[i2]), cmult(gate[11], state[i3])));
+    state[i3] = cadd(cadd(cmult(gate[12], buffer), cmult(gate[13], buffer1)),
+                    cadd(cmult(gate[14], buffer2), cmult(gate[15], state[i3])));
+  }
+};
 
+// Apply fSim gate from https://arxiv.org/abs/2001.08343
 template <typename T>
-__global__ void ApplyTwoQubitGateMultiControlKernel(
-    T* state, const T* gate, long ctk1, long ctk2, long tk1, long tk2, int m1,
-    int m2, int ncontrols, const int* qubits, int nqubits, int t1, int t2) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 2; iq++) {
-    const auto m = qubits[iq];
-    long k = (long)1 << m;
-    i = ((long)((long)i >> m) << (m + 1)) + (i & (k - 1)) + k;
-  }
-  apply_two_gate(state, i - ctk1 - ctk2, tk1, tk2, gate);
-}
+struct ApplyFsimFunctor<GPUDevice, T>
+    : BaseTwoQubitGateFunctor<GPUDevice, T, ApplyFsimFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T* state, long i, long tk1, long tk2,
+                                      const T* gate) {
+    const auto i1 = i + tk1;
+    const auto i2 = i + tk2;
+    const auto i3 = i1 + tk2;
+    const auto buffer = state[i1];
+    state[i1] = cadd(cmult(gate[0], state[i1]), cmult(gate[1], state[i2]));
+    state[i2] = cadd(cmult(gate[2], buffer), cmult(gate[3], state[i2]));
+    state[i3] = cmult(gate[4], state[i3]);
+  }
+};
 
-// Apply general one-qubit gate via gate matrix
+// Apply SWAP gate
 template <typename T>
-struct ApplyTwoQubitGateFunctor<GPUDevice, T>
-    : BaseTwoQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long ctk1, long ctk2,
-                            long tk1, long tk2, int m1, int m2) const override {
-    ApplyTwoQubitGateKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, ctk1, ctk2, tk1, tk2, m1, m2);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long ctk1, long ctk2,
-                               long tk1, long tk2, int m1, int m2,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int t1, int t2) const override {
-    ApplyTwoQubitGateMultiControlKernel<T>
-        <<<numBlocks, blockSize, 0, d.stream()>>>(state, gate, ctk1, ctk2, tk1,
-                                                  tk2, m1, m2, ncontrols,
-                                                  qubits, nqubits, t1, t2);
+struct ApplySwapFunctor<GPUDevice, T>
+    : BaseTwoQubitGateFunctor<GPUDevice, T, ApplySwapFunctor<GPUDevice, T>> {
+  __device__ static inline void apply(T* state, long i, long tk1, long tk2,
+                                      const T* gate) {
+    const auto buffer = state[i + tk1];
+    state[i + tk1] = state[i + tk2];
+    state[i + tk2] = buffer;
   }
 };
 
-template <typename T>
-__device__ void apply_fsim(T* state, long i, long tk1, long tk2,
-                           const T* gate = NULL) {
-  const auto i1 = i + tk1;
-  const auto i2 = i + tk2;
-  const auto i3 = i1 + tk2;
-  const auto buffer = state[i1];
-  state[i1] = cadd(cmult(gate[0], state[i1]), cmult(gate[1], state[i2]));
-  state[i2] = cadd(cmult(gate[2], buffer), cmult(gate[3], state[i2]));
-  state[i3] = cmult(gate[4], state[i3]);
-}
 
-template <typename T>
-__global__ void ApplyFsimKernel(T* state, const T* gate, long ctk1, long ctk2,
-                                long tk1, long tk2, int m1, int m2) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = ((long)((long)g >> m1) << (m1 + 1)) + (g & (ctk1 - 1));
-  i = ((long)((long)i >> m2) << (m2 + 1)) + (i & (ctk2 - 1));
-  apply_fsim(state, i, tk1, tk2, gate);
+// Offsets of the amplitudes that are mixed by a gate acting on ``NT`` targets
+template <int NT>
+struct TargetOffsets {
+  long values[1 << NT];
+};
+
+template <typename T, int NT>
+__global__ void ApplyMultiQubitGateKernel(long nstates, T* state,
+                                          const T* gate, TargetOffsets<NT> tk,
+                                          IndexMasks masks) {
+  constexpr long NS = (long)1 << NT;
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    const long i = masks.controlled(g) - tk.values[NS - 1];
+
+    T buffer[NS];
+    for (long j = 0; j < NS; j++) {
+      buffer[j] = state[i + tk.values[j]];
+    }
+    for (long j = 0; j < NS; j++) {
+      T res = T(0, 0);
+      for (long l = 0; l < NS; l++) {
+        res = cadd(res, cmult(gate[j * NS + l], buffer[l]));
+      }
+      state[i + tk.values[j]] = res;
+    }
+  }
 }
 
-template <typename T>
-__global__ void ApplyFsimMultiControlKernel(T* state, const T* gate, long ctk1,
-                                            long ctk2, long tk1, long tk2,
-                                            int m1, int m2, int ncontrols,
-                                            const int* qubits, int nqubits,
-                                            int t1, int t2) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 2; iq++) {
-    const auto m = qubits[iq];
-    long k = (long)1 << m;
-    i = ((long)((long)i >> m) << (m + 1)) + (i & (k - 1)) + k;
-  }
-  apply_fsim(state, i - ctk1 - ctk2, tk1, tk2, gate);
+template <typename T, int NT>
+void ApplyMultiQubitGate(const GPUDevice& d, T* state, int nqubits,
+                         const int32* targets, int ncontrols,
+                         const int32* qubits, const T* gate) {
+  constexpr long NS = (long)1 << NT;
+  TargetOffsets<NT> tk;
+  for (long j = 0; j < NS; j++) {
+    tk.values[j] = 0;
+    for (int it = 0; it < NT; it++) {
+      if ((j >> (NT - it - 1)) & 1) {
+        tk.values[j] += (long)1 << (nqubits - targets[it] - 1);
+      }
+    }
+  }
+  const int64 nstates = (int64)1 << (nqubits - NT - ncontrols);
+  // ``qubits`` are in host memory so that the masks are computed here
+  const IndexMasks masks(nqubits, ncontrols + NT, qubits);
+  LaunchKernel(ApplyMultiQubitGateKernel<T, NT>, d, nstates, state, gate, tk,
+               masks);
 }
 
+// Apply general multi-qubit gate via gate matrix
 template <typename T>
-struct ApplyFsimFunctor<GPUDevice, T> : BaseTwoQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long ctk1, long ctk2,
-                            long tk1, long tk2, int m1, int m2) const override {
-    ApplyFsimKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, ctk1, ctk2, tk1, tk2, m1, m2);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long ctk1, long ctk2,
-                               long tk1, long tk2, int m1, int m2,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int t1, int t2) const override {
-    ApplyFsimMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, ctk1, ctk2, tk1, tk2, m1, m2, ncontrols, qubits, nqubits,
-        t1, t2);
+struct ApplyMultiQubitGateFunctor<GPUDevice, T> {
+  void operator()(const OpKernelContext* context, const GPUDevice& d, T* state,
+                  int nqubits, int ntargets, const int32* targets,
+                  int ncontrols, const int32* qubits, const T* gate) const {
+    switch (ntargets) {
+      case 3:
+        ApplyMultiQubitGate<T, 3>(d, state, nqubits, targets, ncontrols,
+                                  qubits, gate);
+        break;
+      case 4:
+        ApplyMultiQubitGate<T, 4>(d, state, nqubits, targets, ncontrols,
+                                  qubits, gate);
+        break;
+      case 5:
+        ApplyMultiQubitGate<T, 5>(d, state, nqubits, targets, ncontrols,
+                                  qubits, gate);
+        break;
+    }
   }
 };
 
 template <typename T>
-__device__ void apply_swap(T* state, long i, long tk1, long tk2) {
-  const auto buffer = state[i + tk1];
-  state[i + tk1] = state[i + tk2];
-  state[i + tk2] = buffer;
+__global__ void ApplyDiagonalLayerKernel(long nstates, T* state,
+                                         const T* phases, const int* info,
+                                         int nterms) {
+  GPU_GRID_STRIDE_LOOP(i, nstates) {
+    T phase = T(1, 0);
+    for (auto it = 0; it < nterms; it++) {
+      // info holds (bit of first target, bit of second target, phases offset)
+      const int* tinfo = info + 3 * it;
+      long j = (i >> tinfo[0]) & 1;
+      if (tinfo[1] >= 0) {
+        j = (j << 1) + ((i >> tinfo[1]) & 1);
+      }
+      phase = cmult(phase, phases[tinfo[2] + j]);
+    }
+    state[i] = cmult(state[i], phase);
+  }
 }
 
+// Apply product of diagonal one- and two-qubit gates
 template <typename T>
-__global__ void ApplySwapKernel(T* state, const T* gate, long ctk1, long ctk2,
-                                long tk1, long tk2, int m1, int m2) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = ((long)((long)g >> m1) << (m1 + 1)) + (g & (ctk1 - 1));
-  i = ((long)((long)i >> m2) << (m2 + 1)) + (i & (ctk2 - 1));
-  apply_swap(state, i, tk1, tk2);
-}
+struct ApplyDiagonalLayerFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, T* state,
+                  int nqubits, int nterms, const int32* ntargets,
+                  const int32* targets, const T* phases) const {
+    // ``ntargets`` and ``targets`` are in host memory so that the target
+    // bits are computed here; a device copy is created for the kernel
+    std::vector<int> info(3 * nterms);
+    int nt = 0, np = 0;
+    for (int it = 0; it < nterms; it++) {
+      info[3 * it] = nqubits - targets[nt] - 1;
+      info[3 * it + 1] =
+          ntargets[it] == 2 ? nqubits - targets[nt + 1] - 1 : -1;
+      info[3 * it + 2] = np;
+      nt += ntargets[it];
+      np += 1 << ntargets[it];
+    }
 
-template <typename T>
-__global__ void ApplySwapMultiControlKernel(T* state, const T* gate, long ctk1,
-                                            long ctk2, long tk1, long tk2,
-                                            int m1, int m2, int ncontrols,
-                                            const int* qubits, int nqubits,
-                                            int t1, int t2) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto i = g;
-  for (auto iq = 0; iq < ncontrols + 2; iq++) {
-    const auto m = qubits[iq];
-    long k = (long)1 << m;
-    i = ((long)((long)i >> m) << (m + 1)) + (i & (k - 1)) + k;
-  }
-  apply_swap(state, i - ctk1 - ctk2, tk1, tk2);
-}
+    Tensor tensor_info;
+    TensorShape tensor_info_shape{3 * nterms};
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_INT32, tensor_info_shape,
+                                                   &tensor_info));
+    auto device_info = tensor_info.flat<int32>().data();
+    d.memcpyHostToDevice(device_info, info.data(), 3 * nterms * sizeof(int));
 
-// Apply SWAP gate
-template <typename T>
-struct ApplySwapFunctor<GPUDevice, T> : BaseTwoQubitGateFunctor<GPUDevice, T> {
-  inline void nocontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                            T* state, const T* gate, long ctk1, long ctk2,
-                            long tk1, long tk2, int m1, int m2) const override {
-    ApplySwapKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, ctk1, ctk2, tk1, tk2, m1, m2);
-  }
-
-  inline void multicontrolwork(const GPUDevice& d, int numBlocks, int blockSize,
-                               T* state, const T* gate, long ctk1, long ctk2,
-                               long tk1, long tk2, int m1, int m2,
-                               int ncontrols, const int* qubits, int nqubits,
-                               int t1, int t2) const override {
-    ApplySwapMultiControlKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, gate, ctk1, ctk2, tk1, tk2, m1, m2, ncontrols, qubits, nqubits,
-        t1, t2);
+    const int64 nstates = (int64)1 << nqubits;
+    LaunchKernel(ApplyDiagonalLayerKernel<T>, d, nstates, state, phases,
+                 (const int*)device_info, nterms);
   }
 };
 
-
-// Methods for Collapse gate
-__device__ long GetIndex(long g, long h, const int* qubits, int ntargets) {
-  long i = g;
-  for (auto iq = 0; iq < ntargets; iq++) {
-    const auto n = qubits[iq];
-    long k = (long)1 << n;
-    i = ((long)((int64)i >> n) << (n + 1)) + (i & (k - 1));
-    i += ((long)((int)(h >> iq) % 2) * k);
-  }
-  return i;
-};
-
 template <typename T>
-__global__ void CollapseStateKernel(T* state, const int* qubits,
-                                    const int64* results, int ntargets) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  const long result = results[0];
-  const long nsubstates = (int64)1 << ntargets;
+__global__ void ApplyGateSequenceSliceKernel(T* state, const T* gates,
+                                             const IndexMasks* masks,
+                                             const int* info, int nlocal,
+                                             int first, int last) {
+  // each block loads one slice to shared memory, applies all gates of the
+  // sequence to it and writes it back once
+  extern __shared__ char shared_buffer[];
+  T* tile = reinterpret_cast<T*>(shared_buffer);
+  T* slice = state + ((long)blockIdx.x << nlocal);
+  const long tilesize = (long)1 << nlocal;
+  for (long j = threadIdx.x; j < tilesize; j += blockDim.x) {
+    tile[j] = slice[j];
+  }
+  __syncthreads();
 
-  for (auto h = 0; h < result; h++) {
-    state[GetIndex(g, h, qubits, ntargets)] = T(0, 0);
+  for (auto ig = first; ig < last; ig++) {
+    // info holds (ntargets, ncontrols, gates offset, tk1, tk2)
+    const int* ginfo = info + 5 * ig;
+    const IndexMasks& gmasks = masks[ig];
+    const T* gate = gates + ginfo[2];
+    const long nstates = (long)1 << (nlocal - gmasks.nbits);
+    for (long g = threadIdx.x; g < nstates; g += blockDim.x) {
+      const long i = gmasks.controlled(g);
+      if (ginfo[0] == 1) {
+        ApplyGateFunctor<GPUDevice, T>::apply(tile[i - ginfo[3]], tile[i],
+                                              gate);
+      } else {
+        ApplyTwoQubitGateFunctor<GPUDevice, T>::apply(
+            tile, i - ginfo[3] - ginfo[4], (long)ginfo[3], (long)ginfo[4],
+            gate);
+      }
+    }
+    __syncthreads();
   }
-  for (auto h = result + 1; h < nsubstates; h++) {
-    state[GetIndex(g, h, qubits, ntargets)] = T(0, 0);
+
+  for (long j = threadIdx.x; j < tilesize; j += blockDim.x) {
+    slice[j] = tile[j];
   }
 }
 
-template <typename T, typename NormType>
-__global__ void CalculateCollapsedNormKernel(T* state, NormType* norms,
-                                             const int* qubits,
-                                             const int64* results,
-                                             long nstates, int ntargets) {
-  const auto tid = threadIdx.x;
-  const auto stride = blockDim.x;
-  const long result = results[0];
-  norms[tid] = 0;
-
-  for (auto g = tid; g < nstates; g += stride) {
-    auto x = state[GetIndex(g, result, qubits, ntargets)];
-    norms[tid] += x.real() * x.real() + x.imag() * x.imag();
+// Apply sequence of gates
+template <typename T>
+struct ApplyGateSequenceFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, T* state,
+                  int nqubits, int ngates, const int32* gate_info,
+                  const int32* qubits, const T* gates) const {
+    // states that fit in a single slice are applied as one tile
+    const int nlocal = std::min(nqubits, DEFAULT_LOCAL_QUBITS);
+
+    // ``gate_info`` and ``qubits`` are in host memory so that the launches
+    // can be scheduled here; the index masks of the local gates and their
+    // description are copied to the device for the kernels
+    std::vector<int> local(ngates), qoffsets(ngates);
+    std::vector<int> info(5 * ngates);
+    std::vector<IndexMasks> masks(ngates);
+    int nq = 0, ng = 0;
+    for (int ig = 0; ig < ngates; ig++) {
+      const int32* ginfo = gate_info + 4 * ig;
+      const int N = ginfo[0] + ginfo[1];
+      info[5 * ig] = ginfo[0];
+      info[5 * ig + 1] = ginfo[1];
+      info[5 * ig + 2] = ng;
+      qoffsets[ig] = nq;
+      local[ig] = qubits[nq + N - 1] < nlocal;
+      // target strides and masks are used only inside slices
+      if (local[ig]) {
+        masks[ig] = IndexMasks(nlocal, N, qubits + nq);
+        if (ginfo[0] == 1) {
+          info[5 * ig + 3] = 1 << (nqubits - ginfo[2] - 1);
+        } else {
+          info[5 * ig + 3] = 1 << (nqubits - ginfo[3] - 1);
+          info[5 * ig + 4] = 1 << (nqubits - ginfo[2] - 1);
+        }
+      }
+      nq += N;
+      ng += 1 << (2 * ginfo[0]);
+    }
+
+    const int64 masks_size = ngates * sizeof(IndexMasks);
+    const int64 info_size = 5 * ngates * sizeof(int);
+    Tensor tensor_info;
+    TensorShape tensor_info_shape{masks_size + info_size};
+    OP_REQUIRES_OK(context, context->allocate_temp(DT_INT8, tensor_info_shape,
+                                                   &tensor_info));
+    auto device_masks = (IndexMasks*)tensor_info.flat<int8>().data();
+    auto device_info = (int*)(tensor_info.flat<int8>().data() + masks_size);
+    d.memcpyHostToDevice(device_masks, masks.data(), masks_size);
+    d.memcpyHostToDevice(device_info, info.data(), info_size);
+
+    int ig = 0;
+    while (ig < ngates) {
+      if (!local[ig]) {
+        const int32* ginfo = gate_info + 4 * ig;
+        if (ginfo[0] == 1) {
+          ApplyGateFunctor<GPUDevice, T>()(
+              context, d, state, nqubits, ginfo[2], ginfo[1],
+              qubits + qoffsets[ig], gates + info[5 * ig + 2]);
+        } else {
+          ApplyTwoQubitGateFunctor<GPUDevice, T>()(
+              context, d, state, nqubits, ginfo[2], ginfo[3], ginfo[1],
+              qubits + qoffsets[ig], gates + info[5 * ig + 2]);
+        }
+        ig++;
+        continue;
+      }
+
+      // block of consecutive local gates is applied slice by slice
+      int last = ig;
+      while (last < ngates && local[last]) last++;
+      const int64 nslices = (int64)1 << (nqubits - nlocal);
+      const int blockSize = std::min(1 << (nlocal - 1), DEFAULT_BLOCK_SIZE);
+      const size_t tileBytes = sizeof(T) << nlocal;
+      ApplyGateSequenceSliceKernel<T>
+          <<<nslices, blockSize, tileBytes, d.stream()>>>(
+              state, gates, device_masks, device_info, nlocal, ig, last);
+      ig = last;
+    }
   }
-}
+};
 
+// Apply serialized circuit
+template <typename T>
+struct ExecuteCircuitFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, T* state,
+                  int nqubits, int ngates, const int32* gate_info,
+                  const int32* qubits, const T* gates) const {
+    // ``gate_info`` and ``qubits`` are in host memory, so each gate is a
+    // kernel launch without a separate op
+    const int32* gqubits = qubits;
+    for (int ig = 0; ig < ngates; ig++) {
+      const int32* info = gate_info + CIRCUIT_INFO_SIZE * ig;
+      ApplyCircuitGate<GPUDevice, T>(context, d, state, nqubits, info,
+                                     gqubits, gates + info[3]);
+      gqubits += info[1] + info[2];
+    }
+  }
+};
 
-template <typename NormType>
-__global__ void VectorReductionKernel(NormType *g_idata, NormType *g_odata) {
-  extern __shared__ double sdata[DEFAULT_BLOCK_SIZE];
-  // each thread loads one element from global to shared mem
-  const auto tid = threadIdx.x;
-  sdata[tid] = g_idata[blockIdx.x * blockDim.x + threadIdx.x];
-  __syncthreads();
-  // do reduction in shared mem
-  for (auto s = blockDim.x / 2; s > 0; s >>= 1) {
-    if (tid < s) {
-      sdata[tid] += sdata[tid + s];
+
+// Methods for Collapse gate
+// The result of state ``b`` of a batch is ``results[b * resultstride]``.
+// Each state of the batch is handled by ``nblocks`` consecutive blocks.
+
+// Removes the amplitudes of the other results and writes the partial norm
+// of each block.
+template <typename T, typename NormType>
+__global__ void CollapseStateKernel(T* state, NormType* partial,
+                                    IndexMasks masks, const int64* results,
+                                    long resultstride, int nqubits,
+                                    int nblocks) {
+  const long b = blockIdx.x / nblocks;
+  const long resbits = DepositBits(results[b * resultstride],
+                                   masks.qubitmask);
+  const long nstates = (long)1 << nqubits;
+  const long stride = (long)nblocks * blockDim.x;
+  T* bstate = state + (b << nqubits);
+  NormType norm = 0;
+  for (long i = (blockIdx.x % nblocks) * blockDim.x + threadIdx.x;
+       i < nstates; i += stride) {
+    if (((b << nqubits | i) & masks.qubitmask) == resbits) {
+      const auto x = bstate[i];
+      norm += x.real() * x.real() + x.imag() * x.imag();
+    } else {
+      bstate[i] = T(0, 0);
     }
-    __syncthreads();
   }
-  // write result for this block to global mem
-  if (tid == 0) {
-    g_odata[blockIdx.x] = std::sqrt(sdata[0]);
+  norm = BlockReduceSum(norm);
+  if (threadIdx.x == 0) {
+    partial[blockIdx.x] = norm;
   }
 }
 
+// Reduces the partial norms of each state, writes the probability of the
+// result and optionally normalizes the remaining amplitudes.
 template <typename T, typename NormType>
-__global__ void NormalizeCollapsedStateKernel(T* state, NormType* norms,
-                                              const int* qubits,
+__global__ void NormalizeCollapsedStateKernel(T* state,
+                                              const NormType* partial,
+                                              double* probabilities,
+                                              IndexMasks masks,
                                               const int64* results,
-                                              long nstates, int ntargets) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  auto NormalizeComponent = [&](T& x) {
-    x = T(x.real() / norms[0], x.imag() / norms[0]);
-  };
-  NormalizeComponent(state[GetIndex(g, results[0], qubits, ntargets)]);
+                                              long resultstride, int nbits,
+                                              int npartial, int nblocks,
+                                              bool normalize) {
+  __shared__ NormType shared_norm;
+  const long b = blockIdx.x / nblocks;
+  NormType norm = 0;
+  for (int j = threadIdx.x; j < npartial; j += blockDim.x) {
+    norm += partial[b * npartial + j];
+  }
+  norm = BlockReduceSum(norm);
+  if (threadIdx.x == 0) {
+    shared_norm = norm;
+    if (blockIdx.x % nblocks == 0) probabilities[b] = norm;
+  }
+  __syncthreads();
+  if (!normalize) return;
+
+  norm = std::sqrt(shared_norm);
+  const long resbits = DepositBits(results[b * resultstride],
+                                   masks.qubitmask);
+  const long nstates = (long)1 << nbits;
+  const long stride = (long)nblocks * blockDim.x;
+  for (long g = (blockIdx.x % nblocks) * blockDim.x + threadIdx.x;
+       g < nstates; g += stride) {
+    T& x = state[masks.insert(b * nstates + g) | resbits];
+    x = T(x.real() / norm, x.imag() / norm);
+  }
 }
 
 // Collapse state gate
@@ -600,36 +579,339 @@ template <typename T, typename NormType>
 struct CollapseStateFunctor<GPUDevice, T, NormType> {
   void operator()(OpKernelContext* context, const GPUDevice& d, T* state,
                   int nqubits, bool normalize, int ntargets,
-                  const int32* qubits, const int64* result) const {
-    int64 nstates = (int64)1 << (nqubits - ntargets);
-    int blockSize = DEFAULT_BLOCK_SIZE;
-    int numBlocks = (nstates + blockSize - 1) / blockSize;
-    if (nstates < blockSize) {
-      numBlocks = 1;
-      blockSize = nstates;
+                  const int32* qubits, const int64* result, int64 nbatch = 1,
+                  int64 resultstride = 0,
+                  double* probabilities = NULL) const {
+    // ``qubits`` are in host memory so that the masks are computed here
+    const IndexMasks masks(nqubits + BatchQubits(nbatch), ntargets, qubits);
+
+    // the blocks that fit on the device are split over the states
+    auto collapse = CollapseStateKernel<T, NormType>;
+    const LaunchConfig config = GetLaunchConfig(d, collapse,
+                                                nbatch << nqubits);
+    const int nblocks = (int)std::max((int64)1, config.numBlocks / nbatch);
+
+    Tensor tensor_partial, tensor_probabilities;
+    const auto dtype = std::is_same<NormType, double>::value ? DT_DOUBLE
+                                                             : DT_FLOAT;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, dtype, TensorShape({nbatch * nblocks}), &tensor_partial));
+    NormType* partial = tensor_partial.flat<NormType>().data();
+    if (probabilities == NULL) {
+      OP_REQUIRES_OK(context, AllocatePooled(
+          context, DT_DOUBLE, TensorShape({nbatch}), &tensor_probabilities));
+      probabilities = tensor_probabilities.flat<double>().data();
+    }
+
+    // single pass that removes the other results and computes the norms
+    collapse<<<nbatch * nblocks, config.blockSize, 0, d.stream()>>>(
+        state, partial, masks, result, (long)resultstride, nqubits, nblocks);
+    // the normalization uses the same blocks per state (a single block if
+    // only the probabilities are needed)
+    auto normalize_kernel = NormalizeCollapsedStateKernel<T, NormType>;
+    const int nnorm = normalize ? nblocks : 1;
+    const int blockSize = KernelBlockSize(normalize_kernel);
+    normalize_kernel<<<nbatch * nnorm, blockSize, 0, d.stream()>>>(
+        state, (const NormType*)partial, probabilities, masks, result,
+        (long)resultstride, nqubits - ntargets, nblocks, nnorm, normalize);
+  }
+};
+
+// Copies the amplitudes of the measured result to the reduced state and
+// writes the partial norm of each block.
+template <typename T, typename NormType>
+__global__ void CompactCollapseStateKernel(const T* state, T* out,
+                                           NormType* partial, IndexMasks masks,
+                                           const int64* results,
+                                           long resultstride, int nbits,
+                                           int nblocks) {
+  const long b = blockIdx.x / nblocks;
+  const long resbits = DepositBits(results[b * resultstride],
+                                   masks.qubitmask);
+  const long nstates = (long)1 << nbits;
+  const long stride = (long)nblocks * blockDim.x;
+  NormType norm = 0;
+  for (long g = (blockIdx.x % nblocks) * blockDim.x + threadIdx.x;
+       g < nstates; g += stride) {
+    const auto x = state[masks.insert(b * nstates + g) | resbits];
+    out[b * nstates + g] = x;
+    norm += x.real() * x.real() + x.imag() * x.imag();
+  }
+  norm = BlockReduceSum(norm);
+  if (threadIdx.x == 0) {
+    partial[blockIdx.x] = norm;
+  }
+}
+
+// Collapse state gate that removes the measured qubits
+template <typename T, typename NormType>
+struct CompactCollapseStateFunctor<GPUDevice, T, NormType> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, const T* state,
+                  T* out, int nqubits, bool normalize, int ntargets,
+                  const int32* qubits, const int64* result, int64 nbatch = 1,
+                  int64 resultstride = 0,
+                  double* probabilities = NULL) const {
+    const int nbits = nqubits - ntargets;
+    const int nbatchbits = BatchQubits(nbatch);
+    const IndexMasks masks(nqubits + nbatchbits, ntargets, qubits);
+
+    auto collapse = CompactCollapseStateKernel<T, NormType>;
+    const LaunchConfig config = GetLaunchConfig(d, collapse, nbatch << nbits);
+    const int nblocks = (int)std::max((int64)1, config.numBlocks / nbatch);
+
+    Tensor tensor_partial, tensor_probabilities;
+    const auto dtype = std::is_same<NormType, double>::value ? DT_DOUBLE
+                                                             : DT_FLOAT;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, dtype, TensorShape({nbatch * nblocks}), &tensor_partial));
+    NormType* partial = tensor_partial.flat<NormType>().data();
+    if (probabilities == NULL) {
+      OP_REQUIRES_OK(context, AllocatePooled(
+          context, DT_DOUBLE, TensorShape({nbatch}), &tensor_probabilities));
+      probabilities = tensor_probabilities.flat<double>().data();
     }
 
-    CollapseStateKernel<T><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, qubits, result, ntargets);
-
-    if (normalize) {
-      // allocates support arrays on GPU
-      Tensor tensor_norms, tensor_block_norms;
-      TensorShape tensor_norms_shape{1}, tensor_block_norms_shape{blockSize};
-      const auto dtype = std::is_same<NormType, double>::value ? DT_DOUBLE : DT_FLOAT;
-      OP_REQUIRES_OK(context, context->allocate_temp(dtype, tensor_norms_shape, &tensor_norms));
-      OP_REQUIRES_OK(context, context->allocate_temp(dtype, tensor_block_norms_shape, &tensor_block_norms));
-      auto norms = tensor_norms.flat<NormType>().data();
-      auto block_norms = tensor_block_norms.flat<NormType>().data();
-
-      CalculateCollapsedNormKernel<T, NormType><<<1, blockSize, 0, d.stream()>>>(
-        state, block_norms, qubits, result, nstates, ntargets);
-      VectorReductionKernel<NormType><<<1, blockSize, 0, d.stream()>>>(
-        block_norms, norms);
-      NormalizeCollapsedStateKernel<T, NormType><<<numBlocks, blockSize, 0, d.stream()>>>(
-        state, norms, qubits, result, nstates, ntargets);
+    collapse<<<nbatch * nblocks, config.blockSize, 0, d.stream()>>>(
+        state, out, partial, masks, result, (long)resultstride, nbits, nblocks);
+    // the reduced states are contiguous so they are normalized with masks
+    // that do not insert any bit
+    const IndexMasks outmasks(nbits + nbatchbits, 0, NULL);
+    auto normalize_kernel = NormalizeCollapsedStateKernel<T, NormType>;
+    const int nnorm = normalize ? nblocks : 1;
+    const int blockSize = KernelBlockSize(normalize_kernel);
+    normalize_kernel<<<nbatch * nnorm, blockSize, 0, d.stream()>>>(
+        out, (const NormType*)partial, probabilities, outmasks, result,
+        (long)resultstride, nbits, nblocks, nnorm, normalize);
+  }
+};
+
+// Methods for the gate gradients
+// As in the collapse kernels, the groups of amplitudes that use matrix ``b``
+// of a batch are handled by ``nblocks`` consecutive blocks.
+
+// Undoes the gate if ``undone`` is given, propagates the gradient and writes
+// the partial gradients of the gate elements of each block.
+template <typename T, int Gate>
+__global__ void GateGradientKernel(const T* state, T* undone, T* grad,
+                                   T* partial,
+                                   const T* gate, long gatestride,
+                                   IndexMasks masks, long tk1, long tk2,
+                                   long ngroups, int nblocks) {
+  typedef GradientGateTraits<Gate> traits;
+  typedef typename T::value_type real;
+  const long b = blockIdx.x / nblocks;
+  T u[traits::namplitudes * traits::namplitudes];
+  GradientMatrix<Gate>(gate + b * gatestride, u);
+  const int64_t offsets[4] = {0, traits::ntargets > 1 ? tk2 : tk1, tk1,
+                              tk1 + tk2};
+  T acc[traits::gatesize];
+  for (int k = 0; k < traits::gatesize; k++) {
+    acc[k] = T(0, 0);
+  }
+  const long stride = (long)nblocks * blockDim.x;
+  for (long g = b * ngroups + (blockIdx.x % nblocks) * blockDim.x +
+                threadIdx.x;
+       g < (b + 1) * ngroups; g += stride) {
+    GradientUpdate<Gate>(state, undone, grad, masks.controlled(g) - tk1 - tk2,
+                         offsets, u, acc);
+  }
+  for (int k = 0; k < traits::gatesize; k++) {
+    const real re = BlockReduceSum(acc[k].real());
+    const real im = BlockReduceSum(acc[k].imag());
+    if (threadIdx.x == 0) {
+      partial[blockIdx.x * traits::gatesize + k] = T(re, im);
     }
   }
+}
+
+// Sums the partial gradients of the blocks of each gate matrix.
+template <typename T, int Gate>
+__global__ void GateGradientReduceKernel(long n, T* gategrad,
+                                         const T* partial, int nblocks) {
+  const int gatesize = GradientGateTraits<Gate>::gatesize;
+  GPU_GRID_STRIDE_LOOP(j, n) {
+    const long b = j / gatesize;
+    const int k = j % gatesize;
+    T sum(0, 0);
+    for (int s = 0; s < nblocks; s++) {
+      sum = cadd(sum, partial[(b * nblocks + s) * gatesize + k]);
+    }
+    gategrad[j] = sum;
+  }
+}
+
+// Backward pass of the gates that support gradients
+template <typename T, int Gate>
+struct GateGradientFunctor<GPUDevice, T, Gate> {
+  void operator()(OpKernelContext* context, const GPUDevice& d,
+                  const T* state, T* undone, T* grad, T* gategrad, int nqubits, int target1, int target2,
+                  int ncontrols, const int32* qubits, const T* gate,
+                  int64 nbatch = 1, int64 gatestride = 0) const {
+    typedef GradientGateTraits<Gate> traits;
+    const int ntargets = traits::ntargets;
+    const int64 tk1 = (int64)1 << (nqubits - target1 - 1);
+    const int64 tk2 = ntargets > 1 ? (int64)1 << (nqubits - target2 - 1) : 0;
+    const int nbits = nqubits - ncontrols - ntargets;
+    // ``qubits`` are in host memory so that the masks are computed here
+    const IndexMasks masks(nqubits + BatchQubits(nbatch), ncontrols + ntargets,
+                           qubits);
+
+    const int64 ngates = gatestride > 0 ? nbatch : 1;
+    const int64 ngroups = (nbatch << nbits) / ngates;
+    auto kernel = GateGradientKernel<T, Gate>;
+    const LaunchConfig config = GetLaunchConfig(d, kernel, nbatch << nbits);
+    const int nblocks = (int)std::max((int64)1, config.numBlocks / ngates);
+
+    Tensor tensor_partial;
+    const auto dtype = std::is_same<T, complex128>::value ? DT_COMPLEX128
+                                                          : DT_COMPLEX64;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, dtype, TensorShape({ngates * nblocks * traits::gatesize}),
+        &tensor_partial));
+    T* partial = tensor_partial.flat<T>().data();
+
+    // single pass that undoes the gate and computes the partial gradients
+    kernel<<<ngates * nblocks, config.blockSize, 0, d.stream()>>>(
+        state, undone, grad, partial, gate, (long)gatestride, masks, (long)tk1,
+        (long)tk2, (long)ngroups, nblocks);
+    LaunchKernel(GateGradientReduceKernel<T, Gate>, d,
+                 ngates * traits::gatesize, gategrad, (const T*)partial,
+                 nblocks);
+  }
+};
+
+// Methods for the trajectories
+// The groups of amplitudes of state ``b`` of the batch are handled by
+// ``nblocks`` consecutive blocks, which write the partial norms of all
+// Kraus operators.
+template <typename T, int NT>
+__global__ void KrausNormsKernel(const T* state, double* partial, KrausMasks m,
+                                 const T* ops, int nops, long ngroups,
+                                 int nblocks) {
+  const long b = blockIdx.x / nblocks;
+  double norms[TRAJECTORY_MAX_OPS];
+  for (int k = 0; k < nops; k++) {
+    norms[k] = 0;
+  }
+  const long stride = (long)nblocks * blockDim.x;
+  for (long g = b * ngroups + (blockIdx.x % nblocks) * blockDim.x +
+                threadIdx.x;
+       g < (b + 1) * ngroups; g += stride) {
+    AccumulateKrausNorms<NT>(state, m.masks.insert(g), m, nops, ops, norms);
+  }
+  for (int k = 0; k < nops; k++) {
+    const double norm = BlockReduceSum(norms[k]);
+    if (threadIdx.x == 0) {
+      partial[blockIdx.x * nops + k] = norm;
+    }
+  }
+}
+
+// Writes the partial probability of result ``j`` (of state ``j >> ntargets``)
+// of each block.
+template <typename T>
+__global__ void TrajectoryProbabilitiesKernel(const T* state, double* partial,
+                                              IndexMasks masks, int nqubits,
+                                              int ntargets, long nstates,
+                                              int nblocks) {
+  const long j = blockIdx.x / nblocks;
+  const T* bstate = state + ((j >> ntargets) << nqubits);
+  const long resbits = DepositBits(j & (((long)1 << ntargets) - 1),
+                                   masks.qubitmask);
+  const long stride = (long)nblocks * blockDim.x;
+  double p = 0;
+  for (long g = (blockIdx.x % nblocks) * blockDim.x + threadIdx.x;
+       g < nstates; g += stride) {
+    const auto x = bstate[masks.insert(g) | resbits];
+    p += x.real() * x.real() + x.imag() * x.imag();
+  }
+  p = BlockReduceSum(p);
+  if (threadIdx.x == 0) {
+    partial[blockIdx.x] = p;
+  }
+}
+
+// Sums the partial values of the blocks of each state.
+__global__ void TrajectoryReduceKernel(long n, double* out,
+                                       const double* partial, long nvalues,
+                                       int nblocks) {
+  GPU_GRID_STRIDE_LOOP(j, n) {
+    const long b = j / nvalues;
+    const long k = j % nvalues;
+    double sum = 0;
+    for (int s = 0; s < nblocks; s++) {
+      sum += partial[(b * nblocks + s) * nvalues + k];
+    }
+    out[j] = sum;
+  }
+}
+
+// Squared norms of the Kraus operators of a channel for each trajectory
+template <typename T>
+struct KrausNormsFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, const T* state,
+                  int nqubits, int ntargets, const int32* targets,
+                  const int32* qubits, int nops, const T* ops, int64 nbatch,
+                  double* norms) const {
+    // ``targets`` and ``qubits`` are in host memory so that the masks are
+    // computed here
+    const KrausMasks m(nqubits, nbatch, ntargets, targets, qubits);
+    const int64 ngroups = (int64)1 << (nqubits - ntargets);
+    auto kernel = ntargets == 1 ? KrausNormsKernel<T, 1>
+                                : KrausNormsKernel<T, 2>;
+    const LaunchConfig config = GetLaunchConfig(d, kernel, nbatch * ngroups);
+    const int nblocks = (int)std::max((int64)1, config.numBlocks / nbatch);
+
+    Tensor tensor_partial, tensor_norms;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DT_DOUBLE, TensorShape({nbatch * nblocks * nops}),
+        &tensor_partial));
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DT_DOUBLE, TensorShape({nbatch * nops}), &tensor_norms));
+    double* partial = tensor_partial.flat<double>().data();
+    double* device_norms = tensor_norms.flat<double>().data();
+
+    kernel<<<nbatch * nblocks, config.blockSize, 0, d.stream()>>>(
+        state, partial, m, ops, nops, (long)ngroups, nblocks);
+    LaunchKernel(TrajectoryReduceKernel, d, nbatch * nops, device_norms,
+                 (const double*)partial, (long)nops, nblocks);
+    // the branches are sampled by the host
+    d.memcpyDeviceToHost(norms, device_norms, nbatch * nops * sizeof(double));
+    d.synchronize();
+  }
+};
+
+// Probabilities of the measured qubits for each trajectory
+template <typename T>
+struct TrajectoryProbabilitiesFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, const T* state,
+                  int nqubits, int ntargets, const int32* qubits, int64 nbatch,
+                  double* probs) const {
+    const int64 nresults = nbatch << ntargets;
+    const int64 nstates = (int64)1 << (nqubits - ntargets);
+    // ``qubits`` are in host memory so that the masks are computed here
+    const IndexMasks masks(nqubits, ntargets, qubits);
+    auto kernel = TrajectoryProbabilitiesKernel<T>;
+    const LaunchConfig config = GetLaunchConfig(d, kernel, nbatch << nqubits);
+    const int nblocks = (int)std::max((int64)1, config.numBlocks / nresults);
+
+    Tensor tensor_partial, tensor_probs;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DT_DOUBLE, TensorShape({nresults * nblocks}),
+        &tensor_partial));
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DT_DOUBLE, TensorShape({nresults}), &tensor_probs));
+    double* partial = tensor_partial.flat<double>().data();
+    double* device_probs = tensor_probs.flat<double>().data();
+
+    kernel<<<nresults * nblocks, config.blockSize, 0, d.stream()>>>(
+        state, partial, masks, nqubits, ntargets, (long)nstates, nblocks);
+    LaunchKernel(TrajectoryReduceKernel, d, nresults, device_probs,
+                 (const double*)partial, (long)1, nblocks);
+    // the measurements are sampled by the host
+    d.memcpyDeviceToHost(probs, device_probs, nresults * sizeof(double));
+    d.synchronize();
+  }
 };
 
 // Explicitly instantiate functors for the types of OpKernels registered.
@@ -638,18 +920,45 @@ struct CollapseStateFunctor<GPUDevice, T, NormType> {
   template struct FUNCTOR<GPUDevice, complex128>;
 
 
-REGISTER_TEMPLATE(BaseOneQubitGateFunctor);
-REGISTER_TEMPLATE(ApplyGateFunctor);
-REGISTER_TEMPLATE(ApplyXFunctor);
-REGISTER_TEMPLATE(ApplyYFunctor);
-REGISTER_TEMPLATE(ApplyZFunctor);
-REGISTER_TEMPLATE(ApplyZPowFunctor);
-REGISTER_TEMPLATE(BaseTwoQubitGateFunctor);
-REGISTER_TEMPLATE(ApplyTwoQubitGateFunctor);
-REGISTER_TEMPLATE(ApplyFsimFunctor);
-REGISTER_TEMPLATE(ApplySwapFunctor);
+// The CRTP bases hold ``operator()`` so they are instantiated explicitly too.
+// The one- and two-qubit gates also support half precision states.
+#define REGISTER_GATE_TEMPLATE(BASE, FUNCTOR)                                \
+  template struct BASE<GPUDevice, complex32, FUNCTOR<GPUDevice, complex32>>; \
+  template struct BASE<GPUDevice, complex64, FUNCTOR<GPUDevice, complex64>>; \
+  template struct BASE<GPUDevice, complex128,                                \
+                       FUNCTOR<GPUDevice, complex128>>;                      \
+  template struct FUNCTOR<GPUDevice, complex32>;                             \
+  REGISTER_TEMPLATE(FUNCTOR)
+
+REGISTER_GATE_TEMPLATE(BaseOneQubitGateFunctor, ApplyGateFunctor);
+REGISTER_GATE_TEMPLATE(BaseOneQubitGateFunctor, ApplyXFunctor);
+REGISTER_GATE_TEMPLATE(BaseOneQubitGateFunctor, ApplyYFunctor);
+REGISTER_GATE_TEMPLATE(BaseOneQubitGateFunctor, ApplyZFunctor);
+REGISTER_GATE_TEMPLATE(BaseOneQubitGateFunctor, ApplyZPowFunctor);
+REGISTER_GATE_TEMPLATE(BaseTwoQubitGateFunctor, ApplyTwoQubitGateFunctor);
+REGISTER_GATE_TEMPLATE(BaseTwoQubitGateFunctor, ApplyFsimFunctor);
+REGISTER_GATE_TEMPLATE(BaseTwoQubitGateFunctor, ApplySwapFunctor);
+REGISTER_TEMPLATE(ApplyMultiQubitGateFunctor);
+REGISTER_TEMPLATE(ApplyDiagonalLayerFunctor);
+REGISTER_TEMPLATE(ApplyGateSequenceFunctor);
+REGISTER_TEMPLATE(ExecuteCircuitFunctor);
+REGISTER_TEMPLATE(KrausNormsFunctor);
+REGISTER_TEMPLATE(TrajectoryProbabilitiesFunctor);
+template struct CollapseStateFunctor<GPUDevice, complex32, float>;
 template struct CollapseStateFunctor<GPUDevice, complex64, float>;
 template struct CollapseStateFunctor<GPUDevice, complex128, double>;
+template struct CompactCollapseStateFunctor<GPUDevice, complex32, float>;
+template struct CompactCollapseStateFunctor<GPUDevice, complex64, float>;
+template struct CompactCollapseStateFunctor<GPUDevice, complex128, double>;
+
+#define REGISTER_GRADIENT_TEMPLATE(GATE)                            \
+  template struct GateGradientFunctor<GPUDevice, complex64, GATE>;  \
+  template struct GateGradientFunctor<GPUDevice, complex128, GATE>;
+
+REGISTER_GRADIENT_TEMPLATE(GRADIENT_GATE);
+REGISTER_GRADIENT_TEMPLATE(GRADIENT_ZPOW);
+REGISTER_GRADIENT_TEMPLATE(GRADIENT_TWO_QUBIT_GATE);
+REGISTER_GRADIENT_TEMPLATE(GRADIENT_FSIM);
 }  // end namespace functor
 }  // end namespace tensorflow
 #endif  // GOOGLE_CUDA
@@ -0,0 +1,100 @@
+/************************************************
+ * Half precision storage of states.
+ *
+ * Tensorflow has no complex type of half precision, so states of half
+ * precision are ``float16`` tensors with an additional last dimension of
+ * size two that holds the real and the imaginary part of each amplitude.
+ * The kernels view such tensors as arrays of @struct complex32, which stores
+ * the two parts as ``Eigen::half`` but returns them as ``float`` from
+ * ``real()`` and ``imag()``. Only the storage is of half precision: the
+ * products of @fn cmult return ``complex64`` so that the sums of the gate
+ * kernels, the norms of the collapse and the probabilities of the
+ * measurements are accumulated in single precision, and each amplitude is
+ * rounded once when it is stored. Half precision states use half of the
+ * memory and of the bandwidth of each gate of ``complex64`` states.
+ *
+ * The operators that support half precision states use @fn StateData,
+ * @fn StateSize and @fn StateShape to access their tensors, which reduce
+ * to the plain tensor methods for the complex types.
+ ***********************************************/
+#ifndef KERNEL_COMPLEX_HALF_H_
+#define KERNEL_COMPLEX_HALF_H_
+
+#include "index_masks.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+struct complex32 {
+  typedef Eigen::half value_type;
+
+  INDEX_MASKS_FUNC complex32(float re = 0, float im = 0)
+      : re_(re), im_(im) {}
+  template <typename R>
+  INDEX_MASKS_FUNC complex32(const std::complex<R>& x)
+      : re_((float)x.real()), im_((float)x.imag()) {}
+
+  INDEX_MASKS_FUNC float real() const { return static_cast<float>(re_); }
+  INDEX_MASKS_FUNC float imag() const { return static_cast<float>(im_); }
+
+ private:
+  Eigen::half re_, im_;
+};
+
+static_assert(sizeof(complex32) == 2 * sizeof(Eigen::half),
+              "complex32 should be a pair of half precision numbers.");
+
+// Products of half precision amplitudes in single precision
+INDEX_MASKS_FUNC complex64 cmult(const complex32& a, const complex32& b) {
+  return complex64(a.real() * b.real() - a.imag() * b.imag(),
+                   a.real() * b.imag() + a.imag() * b.real());
+}
+
+// Element type of the tensors that hold states of type ``T`` and number of
+// elements of each amplitude.
+template <typename T>
+struct StateTensorType {
+  typedef T type;
+  static const int ncomponents = 1;
+};
+
+template <>
+struct StateTensorType<complex32> {
+  typedef Eigen::half type;
+  static const int ncomponents = 2;
+};
+
+template <typename T>
+T* StateData(Tensor& tensor) {
+  typedef typename StateTensorType<T>::type type;
+  return reinterpret_cast<T*>(tensor.flat<type>().data());
+}
+
+template <typename T>
+const T* StateData(const Tensor& tensor) {
+  typedef typename StateTensorType<T>::type type;
+  return reinterpret_cast<const T*>(tensor.flat<type>().data());
+}
+
+// Number of amplitudes of ``tensor``.
+template <typename T>
+int64 StateSize(const Tensor& tensor) {
+  return tensor.NumElements() / StateTensorType<T>::ncomponents;
+}
+
+// Shape of the tensor that holds amplitudes of the given ``shape``.
+template <typename T>
+TensorShape StateShape(TensorShape shape) {
+  if (StateTensorType<T>::ncomponents > 1) {
+    shape.AddDim(StateTensorType<T>::ncomponents);
+  }
+  return shape;
+}
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_COMPLEX_HALF_H_
@@ -0,0 +1,202 @@
+/************************************************
+ * Gate kernels for density matrices.
+ *
+ * A density matrix \f$\rho\f$ of \f$n\f$ qubits is stored as a flat array
+ * of \f$4^n\f$ elements, where the bits of the row index are above the bits
+ * of the column index. A gate updates \f$\rho \to U \rho U^\dagger\f$, which
+ * mixes the \f$4^t\f$ elements that share all bits except the row and column
+ * bits of the \f$t\f$ target qubits. @struct DensityMatrixGateFunctor
+ * updates each such group in a single pass over the matrix, instead of
+ * applying \f$U\f$ and \f$U^*\f$ in two passes over the flattened vector of
+ * \f$2n\f$ qubits. The following gates are supported (@enum DensityMatrixGate):
+ *    - ``DM_MATRIX``: gate given by its \f$2^t \times 2^t\f$ matrix.
+ *    - ``DM_DIAGONAL``: gate given by its \f$2^t\f$ diagonal elements, so
+ *      that each element of \f$\rho\f$ is multiplied by a single phase.
+ *    - ``DM_SWAP``: SWAP gate, which permutes the rows and the columns.
+ *    - ``DM_KRAUS``: channel \f$\sum_k K_k \rho K_k^\dagger\f$, where the
+ *      ``nops`` Kraus operators act on the same targets and are given by
+ *      their matrices. The sum is accumulated in a local buffer so that the
+ *      channel also costs a single pass.
+ * Gates act on one or two targets (``DM_SWAP`` on two) and can be
+ * controlled: the matrix is applied from the left to the rows whose control
+ * bits are all one and its adjoint from the right to such columns, which is
+ * the action of the controlled unitary on both sides of \f$\rho\f$.
+ * Channels do not support controls.
+ *
+ * @struct DensityMatrixMasks holds the masks that insert the target bits
+ * and the offsets of the elements of each group. The helpers of this header
+ * are shared by the CPU and GPU kernels.
+ ***********************************************/
+#ifndef KERNEL_DENSITY_MATRIX_H_
+#define KERNEL_DENSITY_MATRIX_H_
+
+#include <algorithm>
+#include "index_masks.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+// Maximum number of targets of the density matrix kernels
+#define DM_MAX_TARGETS 2
+
+namespace tensorflow {
+
+namespace functor {
+
+enum DensityMatrixGate { DM_MATRIX = 0, DM_DIAGONAL, DM_SWAP, DM_KRAUS };
+
+struct DensityMatrixMasks {
+  IndexMasks masks;  //!< Inserts the row and column bits of the targets.
+  int64_t rowoffsets[1 << DM_MAX_TARGETS];  //!< Row bits of each value.
+  int64_t coloffsets[1 << DM_MAX_TARGETS];  //!< Column bits of each value.
+  int64_t rowcontrols;  //!< Row bits of the controls.
+  int64_t colcontrols;  //!< Column bits of the controls.
+
+  /// \param nqubits Number of qubits of the density matrix.
+  /// \param ntargets Number of target qubits.
+  /// \param targets Target qubit ids, the first is the most significant bit
+  ///                of the gate matrix.
+  /// \param ncontrols Number of control qubits.
+  /// \param controls Bit positions of the controls, ``nqubits - q - 1``.
+  DensityMatrixMasks(int nqubits, int ntargets, const int32_t* targets,
+                     int ncontrols, const int32_t* controls)
+      : rowcontrols(0), colcontrols(0) {
+    int32_t qubits[2 * DM_MAX_TARGETS];
+    for (int it = 0; it < ntargets; it++) {
+      const int m = nqubits - targets[it] - 1;
+      qubits[2 * it] = m;
+      qubits[2 * it + 1] = m + nqubits;
+    }
+    std::sort(qubits, qubits + 2 * ntargets);
+    masks = IndexMasks(2 * nqubits, 2 * ntargets, qubits);
+    for (int a = 0; a < (1 << ntargets); a++) {
+      rowoffsets[a] = coloffsets[a] = 0;
+      for (int it = 0; it < ntargets; it++) {
+        if ((a >> (ntargets - it - 1)) & 1) {
+          const int m = nqubits - targets[it] - 1;
+          coloffsets[a] |= (int64_t)1 << m;
+          rowoffsets[a] |= (int64_t)1 << (m + nqubits);
+        }
+      }
+    }
+    for (int ic = 0; ic < ncontrols; ic++) {
+      colcontrols |= (int64_t)1 << controls[ic];
+      rowcontrols |= (int64_t)1 << (controls[ic] + nqubits);
+    }
+  }
+};
+
+// ``a * b`` and ``a * conj(b)`` without the complex operators, which are
+// not available in device code
+template <typename T>
+INDEX_MASKS_FUNC T DensityMatrixMul(const T& a, const T& b) {
+  return T(a.real() * b.real() - a.imag() * b.imag(),
+           a.real() * b.imag() + a.imag() * b.real());
+}
+
+template <typename T>
+INDEX_MASKS_FUNC T DensityMatrixMulConj(const T& a, const T& b) {
+  return T(a.real() * b.real() + a.imag() * b.imag(),
+           a.imag() * b.real() - a.real() * b.imag());
+}
+
+// ``y = u x u^dagger`` for ``NS x NS`` matrices, where only the rows
+// (``left``) or the columns (``right``) may be transformed.
+template <int NS, typename T>
+INDEX_MASKS_FUNC void DensityMatrixConjugate(const T* u, const T* x, T* y,
+                                             bool left, bool right) {
+  T ux[NS * NS];
+  for (int a = 0; a < NS; a++) {
+    for (int b = 0; b < NS; b++) {
+      if (left) {
+        T s(0, 0);
+        for (int c = 0; c < NS; c++) {
+          const T p = DensityMatrixMul(u[a * NS + c], x[c * NS + b]);
+          s = T(s.real() + p.real(), s.imag() + p.imag());
+        }
+        ux[a * NS + b] = s;
+      } else {
+        ux[a * NS + b] = x[a * NS + b];
+      }
+    }
+  }
+  for (int a = 0; a < NS; a++) {
+    for (int b = 0; b < NS; b++) {
+      if (right) {
+        T s(0, 0);
+        for (int d = 0; d < NS; d++) {
+          const T p = DensityMatrixMulConj(ux[a * NS + d], u[b * NS + d]);
+          s = T(s.real() + p.real(), s.imag() + p.imag());
+        }
+        y[a * NS + b] = s;
+      } else {
+        y[a * NS + b] = ux[a * NS + b];
+      }
+    }
+  }
+}
+
+// Updates the group ``g`` of ``2 ** NT x 2 ** NT`` elements of ``state``.
+template <int Gate, int NT, typename T>
+INDEX_MASKS_FUNC void DensityMatrixUpdate(T* state, int64_t g,
+                                          const DensityMatrixMasks& m,
+                                          const T* gate, int nops) {
+  const int NS = 1 << NT;
+  const int64_t i = m.masks.insert(g);
+  const bool left = (i & m.rowcontrols) == m.rowcontrols;
+  const bool right = (i & m.colcontrols) == m.colcontrols;
+  if (Gate == DM_DIAGONAL) {
+    for (int a = 0; a < NS; a++) {
+      for (int b = 0; b < NS; b++) {
+        T& x = state[i + m.rowoffsets[a] + m.coloffsets[b]];
+        if (left) x = DensityMatrixMul(gate[a], x);
+        if (right) x = DensityMatrixMulConj(x, gate[b]);
+      }
+    }
+    return;
+  }
+
+  T x[NS * NS], y[NS * NS];
+  for (int a = 0; a < NS; a++) {
+    for (int b = 0; b < NS; b++) {
+      x[a * NS + b] = state[i + m.rowoffsets[a] + m.coloffsets[b]];
+    }
+  }
+  if (Gate == DM_SWAP) {
+    // the swap exchanges the values 01 and 10 of the two targets
+    for (int a = 0; a < NS; a++) {
+      for (int b = 0; b < NS; b++) {
+        const int sa = left && (a == 1 || a == 2) ? 3 - a : a;
+        const int sb = right && (b == 1 || b == 2) ? 3 - b : b;
+        y[a * NS + b] = x[sa * NS + sb];
+      }
+    }
+  } else if (Gate == DM_KRAUS) {
+    T z[NS * NS];
+    for (int a = 0; a < NS * NS; a++) y[a] = T(0, 0);
+    for (int k = 0; k < nops; k++) {
+      DensityMatrixConjugate<NS>(gate + k * NS * NS, x, z, true, true);
+      for (int a = 0; a < NS * NS; a++) {
+        y[a] = T(y[a].real() + z[a].real(), y[a].imag() + z[a].imag());
+      }
+    }
+  } else {
+    DensityMatrixConjugate<NS>(gate, x, y, left, right);
+  }
+  for (int a = 0; a < NS; a++) {
+    for (int b = 0; b < NS; b++) {
+      state[i + m.rowoffsets[a] + m.coloffsets[b]] = y[a * NS + b];
+    }
+  }
+}
+
+template <typename Device, typename T, int Gate>
+struct DensityMatrixGateFunctor {
+  void operator()(const Device& d, T* state, int nqubits, int ntargets,
+                  const int32* targets, int ncontrols, const int32* controls,
+                  const T* gate, int nops = 1) const;
+};
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_DENSITY_MATRIX_H_
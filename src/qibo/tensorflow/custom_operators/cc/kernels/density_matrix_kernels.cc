@@ -0,0 +1,154 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+#endif  // GOOGLE_CUDA
+
+#include "density_matrix.h"
+#include "forward_state.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+typedef Eigen::ThreadPoolDevice CPUDevice;
+typedef Eigen::GpuDevice GPUDevice;
+
+namespace functor {
+
+template <typename T, int Gate, int NT>
+void ApplyDensityMatrixGate(T* state, int nqubits,
+                            const DensityMatrixMasks& masks, const T* gate,
+                            int nops) {
+  const int64 ngroups = (int64)1 << (2 * (nqubits - NT));
+  #pragma omp parallel for
+  for (int64 g = 0; g < ngroups; g++) {
+    DensityMatrixUpdate<Gate, NT>(state, g, masks, gate, nops);
+  }
+}
+
+// CPU specialization
+template <typename T, int Gate>
+struct DensityMatrixGateFunctor<CPUDevice, T, Gate> {
+  void operator()(const CPUDevice& d, T* state, int nqubits, int ntargets,
+                  const int32* targets, int ncontrols, const int32* controls,
+                  const T* gate, int nops = 1) const {
+    const DensityMatrixMasks masks(nqubits, ntargets, targets, ncontrols,
+                                   controls);
+    if (ntargets == 1) {
+      ApplyDensityMatrixGate<T, Gate, 1>(state, nqubits, masks, gate, nops);
+    } else {
+      ApplyDensityMatrixGate<T, Gate, 2>(state, nqubits, masks, gate, nops);
+    }
+  }
+};
+
+template <typename Device, typename T, int Gate>
+class DensityMatrixGateOp : public OpKernel {
+ public:
+  explicit DensityMatrixGateOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("targets", &targets_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    const int ntargets = targets_.size();
+    OP_REQUIRES(context, ntargets >= 1 && ntargets <= DM_MAX_TARGETS,
+                errors::InvalidArgument("Density matrix gates support one "
+                                        "or two target qubits."));
+    OP_REQUIRES(context, Gate != DM_SWAP || ntargets == 2,
+                errors::InvalidArgument("SWAP acts on two target qubits."));
+    for (int32 t : targets_) {
+      OP_REQUIRES(context, t >= 0 && t < nqubits_,
+                  errors::InvalidArgument("Invalid target qubit."));
+    }
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    OP_REQUIRES(context, state.NumElements() == (int64)1 << (2 * nqubits_),
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
+    const int ntargets = targets_.size();
+    const int64 ns = (int64)1 << ntargets;
+
+    // gate matrix, diagonal or Kraus operators (the swap has no input)
+    const T* gate = NULL;
+    int nops = 1;
+    if (Gate != DM_SWAP) {
+      const Tensor& gate_tensor = context->input(1);
+      const int64 size = Gate == DM_DIAGONAL ? ns : ns * ns;
+      OP_REQUIRES(context, gate_tensor.NumElements() > 0 &&
+                  gate_tensor.NumElements() % size == 0 &&
+                  (Gate == DM_KRAUS || gate_tensor.NumElements() == size),
+                  errors::InvalidArgument("Gate shape does not agree with "
+                                          "the number of targets."));
+      gate = gate_tensor.flat<T>().data();
+      nops = gate_tensor.NumElements() / size;
+    }
+
+    // the controls are the qubits that are not targets
+    std::vector<int32> controls;
+    if (Gate != DM_KRAUS) {
+      const Tensor& qubits = context->input(Gate == DM_SWAP ? 1 : 2);
+      const int32* q = qubits.flat<int32>().data();
+      for (int64 i = 0; i < qubits.NumElements(); i++) {
+        bool target = false;
+        for (int32 t : targets_) target |= q[i] == nqubits_ - t - 1;
+        if (!target) controls.push_back(q[i]);
+      }
+    }
+
+    // call the implementation
+    DensityMatrixGateFunctor<Device, T, Gate>()(
+        context->eigen_device<Device>(), state.flat<T>().data(), nqubits_,
+        ntargets, targets_.data(), controls.size(), controls.data(), gate,
+        nops);
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+  std::vector<int32> targets_;
+};
+
+// Register the CPU kernels.
+#define REGISTER_CPU(T, NAME, GATE)                         \
+  REGISTER_KERNEL_BUILDER(                                  \
+      Name(NAME).Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      DensityMatrixGateOp<CPUDevice, T, GATE>);
+
+#ifdef GOOGLE_CUDA
+// Register the GPU kernels.
+// The qubits are used by the host to compute the index masks.
+#define REGISTER_GPU(T, NAME, GATE)                                         \
+  extern template struct DensityMatrixGateFunctor<GPUDevice, T, GATE>;      \
+  REGISTER_KERNEL_BUILDER(Name(NAME)                                        \
+                              .Device(DEVICE_GPU)                           \
+                              .TypeConstraint<T>("T")                       \
+                              .HostMemory("qubits"),                        \
+                          DensityMatrixGateOp<GPUDevice, T, GATE>);
+#define REGISTER_KRAUS_GPU(T)                                                \
+  extern template struct DensityMatrixGateFunctor<GPUDevice, T, DM_KRAUS>;   \
+  REGISTER_KERNEL_BUILDER(                                                   \
+      Name("ApplyKrausChannel").Device(DEVICE_GPU).TypeConstraint<T>("T"), \
+      DensityMatrixGateOp<GPUDevice, T, DM_KRAUS>);
+#else
+#define REGISTER_GPU(T, NAME, GATE)
+#define REGISTER_KRAUS_GPU(T)
+#endif
+
+#define REGISTER_DENSITY_MATRIX(NAME, GATE) \
+  REGISTER_CPU(complex64, NAME, GATE);      \
+  REGISTER_CPU(complex128, NAME, GATE);     \
+  REGISTER_GPU(complex64, NAME, GATE);      \
+  REGISTER_GPU(complex128, NAME, GATE);
+
+REGISTER_DENSITY_MATRIX("ApplyDensityMatrixGate", DM_MATRIX);
+REGISTER_DENSITY_MATRIX("ApplyDensityMatrixDiagonalGate", DM_DIAGONAL);
+REGISTER_DENSITY_MATRIX("ApplyDensityMatrixSwap", DM_SWAP);
+REGISTER_CPU(complex64, "ApplyKrausChannel", DM_KRAUS);
+REGISTER_CPU(complex128, "ApplyKrausChannel", DM_KRAUS);
+REGISTER_KRAUS_GPU(complex64);
+REGISTER_KRAUS_GPU(complex128);
+}  // namespace functor
+}  // namespace tensorflow
@@ -0,0 +1,54 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+
+#include "density_matrix.h"
+#include "gpu_launch.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+namespace functor {
+
+typedef Eigen::GpuDevice GPUDevice;
+
+// cuda kernel
+template <typename T, int Gate, int NT>
+__global__ void DensityMatrixGateKernel(long ngroups, T* state,
+                                        const DensityMatrixMasks masks,
+                                        const T* gate, int nops) {
+  GPU_GRID_STRIDE_LOOP(g, ngroups) {
+    DensityMatrixUpdate<Gate, NT>(state, g, masks, gate, nops);
+  }
+}
+
+// Define the GPU implementation that launches the CUDA kernel.
+template <typename T, int Gate>
+struct DensityMatrixGateFunctor<GPUDevice, T, Gate> {
+  void operator()(const GPUDevice& d, T* state, int nqubits, int ntargets,
+                  const int32* targets, int ncontrols, const int32* controls,
+                  const T* gate, int nops = 1) const {
+    // the masks are computed on the host and passed by value
+    const DensityMatrixMasks masks(nqubits, ntargets, targets, ncontrols,
+                                   controls);
+    const int64 ngroups = (int64)1 << (2 * (nqubits - ntargets));
+    if (ntargets == 1) {
+      LaunchKernel(DensityMatrixGateKernel<T, Gate, 1>, d, ngroups, state,
+                   masks, gate, nops);
+    } else {
+      LaunchKernel(DensityMatrixGateKernel<T, Gate, 2>, d, ngroups, state,
+                   masks, gate, nops);
+    }
+  }
+};
+
+// Explicitly instantiate functors for the types of OpKernels registered.
+#define INSTANTIATE(GATE)                                              \
+  template struct DensityMatrixGateFunctor<GPUDevice, complex64, GATE>; \
+  template struct DensityMatrixGateFunctor<GPUDevice, complex128, GATE>;
+
+INSTANTIATE(DM_MATRIX)
+INSTANTIATE(DM_DIAGONAL)
+INSTANTIATE(DM_SWAP)
+INSTANTIATE(DM_KRAUS)
+}  // end namespace functor
+}  // end namespace tensorflow
+#endif  // GOOGLE_CUDA
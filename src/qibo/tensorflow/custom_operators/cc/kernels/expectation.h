@@ -0,0 +1,59 @@
+/************************************************
+ * Functors that calculate expectation values of Pauli strings.
+ *
+ *    - @struct PauliExpectationFunctor
+ *        Calculates \f$\left <\psi |P_k|\psi \right >\f$ for a group of
+ *        Pauli strings \f$P_k\f$ that flip the same qubits, using a single
+ *        read-only pass over the state.
+ *
+ * A Pauli string maps each basis state to another basis state and a phase,
+ * \f$P|i\rangle = i^{n_y}(-1)^{|i \wedge z|}|i \oplus x\rangle\f$, where
+ * \f$x\f$ holds the bits of the qubits with X or Y, \f$z\f$ the bits of the
+ * qubits with Y or Z and \f$n_y\f$ is the number of Y. This is the same
+ * bit-flip and phase structure used by @struct ApplyXFunctor and
+ * @struct ApplyZFunctor. Strings with the same \f$x\f$ read the same pairs
+ * of amplitudes \f$(i, i \oplus x)\f$, which are generated using
+ * @struct IndexMasks with the most significant bit of \f$x\f$ set to zero,
+ * so they are grouped and evaluated in the same pass. Each pair contributes
+ * twice the real (even \f$n_y\f$) or imaginary (odd \f$n_y\f$) part of
+ * \f$\psi_{i \oplus x}^*\psi_i\f$ with the sign of \f$i \wedge z\f$.
+ * Strings without flips (\f$x = 0\f$) are diagonal and are evaluated from
+ * the probabilities of all amplitudes.
+ *
+ * @struct PauliGroup holds up to @def PAULI_GROUP_SIZE strings so that it
+ * can be passed by value to CUDA kernels. Larger groups are split.
+ ***********************************************/
+#ifndef KERNEL_EXPECTATION_H_
+#define KERNEL_EXPECTATION_H_
+
+#include "index_masks.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+// Maximum number of Pauli strings evaluated in the same pass
+#define PAULI_GROUP_SIZE 16
+
+namespace tensorflow {
+
+namespace functor {
+
+struct PauliGroup {
+  int nterms;                           //!< Number of strings in the group.
+  int64_t xmask;                        //!< Bits flipped by all strings.
+  int32_t xbit;                         //!< Most significant bit of xmask.
+  int64_t zmasks[PAULI_GROUP_SIZE];     //!< Phase bits of each string.
+  int32_t imag[PAULI_GROUP_SIZE];       //!< Odd number of Y in the string.
+  int32_t sign[PAULI_GROUP_SIZE];       //!< Sign of the global phase.
+  int32_t terms[PAULI_GROUP_SIZE];      //!< Index of each string in output.
+};
+
+template <typename Device, typename T, typename NormType>
+struct PauliExpectationFunctor {
+  void operator()(OpKernelContext* context, const Device& d, const T* state,
+                  int nqubits, const PauliGroup& group, NormType* out) const;
+};
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_EXPECTATION_H_
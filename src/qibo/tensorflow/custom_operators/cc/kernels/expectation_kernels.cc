@@ -0,0 +1,164 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+#endif  // GOOGLE_CUDA
+
+#include "expectation.h"
+#include <map>
+#include <vector>
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+typedef Eigen::ThreadPoolDevice CPUDevice;
+typedef Eigen::GpuDevice GPUDevice;
+
+namespace functor {
+
+inline int Parity(int64 x) { return __builtin_popcountll(x) & 1; }
+
+// CPU specialization
+template <typename T, typename NormType>
+struct PauliExpectationFunctor<CPUDevice, T, NormType> {
+  void operator()(OpKernelContext* context, const CPUDevice& d, const T* state,
+                  int nqubits, const PauliGroup& group, NormType* out) const {
+    const int nterms = group.nterms;
+    std::vector<NormType> sums(nterms, 0);
+    NormType* psums = sums.data();
+    const int64 xmask = group.xmask;
+
+    if (xmask == 0) {
+      const int64 nstates = (int64)1 << nqubits;
+      #pragma omp parallel for reduction(+: psums[:nterms])
+      for (int64 i = 0; i < nstates; i++) {
+        const auto x = state[i];
+        const NormType p = x.real() * x.real() + x.imag() * x.imag();
+        for (int k = 0; k < nterms; k++) {
+          psums[k] += Parity(i & group.zmasks[k]) ? -p : p;
+        }
+      }
+    } else {
+      const int64 npairs = (int64)1 << (nqubits - 1);
+      const IndexMasks masks(nqubits, 1, &group.xbit);
+      #pragma omp parallel for reduction(+: psums[:nterms])
+      for (int64 g = 0; g < npairs; g++) {
+        const int64 i = masks.insert(g);
+        const auto a = state[i];
+        const auto b = state[i ^ xmask];
+        // real and imaginary part of conj(b) * a
+        const NormType re = b.real() * a.real() + b.imag() * a.imag();
+        const NormType im = b.real() * a.imag() - b.imag() * a.real();
+        for (int k = 0; k < nterms; k++) {
+          const NormType v = group.imag[k] ? im : re;
+          psums[k] += Parity(i & group.zmasks[k]) ? -v : v;
+        }
+      }
+    }
+
+    // each pair holds the contributions of both of its amplitudes
+    const NormType factor = xmask == 0 ? 1 : 2;
+    for (int k = 0; k < nterms; k++) {
+      out[group.terms[k]] = factor * group.sign[k] * psums[k];
+    }
+  }
+};
+
+template <typename Device, typename T, typename NormType>
+class PauliExpectationOp : public OpKernel {
+ public:
+  explicit PauliExpectationOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    // grab the input tensor
+    const Tensor& state = context->input(0);
+    const Tensor& paulis = context->input(1);
+    OP_REQUIRES(context, state.NumElements() == (int64)1 << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
+    OP_REQUIRES(context, paulis.dims() == 2 &&
+                         paulis.dim_size(1) == nqubits_,
+                errors::InvalidArgument("Pauli strings must have shape "
+                                        "(nterms, nqubits)."));
+    const int64 nterms = paulis.dim_size(0);
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, TensorShape({nterms}),
+                                                     &output));
+
+    // group the strings that flip the same qubits
+    // (0, 1, 2, 3 stand for I, X, Y, Z and the first qubit is the most
+    // significant bit of the state index)
+    const int32* codes = paulis.flat<int32>().data();
+    std::map<int64, std::vector<PauliGroup>> groups;
+    for (int64 t = 0; t < nterms; t++) {
+      int64 xmask = 0, zmask = 0;
+      int ny = 0;
+      for (int q = 0; q < nqubits_; q++) {
+        const int32 code = codes[t * nqubits_ + q];
+        OP_REQUIRES(context, code >= 0 && code <= 3,
+                    errors::InvalidArgument("Pauli codes must be 0 (I), "
+                                            "1 (X), 2 (Y) or 3 (Z)."));
+        const int64 bit = (int64)1 << (nqubits_ - q - 1);
+        if (code == 1 || code == 2) xmask |= bit;
+        if (code == 2 || code == 3) zmask |= bit;
+        if (code == 2) ny++;
+      }
+      auto& list = groups[xmask];
+      if (list.empty() || list.back().nterms == PAULI_GROUP_SIZE) {
+        PauliGroup group;
+        group.nterms = 0;
+        group.xmask = xmask;
+        group.xbit = xmask == 0 ? 0 : 63 - __builtin_clzll(xmask);
+        list.push_back(group);
+      }
+      PauliGroup& group = list.back();
+      const int k = group.nterms++;
+      group.zmasks[k] = zmask;
+      group.imag[k] = ny % 2;
+      // i^ny for even ny or i^(ny + 1) for odd ny (the imaginary part)
+      group.sign[k] = ((ny + 1) / 2) % 2 ? -1 : 1;
+      group.terms[k] = (int32)t;
+    }
+
+    // call the implementation
+    for (const auto& item : groups) {
+      for (const auto& group : item.second) {
+        PauliExpectationFunctor<Device, T, NormType>()(
+            context, context->eigen_device<Device>(), state.flat<T>().data(),
+            nqubits_, group, output->flat<NormType>().data());
+      }
+    }
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+};
+
+// Register the CPU kernels.
+#define REGISTER_CPU(T, NT)                                          \
+  REGISTER_KERNEL_BUILDER(                                           \
+      Name("PauliExpectation").Device(DEVICE_CPU)                    \
+      .TypeConstraint<T>("T").TypeConstraint<NT>("Tout"),            \
+      PauliExpectationOp<CPUDevice, T, NT>);
+REGISTER_CPU(complex64, float);
+REGISTER_CPU(complex128, double);
+
+#ifdef GOOGLE_CUDA
+// Register the GPU kernels.
+// The Pauli strings are grouped by the host.
+#define REGISTER_GPU(T, NT)                                          \
+  extern template struct PauliExpectationFunctor<GPUDevice, T, NT>; \
+  REGISTER_KERNEL_BUILDER(                                           \
+      Name("PauliExpectation").Device(DEVICE_GPU)                    \
+      .TypeConstraint<T>("T").TypeConstraint<NT>("Tout")             \
+      .HostMemory("paulis"),                                         \
+      PauliExpectationOp<GPUDevice, T, NT>);
+REGISTER_GPU(complex64, float);
+REGISTER_GPU(complex128, double);
+#endif
+}  // namespace functor
+}  // namespace tensorflow
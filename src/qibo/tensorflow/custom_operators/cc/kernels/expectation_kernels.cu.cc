@@ -0,0 +1,98 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+
+#include "expectation.h"
+#include "gpu_launch.h"
+#include "state_pool.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+namespace functor {
+
+typedef Eigen::GpuDevice GPUDevice;
+
+// Each block writes the partial sums of all strings of the group.
+template <typename T, typename NormType>
+__global__ void PauliExpectationKernel(long npairs, const T* state,
+                                       NormType* partial, PauliGroup group,
+                                       IndexMasks masks) {
+  NormType sums[PAULI_GROUP_SIZE];
+  for (int k = 0; k < group.nterms; k++) {
+    sums[k] = 0;
+  }
+  GPU_GRID_STRIDE_LOOP(g, npairs) {
+    long i;
+    NormType re, im;
+    if (group.xmask == 0) {
+      i = g;
+      const auto x = state[i];
+      re = x.real() * x.real() + x.imag() * x.imag();
+      im = 0;
+    } else {
+      i = masks.insert(g);
+      const auto a = state[i];
+      const auto b = state[i ^ group.xmask];
+      re = b.real() * a.real() + b.imag() * a.imag();
+      im = b.real() * a.imag() - b.imag() * a.real();
+    }
+    for (int k = 0; k < group.nterms; k++) {
+      const NormType v = group.imag[k] ? im : re;
+      sums[k] += (__popcll(i & group.zmasks[k]) & 1) ? -v : v;
+    }
+  }
+  for (int k = 0; k < group.nterms; k++) {
+    const NormType sum = BlockReduceSum(sums[k]);
+    if (threadIdx.x == 0) {
+      partial[k * gridDim.x + blockIdx.x] = sum;
+    }
+  }
+}
+
+template <typename NormType>
+__global__ void PauliSumPartialsKernel(long nterms, NormType* out,
+                                       const NormType* partial, int nblocks,
+                                       PauliGroup group, NormType factor) {
+  GPU_GRID_STRIDE_LOOP(k, nterms) {
+    NormType sum = 0;
+    for (int j = 0; j < nblocks; j++) {
+      sum += partial[k * nblocks + j];
+    }
+    out[group.terms[k]] = factor * group.sign[k] * sum;
+  }
+}
+
+template <typename T, typename NormType>
+struct PauliExpectationFunctor<GPUDevice, T, NormType> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, const T* state,
+                  int nqubits, const PauliGroup& group, NormType* out) const {
+    const int64 npairs = (int64)1 << (nqubits - (group.xmask != 0));
+    IndexMasks masks;
+    if (group.xmask != 0) {
+      masks = IndexMasks(nqubits, 1, &group.xbit);
+    }
+
+    auto kernel = PauliExpectationKernel<T, NormType>;
+    const LaunchConfig config = GetLaunchConfig(d, kernel, npairs);
+    Tensor tensor_partial;
+    const auto dtype = std::is_same<NormType, double>::value ? DT_DOUBLE
+                                                             : DT_FLOAT;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, dtype, TensorShape({(int64)group.nterms * config.numBlocks}),
+        &tensor_partial));
+    NormType* partial = tensor_partial.flat<NormType>().data();
+
+    kernel<<<config.numBlocks, config.blockSize, 0, d.stream()>>>(
+        (long)npairs, state, partial, group, masks);
+    // each pair holds the contributions of both of its amplitudes
+    const NormType factor = group.xmask == 0 ? 1 : 2;
+    LaunchKernel(PauliSumPartialsKernel<NormType>, d, group.nterms, out,
+                 (const NormType*)partial, config.numBlocks, group, factor);
+  }
+};
+
+// Explicitly instantiate functors for the types of OpKernels registered.
+template struct PauliExpectationFunctor<GPUDevice, complex64, float>;
+template struct PauliExpectationFunctor<GPUDevice, complex128, double>;
+}  // end namespace functor
+}  // end namespace tensorflow
+#endif  // GOOGLE_CUDA
@@ -0,0 +1,66 @@
+#include "forward_state.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+StateBufferCounters& GetStateBufferCounters() {
+  static StateBufferCounters counters{{0}, {0}, {0}, {0}};
+  return counters;
+}
+
+static std::atomic<bool> copy_shared_states(true);
+
+bool CopySharedStates() { return copy_shared_states; }
+
+void SetCopySharedStates(bool copy) { copy_shared_states = copy; }
+
+class StateBufferCountersOp : public OpKernel {
+ public:
+  explicit StateBufferCountersOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("reset", &reset_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, TensorShape({4}),
+                                                     &output));
+    StateBufferCounters& counters = GetStateBufferCounters();
+    std::atomic<int64>* values[4] = {&counters.forwarded, &counters.shared,
+                                     &counters.copies, &counters.copied_bytes};
+    auto out = output->flat<int64>();
+    for (int i = 0; i < 4; i++) {
+      out(i) = reset_ ? values[i]->exchange(0) : values[i]->load();
+    }
+  }
+
+ private:
+  bool reset_;
+};
+
+class SetCopySharedStatesOp : public OpKernel {
+ public:
+  explicit SetCopySharedStatesOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("copy", &copy_));
+  }
+
+  void Compute(OpKernelContext* context) override {
+    SetCopySharedStates(copy_);
+  }
+
+ private:
+  bool copy_;
+};
+
+// The counters and the policy are global so the kernels run on the host.
+REGISTER_KERNEL_BUILDER(Name("StateBufferCounters").Device(DEVICE_CPU),
+                        StateBufferCountersOp);
+REGISTER_KERNEL_BUILDER(Name("SetCopySharedStates").Device(DEVICE_CPU),
+                        SetCopySharedStatesOp);
+
+}  // namespace functor
+
+}  // namespace tensorflow
@@ -0,0 +1,92 @@
+/************************************************
+ * Buffers of the operators that modify their input in-place.
+ *
+ * Gate, collapse, measurement and multi-GPU operators update the buffer of
+ * their state input and return it as their output. @fn ForwardState makes
+ * this explicit: the input is forwarded to the output when the op holds the
+ * only reference to its buffer (for example in compiled graphs where no
+ * other op uses the state). Otherwise the buffer is shared, for example with
+ * the python object of the input state in eager mode, and the behavior
+ * depends on the global policy set with @fn SetCopySharedStates:
+ *    - By default the output is allocated and the input is copied to it, so
+ *      that other holders of the input (for example callbacks or the tape of
+ *      a gradient) see the state before the op.
+ *    - If copies are disabled the shared buffer is still updated in-place,
+ *      so that the state is never duplicated in memory. This is the fast
+ *      path for large states whose input is not used after the op.
+ * Operators that update buffers owned by the caller by design, such as the
+ * ``tf.Variable`` pieces of distributed states, pass ``always_inplace`` so
+ * that the shared buffer is updated regardless of the policy.
+ * @struct StateBufferCounters counts how many times each case happened and
+ * the number of copied bytes, so that unexpected copies of large states can
+ * be detected. The counters and the policy are accessible from python with
+ * the ``StateBufferCounters`` and ``SetCopySharedStates`` operators.
+ ***********************************************/
+#ifndef KERNEL_FORWARD_STATE_H_
+#define KERNEL_FORWARD_STATE_H_
+
+#include <atomic>
+#include "complex_half.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+struct StateBufferCounters {
+  std::atomic<int64> forwarded;     //!< inputs forwarded to the output
+  std::atomic<int64> shared;        //!< shared inputs updated in-place
+  std::atomic<int64> copies;        //!< shared inputs copied to the output
+  std::atomic<int64> copied_bytes;  //!< total bytes of the copies
+};
+
+// Counters of all in-place operators (defined in forward_state.cc).
+StateBufferCounters& GetStateBufferCounters();
+
+// Policy for shared buffers (defined in forward_state.cc).
+bool CopySharedStates();
+void SetCopySharedStates(bool copy);
+
+// Sets ``state`` to the tensor that the op should update in-place and
+// return as output ``output_index``: the forwarded input ``input_index``,
+// a copy of it or the shared input itself (see above).
+template <typename Device, typename T>
+Status ForwardState(OpKernelContext* context, int input_index,
+                    int output_index, Tensor* state,
+                    bool always_inplace = false) {
+  const Tensor& input = context->input(input_index);
+  StateBufferCounters& counters = GetStateBufferCounters();
+  Tensor* output = nullptr;
+  if (!always_inplace && CopySharedStates()) {
+    int forwarded = -1;
+    Status status = context->forward_input_or_allocate_output(
+        {input_index}, output_index, input.shape(), &output, &forwarded);
+    if (!status.ok()) return status;
+    if (forwarded < 0) {
+      context->eigen_device<Device>().memcpy(
+          StateData<T>(*output), StateData<T>(input),
+          input.TotalBytes());
+      counters.copies++;
+      counters.copied_bytes += input.TotalBytes();
+    } else {
+      counters.forwarded++;
+    }
+    *state = *output;
+  } else if (context->forward_input_to_output_with_shape(
+                 input_index, output_index, input.shape(), &output)) {
+    counters.forwarded++;
+    *state = *output;
+  } else {
+    // no allocation so that the state is not duplicated
+    counters.shared++;
+    context->set_output(output_index, input);
+    *state = input;
+  }
+  return Status::OK();
+}
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_FORWARD_STATE_H_
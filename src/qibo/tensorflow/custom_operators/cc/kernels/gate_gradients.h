@@ -0,0 +1,154 @@
+/************************************************
+ * Adjoint differentiation of the gate kernels.
+ *
+ * The gradient of a gate \f$|\psi'\rangle = U|\psi\rangle\f$ is computed
+ * from the gradient \f$|\lambda\rangle\f$ of the loss with respect to the
+ * state after the gate:
+ *    - The gradient is propagated to the state before the gate,
+ *      \f$U^\dagger|\lambda\rangle\f$.
+ *    - The gradient of each gate element that is an input of the op is
+ *      accumulated as \f$\sum \lambda_a \psi_b^*\f$ over all groups of
+ *      amplitudes that are mixed by the gate, where \f$a, b\f$ are the
+ *      positions of the element in the matrix of the gate.
+ * The state \f$|\psi\rangle\f$ before the gate is obtained in one of two
+ * ways, selected by the ``undo`` attribute of the gradient ops:
+ *    - By default shared states are copied by the gate ops (see
+ *      forward_state.h), so the state before the gate is the input of the
+ *      gate, which the tape already holds. It is read without modification
+ *      and \f$U\f$ does not need to be unitary. The memory of the backward
+ *      pass is that of the tape, one state vector per gate.
+ *    - If shared states are updated in-place, all gates of a circuit share
+ *      one buffer. The state before the gate is then rebuilt as
+ *      \f$|\psi\rangle = U^\dagger|\psi'\rangle\f$ in that buffer, which
+ *      requires \f$U\f$ to be unitary and adds the rounding of one gate per
+ *      gate to the rebuilt states. The backward pass restores the initial
+ *      state in the buffer of the final state, so that its memory is two
+ *      state vectors independently of the number of gates. This is the path
+ *      that gives the memory savings of adjoint differentiation.
+ *
+ * The helpers of this header are shared by the CPU and GPU kernels. Each
+ * gate that supports gradients is described by @struct GradientGateTraits,
+ * which gives the number of amplitudes that it mixes (2 or 4) and the
+ * number of elements of its ``gate`` input. The ZPow gate has a single
+ * element (the phase) and fSim has five (the 2x2 block and the phase, see
+ * ApplyFsimFunctor), so that the matrix on the mixed amplitudes is built
+ * from the elements using @fn GradientElement.
+ ***********************************************/
+#ifndef KERNEL_GATE_GRADIENTS_H_
+#define KERNEL_GATE_GRADIENTS_H_
+
+#include "index_masks.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+// Gates whose ops have gradient kernels
+enum GradientGate {
+  GRADIENT_GATE = 0,  // one-qubit gate given by its matrix
+  GRADIENT_ZPOW,
+  GRADIENT_TWO_QUBIT_GATE,  // two-qubit gate given by its matrix
+  GRADIENT_FSIM
+};
+
+template <int Gate>
+struct GradientGateTraits {
+  static const int ntargets = Gate < GRADIENT_TWO_QUBIT_GATE ? 1 : 2;
+  static const int namplitudes = 1 << ntargets;
+  static const int gatesize = Gate == GRADIENT_GATE             ? 4
+                              : Gate == GRADIENT_ZPOW           ? 1
+                              : Gate == GRADIENT_TWO_QUBIT_GATE ? 16
+                                                                : 5;
+};
+
+// Position ``(a, b)`` of element ``k`` of the ``gate`` input in the matrix
+// of the gate on its mixed amplitudes.
+template <int Gate>
+INDEX_MASKS_FUNC void GradientElement(int k, int& a, int& b) {
+  const int n = GradientGateTraits<Gate>::namplitudes;
+  if (Gate == GRADIENT_ZPOW) {
+    a = b = 1;
+  } else if (Gate == GRADIENT_FSIM) {
+    a = k < 4 ? 1 + (k >> 1) : 3;
+    b = k < 4 ? 1 + (k & 1) : 3;
+  } else {
+    a = k / n;
+    b = k % n;
+  }
+}
+
+// Matrix of the gate on its mixed amplitudes (row-major).
+template <int Gate, typename T>
+INDEX_MASKS_FUNC void GradientMatrix(const T* gate, T* u) {
+  typedef GradientGateTraits<Gate> traits;
+  const int n = traits::namplitudes;
+  for (int a = 0; a < n * n; a++) {
+    u[a] = T(a % (n + 1) == 0 ? 1 : 0, 0);
+  }
+  for (int k = 0; k < traits::gatesize; k++) {
+    int a, b;
+    GradientElement<Gate>(k, a, b);
+    u[a * n + b] = gate[k];
+  }
+}
+
+// Element ``a`` of ``U^dagger x``, which is the sum of ``conj(u[b, a]) x[b]``.
+template <int Gate, typename T>
+INDEX_MASKS_FUNC T AdjointElement(const T* u, const T* x, int a) {
+  const int n = GradientGateTraits<Gate>::namplitudes;
+  T y(0, 0);
+  for (int b = 0; b < n; b++) {
+    const T v = u[b * n + a];
+    y = T(y.real() + v.real() * x[b].real() + v.imag() * x[b].imag(),
+          y.imag() + v.real() * x[b].imag() - v.imag() * x[b].real());
+  }
+  return y;
+}
+
+// Propagates the gradient ``grad`` of the amplitudes ``i + offsets[a]`` and
+// adds the gradient of each gate element to ``acc``. If ``undone`` is
+// ``nullptr`` then ``state`` holds the state before the gate, otherwise it
+// holds the state after the gate and the gate is undone in ``undone``, which
+// is the same buffer.
+template <int Gate, typename T>
+INDEX_MASKS_FUNC void GradientUpdate(const T* state, T* undone, T* grad,
+                                     int64_t i, const int64_t* offsets,
+                                     const T* u, T* acc) {
+  typedef GradientGateTraits<Gate> traits;
+  const int n = traits::namplitudes;
+  T psi[n], lam[n];
+  for (int a = 0; a < n; a++) {
+    psi[a] = state[i + offsets[a]];
+    lam[a] = grad[i + offsets[a]];
+  }
+  if (undone != nullptr) {
+    T before[n];
+    for (int a = 0; a < n; a++) {
+      before[a] = AdjointElement<Gate>(u, psi, a);
+      undone[i + offsets[a]] = before[a];
+    }
+    for (int a = 0; a < n; a++) {
+      psi[a] = before[a];
+    }
+  }
+  for (int a = 0; a < n; a++) {
+    grad[i + offsets[a]] = AdjointElement<Gate>(u, lam, a);
+  }
+  for (int k = 0; k < traits::gatesize; k++) {
+    int a, b;
+    GradientElement<Gate>(k, a, b);
+    // the gradient of ``u[a, b]`` is ``lambda'[a] conj(psi[b])`` where
+    // ``lambda'`` is the gradient after the gate and ``psi`` the state
+    // before the gate
+    const T l = lam[a];
+    const T p = psi[b];
+    acc[k] = T(acc[k].real() + l.real() * p.real() + l.imag() * p.imag(),
+               acc[k].imag() + l.imag() * p.real() - l.real() * p.imag());
+  }
+}
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_GATE_GRADIENTS_H_
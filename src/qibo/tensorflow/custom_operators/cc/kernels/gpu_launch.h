@@ -0,0 +1,128 @@
+/************************************************
+ * Launch configuration shared by the GPU kernels.
+ *
+ * Kernels that are launched with @fn LaunchKernel receive the number of
+ * work items (for example amplitude pairs) as their first argument and
+ * iterate over them using @def GPU_GRID_STRIDE_LOOP, so that they can be
+ * launched with any number of blocks:
+ *    - The block size of each kernel is the one that maximizes its
+ *      occupancy, as given by ``cudaOccupancyMaxPotentialBlockSize``. It is
+ *      computed once per kernel and cached.
+ *    - The number of blocks is chosen such that each thread processes at
+ *      least @def DEFAULT_ELEMENTS_PER_THREAD items and does not exceed the
+ *      number of blocks that can be resident on the device at the same
+ *      time, so that large states never hit the grid size limits.
+ *    - All indices are 64-bit.
+ *
+ * Kernels that reduce values over the threads of a block use
+ * @fn BlockReduceSum, which sums within each warp using shuffles and then
+ * over the warps of the block, so that it works for any block size that is
+ * a multiple of the warp size (as the ones given by the occupancy API).
+ *
+ * This header should only be included by CUDA translation units.
+ ***********************************************/
+#ifndef KERNEL_GPU_LAUNCH_H_
+#define KERNEL_GPU_LAUNCH_H_
+
+#if GOOGLE_CUDA
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#include "tensorflow/core/framework/op_kernel.h"
+
+#define DEFAULT_BLOCK_SIZE 1024  // default number of threads
+#define DEFAULT_ELEMENTS_PER_THREAD 4  // minimum work items per thread
+
+// Loop over ``n`` work items distributed over all threads of the grid.
+#define GPU_GRID_STRIDE_LOOP(i, n)                                   \
+  for (long i = (long)blockIdx.x * blockDim.x + threadIdx.x; i < (n); \
+       i += (long)blockDim.x * gridDim.x)
+
+namespace tensorflow {
+
+namespace functor {
+
+struct LaunchConfig {
+  int numBlocks;
+  int blockSize;
+};
+
+// Block size that maximizes the occupancy of ``kernel`` (cached per kernel).
+template <typename Kernel>
+int KernelBlockSize(Kernel kernel) {
+  static std::mutex mutex;
+  static std::unordered_map<const void*, int> block_sizes;
+  std::lock_guard<std::mutex> lock(mutex);
+  const void* key = (const void*)kernel;
+  auto it = block_sizes.find(key);
+  if (it != block_sizes.end()) {
+    return it->second;
+  }
+  int minGridSize = 0, blockSize = DEFAULT_BLOCK_SIZE;
+  if (cudaOccupancyMaxPotentialBlockSize(&minGridSize, &blockSize, kernel) !=
+      cudaSuccess) {
+    blockSize = DEFAULT_BLOCK_SIZE;
+  }
+  block_sizes[key] = blockSize;
+  return blockSize;
+}
+
+// Launch configuration of ``kernel`` for ``nelements`` work items.
+template <typename Kernel>
+LaunchConfig GetLaunchConfig(const Eigen::GpuDevice& d, Kernel kernel,
+                             int64 nelements) {
+  LaunchConfig config;
+  config.blockSize = KernelBlockSize(kernel);
+  const int64 nthreads =
+      (nelements + DEFAULT_ELEMENTS_PER_THREAD - 1) /
+      DEFAULT_ELEMENTS_PER_THREAD;
+  const int64 maxBlocks = (int64)d.getNumGpuMultiProcessors() *
+                          (d.maxGpuThreadsPerMultiProcessor() /
+                           config.blockSize);
+  const int64 numBlocks = (nthreads + config.blockSize - 1) / config.blockSize;
+  config.numBlocks = (int)std::max((int64)1, std::min(numBlocks, maxBlocks));
+  return config;
+}
+
+// Sum of ``value`` over all threads of the block. The result is valid in
+// the first thread. Must be called by all threads of the block.
+template <typename T>
+__device__ T BlockReduceSum(T value) {
+  __shared__ T warpsums[DEFAULT_BLOCK_SIZE / 32];
+  const int lane = threadIdx.x % warpSize;
+  const int warp = threadIdx.x / warpSize;
+  for (int offset = warpSize / 2; offset > 0; offset >>= 1) {
+    value += __shfl_down_sync(0xffffffff, value, offset);
+  }
+  if (lane == 0) warpsums[warp] = value;
+  __syncthreads();
+  const int nwarps = (blockDim.x + warpSize - 1) / warpSize;
+  value = (int)threadIdx.x < nwarps ? warpsums[threadIdx.x] : T(0);
+  if (warp == 0) {
+    for (int offset = warpSize / 2; offset > 0; offset >>= 1) {
+      value += __shfl_down_sync(0xffffffff, value, offset);
+    }
+  }
+  // the shared sums can be reused by the next call
+  __syncthreads();
+  return value;
+}
+
+// Launches ``kernel`` on the stream of ``d`` for ``nelements`` work items.
+// The number of items is passed to the kernel as its first argument.
+template <typename... KernelArgs, typename... Args>
+void LaunchKernel(void (*kernel)(long, KernelArgs...),
+                  const Eigen::GpuDevice& d, int64 nelements, Args... args) {
+  const LaunchConfig config = GetLaunchConfig(d, kernel, nelements);
+  kernel<<<config.numBlocks, config.blockSize, 0, d.stream()>>>(
+      (long)nelements, args...);
+}
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // GOOGLE_CUDA
+
+#endif  // KERNEL_GPU_LAUNCH_H_
@@ -0,0 +1,103 @@
+/************************************************
+ * Index generation for kernels that act on a subspace of the state.
+ *
+ * Controlled gates, multi-qubit gates and the collapse gate loop over the
+ * indices of the \f$n_q - n\f$ qubits that they do not act on and insert
+ * the bits of the \f$n\f$ controls and targets at the corresponding
+ * positions of each index. @struct IndexMasks precomputes, once per
+ * operation, the masks that are needed for this insertion so that each
+ * index is generated without iterating over the qubits one by one: the index
+ * is split in the \f$n + 1\f$ segments between the inserted bits, each of
+ * which is shifted independently instead of the dependent chain of
+ * per-qubit insertions.
+ *
+ * The struct has a fixed size so that it can be passed by value to CUDA
+ * kernels, which places it in the constant parameter space of the kernel.
+ ***********************************************/
+#ifndef KERNEL_INDEX_MASKS_H_
+#define KERNEL_INDEX_MASKS_H_
+
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define INDEX_MASKS_FUNC __host__ __device__ inline
+#else
+#define INDEX_MASKS_FUNC inline
+#endif
+
+// Maximum number of qubits supported by the index masks
+#define MAX_INDEX_QUBITS 63
+
+namespace tensorflow {
+
+namespace functor {
+
+// Software version of the ``pdep`` instruction: deposits the lowest bits of
+// ``x`` to the positions of the bits that are set in ``mask``.
+INDEX_MASKS_FUNC int64_t DepositBits(int64_t x, int64_t mask) {
+  int64_t res = 0;
+  for (int64_t bit = 1; mask != 0; bit <<= 1) {
+    if (x & bit) res |= mask & -mask;
+    mask &= mask - 1;
+  }
+  return res;
+}
+
+// Number of index bits that hold the batch index of ``nbatch`` states that
+// are stored one after the other. The masks of batched states are built
+// with this number of additional qubits above the qubits of each state.
+inline int BatchQubits(int64_t nbatch) {
+  int n = 0;
+  while (((int64_t)1 << n) < nbatch) n++;
+  return n;
+}
+
+struct IndexMasks {
+  int nbits;                               //!< Number of inserted bits.
+  int64_t qubitmask;                       //!< Bits of all qubits.
+  int64_t segments[MAX_INDEX_QUBITS + 1];  //!< Index bits of each segment.
+
+  IndexMasks() : nbits(0), qubitmask(0) {}
+
+  /// \param nqubits Total number of qubits in the state.
+  /// \param n Number of qubits whose bits are inserted.
+  /// \param qubits Bit positions of the qubits in increasing order.
+  IndexMasks(int nqubits, int n, const int32_t* qubits)
+      : nbits(n), qubitmask(0) {
+    int low = 0;
+    for (int j = 0; j < n; j++) {
+      const int high = qubits[j] - j;
+      segments[j] = (((int64_t)1 << high) - 1) ^ (((int64_t)1 << low) - 1);
+      qubitmask |= (int64_t)1 << qubits[j];
+      low = high;
+    }
+    const int high = nqubits - n;
+    segments[n] = (((int64_t)1 << high) - 1) ^ (((int64_t)1 << low) - 1);
+  }
+
+  /// Inserts zeros at the positions of the qubits to the index ``g``.
+  INDEX_MASKS_FUNC int64_t insert(int64_t g) const {
+    int64_t i = 0;
+    for (int j = 0; j <= nbits; j++) {
+      i |= (g & segments[j]) << j;
+    }
+    return i;
+  }
+
+  /// Index with the bits of all qubits set (used by controlled gates).
+  INDEX_MASKS_FUNC int64_t controlled(int64_t g) const {
+    return insert(g) | qubitmask;
+  }
+
+  /// Index with the qubit bits given by the bits of ``h`` (the first qubit
+  /// corresponds to the least significant bit of ``h``).
+  INDEX_MASKS_FUNC int64_t substate(int64_t g, int64_t h) const {
+    return insert(g) | DepositBits(h, qubitmask);
+  }
+};
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_INDEX_MASKS_H_
@@ -1,19 +1,50 @@
 #ifndef KERNEL_INITIAL_STATE_H_
 #define KERNEL_INITIAL_STATE_H_
 
+#include "index_masks.h"
 #include "tensorflow/core/framework/op_kernel.h"
 
+#define DEFAULT_ZERO_CHUNK 4096  // elements zeroed by each memset on CPU
+
 namespace tensorflow {
 
 namespace functor {
 
 template <typename Device, typename T>
 struct InitialStateFunctor {
-  void operator()(const Device &d, T *in, int64 size);
+  // ``size`` is the number of elements of each state of the batch and
+  // ``index`` the position of the non-zero element in each state
+  void operator()(const Device &d, T *in, int64 size, int64 nbatch = 1,
+                  int64 index = 0);
+};
+
+// Product of the amplitudes of ``nqubits`` qubits for basis state ``i``,
+// where the first qubit is the most significant bit.
+template <typename T>
+INDEX_MASKS_FUNC T ProductAmplitude(const T *amplitudes, int nqubits,
+                                    int64_t i) {
+  T x(1, 0);
+  for (int q = 0; q < nqubits; q++) {
+    const T a = amplitudes[2 * q + ((i >> (nqubits - q - 1)) & 1)];
+    x = T(x.real() * a.real() - x.imag() * a.imag(),
+          x.real() * a.imag() + x.imag() * a.real());
+  }
+  return x;
+}
+
+// Product state with amplitudes ``amplitudes[2 * q + b]`` for value ``b``
+// of qubit ``q``. The amplitudes are the product of a factor of the high
+// and a factor of the low ``nlow`` qubits, which are tabulated in ``high``
+// and ``low`` (of size ``2 ** (nqubits - nlow)`` and ``2 ** nlow``), so
+// that each amplitude costs a single multiplication.
+template <typename Device, typename T>
+struct ProductStateFunctor {
+  void operator()(const Device &d, const T *amplitudes, T *out, T *high,
+                  T *low, int nqubits, int nlow);
 };
 
 }  // namespace functor
 
 }  // namespace tensorflow
 
-#endif  // KERNEL_TIME_TWO_H_
+#endif  // KERNEL_INITIAL_STATE_H_
@@ -2,7 +2,11 @@
 #define EIGEN_USE_GPU
 #endif  // GOOGLE_CUDA
 
+#include "complex_half.h"
+#include "forward_state.h"
 #include "initial_state.h"
+#include "state_pool.h"
+#include <cstring>
 #include "tensorflow/core/framework/op_kernel.h"
 
 namespace tensorflow {
@@ -15,41 +19,139 @@ namespace functor {
 // CPU specialization
 template <typename T>
 struct InitialStateFunctor<CPUDevice, T> {
-  void operator()(const CPUDevice &d, T *out, int64 size)
+  void operator()(const CPUDevice &d, T *out, int64 size, int64 nbatch = 1,
+                  int64 index = 0)
   {
-    #pragma omp parallel for
-    for (size_t i = 1; i < (size_t) size; i++)
-      out[i] = T(0, 0);
-    out[0] = T(1, 0);
+    // The state is zeroed with the same static partition that the gate
+    // kernels use (contiguous chunks per thread), so that each page is
+    // first touched, and therefore allocated on the NUMA node of the thread
+    // that updates it in the following gates. Each chunk is a single
+    // memset, which uses vector and streaming stores for large chunks.
+    const int64 nelements = nbatch * size;
+    const int64 nchunks = (nelements + DEFAULT_ZERO_CHUNK - 1) /
+                          DEFAULT_ZERO_CHUNK;
+    #pragma omp parallel for schedule(static)
+    for (int64 c = 0; c < nchunks; c++) {
+      const int64 start = c * DEFAULT_ZERO_CHUNK;
+      const int64 n = std::min((int64)DEFAULT_ZERO_CHUNK, nelements - start);
+      std::memset((void *)(out + start), 0, n * sizeof(T));
+    }
+    for (int64 b = 0; b < nbatch; b++)
+      out[b * size + index] = T(1, 0);
   }
 };
 
-template <typename Device, typename T>
+template <typename T>
+struct ProductStateFunctor<CPUDevice, T> {
+  void operator()(const CPUDevice &d, const T *amplitudes, T *out, T *high,
+                  T *low, int nqubits, int nlow) {
+    const int nhigh = nqubits - nlow;
+    const int64 nhighstates = (int64)1 << nhigh;
+    const int64 nlowstates = (int64)1 << nlow;
+    for (int64 i = 0; i < nhighstates; i++)
+      high[i] = ProductAmplitude(amplitudes, nhigh, i);
+    for (int64 i = 0; i < nlowstates; i++)
+      low[i] = ProductAmplitude(amplitudes + 2 * nhigh, nlow, i);
+
+    // same partition as the gate kernels for the first touch of the pages
+    #pragma omp parallel for schedule(static)
+    for (int64 h = 0; h < nhighstates; h++) {
+      const T f = high[h];
+      T *o = out + h * nlowstates;
+      for (int64 l = 0; l < nlowstates; l++) {
+        const T x = low[l];
+        o[l] = T(f.real() * x.real() - f.imag() * x.imag(),
+                 f.real() * x.imag() + f.imag() * x.real());
+      }
+    }
+  }
+};
+
+// ``Basis`` ops set the basis state given by their ``index`` input instead
+// of the zero state.
+template <typename Device, typename T, bool Basis = false>
 class InitialStateOp : public OpKernel {
  public:
   explicit InitialStateOp(OpKernelConstruction *context) : OpKernel(context) {
     OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
     OP_REQUIRES_OK(context, context->GetAttr("is_matrix", &is_matrix_));
     OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    OP_REQUIRES_OK(context, context->GetAttr("nbatch", &nbatch_));
     OP_REQUIRES(context, nqubits_ > 0, errors::InvalidArgument("nqubits must be positive"));
+    OP_REQUIRES(context, nbatch_ >= 0, errors::InvalidArgument("nbatch must be non-negative"));
     omp_set_num_threads(threads_);
   }
 
   void Compute(OpKernelContext *context) override {
-    // grabe the input tensor
     const int64 size = pow(2, nqubits_);
 
     TensorShape shape{size};
     if (is_matrix_)
       shape = TensorShape{size, size};
+    // batched states have an additional leading dimension
+    if (nbatch_ > 0)
+      shape.InsertDim(0, nbatch_);
+
+    int64 index = 0;
+    if (Basis) {
+      const Tensor& index_tensor = context->input(0);
+      OP_REQUIRES(context, index_tensor.NumElements() == 1,
+                  errors::InvalidArgument("Basis state index should be a "
+                                          "scalar."));
+      index = index_tensor.flat<int64>()(0);
+      OP_REQUIRES(context, index >= 0 && index < size,
+                  errors::InvalidArgument("Basis state index out of range."));
+      // diagonal element of density matrices
+      if (is_matrix_) index *= size + 1;
+    }
+
+    // the state is not pooled so that the first gate can forward it
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, StateShape<T>(shape),
+                                                     &output));
+    if (std::is_same<Device, CPUDevice>::value) AdviseHugePages(*output);
+    Tensor& output_tensor = *output;
+
+    // call the implementation
+    const int64 nbatch = std::max(nbatch_, 1);
+    InitialStateFunctor<Device, T>()(context->eigen_device<Device>(),
+                                     StateData<T>(output_tensor),
+                                     StateSize<T>(output_tensor) / nbatch,
+                                     nbatch, index);
+  }
+
+ private:
+  int nqubits_;
+  bool is_matrix_;
+  int threads_;
+  int nbatch_;
+};
+
+template <typename Device, typename T>
+class ResetStateOp : public OpKernel {
+ public:
+  explicit ResetStateOp(OpKernelConstruction *context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("is_matrix", &is_matrix_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    OP_REQUIRES(context, nqubits_ > 0, errors::InvalidArgument("nqubits must be positive"));
+    omp_set_num_threads(threads_);
+  }
 
-    Tensor* output_tensor = NULL;
-    OP_REQUIRES_OK(context, context->allocate_output(0, shape, &output_tensor));
+  void Compute(OpKernelContext *context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &state));
+    const int64 size = (int64)1 << (is_matrix_ ? 2 * nqubits_ : nqubits_);
+    const int64 nelements = StateSize<T>(state);
+    OP_REQUIRES(context, nelements > 0 && nelements % size == 0,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
 
     // call the implementation
     InitialStateFunctor<Device, T>()(context->eigen_device<Device>(),
-                                     output_tensor->flat<T>().data(),
-                                     output_tensor->flat<T>().size());
+                                     StateData<T>(state), size,
+                                     nelements / size);
   }
 
  private:
@@ -58,21 +160,103 @@ class InitialStateOp : public OpKernel {
   int threads_;
 };
 
+template <typename Device, typename T>
+class ProductStateOp : public OpKernel {
+ public:
+  explicit ProductStateOp(OpKernelConstruction *context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext *context) override {
+    const Tensor& amplitudes = context->input(0);
+    OP_REQUIRES(context, amplitudes.dims() == 2 &&
+                amplitudes.dim_size(1) == 2,
+                errors::InvalidArgument("Amplitudes should have shape "
+                                        "(nqubits, 2)."));
+    const int nqubits = (int)amplitudes.dim_size(0);
+    OP_REQUIRES(context, nqubits > 0 && nqubits < 63,
+                errors::InvalidArgument("Invalid number of qubits."));
+    const int nlow = (nqubits + 1) / 2;
+    const int64 nhighstates = (int64)1 << (nqubits - nlow);
+    const int64 nlowstates = (int64)1 << nlow;
+
+    // the state is not pooled so that the first gate can forward it
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(
+        0, TensorShape({nhighstates * nlowstates}), &output));
+    if (std::is_same<Device, CPUDevice>::value) AdviseHugePages(*output);
+    Tensor& output_tensor = *output;
+    Tensor tables;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DataTypeToEnum<T>::value,
+        TensorShape({nhighstates + nlowstates}), &tables));
+
+    // call the implementation
+    T* high = tables.flat<T>().data();
+    ProductStateFunctor<Device, T>()(context->eigen_device<Device>(),
+                                     amplitudes.flat<T>().data(),
+                                     output_tensor.flat<T>().data(), high,
+                                     high + nhighstates, nqubits, nlow);
+  }
+
+ private:
+  int threads_;
+};
+
 // Register the CPU kernels.
+// Half precision states are registered for ``float16`` tensors (see
+// complex_half.h) and are not supported by the product state.
+#define REGISTER_STATE_CPU(T)                                                 \
+  REGISTER_KERNEL_BUILDER(Name("InitialState")                                \
+                              .Device(DEVICE_CPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>(      \
+                                  "dtype"),                                   \
+                          InitialStateOp<CPUDevice, T>);                      \
+  REGISTER_KERNEL_BUILDER(Name("BasisState")                                  \
+                              .Device(DEVICE_CPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>(      \
+                                  "dtype"),                                   \
+                          InitialStateOp<CPUDevice, T, true>);                \
+  REGISTER_KERNEL_BUILDER(Name("ResetState")                                  \
+                              .Device(DEVICE_CPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>("T"), \
+                          ResetStateOp<CPUDevice, T>);
 #define REGISTER_CPU(T)                                               \
+  REGISTER_STATE_CPU(T);                                              \
   REGISTER_KERNEL_BUILDER(                                            \
-      Name("InitialState").Device(DEVICE_CPU).TypeConstraint<T>("dtype"), \
-      InitialStateOp<CPUDevice, T>);
+      Name("ProductState").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      ProductStateOp<CPUDevice, T>);
+REGISTER_STATE_CPU(complex32);
 REGISTER_CPU(complex64);
 REGISTER_CPU(complex128);
 
 #ifdef GOOGLE_CUDA
 // Register the GPU kernels.
+#define REGISTER_STATE_GPU(T)                                                 \
+  extern template struct InitialStateFunctor<GPUDevice, T>;                   \
+  REGISTER_KERNEL_BUILDER(Name("InitialState")                                \
+                              .Device(DEVICE_GPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>(      \
+                                  "dtype"),                                   \
+                          InitialStateOp<GPUDevice, T>);                      \
+  REGISTER_KERNEL_BUILDER(Name("BasisState")                                  \
+                              .Device(DEVICE_GPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>(      \
+                                  "dtype")                                    \
+                              .HostMemory("index"),                           \
+                          InitialStateOp<GPUDevice, T, true>);                \
+  REGISTER_KERNEL_BUILDER(Name("ResetState")                                  \
+                              .Device(DEVICE_GPU)                             \
+                              .TypeConstraint<StateTensorType<T>::type>("T"), \
+                          ResetStateOp<GPUDevice, T>);
 #define REGISTER_GPU(T)                                               \
-  extern template struct InitialStateFunctor<GPUDevice, T>;           \
+  REGISTER_STATE_GPU(T);                                              \
+  extern template struct ProductStateFunctor<GPUDevice, T>;           \
   REGISTER_KERNEL_BUILDER(                                            \
-      Name("InitialState").Device(DEVICE_GPU).TypeConstraint<T>("dtype"), \
-      InitialStateOp<GPUDevice, T>);
+      Name("ProductState").Device(DEVICE_GPU).TypeConstraint<T>("T"), \
+      ProductStateOp<GPUDevice, T>);
+REGISTER_STATE_GPU(complex32);
 REGISTER_GPU(complex64);
 REGISTER_GPU(complex128);
 #endif
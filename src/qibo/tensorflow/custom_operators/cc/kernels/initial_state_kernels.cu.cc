@@ -1,8 +1,8 @@
 #if GOOGLE_CUDA
 #define EIGEN_USE_GPU
 
-#define DEFAULT_BLOCK_SIZE 1024  // default number of threads
-
+#include "complex_half.h"
+#include "gpu_launch.h"
 #include "initial_state.h"
 #include "tensorflow/core/framework/op_kernel.h"
 
@@ -13,36 +13,63 @@ typedef Eigen::GpuDevice GPUDevice;
 
 // cuda kernel
 template <typename T>
-__global__ void SetFirstEntryToZero(T* out) {
-  out[0] = T(1, 0);
+__global__ void SetNonZeroEntry(long nbatch, T* out, long size, long index) {
+  GPU_GRID_STRIDE_LOOP(b, nbatch) {
+    out[b * size + index] = T(1, 0);
+  }
 }
 
 template <typename T>
-__global__ void InitializeToZero(T* out) {
-  const auto g = blockIdx.x * blockDim.x + threadIdx.x;
-  out[g] = T(0, 0);
+__global__ void ProductTableKernel(long size, const T* amplitudes, T* table,
+                                   int nqubits) {
+  GPU_GRID_STRIDE_LOOP(i, size) {
+    table[i] = ProductAmplitude(amplitudes, nqubits, i);
+  }
+}
+
+template <typename T>
+__global__ void ProductStateKernel(long size, T* out, const T* high,
+                                   const T* low, int nlow) {
+  const long lowmask = (1L << nlow) - 1;
+  GPU_GRID_STRIDE_LOOP(g, size) {
+    const T f = high[g >> nlow];
+    const T x = low[g & lowmask];
+    out[g] = T(f.real() * x.real() - f.imag() * x.imag(),
+               f.real() * x.imag() + f.imag() * x.real());
+  }
 }
 
 // Define the GPU implementation that launches the CUDA kernel.
 template <typename T>
 struct InitialStateFunctor<GPUDevice, T> {
-  void operator()(const GPUDevice& d, T* out, int64 size) {
-
-    int64 blockSize = DEFAULT_BLOCK_SIZE;
-    int64 numBlocks = (size + blockSize - 1) / blockSize;
-    if (size < blockSize) {
-      numBlocks = 1;
-      blockSize = size;
-    }
+  void operator()(const GPUDevice& d, T* out, int64 size, int64 nbatch = 1,
+                  int64 index = 0) {
+    // the zero bytes are the zero amplitudes
+    d.memset(out, 0, nbatch * size * sizeof(T));
+    LaunchKernel(SetNonZeroEntry<T>, d, nbatch, out, (long)size, (long)index);
+  }
+};
 
-    InitializeToZero<T><<<numBlocks, blockSize, 0, d.stream()>>>(out);
-    SetFirstEntryToZero<T><<<1, 1, 0, d.stream()>>>(out);
+template <typename T>
+struct ProductStateFunctor<GPUDevice, T> {
+  void operator()(const GPUDevice& d, const T* amplitudes, T* out, T* high,
+                  T* low, int nqubits, int nlow) {
+    const int nhigh = nqubits - nlow;
+    LaunchKernel(ProductTableKernel<T>, d, (int64)1 << nhigh, amplitudes,
+                 high, nhigh);
+    LaunchKernel(ProductTableKernel<T>, d, (int64)1 << nlow,
+                 amplitudes + 2 * nhigh, low, nlow);
+    LaunchKernel(ProductStateKernel<T>, d, (int64)1 << nqubits, out,
+                 (const T*)high, (const T*)low, nlow);
   }
 };
 
 // Explicitly instantiate functors for the types of OpKernels registered.
+template struct InitialStateFunctor<GPUDevice, complex32>;
 template struct InitialStateFunctor<GPUDevice, complex64>;
 template struct InitialStateFunctor<GPUDevice, complex128>;
+template struct ProductStateFunctor<GPUDevice, complex64>;
+template struct ProductStateFunctor<GPUDevice, complex128>;
 }  // end namespace functor
 }  // end namespace tensorflow
 #endif  // GOOGLE_CUDA
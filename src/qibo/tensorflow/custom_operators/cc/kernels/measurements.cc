@@ -3,21 +3,97 @@
 #endif  // GOOGLE_CUDA
 
 #include "measurements.h"
+#include "complex_half.h"
+#include "forward_state.h"
+#include "state_pool.h"
+#include <random>
 #include "tensorflow/core/framework/op_kernel.h"
 
+// Number of states that are sampled together by the exact sampler.
+// The chunks do not depend on the number of threads so that the sampled
+// frequencies are reproducible for a given seed.
+#define DEFAULT_SAMPLE_CHUNK (1 << 16)
+
 namespace tensorflow {
 
 typedef Eigen::ThreadPoolDevice CPUDevice;
+typedef Eigen::GpuDevice GPUDevice;
 
 namespace functor {
 
+// Samples ``nshots`` from the distribution defined by the non-negative
+// ``probs`` and calls ``visit(chunk, state, count)`` for every state that
+// was sampled at least once. States of each chunk are visited in increasing
+// order and different chunks may be visited concurrently.
+template <typename Tfloat, typename Visitor>
+void SampleExact(const Tfloat* probs, int64 nstates, int64 nshots, int64 seed,
+                 Visitor visit) {
+  const int64 chunk = std::min(nstates, (int64)DEFAULT_SAMPLE_CHUNK);
+  const int64 nchunks = nstates / chunk;
+  std::vector<double> mass(nchunks, 0);
+  std::vector<int64> last(nchunks, -1);
+  #pragma omp parallel for
+  for (int64 c = 0; c < nchunks; c++) {
+    for (int64 i = c * chunk; i < (c + 1) * chunk; i++) {
+      if (probs[i] > 0) {
+        mass[c] += probs[i];
+        last[c] = i;
+      }
+    }
+  }
+
+  // split the shots over chunks using conditional binomial draws
+  double remaining_mass = 0;
+  int64 lastchunk = -1;
+  for (int64 c = 0; c < nchunks; c++) {
+    remaining_mass += mass[c];
+    if (last[c] >= 0) lastchunk = c;
+  }
+  std::vector<int64> shots(nchunks, 0);
+  PhiloxEngine engine(seed, 0);
+  int64 remaining_shots = nshots;
+  for (int64 c = 0; c <= lastchunk && remaining_shots > 0; c++) {
+    if (c == lastchunk) {
+      shots[c] = remaining_shots;
+    } else if (mass[c] > 0) {
+      const double p = std::min(1.0, mass[c] / remaining_mass);
+      shots[c] = std::binomial_distribution<int64>(remaining_shots, p)(engine);
+    }
+    remaining_shots -= shots[c];
+    remaining_mass -= mass[c];
+  }
+
+  // sample each chunk by matching sorted uniforms to its cumulative sum
+  #pragma omp parallel for schedule(dynamic)
+  for (int64 c = 0; c < nchunks; c++) {
+    if (shots[c] == 0) continue;
+    PhiloxEngine engine(seed, c + 1);
+    int64 i = c * chunk;
+    double cumsum = std::max((double)probs[i], 0.0);
+    double u = 0;
+    int64 count = 0;
+    for (int64 s = shots[c]; s > 0; s--) {
+      u = 1.0 - (1.0 - u) * std::pow(engine.Uniform(), 1.0 / s);
+      const double target = u * mass[c];
+      while (target >= cumsum && i < last[c]) {
+        if (count > 0) visit(c, i, count);
+        count = 0;
+        i++;
+        cumsum += std::max((double)probs[i], 0.0);
+      }
+      count++;
+    }
+    visit(c, i, count);
+  }
+}
+
 // CPU specialization
 template <typename Tint, typename Tfloat>
 struct MeasureFrequenciesFunctor<CPUDevice, Tint, Tfloat> {
-  void operator()(const CPUDevice &d, Tint* frequencies, const Tfloat* probs,
-                  int64 nshots, int nqubits, int user_seed = 1234)
+  void operator()(OpKernelContext* context, const CPUDevice &d, Tint* frequencies, const Tfloat* probs,
+                  int64 nshots, int nqubits, int user_seed)
   {
-    int64 nstates = 1 << nqubits;
+    int64 nstates = (int64)1 << nqubits;
     srand(user_seed);
     // Create vector of seeds for each thread
     std::vector<unsigned> thread_seed;
@@ -57,6 +133,57 @@ struct MeasureFrequenciesFunctor<CPUDevice, Tint, Tfloat> {
   }
 };
 
+template <typename Tint, typename Tfloat>
+struct ExactFrequenciesFunctor<CPUDevice, Tint, Tfloat> {
+  void operator()(OpKernelContext* context, const CPUDevice &d, Tint* frequencies, const Tfloat* probs,
+                  int64 nshots, int nqubits, int64 seed)
+  {
+    SampleExact(probs, (int64)1 << nqubits, nshots, seed,
+                [frequencies](int64 c, int64 i, int64 count) {
+                  frequencies[i] += count;
+                });
+  }
+};
+
+template <typename T, typename NormType>
+struct MarginalProbabilitiesFunctor<CPUDevice, T, NormType> {
+  void operator()(OpKernelContext* context, const CPUDevice &d, const T* state,
+                  NormType* probs, int nqubits, int ntargets,
+                  const int32* qubits)
+  {
+    const int64 nresults = (int64)1 << ntargets;
+    const int64 nstates = (int64)1 << (nqubits - ntargets);
+    const IndexMasks masks(nqubits, ntargets, qubits);
+    auto Probability = [&](int64 g, int64 resbits) {
+      const auto x = state[masks.insert(g) | resbits];
+      return x.real() * x.real() + x.imag() * x.imag();
+    };
+
+    if (nresults >= omp_get_max_threads()) {
+      // enough results to give at least one to each thread
+      #pragma omp parallel for
+      for (int64 r = 0; r < nresults; r++) {
+        const int64 resbits = DepositBits(r, masks.qubitmask);
+        NormType p = 0;
+        for (int64 g = 0; g < nstates; g++) {
+          p += Probability(g, resbits);
+        }
+        probs[r] = p;
+      }
+    } else {
+      for (int64 r = 0; r < nresults; r++) {
+        const int64 resbits = DepositBits(r, masks.qubitmask);
+        NormType p = 0;
+        #pragma omp parallel for reduction(+: p)
+        for (int64 g = 0; g < nstates; g++) {
+          p += Probability(g, resbits);
+        }
+        probs[r] = p;
+      }
+    }
+  }
+};
+
 template <typename Device, typename Tint, typename Tfloat>
 class MeasureFrequenciesOp : public OpKernel {
  public:
@@ -65,19 +192,156 @@ class MeasureFrequenciesOp : public OpKernel {
     OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
     OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
     OP_REQUIRES_OK(context, context->GetAttr("seed", &seed_));
+    OP_REQUIRES_OK(context, context->GetAttr("exact", &exact_));
     omp_set_num_threads(threads_);
   }
 
   void Compute(OpKernelContext *context) override {
-    // grab the input tensor
-    Tensor frequencies = context->input(0);
+    // the input is updated in-place (see forward_state.h)
+    Tensor frequencies;
+    OP_REQUIRES_OK(context, ForwardState<Device, Tint>(
+        context, 0, 0, &frequencies));
     const Tensor& probs = context->input(1);
+    // batched probabilities of shape (nbatch, 2^nqubits) are sampled
+    // independently, each with its own seed
+    const int64 nstates = (int64)1 << nqubits_;
+    const int64 nbatch = probs.NumElements() / nstates;
+    OP_REQUIRES(context, nbatch > 0 && probs.NumElements() == nbatch * nstates,
+                errors::InvalidArgument("Probabilities shape does not agree "
+                                        "with nqubits."));
+    OP_REQUIRES(context, frequencies.NumElements() == probs.NumElements(),
+                errors::InvalidArgument("Frequencies and probabilities must "
+                                        "have the same shape."));
 
     // call the implementation
-    MeasureFrequenciesFunctor<Device, Tint, Tfloat>()
-      (context->eigen_device<Device>(), frequencies.flat<Tint>().data(),
-       probs.flat<Tfloat>().data(), (int64) nshots_, nqubits_, seed_);
-    context->set_output(0, frequencies);
+    for (int64 b = 0; b < nbatch; b++) {
+      Tint* freqs = frequencies.flat<Tint>().data() + b * nstates;
+      const Tfloat* p = probs.flat<Tfloat>().data() + b * nstates;
+      if (exact_) {
+        ExactFrequenciesFunctor<Device, Tint, Tfloat>()
+          (context, context->eigen_device<Device>(), freqs, p, (int64) nshots_,
+           nqubits_, seed_ + b);
+      } else {
+        MeasureFrequenciesFunctor<Device, Tint, Tfloat>()
+          (context, context->eigen_device<Device>(), freqs, p, (int64) nshots_,
+           nqubits_, seed_ + b);
+      }
+    }
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+  int seed_;
+  bool exact_;
+  float nshots_;
+};
+
+// Samples the frequencies exactly and returns only the states that were
+// sampled at least once together with their counts, so that no array of
+// size 2^nqubits is allocated for the output.
+template <typename Tint, typename Tfloat>
+class MeasureFrequenciesSparseOp : public OpKernel {
+ public:
+  explicit MeasureFrequenciesSparseOp(OpKernelConstruction *context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nshots", &nshots_));
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    OP_REQUIRES_OK(context, context->GetAttr("seed", &seed_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext *context) override {
+    const Tensor& probs = context->input(0);
+    const int64 nstates = (int64)1 << nqubits_;
+    OP_REQUIRES(context, probs.NumElements() == nstates,
+                errors::InvalidArgument("Probabilities shape does not agree "
+                                        "with nqubits."));
+
+    // every chunk collects its samples separately so that the output is
+    // sorted by state after concatenating the chunks
+    const int64 nchunks = nstates / std::min(nstates,
+                                             (int64)DEFAULT_SAMPLE_CHUNK);
+    std::vector<std::vector<std::pair<int64, int64>>> samples(nchunks);
+    SampleExact(probs.flat<Tfloat>().data(), nstates, (int64) nshots_, seed_,
+                [&samples](int64 c, int64 i, int64 count) {
+                  samples[c].emplace_back(i, count);
+                });
+    int64 nsampled = 0;
+    for (const auto& s : samples) nsampled += s.size();
+
+    Tensor* states = nullptr;
+    Tensor* counts = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(
+        0, TensorShape({nsampled}), &states));
+    OP_REQUIRES_OK(context, context->allocate_output(
+        1, TensorShape({nsampled}), &counts));
+    auto states_flat = states->flat<int64>();
+    auto counts_flat = counts->flat<Tint>();
+    int64 k = 0;
+    for (const auto& s : samples) {
+      for (const auto& sample : s) {
+        states_flat(k) = sample.first;
+        counts_flat(k) = (Tint) sample.second;
+        k++;
+      }
+    }
+  }
+
+ private:
+  int nqubits_;
+  int threads_;
+  int seed_;
+  float nshots_;
+};
+
+// Samples the frequencies of the measured qubits directly from the state.
+// Only the probabilities of the 2^ntargets results are allocated.
+template <typename Device, typename T, typename NormType, typename Tint>
+class MeasureStateOp : public OpKernel {
+ public:
+  explicit MeasureStateOp(OpKernelConstruction *context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("nshots", &nshots_));
+    OP_REQUIRES_OK(context, context->GetAttr("nqubits", &nqubits_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    OP_REQUIRES_OK(context, context->GetAttr("seed", &seed_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext *context) override {
+    // the input is updated in-place (see forward_state.h)
+    Tensor frequencies;
+    OP_REQUIRES_OK(context, ForwardState<Device, Tint>(
+        context, 0, 0, &frequencies));
+    const Tensor& state = context->input(1);
+    const Tensor& qubits = context->input(2);
+    const int ntargets = qubits.flat<int32>().size();
+    OP_REQUIRES(context, StateSize<T>(state) == (int64)1 << nqubits_,
+                errors::InvalidArgument("State shape does not agree with "
+                                        "nqubits."));
+    OP_REQUIRES(context, ntargets > 0 && ntargets <= nqubits_,
+                errors::InvalidArgument("Invalid number of measured qubits."));
+    OP_REQUIRES(context, frequencies.NumElements() == (int64)1 << ntargets,
+                errors::InvalidArgument("Frequencies shape does not agree "
+                                        "with the number of measured "
+                                        "qubits."));
+
+    Tensor tensor_probs;
+    const auto dtype = std::is_same<NormType, double>::value ? DT_DOUBLE
+                                                             : DT_FLOAT;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, dtype, TensorShape({(int64)1 << ntargets}), &tensor_probs));
+    NormType* probs = tensor_probs.flat<NormType>().data();
+
+    // call the implementation
+    const Device& d = context->eigen_device<Device>();
+    MarginalProbabilitiesFunctor<Device, T, NormType>()(
+        context, d, StateData<T>(state), probs, nqubits_, ntargets,
+        qubits.flat<int32>().data());
+    ExactFrequenciesFunctor<Device, Tint, NormType>()(
+        context, d, frequencies.flat<Tint>().data(), probs, (int64) nshots_,
+        ntargets, seed_);
   }
 
  private:
@@ -92,11 +356,63 @@ class MeasureFrequenciesOp : public OpKernel {
   REGISTER_KERNEL_BUILDER(                                             \
       Name("MeasureFrequencies").Device(DEVICE_CPU)                    \
       .TypeConstraint<Tint>("Tint").TypeConstraint<Tfloat>("Tfloat"),  \
-      MeasureFrequenciesOp<CPUDevice, Tint, Tfloat>);
+      MeasureFrequenciesOp<CPUDevice, Tint, Tfloat>);                 \
+  REGISTER_KERNEL_BUILDER(                                             \
+      Name("MeasureFrequenciesSparse").Device(DEVICE_CPU)              \
+      .TypeConstraint<Tint>("Tint").TypeConstraint<Tfloat>("Tfloat"),  \
+      MeasureFrequenciesSparseOp<Tint, Tfloat>);
 REGISTER_CPU(int32, float);
 REGISTER_CPU(int64, float);
 REGISTER_CPU(int32, double);
 REGISTER_CPU(int64, double);
 
+// Half precision states are registered for ``float16`` tensors (see
+// complex_half.h).
+#define REGISTER_STATE_CPU(T, NT, Tint)                                \
+  REGISTER_KERNEL_BUILDER(                                             \
+      Name("MeasureState").Device(DEVICE_CPU)                          \
+      .TypeConstraint<StateTensorType<T>::type>("T")                   \
+      .TypeConstraint<Tint>("Tint"),                                   \
+      MeasureStateOp<CPUDevice, T, NT, Tint>);
+REGISTER_STATE_CPU(complex32, float, int32);
+REGISTER_STATE_CPU(complex32, float, int64);
+REGISTER_STATE_CPU(complex64, float, int32);
+REGISTER_STATE_CPU(complex64, float, int64);
+REGISTER_STATE_CPU(complex128, double, int32);
+REGISTER_STATE_CPU(complex128, double, int64);
+
+#ifdef GOOGLE_CUDA
+// Register the GPU kernels.
+#define REGISTER_GPU(Tint, Tfloat)                                     \
+  extern template struct                                               \
+      MeasureFrequenciesFunctor<GPUDevice, Tint, Tfloat>;              \
+  extern template struct                                               \
+      ExactFrequenciesFunctor<GPUDevice, Tint, Tfloat>;                \
+  REGISTER_KERNEL_BUILDER(                                             \
+      Name("MeasureFrequencies").Device(DEVICE_GPU)                    \
+      .TypeConstraint<Tint>("Tint").TypeConstraint<Tfloat>("Tfloat"),  \
+      MeasureFrequenciesOp<GPUDevice, Tint, Tfloat>);
+REGISTER_GPU(int32, float);
+REGISTER_GPU(int64, float);
+REGISTER_GPU(int32, double);
+REGISTER_GPU(int64, double);
+
+// The qubits are used by the host to compute the index masks.
+#define REGISTER_STATE_GPU(T, NT, Tint)                                \
+  extern template struct MarginalProbabilitiesFunctor<GPUDevice, T, NT>; \
+  REGISTER_KERNEL_BUILDER(                                             \
+      Name("MeasureState").Device(DEVICE_GPU)                          \
+      .TypeConstraint<StateTensorType<T>::type>("T")                   \
+      .TypeConstraint<Tint>("Tint")                                    \
+      .HostMemory("qubits"),                                           \
+      MeasureStateOp<GPUDevice, T, NT, Tint>);
+REGISTER_STATE_GPU(complex32, float, int32);
+REGISTER_STATE_GPU(complex32, float, int64);
+REGISTER_STATE_GPU(complex64, float, int32);
+REGISTER_STATE_GPU(complex64, float, int64);
+REGISTER_STATE_GPU(complex128, double, int32);
+REGISTER_STATE_GPU(complex128, double, int64);
+#endif
+
 }  // namespace functor
 }  // namespace tensorflow
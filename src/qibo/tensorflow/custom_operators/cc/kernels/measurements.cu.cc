@@ -0,0 +1,214 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+
+#include <cub/device/device_scan.cuh>
+#include <cub/iterator/transform_input_iterator.cuh>
+
+#include "complex_half.h"
+#include "gpu_launch.h"
+#include "measurements.h"
+#include "state_pool.h"
+#include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/lib/random/philox_random.h"
+
+// Maximum number of states that are scanned by a single cub call,
+// so that the item count fits in the ``int`` used by cub.
+#define DEFAULT_SCAN_SEGMENT (1l << 30)
+
+namespace tensorflow {
+namespace functor {
+
+typedef Eigen::GpuDevice GPUDevice;
+
+// Probabilities are accumulated in double precision and negative values
+// (roundoff of zero probabilities) are ignored.
+template <typename Tfloat>
+struct NonNegativeProbability {
+  __host__ __device__ double operator()(const Tfloat& p) const {
+    return p > 0 ? (double)p : 0.0;
+  }
+};
+
+// Adds the last cumulative probability of the previous segment.
+__global__ void AddScanOffsetKernel(long n, double* cdf) {
+  const double offset = cdf[-1];
+  GPU_GRID_STRIDE_LOOP(i, n) {
+    cdf[i] += offset;
+  }
+}
+
+__device__ inline void AtomicAddCount(int32* address, int32 value) {
+  atomicAdd((int*)address, (int)value);
+}
+
+__device__ inline void AtomicAddCount(int64* address, int64 value) {
+  atomicAdd((unsigned long long*)address, (unsigned long long)value);
+}
+
+// Each shot uses its own Philox counter so that the sampled frequencies do
+// not depend on the launch configuration.
+template <typename Tint>
+__global__ void SampleShotsKernel(long nshots, Tint* frequencies,
+                                  const double* cdf, long nstates, long seed) {
+  const double total = cdf[nstates - 1];
+  if (total <= 0) return;
+  GPU_GRID_STRIDE_LOOP(s, nshots) {
+    random::PhiloxRandom generator(seed, 0);
+    generator.Skip(s);
+    const auto bits = generator();
+    const uint64 a = bits[0] >> 5, b = bits[1] >> 6;
+    // uniform in [0, total) so that the search never ends on a state with
+    // zero probability
+    const double target = ((a << 26) + b) / 9007199254740992.0 * total;
+    long lo = 0, hi = nstates - 1;
+    while (lo < hi) {
+      const long mid = (lo + hi) / 2;
+      if (cdf[mid] > target) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    AtomicAddCount(frequencies + lo, (Tint)1);
+  }
+}
+
+template <typename Tint, typename Tfloat>
+struct ExactFrequenciesFunctor<GPUDevice, Tint, Tfloat> {
+  void operator()(OpKernelContext* context, const GPUDevice& d,
+                  Tint* frequencies, const Tfloat* probs, int64 nshots,
+                  int nqubits, int64 seed) {
+    const int64 nstates = (int64)1 << nqubits;
+    Tensor tensor_cdf;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DT_DOUBLE, TensorShape({nstates}), &tensor_cdf));
+    double* cdf = tensor_cdf.flat<double>().data();
+
+    // device-wide prefix sum of the probabilities
+    typedef cub::TransformInputIterator<double, NonNegativeProbability<Tfloat>,
+                                        const Tfloat*> Iterator;
+    const int segment = (int)std::min(nstates, (int64)DEFAULT_SCAN_SEGMENT);
+    size_t temp_bytes = 0;
+    cub::DeviceScan::InclusiveSum(nullptr, temp_bytes, Iterator(probs, {}),
+                                  cdf, segment, d.stream());
+    Tensor tensor_temp;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, DT_INT8, TensorShape({(int64)temp_bytes}), &tensor_temp));
+    void* temp = tensor_temp.flat<int8>().data();
+    for (int64 start = 0; start < nstates; start += segment) {
+      cub::DeviceScan::InclusiveSum(temp, temp_bytes,
+                                    Iterator(probs + start, {}), cdf + start,
+                                    segment, d.stream());
+      if (start > 0) {
+        LaunchKernel(AddScanOffsetKernel, d, segment, cdf + start);
+      }
+    }
+
+    LaunchKernel(SampleShotsKernel<Tint>, d, nshots, frequencies,
+                 (const double*)cdf, (long)nstates, (long)seed);
+  }
+};
+
+// The Metropolis chain is sequential so the GPU always samples exactly.
+template <typename Tint, typename Tfloat>
+struct MeasureFrequenciesFunctor<GPUDevice, Tint, Tfloat> {
+  void operator()(OpKernelContext* context, const GPUDevice& d,
+                  Tint* frequencies, const Tfloat* probs, int64 nshots,
+                  int nqubits, int user_seed) {
+    ExactFrequenciesFunctor<GPUDevice, Tint, Tfloat>()(
+        context, d, frequencies, probs, nshots, nqubits, user_seed);
+  }
+};
+
+// Each group of ``nblocks`` consecutive blocks calculates the partial
+// probabilities of one result, which are reduced in shared memory.
+template <typename T, typename NormType>
+__global__ void MarginalProbabilitiesKernel(const T* state, NormType* partial,
+                                            IndexMasks masks, long nstates,
+                                            int nblocks) {
+  extern __shared__ unsigned char shared[];
+  NormType* sdata = (NormType*)shared;
+  const auto tid = threadIdx.x;
+  const long r = blockIdx.x / nblocks;
+  const long resbits = DepositBits(r, masks.qubitmask);
+  const long stride = (long)nblocks * blockDim.x;
+  NormType p = 0;
+  for (long g = (blockIdx.x % nblocks) * blockDim.x + tid; g < nstates;
+       g += stride) {
+    const auto x = state[masks.insert(g) | resbits];
+    p += x.real() * x.real() + x.imag() * x.imag();
+  }
+  sdata[tid] = p;
+  __syncthreads();
+  for (auto s = blockDim.x / 2; s > 0; s >>= 1) {
+    if (tid < s) {
+      sdata[tid] += sdata[tid + s];
+    }
+    __syncthreads();
+  }
+  if (tid == 0) {
+    partial[blockIdx.x] = sdata[0];
+  }
+}
+
+template <typename NormType>
+__global__ void SumPartialProbabilitiesKernel(long nresults, NormType* probs,
+                                              const NormType* partial,
+                                              int nblocks) {
+  GPU_GRID_STRIDE_LOOP(r, nresults) {
+    NormType p = 0;
+    for (int j = 0; j < nblocks; j++) {
+      p += partial[r * nblocks + j];
+    }
+    probs[r] = p;
+  }
+}
+
+template <typename T, typename NormType>
+struct MarginalProbabilitiesFunctor<GPUDevice, T, NormType> {
+  void operator()(OpKernelContext* context, const GPUDevice& d, const T* state,
+                  NormType* probs, int nqubits, int ntargets,
+                  const int32* qubits) {
+    const int64 nresults = (int64)1 << ntargets;
+    const int64 nstates = (int64)1 << (nqubits - ntargets);
+    // ``qubits`` are in host memory so that the masks are computed here
+    const IndexMasks masks(nqubits, ntargets, qubits);
+
+    // the blocks that fit on the device are split over the results
+    const int blockSize = (int)std::min(nstates, (int64)DEFAULT_BLOCK_SIZE);
+    const int64 maxBlocks = (int64)d.getNumGpuMultiProcessors() *
+                            (d.maxGpuThreadsPerMultiProcessor() / blockSize);
+    const int nblocks = (int)std::max((int64)1, std::min(
+        maxBlocks / nresults, nstates / blockSize));
+
+    Tensor tensor_partial;
+    const auto dtype = std::is_same<NormType, double>::value ? DT_DOUBLE
+                                                             : DT_FLOAT;
+    OP_REQUIRES_OK(context, AllocatePooled(
+        context, dtype, TensorShape({nresults * nblocks}), &tensor_partial));
+    NormType* partial = tensor_partial.flat<NormType>().data();
+
+    const int64 numBlocks = nresults * nblocks;
+    const size_t sharedBytes = blockSize * sizeof(NormType);
+    MarginalProbabilitiesKernel<T, NormType>
+        <<<numBlocks, blockSize, sharedBytes, d.stream()>>>(
+            state, partial, masks, nstates, nblocks);
+    LaunchKernel(SumPartialProbabilitiesKernel<NormType>, d, nresults, probs,
+                 (const NormType*)partial, nblocks);
+  }
+};
+
+// Explicitly instantiate functors for the types of OpKernels registered.
+#define REGISTER_TEMPLATE(Tint, Tfloat)                             \
+  template struct MeasureFrequenciesFunctor<GPUDevice, Tint, Tfloat>; \
+  template struct ExactFrequenciesFunctor<GPUDevice, Tint, Tfloat>;
+REGISTER_TEMPLATE(int32, float);
+REGISTER_TEMPLATE(int64, float);
+REGISTER_TEMPLATE(int32, double);
+REGISTER_TEMPLATE(int64, double);
+template struct MarginalProbabilitiesFunctor<GPUDevice, complex32, float>;
+template struct MarginalProbabilitiesFunctor<GPUDevice, complex64, float>;
+template struct MarginalProbabilitiesFunctor<GPUDevice, complex128, double>;
+}  // end namespace functor
+}  // end namespace tensorflow
+#endif  // GOOGLE_CUDA
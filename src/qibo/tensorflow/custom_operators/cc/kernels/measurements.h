@@ -1,20 +1,100 @@
+/************************************************
+ * Functors that sample measurement frequencies from probabilities.
+ *
+ *    - @struct MeasureFrequenciesFunctor
+ *        Samples the shots using a Metropolis chain that starts from the
+ *        most probable bitstring.
+ *    - @struct ExactFrequenciesFunctor
+ *        Samples the shots exactly from the distribution defined by the
+ *        probabilities (which do not need to be normalized). The states are
+ *        split in chunks of fixed size and the shots are first distributed
+ *        over the chunks using conditional binomial draws (multinomial
+ *        splitting). Each chunk then generates its shots as sorted uniforms
+ *        that are matched to its cumulative probabilities in a single pass.
+ *        Every chunk uses its own Philox stream of the given seed, so that
+ *        the result is reproducible independently of the number of threads.
+ *    - @struct MarginalProbabilitiesFunctor
+ *        Calculates the probabilities of the measured qubits directly from
+ *        the state amplitudes, without computing the probabilities of the
+ *        full state. The amplitudes that contribute to each result are
+ *        generated with the same @struct IndexMasks used by the collapse
+ *        gate. The ``qubits`` array holds the sorted bit positions of the
+ *        measured qubits, so the first measured qubit is the most
+ *        significant bit of the result.
+ *
+ * Both sampling functors add the sampled frequencies to the ``frequencies`` array.
+ *
+ * On GPU the Metropolis chain is not available and both functors sample
+ * the shots exactly: the cumulative probabilities are computed with a
+ * device-wide prefix sum and each shot draws a uniform from its own Philox
+ * counter, finds its state with a binary search and increments the
+ * corresponding frequency atomically. The probabilities and frequencies
+ * stay on device and the result only depends on the seed (but differs from
+ * the CPU result for the same seed).
+ ***********************************************/
 #ifndef KERNEL_MEASUREMENTS_H_
 #define KERNEL_MEASUREMENTS_H_
 
+#include "index_masks.h"
 #include "tensorflow/core/framework/op_kernel.h"
+#include "tensorflow/core/lib/random/philox_random.h"
 
 namespace tensorflow {
 
 namespace functor {
 
+// Uniform random bit generator on top of a Philox stream so that it can be
+// used with the standard distributions.
+class PhiloxEngine {
+ public:
+  typedef uint32 result_type;
+
+  PhiloxEngine(int64 seed, int64 stream) : generator_(seed, stream), used_(4) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return 0xFFFFFFFF; }
+
+  result_type operator()() {
+    if (used_ == 4) {
+      buffer_ = generator_();
+      used_ = 0;
+    }
+    return buffer_[used_++];
+  }
+
+  // Uniform double in (0, 1] with 53 random bits.
+  double Uniform() {
+    const uint64 a = (*this)() >> 5, b = (*this)() >> 6;
+    return ((a << 26) + b + 1.0) / 9007199254740992.0;
+  }
+
+ private:
+  random::PhiloxRandom generator_;
+  random::PhiloxRandom::ResultType buffer_;
+  int used_;
+};
+
 template <typename Device, typename Tint, typename Tfloat>
 struct MeasureFrequenciesFunctor {
-  void operator()(const Device &d, Tint* frequencies, const Tfloat* probs,
-                  Tint nshots, int nqubits, int user_seed);
+  void operator()(OpKernelContext* context, const Device &d, Tint* frequencies, const Tfloat* probs,
+                  int64 nshots, int nqubits, int user_seed);
+};
+
+template <typename Device, typename Tint, typename Tfloat>
+struct ExactFrequenciesFunctor {
+  void operator()(OpKernelContext* context, const Device &d, Tint* frequencies, const Tfloat* probs,
+                  int64 nshots, int nqubits, int64 seed);
+};
+
+template <typename Device, typename T, typename NormType>
+struct MarginalProbabilitiesFunctor {
+  void operator()(OpKernelContext* context, const Device &d, const T* state,
+                  NormType* probs, int nqubits, int ntargets,
+                  const int32* qubits);
 };
 
 }  // namespace functor
 
 }  // namespace tensorflow
 
-#endif  // KERNEL_TIME_TWO_H_
+#endif  // KERNEL_MEASUREMENTS_H_
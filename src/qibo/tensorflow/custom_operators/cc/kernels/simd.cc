@@ -0,0 +1,57 @@
+#include "simd.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+namespace simd {
+
+#if defined(__x86_64__) || defined(__i386__)
+Level level() {
+  static const Level supported = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return AVX2;
+    }
+    return NONE;
+  }();
+  return supported;
+}
+
+// Uses the widest instruction set whose vector fits in the target strides.
+#define DISPATCH_SIMD_METHOD(METHOD, ...)                                     \
+  const Level supported = level();                                            \
+  if (supported >= AVX512 && avx512::METHOD(__VA_ARGS__)) return true;        \
+  if (supported >= AVX2 && avx2::METHOD(__VA_ARGS__)) return true;            \
+  return false;
+#else
+Level level() { return NONE; }
+
+#define DISPATCH_SIMD_METHOD(METHOD, ...) return false;
+#endif
+
+#define DEFINE_SIMD_METHODS(REAL)                                             \
+  bool ApplyGate(REAL* state, const REAL* gate, int64_t nstates, int64_t tk,  \
+                 int m) {                                                     \
+    DISPATCH_SIMD_METHOD(ApplyGate, state, gate, nstates, tk, m)              \
+  }                                                                           \
+  bool ApplyZPow(REAL* state, const REAL* gate, int64_t nstates, int64_t tk,  \
+                 int m) {                                                     \
+    DISPATCH_SIMD_METHOD(ApplyZPow, state, gate, nstates, tk, m)              \
+  }                                                                           \
+  bool ApplyTwoQubitGate(REAL* state, const REAL* gate, int64_t nstates,      \
+                         int64_t ctk1, int64_t ctk2, int64_t tk1,             \
+                         int64_t tk2, int m1, int m2) {                       \
+    DISPATCH_SIMD_METHOD(ApplyTwoQubitGate, state, gate, nstates, ctk1,       \
+                         ctk2, tk1, tk2, m1, m2)                              \
+  }
+
+DEFINE_SIMD_METHODS(float)
+DEFINE_SIMD_METHODS(double)
+
+}  // namespace simd
+
+}  // namespace functor
+
+}  // namespace tensorflow
@@ -0,0 +1,95 @@
+/************************************************
+ * Vectorized CPU loops for the most common gate kernels.
+ *
+ * The loops are compiled once for each supported instruction set
+ * (AVX2 and AVX-512) in separate translation units and the best one is
+ * selected at runtime according to the features of the CPU, so that the
+ * same library can be used on all x86 machines.
+ *
+ * This header is included by translation units that are compiled with
+ * instruction set specific flags and therefore must not include Tensorflow
+ * or Eigen headers, whose inline functions would be compiled with these
+ * flags. Complex numbers are passed as pointers to interleaved real and
+ * imaginary parts.
+ *
+ * All methods return ``false`` if no vectorized implementation can be used
+ * (the CPU does not support any of the instruction sets or the target
+ * stride is smaller than the vector width) in which case the caller should
+ * fall back to the scalar implementation.
+ *
+ * The results are not bitwise identical across machines. The complex
+ * multiplications use fused multiply-add instructions, which round once
+ * instead of twice, so the vectorized and scalar loops may differ in the
+ * last bit of each amplitude. Which loop is used depends on the CPU and on
+ * the target qubits of each gate. The difference is bounded by a few units
+ * in the last place per gate (about 1e-7 in single and 1e-16 in double
+ * precision, relative to the amplitude) and grows at most linearly with the
+ * circuit depth, so results should be compared with a tolerance.
+ ***********************************************/
+#ifndef KERNEL_SIMD_H_
+#define KERNEL_SIMD_H_
+
+#include <cstdint>
+
+namespace tensorflow {
+
+namespace functor {
+
+namespace simd {
+
+enum Level { NONE = 0, AVX2 = 1, AVX512 = 2 };
+
+// Returns the widest instruction set supported by the CPU.
+Level level();
+
+// Applies a one-qubit gate matrix without controls.
+bool ApplyGate(float* state, const float* gate, int64_t nstates, int64_t tk,
+               int m);
+bool ApplyGate(double* state, const double* gate, int64_t nstates,
+               int64_t tk, int m);
+
+// Multiplies the |...1...> amplitudes with the phase ``gate[0]``.
+bool ApplyZPow(float* state, const float* gate, int64_t nstates, int64_t tk,
+               int m);
+bool ApplyZPow(double* state, const double* gate, int64_t nstates,
+               int64_t tk, int m);
+
+// Applies a two-qubit gate matrix without controls.
+// ``ctk1`` and ``ctk2`` are the strides of the targets ordered by qubit id
+// while ``tk1`` and ``tk2`` follow the order of the gate matrix.
+bool ApplyTwoQubitGate(float* state, const float* gate, int64_t nstates,
+                       int64_t ctk1, int64_t ctk2, int64_t tk1, int64_t tk2,
+                       int m1, int m2);
+bool ApplyTwoQubitGate(double* state, const double* gate, int64_t nstates,
+                       int64_t ctk1, int64_t ctk2, int64_t tk1, int64_t tk2,
+                       int m1, int m2);
+
+// Implementations for each instruction set.
+#define DECLARE_SIMD_METHODS(REAL)                                           \
+  bool ApplyGate(REAL* state, const REAL* gate, int64_t nstates, int64_t tk, \
+                 int m);                                                     \
+  bool ApplyZPow(REAL* state, const REAL* gate, int64_t nstates, int64_t tk, \
+                 int m);                                                     \
+  bool ApplyTwoQubitGate(REAL* state, const REAL* gate, int64_t nstates,     \
+                         int64_t ctk1, int64_t ctk2, int64_t tk1,           \
+                         int64_t tk2, int m1, int m2);
+
+namespace avx2 {
+DECLARE_SIMD_METHODS(float)
+DECLARE_SIMD_METHODS(double)
+}  // namespace avx2
+
+namespace avx512 {
+DECLARE_SIMD_METHODS(float)
+DECLARE_SIMD_METHODS(double)
+}  // namespace avx512
+
+#undef DECLARE_SIMD_METHODS
+
+}  // namespace simd
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_SIMD_H_
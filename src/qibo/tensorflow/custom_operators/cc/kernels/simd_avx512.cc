@@ -0,0 +1,77 @@
+// This file is compiled with ``-mavx512f`` on x86 (see Makefile)
+#ifdef __AVX512F__
+#include <immintrin.h>
+
+#include "simd.h"
+#include "simd_kernels.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+namespace simd {
+
+namespace avx512 {
+
+namespace {
+
+struct FloatVector {
+  typedef float real;
+  typedef __m512 vector;
+  static constexpr int64_t width = 8;
+
+  static inline vector set1(real x) { return _mm512_set1_ps(x); }
+  static inline vector load(const real* p) { return _mm512_loadu_ps(p); }
+  static inline void store(real* p, vector a) { _mm512_storeu_ps(p, a); }
+  static inline vector add(vector a, vector b) { return _mm512_add_ps(a, b); }
+  static inline vector mul(vector a, vector re, vector im) {
+    // (ar * re - ai * im, ai * re + ar * im)
+    const vector swapped = _mm512_permute_ps(a, 0xB1);
+    return _mm512_fmaddsub_ps(a, re, _mm512_mul_ps(swapped, im));
+  }
+};
+
+struct DoubleVector {
+  typedef double real;
+  typedef __m512d vector;
+  static constexpr int64_t width = 4;
+
+  static inline vector set1(real x) { return _mm512_set1_pd(x); }
+  static inline vector load(const real* p) { return _mm512_loadu_pd(p); }
+  static inline void store(real* p, vector a) { _mm512_storeu_pd(p, a); }
+  static inline vector add(vector a, vector b) { return _mm512_add_pd(a, b); }
+  static inline vector mul(vector a, vector re, vector im) {
+    const vector swapped = _mm512_permute_pd(a, 0x55);
+    return _mm512_fmaddsub_pd(a, re, _mm512_mul_pd(swapped, im));
+  }
+};
+
+}  // namespace
+
+#define DEFINE_SIMD_METHODS(REAL, VECTOR)                                    \
+  bool ApplyGate(REAL* state, const REAL* gate, int64_t nstates, int64_t tk, \
+                 int m) {                                                     \
+    return ApplyGateLoop<VECTOR>(state, gate, nstates, tk, m);                \
+  }                                                                           \
+  bool ApplyZPow(REAL* state, const REAL* gate, int64_t nstates, int64_t tk, \
+                 int m) {                                                     \
+    return ApplyZPowLoop<VECTOR>(state, gate, nstates, tk, m);                \
+  }                                                                           \
+  bool ApplyTwoQubitGate(REAL* state, const REAL* gate, int64_t nstates,     \
+                         int64_t ctk1, int64_t ctk2, int64_t tk1,            \
+                         int64_t tk2, int m1, int m2) {                       \
+    return ApplyTwoQubitGateLoop<VECTOR>(state, gate, nstates, ctk1, ctk2,   \
+                                         tk1, tk2, m1, m2);                  \
+  }
+
+DEFINE_SIMD_METHODS(float, FloatVector)
+DEFINE_SIMD_METHODS(double, DoubleVector)
+
+}  // namespace avx512
+
+}  // namespace simd
+
+}  // namespace functor
+
+}  // namespace tensorflow
+#endif  // __AVX512F__
@@ -0,0 +1,114 @@
+/************************************************
+ * Vectorized loops used by the instruction set specific implementations
+ * declared in ``simd.h``.
+ *
+ * The loops are templated on a vector type ``V`` that defines:
+ *    - ``V::real``: float or double,
+ *    - ``V::vector``: the register type,
+ *    - ``V::width``: the number of complex numbers in a register,
+ *    - ``V::set1(x)``: broadcasts a real number,
+ *    - ``V::load(p)``/``V::store(p, a)``: unaligned load and store,
+ *    - ``V::add(a, b)``: addition,
+ *    - ``V::mul(a, re, im)``: multiplication with a broadcasted complex number.
+ *
+ * A vector holds ``V::width`` consecutive amplitudes, therefore the loops
+ * can be used only when the strides of all targets are at least
+ * ``V::width``, so that the amplitudes of consecutive pairs are contiguous.
+ ***********************************************/
+#ifndef KERNEL_SIMD_KERNELS_H_
+#define KERNEL_SIMD_KERNELS_H_
+
+#include <cstdint>
+
+namespace tensorflow {
+
+namespace functor {
+
+namespace simd {
+
+template <typename V>
+bool ApplyGateLoop(typename V::real* state, const typename V::real* gate,
+                   int64_t nstates, int64_t tk, int m) {
+  typedef typename V::real real;
+  typedef typename V::vector vector;
+  if (tk < V::width) return false;
+  vector re[4], im[4];
+  for (int j = 0; j < 4; j++) {
+    re[j] = V::set1(gate[2 * j]);
+    im[j] = V::set1(gate[2 * j + 1]);
+  }
+
+  #pragma omp parallel for
+  for (int64_t g = 0; g < nstates; g += V::width) {
+    const int64_t i = ((int64_t)(g >> m) << (m + 1)) + (g & (tk - 1));
+    real* s1 = state + 2 * i;
+    real* s2 = state + 2 * (i + tk);
+    const vector x = V::load(s1);
+    const vector y = V::load(s2);
+    V::store(s1, V::add(V::mul(x, re[0], im[0]), V::mul(y, re[1], im[1])));
+    V::store(s2, V::add(V::mul(x, re[2], im[2]), V::mul(y, re[3], im[3])));
+  }
+  return true;
+}
+
+template <typename V>
+bool ApplyZPowLoop(typename V::real* state, const typename V::real* gate,
+                   int64_t nstates, int64_t tk, int m) {
+  typedef typename V::real real;
+  typedef typename V::vector vector;
+  if (tk < V::width) return false;
+  const vector re = V::set1(gate[0]);
+  const vector im = V::set1(gate[1]);
+
+  #pragma omp parallel for
+  for (int64_t g = 0; g < nstates; g += V::width) {
+    const int64_t i = ((int64_t)(g >> m) << (m + 1)) + (g & (tk - 1));
+    real* s2 = state + 2 * (i + tk);
+    V::store(s2, V::mul(V::load(s2), re, im));
+  }
+  return true;
+}
+
+template <typename V>
+bool ApplyTwoQubitGateLoop(typename V::real* state,
+                           const typename V::real* gate, int64_t nstates,
+                           int64_t ctk1, int64_t ctk2, int64_t tk1,
+                           int64_t tk2, int m1, int m2) {
+  typedef typename V::real real;
+  typedef typename V::vector vector;
+  // ``ctk1`` is the smallest of the two strides
+  if (ctk1 < V::width) return false;
+  vector re[16], im[16];
+  for (int j = 0; j < 16; j++) {
+    re[j] = V::set1(gate[2 * j]);
+    im[j] = V::set1(gate[2 * j + 1]);
+  }
+
+  #pragma omp parallel for
+  for (int64_t g = 0; g < nstates; g += V::width) {
+    int64_t i = ((int64_t)(g >> m1) << (m1 + 1)) + (g & (ctk1 - 1));
+    i = ((int64_t)(i >> m2) << (m2 + 1)) + (i & (ctk2 - 1));
+    real* s[4] = {state + 2 * i, state + 2 * (i + tk1), state + 2 * (i + tk2),
+                  state + 2 * (i + tk1 + tk2)};
+    vector x[4];
+    for (int l = 0; l < 4; l++) {
+      x[l] = V::load(s[l]);
+    }
+    for (int j = 0; j < 4; j++) {
+      vector y = V::mul(x[0], re[4 * j], im[4 * j]);
+      for (int l = 1; l < 4; l++) {
+        y = V::add(y, V::mul(x[l], re[4 * j + l], im[4 * j + l]));
+      }
+      V::store(s[j], y);
+    }
+  }
+  return true;
+}
+
+}  // namespace simd
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_SIMD_KERNELS_H_
@@ -0,0 +1,312 @@
+#include "state_checkpoint.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "tensorflow/core/framework/allocation_description.pb.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+// ``pwrite`` and ``pread`` of ``size`` bytes, retrying partial transfers
+static bool WriteAll(int fd, const char* data, int64 size, int64 offset) {
+  while (size > 0) {
+    const ssize_t n = pwrite(fd, data, size, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n, size -= n, offset += n;
+  }
+  return true;
+}
+
+static bool ReadAll(int fd, char* data, int64 size, int64 offset) {
+  while (size > 0) {
+    const ssize_t n = pread(fd, data, size, offset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n, size -= n, offset += n;
+  }
+  return true;
+}
+
+static int64 Align(int64 x) {
+  return (x + kCheckpointAlignment - 1) / kCheckpointAlignment *
+         kCheckpointAlignment;
+}
+
+// Offset of the first piece of a file with ``ntotal`` chunks
+static int64 DataOffset(int64 ntotal) {
+  return Align(sizeof(CheckpointHeader) + ntotal * sizeof(int64));
+}
+
+// Buffer of a piece that is mapped to memory, unmapped with the last tensor
+class MappedBuffer : public TensorBuffer {
+ public:
+  MappedBuffer(void* data, size_t size) : TensorBuffer(data), size_(size) {}
+  ~MappedBuffer() override { munmap(data(), size_); }
+
+  size_t size() const override { return size_; }
+  TensorBuffer* root_buffer() override { return this; }
+  void FillAllocationDescription(AllocationDescription* proto) const override {
+    proto->set_requested_bytes(size_);
+    proto->set_allocator_name("mmap");
+  }
+
+ private:
+  size_t size_;
+};
+
+
+template <typename T>
+class SaveStateOp : public OpKernel {
+ public:
+  explicit SaveStateOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("npieces", &npieces_));
+    OP_REQUIRES_OK(context, context->GetAttr("chunk_size", &chunk_size_));
+    OP_REQUIRES_OK(context, context->GetAttr("threshold", &threshold_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const std::string filename = context->input(0).scalar<tstring>()();
+    const int64 piece_size = context->input(1).NumElements();
+    std::vector<const T*> pieces(npieces_);
+    for (int i = 0; i < npieces_; i++) {
+      const Tensor& piece = context->input(i + 1);
+      OP_REQUIRES(context, piece.NumElements() == piece_size,
+                  errors::InvalidArgument("All pieces should have the same "
+                                          "number of amplitudes."));
+      pieces[i] = piece.flat<T>().data();
+    }
+    const int64 chunk_size = std::min(chunk_size_, piece_size);
+    OP_REQUIRES(context, chunk_size > 0 && piece_size % chunk_size == 0,
+                errors::InvalidArgument("The chunk size should divide the "
+                                        "size of the pieces."));
+    const int64 nchunks = piece_size / chunk_size;
+    const int64 ntotal = npieces_ * nchunks;
+    const int64 chunk_bytes = chunk_size * sizeof(T);
+
+    // zero chunks, or chunks of small norm, are not stored
+    std::vector<char> stored(ntotal);
+    #pragma omp parallel for
+    for (int64 c = 0; c < ntotal; c++) {
+      const T* x = pieces[c / nchunks] + (c % nchunks) * chunk_size;
+      bool keep = false;
+      if (threshold_ > 0) {
+        double norm = 0;
+        for (int64 j = 0; j < chunk_size; j++) norm += std::norm(x[j]);
+        keep = norm >= threshold_;
+      } else {
+        for (int64 j = 0; j < chunk_size && !keep; j++) keep = x[j] != T(0);
+      }
+      stored[c] = keep;
+    }
+
+    std::vector<int64> offsets(ntotal, -1);
+    int64 size = DataOffset(ntotal);
+    for (int64 p = 0; p < npieces_; p++) {
+      size = Align(size);
+      for (int64 c = p * nchunks; c < (p + 1) * nchunks; c++) {
+        if (stored[c]) {
+          offsets[c] = size;
+          size += chunk_bytes;
+        }
+      }
+    }
+
+    CheckpointHeader header;
+    std::memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+    header.version = kCheckpointVersion;
+    header.dtype = (int32)DataTypeToEnum<T>::value;
+    header.npieces = npieces_;
+    header.piece_size = piece_size;
+    header.chunk_size = chunk_size;
+
+    const std::string tmpname = filename + ".tmp";
+    const int fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    OP_REQUIRES(context, fd >= 0,
+                errors::Unavailable("Cannot open ", tmpname, ": ",
+                                    std::strerror(errno)));
+    std::atomic<bool> failed(
+        ftruncate(fd, size) != 0 ||
+        !WriteAll(fd, (const char*)&header, sizeof(header), 0) ||
+        !WriteAll(fd, (const char*)offsets.data(), ntotal * sizeof(int64),
+                  sizeof(header)));
+    #pragma omp parallel for schedule(dynamic)
+    for (int64 c = 0; c < ntotal; c++) {
+      if (offsets[c] < 0 || failed) continue;
+      const T* x = pieces[c / nchunks] + (c % nchunks) * chunk_size;
+      if (!WriteAll(fd, (const char*)x, chunk_bytes, offsets[c])) {
+        failed = true;
+      }
+    }
+    // the file is on disk before it replaces the previous checkpoint
+    bool ok = !failed && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    ok = ok && std::rename(tmpname.c_str(), filename.c_str()) == 0;
+    if (!ok) unlink(tmpname.c_str());
+    OP_REQUIRES(context, ok,
+                errors::Unavailable("Cannot write ", filename, "."));
+
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, TensorShape({}),
+                                                     &output));
+    output->flat<int64>()(0) = size;
+  }
+
+ private:
+  int npieces_, threads_;
+  int64 chunk_size_;
+  float threshold_;
+};
+
+
+template <typename T>
+class LoadStateOp : public OpKernel {
+ public:
+  explicit LoadStateOp(OpKernelConstruction* context) : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("npieces", &npieces_));
+    OP_REQUIRES_OK(context, context->GetAttr("mmap", &mmap_));
+    OP_REQUIRES_OK(context, context->GetAttr("omp_num_threads", &threads_));
+    omp_set_num_threads(threads_);
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const std::string filename = context->input(0).scalar<tstring>()();
+    const int fd = open(filename.c_str(), O_RDONLY);
+    OP_REQUIRES(context, fd >= 0,
+                errors::NotFound("Cannot open ", filename, ": ",
+                                 std::strerror(errno)));
+    // the descriptor is closed on all paths, mappings stay valid after it
+    std::unique_ptr<int, void (*)(int*)> closer(new int(fd), [](int* f) {
+      close(*f);
+      delete f;
+    });
+    struct stat st;
+    OP_REQUIRES(context, fstat(fd, &st) == 0,
+                errors::Unavailable("Cannot access ", filename, ": ",
+                                    std::strerror(errno)));
+    const int64 file_size = st.st_size;
+
+    CheckpointHeader header;
+    OP_REQUIRES(context, file_size >= (int64)sizeof(header) &&
+                             ReadAll(fd, (char*)&header, sizeof(header), 0) &&
+                             std::memcmp(header.magic, kCheckpointMagic,
+                                         sizeof(header.magic)) == 0,
+                errors::DataLoss(filename, " is not a state checkpoint."));
+    OP_REQUIRES(context, header.version == kCheckpointVersion,
+                errors::Unimplemented("Checkpoint version ", header.version,
+                                      " is not supported."));
+    OP_REQUIRES(context, header.dtype == (int32)DataTypeToEnum<T>::value,
+                errors::InvalidArgument(
+                    "Checkpoint of type ",
+                    DataTypeString((DataType)header.dtype),
+                    " cannot be loaded as ",
+                    DataTypeString(DataTypeToEnum<T>::value), "."));
+    OP_REQUIRES(context, header.npieces == npieces_,
+                errors::InvalidArgument("Checkpoint has ", header.npieces,
+                                        " pieces but ", npieces_,
+                                        " were requested."));
+    OP_REQUIRES(context, header.piece_size > 0 &&
+                             header.piece_size <= kCheckpointMaxPieceSize,
+                errors::DataLoss(filename, " has invalid piece size ",
+                                 header.piece_size, "."));
+    const int64 chunk_size = header.chunk_size;
+    OP_REQUIRES(context, chunk_size > 0 &&
+                             header.piece_size % chunk_size == 0,
+                errors::DataLoss(filename, " has invalid chunks."));
+    const int64 nchunks = header.piece_size / chunk_size;
+    // the table of offsets and all stored chunks must be in the file, so
+    // that truncated files are not read or mapped beyond their end
+    OP_REQUIRES(context, nchunks <= (file_size - (int64)sizeof(header)) /
+                                        (int64)sizeof(int64) / npieces_,
+                errors::DataLoss(filename, " is truncated."));
+    const int64 ntotal = npieces_ * nchunks;
+    const int64 chunk_bytes = chunk_size * sizeof(T);
+    std::vector<int64> offsets(ntotal);
+    OP_REQUIRES(context, ReadAll(fd, (char*)offsets.data(),
+                                 ntotal * sizeof(int64), sizeof(header)),
+                errors::DataLoss("Cannot read the chunks of ", filename, "."));
+    const int64 data_offset = DataOffset(ntotal);
+    for (int64 c = 0; c < ntotal; c++) {
+      OP_REQUIRES(context, offsets[c] == -1 ||
+                               (offsets[c] >= data_offset &&
+                                offsets[c] <= file_size - chunk_bytes),
+                  errors::DataLoss(filename, " is truncated or has invalid "
+                                   "chunk offsets."));
+    }
+
+    const TensorShape shape({header.piece_size});
+    const int64 page = sysconf(_SC_PAGESIZE);
+    std::vector<T*> pieces(npieces_, nullptr);
+    for (int p = 0; p < npieces_; p++) {
+      // pieces with all chunks stored are contiguous in the file
+      const int64* piece_offsets = offsets.data() + p * nchunks;
+      bool contiguous = piece_offsets[0] % page == 0;
+      for (int64 c = 0; c < nchunks && contiguous; c++) {
+        contiguous = piece_offsets[c] == piece_offsets[0] + c * chunk_bytes;
+      }
+      if (mmap_ && contiguous) {
+        const size_t bytes = header.piece_size * sizeof(T);
+        void* data = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, piece_offsets[0]);
+        OP_REQUIRES(context, data != MAP_FAILED,
+                    errors::Unavailable("Cannot map ", filename, ": ",
+                                        std::strerror(errno)));
+        MappedBuffer* buffer = new MappedBuffer(data, bytes);
+        context->set_output(p, Tensor(DataTypeToEnum<T>::value, shape,
+                                      buffer));
+        buffer->Unref();
+      } else {
+        Tensor* output = nullptr;
+        OP_REQUIRES_OK(context, context->allocate_output(p, shape, &output));
+        pieces[p] = output->flat<T>().data();
+      }
+    }
+
+    std::atomic<bool> failed(false);
+    #pragma omp parallel for schedule(dynamic)
+    for (int64 c = 0; c < ntotal; c++) {
+      T* x = pieces[c / nchunks];
+      if (x == nullptr || failed) continue;
+      x += (c % nchunks) * chunk_size;
+      if (offsets[c] < 0) {
+        std::memset((void*)x, 0, chunk_bytes);
+      } else if (!ReadAll(fd, (char*)x, chunk_bytes, offsets[c])) {
+        failed = true;
+      }
+    }
+    OP_REQUIRES(context, !failed,
+                errors::DataLoss("Cannot read the chunks of ", filename, "."));
+  }
+
+ private:
+  int npieces_, threads_;
+  bool mmap_;
+};
+
+
+// Checkpoints are written and read on the host.
+#define REGISTER_CHECKPOINT(T)                                               \
+  REGISTER_KERNEL_BUILDER(                                                   \
+      Name("SaveState").Device(DEVICE_CPU).TypeConstraint<T>("T"),           \
+      SaveStateOp<T>);                                                       \
+  REGISTER_KERNEL_BUILDER(                                                   \
+      Name("LoadState").Device(DEVICE_CPU).TypeConstraint<T>("T"),           \
+      LoadStateOp<T>);
+REGISTER_CHECKPOINT(complex64);
+REGISTER_CHECKPOINT(complex128);
+
+}  // namespace functor
+
+}  // namespace tensorflow
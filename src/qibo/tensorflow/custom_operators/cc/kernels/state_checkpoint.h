@@ -0,0 +1,55 @@
+/************************************************
+ * Checkpoint files of state vectors.
+ *
+ * ``SaveState`` writes one or more state pieces (a state vector or the
+ * pieces of a distributed state, as used by ``TransposeState``) to a binary
+ * file and ``LoadState`` reads them back. The file starts with a
+ * @struct CheckpointHeader, followed by a table with the byte offset of
+ * each chunk of ``chunk_size`` amplitudes of each piece. Chunks whose
+ * amplitudes are all zero are not stored and have offset ``-1``, which
+ * compresses the zero blocks of sparse states without loss. Optionally,
+ * chunks whose squared norm is below ``threshold`` are also dropped, which
+ * removes at most norm ``sqrt(threshold * nchunks)`` from the state.
+ *
+ * The stored chunks of each piece are contiguous and each piece starts at
+ * a page boundary, so chunks are written and read in parallel with
+ * ``pwrite`` and ``pread``, and pieces without dropped chunks can be mapped
+ * to memory without a copy. Mapped pieces are private mappings whose pages
+ * are read on first access, and the in-place operators modify them without
+ * changing the file. The file is written to ``filename.tmp``, flushed to
+ * disk with ``fsync`` and renamed at the end, so an interrupted checkpoint
+ * does not replace the previous file. ``LoadState`` checks the header and
+ * the chunk offsets against the size of the file before reading or mapping
+ * it, so truncated or corrupted files give an error. Numbers are stored in
+ * the byte order of the host.
+ ***********************************************/
+#ifndef KERNEL_STATE_CHECKPOINT_H_
+#define KERNEL_STATE_CHECKPOINT_H_
+
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+const char kCheckpointMagic[8] = {'Q', 'I', 'B', 'O', 'S', 'T', 'A', 'T'};
+const int32 kCheckpointVersion = 1;
+// Alignment of the pieces in the file, a multiple of the usual page sizes
+const int64 kCheckpointAlignment = 1 << 16;
+// Largest number of amplitudes of a piece that is loaded
+const int64 kCheckpointMaxPieceSize = (int64)1 << 50;
+
+struct CheckpointHeader {
+  char magic[8];       //!< ``kCheckpointMagic``.
+  int32 version;       //!< ``kCheckpointVersion``.
+  int32 dtype;         //!< ``DataType`` of the amplitudes.
+  int64 npieces;       //!< Number of pieces.
+  int64 piece_size;    //!< Number of amplitudes of each piece.
+  int64 chunk_size;    //!< Number of amplitudes of each chunk.
+};
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_STATE_CHECKPOINT_H_
@@ -0,0 +1,95 @@
+#include "state_pool.h"
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+typedef std::tuple<std::string, int, int64> PoolKey;
+
+static std::mutex pool_mutex;
+
+static std::map<PoolKey, std::vector<Tensor>>& Pool() {
+  static std::map<PoolKey, std::vector<Tensor>> pool;
+  return pool;
+}
+
+// Only the aligned part of the buffer can be backed by huge pages.
+void AdviseHugePages(const Tensor& tensor) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  const uintptr_t page = (uintptr_t)1 << 21;
+  const uintptr_t start = (uintptr_t)tensor.tensor_data().data();
+  const uintptr_t begin = (start + page - 1) & ~(page - 1);
+  const uintptr_t end = (start + tensor.TotalBytes()) & ~(page - 1);
+  if (end > begin) {
+    // failures are ignored because the advice only affects performance
+    madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+  }
+#endif
+}
+
+Status AllocatePooled(OpKernelContext* context, DataType dtype,
+                      const TensorShape& shape, Tensor* tensor) {
+  const PoolKey key(context->device()->name(), (int)dtype,
+                    shape.num_elements());
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  std::vector<Tensor>& entries = Pool()[key];
+  for (Tensor& entry : entries) {
+    // the pool holds the only reference so no other tensor uses the buffer
+    if (entry.RefCountIsOne()) {
+      if (!tensor->CopyFrom(entry, shape)) {
+        return errors::Internal("Cannot reshape pooled buffer.");
+      }
+      return Status::OK();
+    }
+  }
+  Status status = context->allocate_temp(dtype, shape, tensor);
+  if (!status.ok()) return status;
+  if ((int)entries.size() < kMaxPooledTensors) entries.push_back(*tensor);
+  return Status::OK();
+}
+
+int64 ClearStatePool() {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  int64 released = 0;
+  for (auto& it : Pool()) {
+    std::vector<Tensor>& entries = it.second;
+    for (auto entry = entries.begin(); entry != entries.end();) {
+      if (entry->RefCountIsOne()) {
+        released += entry->TotalBytes();
+        entry = entries.erase(entry);
+      } else {
+        entry++;
+      }
+    }
+  }
+  return released;
+}
+
+class ClearStatePoolOp : public OpKernel {
+ public:
+  explicit ClearStatePoolOp(OpKernelConstruction* context)
+      : OpKernel(context) {}
+
+  void Compute(OpKernelContext* context) override {
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context, context->allocate_output(0, TensorShape({}),
+                                                     &output));
+    output->flat<int64>()(0) = ClearStatePool();
+  }
+};
+
+// The pool is global so the kernel runs on the host.
+REGISTER_KERNEL_BUILDER(Name("ClearStatePool").Device(DEVICE_CPU),
+                        ClearStatePoolOp);
+
+}  // namespace functor
+
+}  // namespace tensorflow
@@ -0,0 +1,49 @@
+/************************************************
+ * Pool of scratch buffers that are reused across executions.
+ *
+ * Circuits of the same size allocate the same scratch buffers (norms,
+ * partial sums, probabilities, trajectory batches) in every execution.
+ * @fn AllocatePooled returns such buffers from a pool that is keyed by the
+ * device, the data type and the number of elements. A pooled tensor is
+ * reused only when the pool holds its only reference, that is when the op
+ * that used it before has finished, so reuse never changes the results of
+ * the ops. Otherwise a new entry is allocated, up to ``kMaxPooledTensors``
+ * per key, after which the buffers are allocated without the pool.
+ *
+ * Only temporary buffers that are released when the op finishes are pooled.
+ * States returned as outputs are not, because the reference of the pool
+ * would prevent @fn ForwardState from forwarding them to the first gate
+ * (see forward_state.h), which would then copy the whole state. Large host
+ * states are instead advised to use transparent huge pages with
+ * @fn AdviseHugePages before their first touch. The ``ClearStatePool``
+ * operator releases the pooled buffers that are not in use.
+ ***********************************************/
+#ifndef KERNEL_STATE_POOL_H_
+#define KERNEL_STATE_POOL_H_
+
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+
+namespace functor {
+
+// Maximum number of buffers of each key that the pool holds
+const int kMaxPooledTensors = 4;
+
+// Sets ``tensor`` to a scratch buffer of ``dtype`` and ``shape`` on the
+// device of the op, which must not be set as an output.
+Status AllocatePooled(OpKernelContext* context, DataType dtype,
+                      const TensorShape& shape, Tensor* tensor);
+
+// Advises the kernel to back the host buffer of ``tensor`` with huge pages.
+// This has to happen before the first touch of the pages.
+void AdviseHugePages(const Tensor& tensor);
+
+// Releases the pooled buffers that are not in use and returns their bytes.
+int64 ClearStatePool();
+
+}  // namespace functor
+
+}  // namespace tensorflow
+
+#endif  // KERNEL_STATE_POOL_H_
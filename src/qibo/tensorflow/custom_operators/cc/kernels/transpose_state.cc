@@ -1,6 +1,17 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+#endif  // GOOGLE_CUDA
+
 #include "transpose_state.h"
+#include "forward_state.h"
+#include <algorithm>
+#include <cstring>
 #include "tensorflow/core/framework/op_kernel.h"
 
+#define DEFAULT_TRANSPOSE_BLOCK 12  // bits of the transposed index handled
+                                    // by the inner loop of each thread
+#define DEFAULT_TRANSPOSE_RUN 16    // minimum run length copied by memcpy
+
 namespace tensorflow {
 
 typedef Eigen::ThreadPoolDevice CPUDevice;
@@ -10,23 +21,53 @@ namespace functor {
 
 template <typename T>
 struct TransposeStateFunctor<CPUDevice, T> {
-  void operator()(const OpKernelContext* context, const CPUDevice &d,
+  void operator()(OpKernelContext* context, const CPUDevice &d,
                   const std::vector<T*> state, T* transposed_state,
                   int nqubits, int ndevices, const int* qubit_order) {
-    const int64 nstates = (int64) 1 << nqubits;
-    const int64 npiece = (int64) nstates / ndevices;
+    int nglobal = 0;
+    while ((1 << nglobal) < ndevices) nglobal++;
+    const int nlocal = nqubits - nglobal;
+    const int64 localmask = ((int64)1 << nlocal) - 1;
+    // index of the state that corresponds to each bit of the transposed index
     std::vector<int64> qubit_exponents(nqubits);
     for (int q = 0; q < nqubits; q++) {
       qubit_exponents[q] = (int64) 1 << (nqubits - qubit_order[nqubits - q - 1] - 1);
     }
 
+    // the lowest ``nrun`` bits are not permuted, so runs of ``2^nrun``
+    // amplitudes are contiguous both in the pieces and in the output
+    int nrun = 0;
+    while (nrun < nlocal && qubit_exponents[nrun] == (int64)1 << nrun) nrun++;
+    // the next bits up to ``nblock`` form the permuted inner part, whose
+    // offsets are tabulated once
+    const int nblock = std::min(nqubits, std::max(nrun, DEFAULT_TRANSPOSE_BLOCK));
+    const int64 nrunstates = (int64)1 << nrun;
+    const int64 ninner = (int64)1 << (nblock - nrun);
+    std::vector<int64> offsets(ninner, 0);
+    for (int64 t = 0; t < ninner; t++) {
+      for (int q = nrun; q < nblock; q++) {
+        if ((t >> (q - nrun)) & 1) offsets[t] |= qubit_exponents[q];
+      }
+    }
+
+    const int64 nouter = (int64)1 << (nqubits - nblock);
     #pragma omp parallel for
-    for (int64 g = 0; g < nstates; g++) {
-      int64 k = 0;
-      for (int q = 0; q < nqubits; q++) {
-        if ((g >> q) % 2) k += qubit_exponents[q];
+    for (int64 h = 0; h < nouter; h++) {
+      int64 base = 0;
+      for (int q = nblock; q < nqubits; q++) {
+        if ((h >> (q - nblock)) & 1) base |= qubit_exponents[q];
+      }
+      T* out = transposed_state + (h << nblock);
+      for (int64 t = 0; t < ninner; t++) {
+        const int64 k = base | offsets[t];
+        const T* src = state[k >> nlocal] + (k & localmask);
+        if (nrunstates >= DEFAULT_TRANSPOSE_RUN) {
+          std::memcpy(out, src, nrunstates * sizeof(T));
+        } else {
+          for (int64 j = 0; j < nrunstates; j++) out[j] = src[j];
+        }
+        out += nrunstates;
       }
-      transposed_state[g] = state[(int64) k / npiece][(int64) k % npiece];
     }
   };
 };
@@ -34,7 +75,7 @@ struct TransposeStateFunctor<CPUDevice, T> {
 
 template <typename T>
 struct SwapPiecesFunctor<CPUDevice, T> {
-  void operator()(const OpKernelContext* context, const CPUDevice &d,
+  void operator()(OpKernelContext* context, const CPUDevice &d,
                   T* piece0, T* piece1, int new_global, int nqubits) {
     const int m = nqubits - new_global - 1;
     const int64 tk = (int64)1 << m;
@@ -66,18 +107,15 @@ class TransposeStateOp : public OpKernel {
     for (int i = 0; i < ndevices_; i++) {
       state[i] = (T*) context->input(i).flat<T>().data();
     }
-    Tensor transposed_state = context->input(ndevices_);
-
-    // prevent running on GPU
-    OP_REQUIRES(
-        context, (std::is_same<Device, CPUDevice>::value == true),
-        errors::Unimplemented("TransposeStateOp operator not implemented for GPU."));
+    // the output buffer is overwritten so it is never copied
+    Tensor transposed_state;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(
+        context, ndevices_, 0, &transposed_state, true));
 
     // call the implementation
     TransposeStateFunctor<Device, T>()(context, context->eigen_device<Device>(),
                                        state, transposed_state.flat<T>().data(),
                                        nqubits_, ndevices_, qubit_order_.data());
-    context->set_output(0, transposed_state);
   }
   private:
    int nqubits_;
@@ -98,23 +136,20 @@ class SwapPiecesOp : public OpKernel {
   }
 
   void Compute(OpKernelContext *context) override {
-    // grabe the input tensor
-    Tensor piece0 = context->input(0);
-    Tensor piece1 = context->input(1);
-
-    // prevent running on GPU
-    OP_REQUIRES(
-        context, (std::is_same<Device, CPUDevice>::value == true),
-        errors::Unimplemented("SwapPiecesOp operator not implemented for GPU."));
+    // the pieces are always updated in-place because they are the buffers
+    // of the ``tf.Variable``s of the distributed state (see forward_state.h)
+    Tensor piece0;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 0, 0, &piece0,
+                                                    true));
+    Tensor piece1;
+    OP_REQUIRES_OK(context, ForwardState<Device, T>(context, 1, 1, &piece1,
+                                                    true));
 
     // call the implementation
     SwapPiecesFunctor<Device, T>()(context, context->eigen_device<Device>(),
                                    piece0.flat<T>().data(),
                                    piece1.flat<T>().data(),
                                    target_, nqubits_);
-
-    context->set_output(0, piece0);
-    context->set_output(1, piece1);
   }
   private:
    int nqubits_, target_, threads_;
@@ -137,21 +172,23 @@ REGISTER_SWAPPIECE_CPU(complex64);
 REGISTER_SWAPPIECE_CPU(complex128);
 
 
+#ifdef GOOGLE_CUDA
 // Register the GPU kernels.
-#define REGISTER_TRANSPOSE_GPU(T)                                             \
+#define REGISTER_TRANSPOSE_GPU(T)                                       \
   extern template struct TransposeStateFunctor<GPUDevice, T>;           \
-  REGISTER_KERNEL_BUILDER(                                          \
+  REGISTER_KERNEL_BUILDER(                                              \
       Name("TransposeState").Device(DEVICE_GPU).TypeConstraint<T>("T"), \
       TransposeStateOp<GPUDevice, T>);
 REGISTER_TRANSPOSE_GPU(complex64);
 REGISTER_TRANSPOSE_GPU(complex128);
 
-#define REGISTER_SWAPPIECE_GPU(T)                                             \
+#define REGISTER_SWAPPIECE_GPU(T)                                   \
   extern template struct SwapPiecesFunctor<GPUDevice, T>;           \
   REGISTER_KERNEL_BUILDER(                                          \
       Name("SwapPieces").Device(DEVICE_GPU).TypeConstraint<T>("T"), \
       SwapPiecesOp<GPUDevice, T>);
 REGISTER_SWAPPIECE_GPU(complex64);
 REGISTER_SWAPPIECE_GPU(complex128);
+#endif
 }  // namespace functor
 }  // namespace tensorflow
@@ -0,0 +1,152 @@
+#if GOOGLE_CUDA
+#define EIGEN_USE_GPU
+
+#include "gpu_launch.h"
+#include "transpose_state.h"
+#include "tensorflow/core/framework/op_kernel.h"
+
+namespace tensorflow {
+namespace functor {
+
+typedef Eigen::GpuDevice GPUDevice;
+
+// Returns the device that holds ``ptr`` or -1 if it is not device memory.
+inline int PointerDevice(const void* ptr) {
+  cudaPointerAttributes attributes;
+  if (cudaPointerGetAttributes(&attributes, ptr) != cudaSuccess) {
+    cudaGetLastError();
+    return -1;
+  }
+  return attributes.type == cudaMemoryTypeDevice ? attributes.device : -1;
+}
+
+// Returns the other device that holds ``ptr`` if the current device
+// ``device`` can copy from it with peer-to-peer transfers, otherwise -1.
+inline int PeerDevice(const void* ptr, int device) {
+  const int other = PointerDevice(ptr);
+  if (other < 0 || other == device) return -1;
+  int can_access = 0;
+  if (cudaDeviceCanAccessPeer(&can_access, device, other) != cudaSuccess) {
+    cudaGetLastError();
+    return -1;
+  }
+  return can_access ? other : -1;
+}
+
+// ``exponents`` holds the index of the state that corresponds to each bit
+// of the transposed index and ``pieces`` the device pointers of the pieces.
+template <typename T>
+__global__ void TransposeStateKernel(long nstates, T** pieces,
+                                     T* transposed_state,
+                                     const int64* exponents, int nqubits,
+                                     int nlocal) {
+  const long mask = ((long)1 << nlocal) - 1;
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    long k = 0;
+    for (int q = 0; q < nqubits; q++) {
+      if ((g >> q) & 1) k += exponents[q];
+    }
+    transposed_state[g] = pieces[k >> nlocal][k & mask];
+  }
+}
+
+template <typename T>
+struct TransposeStateFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d,
+                  const std::vector<T*> state, T* transposed_state,
+                  int nqubits, int ndevices, const int* qubit_order) const {
+    const int64 nstates = (int64)1 << nqubits;
+    int nglobal = 0;
+    while ((1 << nglobal) < ndevices) nglobal++;
+
+    // the exponents and the piece pointers are copied to the device together
+    std::vector<int64> info(nqubits + ndevices);
+    for (int q = 0; q < nqubits; q++) {
+      info[q] = (int64)1 << (nqubits - qubit_order[nqubits - q - 1] - 1);
+    }
+    // pieces of other devices are copied peer-to-peer to a buffer of this
+    // device instead of being read remotely by the kernel
+    const int64 piece_size = nstates / ndevices;
+    int device;
+    cudaGetDevice(&device);
+    std::vector<int> peers(ndevices);
+    int npeers = 0;
+    for (int i = 0; i < ndevices; i++) {
+      peers[i] = PeerDevice(state[i], device);
+      if (peers[i] >= 0) npeers++;
+    }
+    Tensor tensor_peers;
+    if (npeers > 0) {
+      OP_REQUIRES_OK(context, context->allocate_temp(
+          DataTypeToEnum<T>::value, TensorShape({npeers * piece_size}),
+          &tensor_peers));
+    }
+    T* buffer = npeers > 0 ? tensor_peers.flat<T>().data() : nullptr;
+    for (int i = 0; i < ndevices; i++) {
+      T* piece = state[i];
+      if (peers[i] >= 0) {
+        cudaMemcpyPeerAsync(buffer, device, piece, peers[i],
+                            piece_size * sizeof(T), d.stream());
+        piece = buffer;
+        buffer += piece_size;
+      }
+      info[nqubits + i] = (int64)piece;
+    }
+    Tensor tensor_info;
+    OP_REQUIRES_OK(context, context->allocate_temp(
+        DT_INT64, TensorShape({(int64)info.size()}), &tensor_info));
+    int64* device_info = tensor_info.flat<int64>().data();
+    d.memcpyHostToDevice(device_info, info.data(),
+                         info.size() * sizeof(int64));
+
+    LaunchKernel(TransposeStateKernel<T>, d, nstates,
+                 (T**)(device_info + nqubits), transposed_state,
+                 (const int64*)device_info, nqubits, nqubits - nglobal);
+  }
+};
+
+template <typename T>
+__global__ void SwapPiecesKernel(long nstates, T* piece0, T* piece1, int m) {
+  const long tk = (long)1 << m;
+  GPU_GRID_STRIDE_LOOP(g, nstates) {
+    const long i = ((g >> m) << (m + 1)) + (g & (tk - 1));
+    const T x = piece0[i + tk];
+    piece0[i + tk] = piece1[i];
+    piece1[i] = x;
+  }
+}
+
+template <typename T>
+struct SwapPiecesFunctor<GPUDevice, T> {
+  void operator()(OpKernelContext* context, const GPUDevice& d,
+                  T* piece0, T* piece1, int new_global, int nqubits) const {
+    const int m = nqubits - new_global - 1;
+    const int64 nstates = (int64)1 << (nqubits - 1);
+    int device;
+    cudaGetDevice(&device);
+    const int peer = PeerDevice(piece1, device);
+    if (peer < 0) {
+      LaunchKernel(SwapPiecesKernel<T>, d, nstates, piece0, piece1, m);
+      return;
+    }
+    // ``piece1`` is on another device: it is swapped in a copy on this
+    // device and copied back, with peer-to-peer transfers on the stream
+    const int64 bytes = 2 * nstates * sizeof(T);
+    Tensor tensor_copy;
+    OP_REQUIRES_OK(context, context->allocate_temp(
+        DataTypeToEnum<T>::value, TensorShape({2 * nstates}), &tensor_copy));
+    T* copy = tensor_copy.flat<T>().data();
+    cudaMemcpyPeerAsync(copy, device, piece1, peer, bytes, d.stream());
+    LaunchKernel(SwapPiecesKernel<T>, d, nstates, piece0, copy, m);
+    cudaMemcpyPeerAsync(piece1, peer, copy, device, bytes, d.stream());
+  }
+};
+
+// Explicitly instantiate functors for the types of OpKernels registered.
+template struct TransposeStateFunctor<GPUDevice, complex64>;
+template struct TransposeStateFunctor<GPUDevice, complex128>;
+template struct SwapPiecesFunctor<GPUDevice, complex64>;
+template struct SwapPiecesFunctor<GPUDevice, complex128>;
+}  // end namespace functor
+}  // end namespace tensorflow
+#endif  // GOOGLE_CUDA
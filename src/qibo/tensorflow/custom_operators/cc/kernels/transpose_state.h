@@ -1,3 +1,17 @@
+/************************************************
+ * Functors that move amplitudes between the pieces of a distributed state.
+ *
+ *    - @struct TransposeStateFunctor
+ *        Reassembles the pieces of a state whose global qubits are given by
+ *        ``qubit_order`` into a single state with the normal qubit order.
+ *    - @struct SwapPiecesFunctor
+ *        Swaps a global qubit with a local qubit by exchanging the halves of
+ *        two pieces that differ in the local qubit.
+ *
+ * Both functors have CPU and GPU implementations, so that the pieces can be
+ * kept on a GPU memory device and global-local swaps do not go through host
+ * memory. The GPU functors receive device pointers of all pieces.
+ ***********************************************/
 #ifndef KERNEL_TRANSPOSE_STATE_H_
 #define KERNEL_TRANSPOSE_STATE_H_
 
@@ -9,14 +23,14 @@ namespace functor {
 
 template <typename Device, typename T>
 struct TransposeStateFunctor {
-  void operator()(const OpKernelContext* context, const Device &d,
+  void operator()(OpKernelContext* context, const Device &d,
                   const std::vector<T*> state, T* transposed_state,
                   int nqubits, int ndevices, const int* qubit_order) const;
 };
 
 template <typename Device, typename T>
 struct SwapPiecesFunctor {
-  void operator()(const OpKernelContext* context, const Device &d,
+  void operator()(OpKernelContext* context, const Device &d,
                   T* piece0, T* piece1, int new_global, int nqubits) const;
 };
 
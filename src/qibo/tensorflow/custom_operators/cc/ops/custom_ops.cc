@@ -6,12 +6,46 @@ using namespace tensorflow;
 // Register op that generates initial state
 REGISTER_OP("InitialState")
     .Attr("nqubits: int")
-    .Attr("dtype: {complex64, complex128}")
+    .Attr("dtype: {complex64, complex128, half}")
     .Attr("is_matrix: bool")
     .Attr("omp_num_threads: int")
+    .Attr("nbatch: int = 0")
     .Output("out: dtype");
 
 
+// Register op that creates a computational basis state
+REGISTER_OP("BasisState")
+    .Input("index: int64")
+    .Attr("nqubits: int")
+    .Attr("dtype: {complex64, complex128, half}")
+    .Attr("is_matrix: bool")
+    .Attr("omp_num_threads: int")
+    .Attr("nbatch: int = 0")
+    .Output("out: dtype");
+
+
+// Register op that creates a product state from the amplitudes of each qubit
+REGISTER_OP("ProductState")
+    .Attr("T: {complex64, complex128}")
+    .Input("amplitudes: T")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->UnknownShapeOfRank(1));
+      return Status::OK();
+    });
+
+// Register op that resets an existing state to the initial state in-place
+REGISTER_OP("ResetState")
+    .Attr("T: {complex64, complex128, half}")
+    .Input("state: T")
+    .Attr("nqubits: int")
+    .Attr("is_matrix: bool")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+
 // Register op that changes qubit order for multi-GPU
 REGISTER_OP("TransposeState")
     .Attr("T: {complex64, complex128}")
@@ -48,81 +82,367 @@ REGISTER_OP("MeasureFrequencies")
     .Attr("nqubits: int")
     .Attr("seed: int")
     .Attr("omp_num_threads: int")
+    .Attr("exact: bool = false")
     .Output("out: Tint")
     .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
 
+// Register op that samples measurement frequencies exactly and returns
+// only the sampled states with their counts
+REGISTER_OP("MeasureFrequenciesSparse")
+    .Attr("Tfloat: {float32, float64}")
+    .Attr("Tint: {int32, int64} = DT_INT64")
+    .Input("probs: Tfloat")
+    .Attr("nshots: float")
+    .Attr("nqubits: int")
+    .Attr("seed: int")
+    .Attr("omp_num_threads: int")
+    .Output("states: int64")
+    .Output("counts: Tint")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->Vector(c->UnknownDim()));
+      c->set_output(1, c->Vector(c->UnknownDim()));
+      return Status::OK();
+    });
 
-// Register op that collapses state vector according to measured bit string
-REGISTER_OP("CollapseState")            \
-    .Attr("T: {complex64, complex128}") \
-    .Input("state: T")                  \
-    .Input("qubits: int32")             \
-    .Input("result: int64")             \
-    .Attr("nqubits: int")               \
-    .Attr("normalize: bool")            \
-    .Attr("omp_num_threads: int")       \
-    .Output("out: T")                   \
+
+// Register op that samples measurement frequencies of some qubits directly
+// from the state vector
+REGISTER_OP("MeasureState")
+    .Attr("T: {complex64, complex128, half}")
+    .Attr("Tint: {int32, int64}")
+    .Input("frequencies: Tint")
+    .Input("state: T")
+    .Input("qubits: int32")
+    .Attr("nshots: float")
+    .Attr("nqubits: int")
+    .Attr("seed: int")
+    .Attr("omp_num_threads: int")
+    .Output("out: Tint")
     .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
 
 
+// Register op that calculates expectation values of Pauli strings
+REGISTER_OP("PauliExpectation")
+    .Attr("T: {complex64, complex128}")
+    .Attr("Tout: {float32, float64}")
+    .Input("state: T")
+    .Input("paulis: int32")
+    .Attr("nqubits: int")
+    .Attr("omp_num_threads: int")
+    .Output("out: Tout")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->Vector(c->Dim(c->input(1), 0)));
+      return Status::OK();
+    });
+
+
+// Register op that collapses state vector according to measured bit string
+// and returns the probability of the measured result
+REGISTER_OP("CollapseState")                  \
+    .Attr("T: {complex64, complex128, half}") \
+    .Input("state: T")                        \
+    .Input("qubits: int32")                   \
+    .Input("result: int64")                   \
+    .Attr("nqubits: int")                     \
+    .Attr("normalize: bool")                  \
+    .Attr("omp_num_threads: int")             \
+    .Output("out: T")                         \
+    .Output("probability: float64")           \
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->input(0));
+      c->set_output(1, c->Vector(c->UnknownDim()));
+      return Status::OK();
+    });
+
+
+// Register op that collapses state vector according to measured bit string
+// and returns the state of the unmeasured qubits
+REGISTER_OP("CompactCollapseState")
+    .Attr("T: {complex64, complex128, half}")
+    .Input("state: T")
+    .Input("qubits: int32")
+    .Input("result: int64")
+    .Attr("nqubits: int")
+    .Attr("normalize: bool")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .Output("probability: float64")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->UnknownShape());
+      c->set_output(1, c->Vector(c->UnknownDim()));
+      return Status::OK();
+    });
+
+
 // Register one-qubit gate op with gate matrix
-#define REGISTER_GATE1_OP(NAME)           \
-  REGISTER_OP(NAME)                       \
-      .Attr("T: {complex64, complex128}") \
-      .Input("state: T")                  \
-      .Input("gate: T")                   \
-      .Input("qubits: int32")             \
-      .Attr("nqubits: int")               \
-      .Attr("target: int")                \
-      .Attr("omp_num_threads: int")       \
-      .Output("out: T")                   \
+#define REGISTER_GATE1_OP(NAME)                 \
+  REGISTER_OP(NAME)                             \
+      .Attr("T: {complex64, complex128, half}") \
+      .Input("state: T")                        \
+      .Input("gate: T")                         \
+      .Input("qubits: int32")                   \
+      .Attr("nqubits: int")                     \
+      .Attr("target: int")                      \
+      .Attr("omp_num_threads: int")             \
+      .Output("out: T")                         \
       .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
 
 // Register one-qubit gate op without gate matrix
-#define REGISTER_GATE1_NOMATRIX_OP(NAME)  \
+#define REGISTER_GATE1_NOMATRIX_OP(NAME)        \
+  REGISTER_OP(NAME)                             \
+      .Attr("T: {complex64, complex128, half}") \
+      .Input("state: T")                        \
+      .Input("qubits: int32")                   \
+      .Attr("nqubits: int")                     \
+      .Attr("target: int")                      \
+      .Attr("omp_num_threads: int")             \
+      .Output("out: T")                         \
+      .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+// Register two-qubit gate op with gate matrix
+#define REGISTER_GATE2_OP(NAME)                 \
+  REGISTER_OP(NAME)                             \
+      .Attr("T: {complex64, complex128, half}") \
+      .Input("state: T")                        \
+      .Input("gate: T")                         \
+      .Input("qubits: int32")                   \
+      .Attr("nqubits: int")                     \
+      .Attr("target1: int")                     \
+      .Attr("target2: int")                     \
+      .Attr("omp_num_threads: int")             \
+      .Output("out: T")                         \
+      .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+// Register two-qubit gate op without gate matrix
+#define REGISTER_GATE2_NOMATRIX_OP(NAME)        \
+  REGISTER_OP(NAME)                             \
+      .Attr("T: {complex64, complex128, half}") \
+      .Input("state: T")                        \
+      .Input("qubits: int32")                   \
+      .Attr("nqubits: int")                     \
+      .Attr("target1: int")                     \
+      .Attr("target2: int")                     \
+      .Attr("omp_num_threads: int")             \
+      .Output("out: T")                         \
+      .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+REGISTER_GATE1_OP("ApplyGate")
+REGISTER_GATE1_OP("ApplyZPow")
+REGISTER_GATE1_NOMATRIX_OP("ApplyX")
+REGISTER_GATE1_NOMATRIX_OP("ApplyY")
+REGISTER_GATE1_NOMATRIX_OP("ApplyZ")
+
+REGISTER_GATE2_OP("ApplyTwoQubitGate")
+REGISTER_GATE2_OP("ApplyFsim")
+REGISTER_GATE2_NOMATRIX_OP("ApplySwap")
+
+
+// Register gradient ops of the gates with gate matrix. They return the
+// gradients with respect to the state before the gate and to the gate
+// matrix. If ``undo`` is set the state input is the state after the gate,
+// which is restored to the state before the gate, otherwise it is the state
+// before the gate, which is returned unchanged.
+static Status GateGradientShape(
+    ::tensorflow::shape_inference::InferenceContext* c) {
+  c->set_output(0, c->input(0));
+  c->set_output(1, c->input(1));
+  c->set_output(2, c->input(2));
+  return Status::OK();
+}
+
+#define REGISTER_GATE1_GRAD_OP(NAME)      \
   REGISTER_OP(NAME)                       \
       .Attr("T: {complex64, complex128}") \
       .Input("state: T")                  \
+      .Input("grad: T")                   \
+      .Input("gate: T")                   \
       .Input("qubits: int32")             \
       .Attr("nqubits: int")               \
       .Attr("target: int")                \
       .Attr("omp_num_threads: int")       \
-      .Output("out: T")                   \
-      .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+      .Attr("undo: bool = true")          \
+      .Output("state_out: T")             \
+      .Output("grad_out: T")              \
+      .Output("gate_grad: T")             \
+      .SetShapeFn(GateGradientShape);
 
-// Register two-qubit gate op with gate matrix
-#define REGISTER_GATE2_OP(NAME)           \
+#define REGISTER_GATE2_GRAD_OP(NAME)      \
   REGISTER_OP(NAME)                       \
       .Attr("T: {complex64, complex128}") \
       .Input("state: T")                  \
+      .Input("grad: T")                   \
       .Input("gate: T")                   \
       .Input("qubits: int32")             \
       .Attr("nqubits: int")               \
       .Attr("target1: int")               \
       .Attr("target2: int")               \
       .Attr("omp_num_threads: int")       \
-      .Output("out: T")                   \
-      .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+      .Attr("undo: bool = true")          \
+      .Output("state_out: T")             \
+      .Output("grad_out: T")              \
+      .Output("gate_grad: T")             \
+      .SetShapeFn(GateGradientShape);
 
-// Register two-qubit gate op without gate matrix
-#define REGISTER_GATE2_NOMATRIX_OP(NAME)  \
+REGISTER_GATE1_GRAD_OP("ApplyGateGrad")
+REGISTER_GATE1_GRAD_OP("ApplyZPowGrad")
+REGISTER_GATE2_GRAD_OP("ApplyTwoQubitGateGrad")
+REGISTER_GATE2_GRAD_OP("ApplyFsimGrad")
+
+
+// Register multi-qubit gate op with gate matrix
+REGISTER_OP("ApplyMultiQubitGate")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("gate: T")
+    .Input("qubits: int32")
+    .Attr("nqubits: int")
+    .Attr("targets: list(int)")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+
+// Register op that applies a product of diagonal gates in a single pass
+REGISTER_OP("ApplyDiagonalLayer")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("phases: T")
+    .Input("targets: int32")
+    .Input("ntargets: int32")
+    .Attr("nqubits: int")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+// Register op that applies a sequence of gates
+REGISTER_OP("ApplyGateSequence")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("gates: T")
+    .Input("qubits: int32")
+    .Input("gate_info: int32")
+    .Attr("nqubits: int")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+// Register op that applies a serialized circuit
+REGISTER_OP("ExecuteCircuit")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("gates: T")
+    .Input("qubits: int32")
+    .Input("gate_info: int32")
+    .Attr("nqubits: int")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+
+// Register op that samples the measurements of noisy circuits using
+// trajectories
+REGISTER_OP("SimulateTrajectories")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("gates: T")
+    .Input("qubits: int32")
+    .Input("gate_info: int32")
+    .Input("measured: int32")
+    .Attr("nqubits: int")
+    .Attr("ntrajectories: int")
+    .Attr("seed: int")
+    .Attr("omp_num_threads: int")
+    .Output("frequencies: int64")
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->Vector(c->UnknownDim()));
+      return Status::OK();
+    });
+
+
+// Register density matrix gate ops that update rows and columns in one pass
+#define REGISTER_DENSITY_MATRIX_OP(NAME)  \
   REGISTER_OP(NAME)                       \
       .Attr("T: {complex64, complex128}") \
       .Input("state: T")                  \
+      .Input("gate: T")                   \
       .Input("qubits: int32")             \
       .Attr("nqubits: int")               \
-      .Attr("target1: int")               \
-      .Attr("target2: int")               \
+      .Attr("targets: list(int)")         \
       .Attr("omp_num_threads: int")       \
       .Output("out: T")                   \
       .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
 
-REGISTER_GATE1_OP("ApplyGate")
-REGISTER_GATE1_OP("ApplyZPow")
-REGISTER_GATE1_NOMATRIX_OP("ApplyX")
-REGISTER_GATE1_NOMATRIX_OP("ApplyY")
-REGISTER_GATE1_NOMATRIX_OP("ApplyZ")
+REGISTER_DENSITY_MATRIX_OP("ApplyDensityMatrixGate")
+REGISTER_DENSITY_MATRIX_OP("ApplyDensityMatrixDiagonalGate")
 
-REGISTER_GATE2_OP("ApplyTwoQubitGate")
-REGISTER_GATE2_OP("ApplyFsim")
-REGISTER_GATE2_NOMATRIX_OP("ApplySwap")
+// Register op that applies a SWAP gate to a density matrix in one pass
+REGISTER_OP("ApplyDensityMatrixSwap")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("qubits: int32")
+    .Attr("nqubits: int")
+    .Attr("targets: list(int)")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+// Register op that applies a channel to a density matrix in one pass
+REGISTER_OP("ApplyKrausChannel")
+    .Attr("T: {complex64, complex128}")
+    .Input("state: T")
+    .Input("ops: T")
+    .Attr("nqubits: int")
+    .Attr("targets: list(int)")
+    .Attr("omp_num_threads: int")
+    .Output("out: T")
+    .SetShapeFn(::tensorflow::shape_inference::UnchangedShape);
+
+// Register op that counts how the in-place ops use their state buffers
+REGISTER_OP("StateBufferCounters")
+    .Attr("reset: bool = false")
+    .Output("out: int64")
+    .SetIsStateful()
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      c->set_output(0, c->Vector(4));
+      return Status::OK();
+    });
+
+// Register op that sets the policy of the in-place ops for shared buffers
+REGISTER_OP("SetCopySharedStates")
+    .Attr("copy: bool")
+    .SetIsStateful();
+
+// Register op that releases the unused buffers of the state pool
+REGISTER_OP("ClearStatePool")
+    .Output("out: int64")
+    .SetIsStateful()
+    .SetShapeFn(::tensorflow::shape_inference::ScalarShape);
+
+// Register op that writes a checkpoint of state pieces
+REGISTER_OP("SaveState")
+    .Attr("T: {complex64, complex128}")
+    .Attr("npieces: int >= 1")
+    .Input("filename: string")
+    .Input("pieces: npieces * T")
+    .Attr("chunk_size: int")
+    .Attr("threshold: float = 0")
+    .Attr("omp_num_threads: int")
+    .Output("out: int64")
+    .SetIsStateful()
+    .SetShapeFn(::tensorflow::shape_inference::ScalarShape);
+
+// Register op that reads the pieces of a checkpoint
+REGISTER_OP("LoadState")
+    .Attr("T: {complex64, complex128}")
+    .Attr("npieces: int >= 1")
+    .Input("filename: string")
+    .Attr("mmap: bool = false")
+    .Attr("omp_num_threads: int")
+    .Output("pieces: npieces * T")
+    .SetIsStateful()
+    .SetShapeFn([](::tensorflow::shape_inference::InferenceContext* c) {
+      for (int i = 0; i < c->num_outputs(); i++) {
+        c->set_output(i, c->Vector(c->UnknownDim()));
+      }
+      return Status::OK();
+    });
@@ -17,6 +17,97 @@ custom_module = load_library.load_op_library(
 # initial_state operator
 initial_state = custom_module.initial_state
 
+def basis_state(nqubits, index, dtype, is_matrix=False, nbatch=0,
+                omp_num_threads=get_threads()):
+    """Creates the computational basis state ``|index>``.
+
+    Args:
+        nqubits (int): Number of qubits of the state.
+        index (int): Integer whose binary representation gives the basis
+            state, with the first qubit as the most significant bit.
+        dtype: Complex type of the state.
+        is_matrix (bool): If ``True`` the density matrix
+            ``|index><index|`` is returned.
+        nbatch (int): If positive a batch of ``nbatch`` copies of the state
+            is returned.
+
+    Return:
+        State vector of shape ``(2 ** nqubits,)`` or density matrix.
+    """
+    index = tf.cast(index, dtype=tf.int64)
+    return custom_module.basis_state(index, nqubits, dtype, is_matrix,
+                                     omp_num_threads, nbatch=nbatch)
+
+def product_state(amplitudes, omp_num_threads=get_threads()):
+    """Creates the product state of the given single-qubit states.
+
+    The amplitudes are multiplied as given, so the state is normalized only
+    if the state of each qubit is normalized.
+
+    Args:
+        amplitudes (tf.Tensor): Complex tensor of shape ``(nqubits, 2)``
+            with the single-qubit state of each qubit.
+
+    Return:
+        State vector of shape ``(2 ** nqubits,)``.
+    """
+    amplitudes = tf.convert_to_tensor(amplitudes)
+    return custom_module.product_state(amplitudes, omp_num_threads)
+
+def reset_state(state, nqubits, is_matrix=False,
+                omp_num_threads=get_threads()):
+    """Resets an existing state to the initial state without allocating.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`), so that the same buffer
+    can be used for repeated executions of circuits of the same size.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` or
+            density matrix of shape ``(2 ** nqubits, 2 ** nqubits)``. Batches
+            of states with an additional leading dimension are also reset.
+        nqubits (int): Number of qubits of each state.
+        is_matrix (bool): If ``True`` the states are density matrices.
+
+    Return:
+        ``state`` set to the zero state for all qubits.
+    """
+    return custom_module.reset_state(state, nqubits, is_matrix,
+                                     omp_num_threads)
+
+def to_half_precision(state):
+    """Converts a complex state to the storage of half precision states.
+
+    States of half precision are ``tf.float16`` tensors with an additional
+    last dimension of size two that holds the real and the imaginary part of
+    each amplitude. They are accepted by the one- and two-qubit gate,
+    collapse, initial state and measurement operators, which accumulate in
+    single precision and store the result in half precision.
+
+    Args:
+        state (tf.Tensor): Complex tensor of any shape.
+
+    Return:
+        ``tf.float16`` tensor of shape ``state.shape + (2,)``.
+    """
+    state = tf.stack([tf.math.real(state), tf.math.imag(state)], axis=-1)
+    return tf.cast(state, dtype=tf.float16)
+
+def from_half_precision(state, dtype=tf.complex64):
+    """Converts a half precision state to a complex state of ``dtype``.
+
+    Args:
+        state (tf.Tensor): ``tf.float16`` tensor whose last dimension holds
+            the real and the imaginary part of each amplitude.
+        dtype: Complex type of the returned state.
+
+    Return:
+        Complex tensor of shape ``state.shape[:-1]``.
+    """
+    rtype = tf.float64 if dtype == tf.complex128 else tf.float32
+    state = tf.cast(state, dtype=rtype)
+    return tf.complex(state[..., 0], state[..., 1])
+
 # transpose_state operator (for multi-GPU)
 transpose_state = custom_module.transpose_state
 
@@ -25,17 +116,26 @@ swap_pieces = custom_module.swap_pieces
 
 # measurement frequencies operator
 measure_frequencies = custom_module.measure_frequencies
+measure_frequencies_sparse = custom_module.measure_frequencies_sparse
+measure_state = custom_module.measure_state
 
 # apply_gate operator
 def apply_gate(state, gate, qubits, nqubits, target, omp_num_threads=get_threads()):
     """Applies arbitrary one-qubit gate to a state vector.
 
-    Modifies ``state`` in-place.
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
     Gates can be controlled to multiple qubits.
+    All one- and two-qubit gate operators also accept batches of states of
+    shape ``(nbatch, 2 ** nqubits)``, with either a single gate matrix for
+    all states or one matrix per state stacked along the first axis.
+    They also accept states of half precision (see :meth:`to_half_precision`)
+    with gate matrices of the same storage.
 
     Args:
-        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)``.
-        gate (tf.Tensor): Gate matrix of shape ``(2, 2)``.
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` or batch
+            of state vectors of shape ``(nbatch, 2 ** nqubits)``.
+        gate (tf.Tensor): Gate matrix of shape ``(2, 2)`` or ``(nbatch, 2, 2)``.
         qubits (tf.Tensor): Tensor that contains control and target qubits in
             sorted order. See :meth:`qibo.backends.abstract.TensorflowCustomBackend.cache.qubits_tensor`
             for more details.
@@ -44,8 +144,8 @@ def apply_gate(state, gate, qubits, nqubits, target, omp_num_threads=get_threads
             Must be smaller than ``nqubits``.
 
     Return:
-        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` after
-            ``gate`` is applied.
+        state (tf.Tensor): State vector(s) of the same shape as ``state``
+            after ``gate`` is applied.
     """
     return custom_module.apply_gate(state, gate, qubits, nqubits, target, omp_num_threads)
 
@@ -65,5 +165,440 @@ apply_fsim = custom_module.apply_fsim
 
 apply_swap = custom_module.apply_swap
 
-def collapse_state(state, qubits, result, nqubits, normalize=True, omp_num_threads=get_threads()):
-    return custom_module.collapse_state(state, qubits, result, nqubits, normalize, omp_num_threads)
+# apply_multi_qubit_gate operator
+def apply_multi_qubit_gate(state, gate, qubits, nqubits, targets,
+                           omp_num_threads=get_threads()):
+    """Applies arbitrary gate acting on three to five qubits to a state vector.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+    Gates can be controlled to multiple qubits.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)``.
+        gate (tf.Tensor): Gate matrix of shape ``(2 ** k, 2 ** k)`` where
+            ``k = len(targets)``.
+        qubits (tf.Tensor): Tensor that contains control and target qubits in
+            sorted order. See :meth:`qibo.backends.abstract.TensorflowCustomBackend.cache.qubits_tensor`
+            for more details.
+        nqubits (int): Total number of qubits in the state vector.
+        targets (list): Qubit IDs that the gate will act on, in the order
+            that corresponds to the gate matrix.
+
+    Return:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` after
+            ``gate`` is applied.
+    """
+    return custom_module.apply_multi_qubit_gate(state, gate, qubits, nqubits,
+                                                targets, omp_num_threads)
+
+def apply_diagonal_layer(state, phases, targets, ntargets, nqubits,
+                         omp_num_threads=get_threads()):
+    """Applies a product of diagonal one- and two-qubit gates to a state vector.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+    All terms are applied in a single pass over the state. The phase of each
+    amplitude is computed from the bits of its index that correspond to the
+    target qubits of each term.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)``.
+        phases (tf.Tensor): Diagonals of all terms concatenated in the order
+            of ``ntargets``. One-qubit terms have two elements and two-qubit
+            terms have four elements ordered with the first target qubit as
+            the most significant bit.
+        targets (tf.Tensor): Concatenated target qubit ids of all terms.
+        ntargets (tf.Tensor): Number of target qubits (1 or 2) of each term.
+        nqubits (int): Total number of qubits in the state vector.
+
+    Return:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` after
+            all phases are applied.
+    """
+    return custom_module.apply_diagonal_layer(state, phases, targets, ntargets,
+                                              nqubits, omp_num_threads)
+
+def apply_gate_sequence(state, gates, qubits, gate_info, nqubits,
+                        omp_num_threads=get_threads()):
+    """Applies a sequence of one- and two-qubit gates to a state vector.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+    Consecutive gates that act on the last qubits are applied to state slices
+    that fit in cache, so that a single pass over the state is needed for
+    each block of such gates.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)``.
+        gates (tf.Tensor): Flattened matrices of all gates concatenated in
+            the order of application.
+        qubits (tf.Tensor): Concatenated qubit tensors of all gates. Each qubit
+            tensor contains the control and target qubits of a gate in sorted
+            order (see :meth:`qibo.backends.abstract.TensorflowCustomBackend.cache.qubits_tensor`).
+        gate_info (tf.Tensor): Tensor of shape ``(ngates, 4)`` with the number
+            of target qubits (1 or 2), the number of control qubits and the
+            two target qubit ids of each gate. The second target is ignored
+            for one-qubit gates.
+        nqubits (int): Total number of qubits in the state vector.
+
+    Return:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` after
+            all gates are applied.
+    """
+    return custom_module.apply_gate_sequence(state, gates, qubits, gate_info,
+                                             nqubits, omp_num_threads)
+
+def execute_circuit(state, gates, qubits, gate_info, nqubits,
+                    omp_num_threads=get_threads()):
+    """Applies a serialized circuit to a state vector with a single operator.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+    The gates are applied by a loop in the operator that calls the kernels of
+    the individual gate operators, which avoids the dispatch of one operator
+    per gate. Small states are simulated by a single thread and blocks of
+    gates that act on the last qubits of larger states are applied to state
+    slices, as in :meth:`apply_gate_sequence`.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)``.
+        gates (tf.Tensor): Flat tensor with the elements of all gates. Gates
+            with equal elements may share them.
+        qubits (tf.Tensor): Concatenated qubit tensors of all gates. Each qubit
+            tensor contains the control and target qubits of a gate in sorted
+            order (see :meth:`qibo.backends.abstract.TensorflowCustomBackend.cache.qubits_tensor`).
+        gate_info (tf.Tensor): Tensor of shape ``(ngates, 9)`` with the type
+            of each gate, its number of targets, its number of controls, the
+            offset of its elements in ``gates`` and up to five target ids
+            (unused targets are ignored). The types are 0 for gates given by
+            their matrix (one to five targets), 1, 2 and 3 for the Pauli
+            ``X``, ``Y`` and ``Z`` gates, 4 for ``ZPow`` gates (one element,
+            the phase), 5 for ``fSim`` gates (five elements: the ``(2, 2)``
+            block that mixes ``|01>`` and ``|10>`` and the phase of ``|11>``)
+            and 6 for ``SWAP`` gates. The offset is ignored for gates without
+            elements.
+        nqubits (int): Total number of qubits in the state vector.
+
+    Return:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` after
+            all gates are applied.
+    """
+    return custom_module.execute_circuit(state, gates, qubits, gate_info,
+                                         nqubits, omp_num_threads)
+
+def simulate_trajectories(state, gates, qubits, gate_info, measured, nqubits,
+                          ntrajectories, seed, omp_num_threads=get_threads()):
+    """Samples the measurements of a noisy circuit using trajectories.
+
+    Every trajectory starts from ``state``, applies the gates and samples one
+    Kraus operator of each channel with probability ``||K_k psi||^2``. It
+    then gives a single shot of the measured qubits. The trajectories are
+    simulated in batches of states and each one uses its own random stream,
+    so the result depends only on ``seed``.
+
+    Args:
+        state (tf.Tensor): Initial state vector of shape ``(2 ** nqubits,)``.
+        gates (tf.Tensor): Flattened matrices of all gates and the Kraus
+            operators of all channels concatenated in the order of application.
+        qubits (tf.Tensor): Concatenated qubit tensors of all gates and
+            channels, as for :meth:`apply_gate_sequence`.
+        gate_info (tf.Tensor): Tensor of shape ``(ngates, 5)`` with the
+            number of Kraus operators (0 for gates), the number of target
+            qubits (1 or 2), the number of control qubits and the two target
+            qubit ids of each gate or channel. Channels cannot be controlled.
+        measured (tf.Tensor): Sorted ``nqubits - q - 1`` of the measured
+            qubits ``q``.
+        nqubits (int): Total number of qubits in the state vector.
+        ntrajectories (int): Number of trajectories (shots).
+        seed (int): Seed of the random streams.
+
+    Return:
+        Frequencies of the ``2 ** len(measured)`` measurement results, where
+        the measured qubit with the smallest id is the most significant bit.
+    """
+    return custom_module.simulate_trajectories(state, gates, qubits, gate_info,
+                                               measured, nqubits, ntrajectories,
+                                               seed, omp_num_threads)
+
+def apply_density_matrix_gate(state, gate, qubits, nqubits, targets,
+                              omp_num_threads=get_threads()):
+    """Applies a gate to both sides of a density matrix in a single pass.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+
+    Args:
+        state (tf.Tensor): Density matrix of shape
+            ``(2 ** nqubits, 2 ** nqubits)``.
+        gate (tf.Tensor): Matrix of the gate on one or two targets.
+        qubits (tf.Tensor): Sorted ``nqubits - q - 1`` of all control and
+            target qubits ``q``, as for the state vector operators.
+        nqubits (int): Number of qubits of the density matrix.
+        targets (list): Target qubit ids.
+
+    Return:
+        ``state`` updated to ``U state U^dagger``.
+    """
+    return custom_module.apply_density_matrix_gate(state, gate, qubits,
+                                                   nqubits, targets,
+                                                   omp_num_threads)
+
+def apply_density_matrix_diagonal_gate(state, diagonal, qubits, nqubits,
+                                       targets, omp_num_threads=get_threads()):
+    """Same as :meth:`apply_density_matrix_gate` for diagonal gates.
+
+    ``diagonal`` holds the ``2 ** len(targets)`` diagonal elements of the
+    gate matrix.
+    """
+    return custom_module.apply_density_matrix_diagonal_gate(
+        state, diagonal, qubits, nqubits, targets, omp_num_threads)
+
+def apply_density_matrix_swap(state, qubits, nqubits, targets,
+                              omp_num_threads=get_threads()):
+    """Same as :meth:`apply_density_matrix_gate` for the SWAP gate."""
+    return custom_module.apply_density_matrix_swap(state, qubits, nqubits,
+                                                   targets, omp_num_threads)
+
+def apply_kraus_channel(state, ops, nqubits, targets,
+                        omp_num_threads=get_threads()):
+    """Applies the channel ``sum_k K_k state K_k^dagger`` in a single pass.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+
+    Args:
+        state (tf.Tensor): Density matrix of shape
+            ``(2 ** nqubits, 2 ** nqubits)``.
+        ops (tf.Tensor): Kraus operators of shape ``(nops, 2 ** t, 2 ** t)``
+            acting on the same ``t = len(targets)`` (one or two) qubits.
+        nqubits (int): Number of qubits of the density matrix.
+        targets (list): Target qubit ids.
+
+    Return:
+        ``state`` updated by the channel.
+    """
+    return custom_module.apply_kraus_channel(state, ops, nqubits, targets,
+                                             omp_num_threads)
+
+def collapse_state(state, qubits, result, nqubits, normalize=True,
+                   omp_num_threads=get_threads(), return_probability=False):
+    """Collapses a state vector to a measured result of some qubits.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+    The amplitudes of the other results are removed and the norm of the
+    remaining amplitudes is computed in the same pass.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` or batch
+            of states of shape ``(nbatch, 2 ** nqubits)``.
+        qubits (tf.Tensor): Sorted bit positions of the measured qubits.
+        result (tf.Tensor): Measured result, or one result for each state of
+            a batch.
+        nqubits (int): Total number of qubits in the state vector.
+        normalize (bool): Normalize the state after the collapse.
+        return_probability (bool): Also return the probability of the
+            measured result of each state.
+
+    Return:
+        state (tf.Tensor): The collapsed state. If ``return_probability`` is
+            ``True`` a tensor of shape ``(nbatch,)`` with the probability of
+            the result is also returned.
+    """
+    state, probability = custom_module.collapse_state(
+        state, qubits, result, nqubits, normalize, omp_num_threads)
+    if return_probability:
+        return state, probability
+    return state
+
+def collapse_state_compact(state, qubits, result, nqubits, normalize=True,
+                           omp_num_threads=get_threads(),
+                           return_probability=False):
+    """Collapses a state vector and removes the measured qubits.
+
+    Does not modify ``state``. Only the amplitudes of the measured result
+    are copied to a new state of ``nqubits - len(qubits)`` qubits, in which
+    the unmeasured qubits keep their order. The returned state can be used
+    as the initial state of a circuit with the remaining number of qubits.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` or batch
+            of states of shape ``(nbatch, 2 ** nqubits)``.
+        qubits (tf.Tensor): Sorted bit positions of the measured qubits.
+        result (tf.Tensor): Measured result, or one result for each state of
+            a batch.
+        nqubits (int): Total number of qubits in the state vector.
+        normalize (bool): Normalize the reduced state.
+        return_probability (bool): Also return the probability of the
+            measured result of each state.
+
+    Return:
+        state (tf.Tensor): The reduced state of shape
+            ``(2 ** (nqubits - len(qubits)),)`` (or the corresponding batch).
+            If ``return_probability`` is ``True`` a tensor of shape
+            ``(nbatch,)`` with the probability of the result is also returned.
+    """
+    state, probability = custom_module.compact_collapse_state(
+        state, qubits, result, nqubits, normalize, omp_num_threads)
+    if return_probability:
+        return state, probability
+    return state
+
+def renormalize_state(state, nqubits, omp_num_threads=get_threads()):
+    """Normalizes a state vector.
+
+    Modifies ``state`` in-place unless its buffer is shared with other
+    tensors (see :meth:`set_copy_shared_states`).
+
+    Rounding errors accumulate in the norm of half precision states after
+    many gates, so such states should be renormalized periodically.
+    The state is collapsed to the result of no qubits, which computes the
+    norm and rescales the amplitudes in two passes.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)`` or batch
+            of states of shape ``(nbatch, 2 ** nqubits)``.
+        nqubits (int): Total number of qubits in the state vector.
+
+    Return:
+        state (tf.Tensor): The normalized state.
+    """
+    qubits = tf.zeros((0,), dtype=tf.int32)
+    result = tf.zeros((1,), dtype=tf.int64)
+    return collapse_state(state, qubits, result, nqubits, True,
+                          omp_num_threads)
+
+def pauli_expectation(state, paulis, nqubits, coefficients=None,
+                      omp_num_threads=get_threads()):
+    """Calculates expectation values of Pauli strings on a state vector.
+
+    Does not modify ``state``. Strings that flip the same qubits are
+    evaluated in the same read-only pass over the state.
+
+    Args:
+        state (tf.Tensor): State vector of shape ``(2 ** nqubits,)``.
+        paulis (tf.Tensor): Integer tensor of shape ``(nterms, nqubits)``
+            with the Pauli matrix that each string applies to each qubit
+            (0, 1, 2, 3 for I, X, Y, Z).
+        nqubits (int): Total number of qubits in the state vector.
+        coefficients (tf.Tensor): Optional weights of the strings. If given
+            the weighted sum of the expectation values is returned.
+
+    Return:
+        Real tensor of shape ``(nterms,)`` with the expectation value of each
+        string, or their weighted sum if ``coefficients`` are given.
+    """
+    state = tf.convert_to_tensor(state)
+    paulis = tf.cast(paulis, dtype=tf.int32)
+    tout = tf.float64 if state.dtype == tf.complex128 else tf.float32
+    values = custom_module.pauli_expectation(state, paulis, nqubits,
+                                             omp_num_threads, Tout=tout)
+    if coefficients is None:
+        return values
+    coefficients = tf.math.real(tf.cast(coefficients, dtype=state.dtype))
+    return tf.reduce_sum(coefficients * values)
+
+def state_buffer_counters(reset=False):
+    """Counts how the in-place operators used the buffers of their states.
+
+    Args:
+        reset (bool): If ``True`` the counters are set to zero after they
+            are read.
+
+    Return:
+        Dictionary with the number of states that were forwarded to the
+        output (``"forwarded"``), updated in-place while shared with other
+        tensors (``"shared"``) or copied (``"copies"``), and the total bytes
+        of the copies (``"copied_bytes"``).
+    """
+    values = custom_module.state_buffer_counters(reset=reset).numpy()
+    keys = ("forwarded", "shared", "copies", "copied_bytes")
+    return {k: int(v) for k, v in zip(keys, values)}
+
+_copy_shared_states = True
+
+def set_copy_shared_states(copy):
+    """Sets the policy of the in-place operators for shared state buffers.
+
+    By default a state whose buffer is shared with other tensors, for example
+    the input tensor of an eager call, is copied to a new output so that the
+    input is not modified, at the cost of an additional state vector per
+    operator. If ``copy`` is ``False`` such states are updated in-place, which
+    avoids the copies when the input state is not used after the operator.
+    The pieces of distributed states are always updated in-place.
+    """
+    global _copy_shared_states
+    custom_module.set_copy_shared_states(copy=copy)
+    _copy_shared_states = bool(copy)
+
+def copy_shared_states():
+    """Returns ``True`` if shared state buffers are copied (see :meth:`set_copy_shared_states`)."""
+    return _copy_shared_states
+
+def clear_state_pool():
+    """Releases the reusable scratch buffers that are not in use.
+
+    The collapse, measurement, expectation and trajectory operators keep
+    their scratch buffers for the following executions of circuits of the
+    same size (see ``state_pool.h``). States are not pooled, so that the
+    first gate of a compiled circuit can update the initial state in-place.
+
+    Return:
+        Number of bytes released.
+    """
+    return int(custom_module.clear_state_pool().numpy())
+
+def save_state(filename, state, chunk_size=2 ** 20, threshold=0,
+               omp_num_threads=get_threads()):
+    """Writes a state vector or the pieces of a distributed state to a file.
+
+    The amplitudes are written in parallel in chunks and the chunks whose
+    amplitudes are all zero are not stored (see ``state_checkpoint.h``).
+    The file is replaced only after it is written completely, so it can be
+    used to checkpoint long simulations.
+
+    Args:
+        filename (str): Path of the checkpoint file.
+        state (tf.Tensor): State tensor of any shape or list of state pieces
+            with the same number of amplitudes, for example the pieces of a
+            :class:`qibo.core.states.DistributedState`.
+        chunk_size (int): Number of amplitudes of each chunk. It should
+            divide the number of amplitudes of each piece.
+        threshold (float): If positive, the chunks whose squared norm is
+            below ``threshold`` are also not stored, so that they are loaded
+            as zeros. The loaded state is then not exact.
+
+    Return:
+        Size of the file in bytes.
+    """
+    pieces = state if isinstance(state, (list, tuple)) else [state]
+    size = custom_module.save_state(filename, pieces, chunk_size=chunk_size,
+                                    threshold=threshold,
+                                    omp_num_threads=omp_num_threads)
+    return int(size.numpy())
+
+def load_state(filename, dtype, npieces=1, mmap=False,
+               omp_num_threads=get_threads()):
+    """Reads a state written by :meth:`save_state`.
+
+    Args:
+        filename (str): Path of the checkpoint file.
+        dtype: Complex type of the saved state.
+        npieces (int): Number of saved pieces.
+        mmap (bool): If ``True`` the pieces without dropped chunks are mapped
+            to memory instead of copied, so that their amplitudes are read
+            from the file when they are first accessed. Updates of the in-place
+            operators do not modify the file.
+
+    Return:
+        The state as a tensor of shape ``(size,)`` if ``npieces`` is one,
+        otherwise the list of pieces. States of other shapes should be
+        reshaped after they are loaded.
+    """
+    pieces = custom_module.load_state(filename, npieces=npieces, T=dtype,
+                                      mmap=mmap,
+                                      omp_num_threads=omp_num_threads)
+    if npieces == 1:
+        return pieces[0]
+    return pieces
@@ -1,5 +1,8 @@
 import tensorflow as tf
 from tensorflow.python.framework import ops # pylint: disable=no-name-in-module
+from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import custom_module
+from qibo.tensorflow.custom_operators.python.ops.qibo_tf_custom_operators import copy_shared_states
+from qibo.config import raise_error
 
 
 @ops.RegisterGradient("InitialState")
@@ -17,3 +20,137 @@ def _initial_state_grad(op, grad): # pragma: no cover
     # Not tested currently due to ``tf.tensor_scatter_nd_update`` bug on GPU
     to_initial_state = tf.concat([[0], grad[1:]], axis=0)
     return [to_initial_state]
+
+
+def _gate_attrs(op, ntargets):
+    """Attributes of a gate op in the order of the op arguments."""
+    targets = ("target",) if ntargets == 1 else ("target1", "target2")
+    names = ("nqubits",) + targets + ("omp_num_threads",)
+    return [op.get_attr(name) for name in names]
+
+
+def _check_inplace_gradient():
+    """Checks that in-place state updates can be used in the backward pass.
+
+    If shared state buffers are not copied (see ``set_copy_shared_states``)
+    the outputs of all gates share one buffer, which the backward pass
+    updates in-place. This is only possible in eager mode, because in graph
+    mode the outputs are still used by other ops and the backward pass of the
+    gates without matrix has no output that uses the update. The final state
+    is restored to the initial state by the backward pass, so persistent
+    tapes and repeated gradients are not supported in this case either.
+    """
+    if not copy_shared_states() and not tf.executing_eagerly():
+        raise_error(RuntimeError, "Gradients of custom gate operators with "
+                                  "in-place updates of shared states are not "
+                                  "supported in graph mode. Use "
+                                  "``set_copy_shared_states(True)``.")
+
+
+def _unitarity_checks(gate, gatesize):
+    """Assertions that the gate matrices of an op are unitary.
+
+    Args:
+        gate (tf.Tensor): Gate input of the op.
+        gatesize (int): Number of elements of the gate of ``ApplyGate``
+            (4), ``ApplyTwoQubitGate`` (16), ``ApplyZPow`` (1) or
+            ``ApplyFsim`` (5).
+
+    Returns:
+        List of assertion ops.
+    """
+    atol = 1e-10 if gate.dtype == tf.complex128 else 1e-5
+    message = "Gradients of custom gate operators require unitary gates."
+    def assert_unitary(matrix, n):
+        matrix = tf.reshape(matrix, (-1, n, n))
+        product = tf.matmul(matrix, matrix, adjoint_b=True)
+        eye = tf.broadcast_to(tf.eye(n, dtype=gate.dtype), tf.shape(product))
+        return tf.debugging.assert_near(product, eye, atol=atol,
+                                        message=message)
+    def assert_phase(phase):
+        phase = tf.abs(phase)
+        return tf.debugging.assert_near(phase, tf.ones_like(phase),
+                                        atol=atol, message=message)
+
+    if gatesize == 1:
+        return [assert_phase(gate)]
+    if gatesize == 5:
+        gate = tf.reshape(gate, (-1, 5))
+        return [assert_unitary(gate[:, :4], 2), assert_phase(gate[:, 4])]
+    return [assert_unitary(gate, 4 if gatesize == 16 else 2)]
+
+
+def _adjoint_gate_grad(grad_op, ntargets, gatesize):
+    """Creates the gradient of a gate op with gate matrix.
+
+    By default shared states are copied, so the input of the gate
+    (``op.inputs[0]``) is the state before the gate and it is kept by the
+    tape. ``grad_op`` reads it without modification and the gate does not
+    need to be unitary, but the tape holds one state per gate.
+
+    The memory savings of adjoint differentiation require shared states to
+    be updated in-place (see ``set_copy_shared_states``). Then the outputs
+    of all gates share one buffer, which holds the state after the gate when
+    its gradient is computed because the gradients are computed in reverse
+    order. ``grad_op`` undoes the gate in this buffer to rebuild the state
+    before the gate, so the gate matrices must be unitary and no intermediate
+    state is stored (see ``_check_inplace_gradient``).
+
+    Args:
+        grad_op: The gradient operator (``apply_gate_grad``,
+            ``apply_z_pow_grad``, ``apply_two_qubit_gate_grad`` or
+            ``apply_fsim_grad``).
+        ntargets (int): Number of target qubits of the gate.
+        gatesize (int): Number of elements of the gate (see
+            ``_unitarity_checks``).
+
+    Returns:
+        Function that calculates the gradients with respect to the state and
+        the gate matrix of the op.
+    """
+    def _grad(op, grad):
+        attrs = _gate_attrs(op, ntargets)
+        if copy_shared_states():
+            _, grad, gate_grad = grad_op(op.inputs[0], grad, op.inputs[1],
+                                         op.inputs[2], *attrs, undo=False)
+            return [grad, gate_grad, None]
+        _check_inplace_gradient()
+        checks = _unitarity_checks(op.inputs[1], gatesize)
+        with tf.control_dependencies(checks):
+            _, grad, gate_grad = grad_op(op.outputs[0], grad, op.inputs[1],
+                                         op.inputs[2], *attrs, undo=True)
+        return [grad, gate_grad, None]
+    return _grad
+
+
+def _self_inverse_gate_grad(gate_op, ntargets):
+    """Creates the gradient of a gate op without gate matrix.
+
+    These gates (X, Y, Z and SWAP) are their own inverse so the gate op
+    propagates the gradient. If shared states are updated in-place the gate
+    op is also applied to the state buffer to undo the gate, so that the
+    gradients of the previous gates find the state before this gate (see
+    ``_adjoint_gate_grad``).
+    """
+    def _grad(op, grad):
+        _check_inplace_gradient()
+        attrs = _gate_attrs(op, ntargets)
+        if not copy_shared_states():
+            gate_op(op.outputs[0], op.inputs[1], *attrs)
+        return [gate_op(grad, op.inputs[1], *attrs), None]
+    return _grad
+
+
+ops.RegisterGradient("ApplyGate")(
+    _adjoint_gate_grad(custom_module.apply_gate_grad, 1, 4))
+ops.RegisterGradient("ApplyZPow")(
+    _adjoint_gate_grad(custom_module.apply_z_pow_grad, 1, 1))
+ops.RegisterGradient("ApplyTwoQubitGate")(
+    _adjoint_gate_grad(custom_module.apply_two_qubit_gate_grad, 2, 16))
+ops.RegisterGradient("ApplyFsim")(
+    _adjoint_gate_grad(custom_module.apply_fsim_grad, 2, 5))
+ops.RegisterGradient("ApplyX")(_self_inverse_gate_grad(custom_module.apply_x, 1))
+ops.RegisterGradient("ApplyY")(_self_inverse_gate_grad(custom_module.apply_y, 1))
+ops.RegisterGradient("ApplyZ")(_self_inverse_gate_grad(custom_module.apply_z, 1))
+ops.RegisterGradient("ApplySwap")(
+    _self_inverse_gate_grad(custom_module.apply_swap, 2))
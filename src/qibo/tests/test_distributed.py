@@ -299,6 +299,30 @@ def test_execution_with_global_swap():
     qibo.set_backend(original_backend)
 
 
+@pytest.mark.parametrize("ndevices", [2, 4, 8])
+def test_asynchronous_execution_with_global_swap(ndevices):
+    """Check that the pipelined execution agrees with the default one."""
+    original_backend = qibo.get_backend()
+    qibo.set_backend("custom")
+    devices = {"/GPU:0": ndevices // 2, "/GPU:1": ndevices // 2}
+
+    def create_circuit(accelerators=None):
+        c = models.Circuit(6, accelerators)
+        c.add((gates.H(i) for i in range(6)))
+        c.add((gates.SWAP(i, i + 1) for i in range(5)))
+        c.add((gates.CZ(i, 5 - i) for i in range(3)))
+        c.add((gates.RX(i, theta=0.1 * i) for i in range(6)))
+        return c
+
+    dist_c = create_circuit(devices)
+    dist_c.asynchronous = True
+    initial_state = utils.random_numpy_state(dist_c.nqubits)
+    final_state = dist_c(np.copy(initial_state)).numpy()
+    target_state = create_circuit()(np.copy(initial_state)).numpy()
+    np.testing.assert_allclose(target_state, final_state)
+    qibo.set_backend(original_backend)
+
+
 @pytest.mark.parametrize("ndevices", [2, 4, 8])
 def test_execution_special_gate(ndevices):
     original_backend = qibo.get_backend()
@@ -440,3 +464,175 @@ def test_distributed_state_getitem():
     # Check error
     with pytest.raises(TypeError):
         state["a"]
+
+
+def test_mpi_distributed_circuit_single_rank():
+    """Check the MPI distributed circuit with all pieces owned by one rank."""
+    pytest.importorskip("mpi4py")
+    import sympy
+    from qibo import matrices
+    from qibo.core.hamiltonians import SymbolicHamiltonian
+    from qibo.core.mpicircuit import MPIDistributedCircuit
+    original_backend = qibo.get_backend()
+    qibo.set_backend("custom")
+    dist_c = MPIDistributedCircuit(6, {"/GPU:0": 2, "/GPU:1": 2})
+    dist_c.add((gates.H(i) for i in range(6)))
+    dist_c.add((gates.SWAP(i, i + 1) for i in range(5)))
+    dist_c.add((gates.RX(i, theta=0.1 * i) for i in range(6)))
+    c = models.Circuit(6)
+    c.add((gates.H(i) for i in range(6)))
+    c.add((gates.SWAP(i, i + 1) for i in range(5)))
+    c.add((gates.RX(i, theta=0.1 * i) for i in range(6)))
+
+    initial_state = utils.random_numpy_state(c.nqubits)
+    final_state = dist_c(np.copy(initial_state))
+    target_state = c(np.copy(initial_state))
+    np.testing.assert_allclose(final_state.numpy(), target_state.numpy())
+    np.testing.assert_allclose(final_state.probabilities(qubits=[0, 4]),
+                               target_state.probabilities(qubits=[0, 4]))
+    z = sympy.symbols(" ".join(f"Z{i}" for i in range(6)))
+    symmap = {s: (i, matrices.Z) for i, s in enumerate(z)}
+    symham = sum(z[i] * z[i + 1] for i in range(5)) + 0.5 * z[0] + 1
+    symham = SymbolicHamiltonian(symham, symmap)
+    state = target_state.numpy()
+    target_value = np.real(np.conj(state).dot(symham.dense_matrix().dot(state)))
+    np.testing.assert_allclose(final_state.expectation(symham), target_value)
+    qibo.set_backend(original_backend)
+
+
+class ThreadComm:
+    """Communicator of ranks simulated by the threads of one process.
+
+    Implements the communication methods used by ``MPIDistributedCircuit``
+    and records the size and tag of each ``Sendrecv_replace`` message.
+    """
+
+    def __init__(self, rank, size, shared):
+        self.rank, self.size, self.shared = rank, size, shared
+
+    def Get_rank(self):
+        return self.rank
+
+    def allgather(self, value):
+        values, barrier = self.shared["values"], self.shared["barrier"]
+        values[self.rank] = value
+        barrier.wait()
+        result = list(values)
+        barrier.wait()
+        return result
+
+    def bcast(self, value, root=0):
+        return self.allgather(value)[root]
+
+    def _mailbox(self, key):
+        with self.shared["lock"]:
+            return self.shared["mailboxes"][key]
+
+    def Sendrecv_replace(self, buf, dest, sendtag=0, source=None, recvtag=0):
+        self.shared["messages"].append((buf.size, sendtag))
+        self._mailbox((self.rank, dest, sendtag)).put(np.copy(buf))
+        buf[...] = self._mailbox((source, self.rank, recvtag)).get(timeout=60)
+
+
+@pytest.mark.parametrize("chunk_size", [2 ** 2, 2 ** 4, 2 ** 10])
+def test_mpi_distributed_circuit_two_ranks(chunk_size):
+    """Check swaps between the pieces of two ranks with a mocked communicator."""
+    import collections
+    import queue
+    import threading
+    from qibo.core.mpicircuit import MPIDistributedCircuit
+    original_backend = qibo.get_backend()
+    qibo.set_backend("custom")
+    nqubits = 6
+    c = models.Circuit(nqubits)
+    c.add((gates.H(i) for i in range(nqubits)))
+    c.add((gates.SWAP(i, i + 1) for i in range(nqubits - 1)))
+    c.add((gates.RX(i, theta=0.1 * i) for i in range(nqubits)))
+    initial_state = utils.random_numpy_state(nqubits)
+    target_state = c(np.copy(initial_state)).numpy()
+
+    shared = {"values": 2 * [None], "barrier": threading.Barrier(2, timeout=60),
+              "mailboxes": collections.defaultdict(queue.Queue),
+              "lock": threading.Lock(), "messages": []}
+    final_states = 2 * [None]
+    def run(rank):
+        comm = ThreadComm(rank, 2, shared)
+        dist_c = MPIDistributedCircuit(nqubits, {"/GPU:0": 2}, comm=comm)
+        dist_c.chunk_size = chunk_size
+        dist_c.add((gates.H(i) for i in range(nqubits)))
+        dist_c.add((gates.SWAP(i, i + 1) for i in range(nqubits - 1)))
+        dist_c.add((gates.RX(i, theta=0.1 * i) for i in range(nqubits)))
+        final_states[rank] = dist_c(np.copy(initial_state)).tensor.numpy()
+
+    threads = [threading.Thread(target=run, args=(rank,)) for rank in range(2)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    for final_state in final_states:
+        np.testing.assert_allclose(final_state, target_state)
+    assert shared["messages"]
+    assert max(size for size, _ in shared["messages"]) <= chunk_size
+    qibo.set_backend(original_backend)
+
+
+def test_mpi_distributed_circuit_measurements():
+    """Check that all ranks get the same shots sampled from the reduced probabilities."""
+    import collections
+    import queue
+    import threading
+    from qibo.core.mpicircuit import MPIDistributedCircuit
+    original_backend = qibo.get_backend()
+    qibo.set_backend("custom")
+    shared = {"values": 2 * [None], "barrier": threading.Barrier(2, timeout=60),
+              "mailboxes": collections.defaultdict(queue.Queue),
+              "lock": threading.Lock(), "messages": []}
+    results = 2 * [None]
+    def run(rank):
+        comm = ThreadComm(rank, 2, shared)
+        c = MPIDistributedCircuit(6, {"/GPU:0": 2}, comm=comm)
+        c.add([gates.X(0), gates.X(3), gates.H(4)])
+        c.add(gates.M(3, 0, 5, 4))
+        result = c(nshots=100)
+        results[rank] = result.samples(binary=False).numpy()
+
+    threads = [threading.Thread(target=run, args=(rank,)) for rank in range(2)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    np.testing.assert_allclose(results[0], results[1])
+    assert set(results[0]) <= {12, 13}
+    qibo.set_backend(original_backend)
+
+
+@pytest.mark.parametrize("nchunks", [2, 4, 8])
+def test_out_of_core_circuit(nchunks, tmp_path):
+    """Check the out-of-core circuit against the default simulation."""
+    from qibo.core.oocircuit import OutOfCoreCircuit, OutOfCoreState
+    original_backend = qibo.get_backend()
+    qibo.set_backend("custom")
+
+    def create_circuit(c):
+        c.add((gates.H(i) for i in range(6)))
+        c.add((gates.SWAP(i, i + 1) for i in range(5)))
+        c.add((gates.CZ(i, 5 - i) for i in range(3)))
+        c.add(gates.CNOT(0, 4))
+        c.add((gates.RX(i, theta=0.1 * i) for i in range(6)))
+        return c
+
+    oo_c = create_circuit(OutOfCoreCircuit(6, nchunks, directory=str(tmp_path)))
+    c = create_circuit(models.Circuit(6))
+    initial_state = utils.random_numpy_state(c.nqubits)
+    final_state = oo_c(np.copy(initial_state))
+    target_state = c(np.copy(initial_state))
+    assert isinstance(final_state, OutOfCoreState)
+    np.testing.assert_allclose(final_state.numpy(), target_state.numpy())
+    np.testing.assert_allclose(final_state[5], target_state.numpy()[5])
+    np.testing.assert_allclose(final_state.norm(), 1)
+    np.testing.assert_allclose(final_state.probabilities(qubits=[0, 4]),
+                               target_state.probabilities(qubits=[0, 4]))
+    # the default initial state
+    final_state = oo_c()
+    np.testing.assert_allclose(final_state.numpy(), c().numpy())
+    qibo.set_backend(original_backend)
@@ -7,8 +7,6 @@ from qibo.models import Circuit
 
 
 def test_variable_backpropagation(backend):
-    if backend == "custom":
-        pytest.skip("Custom gates do not support automatic differentiation.")
     original_backend = qibo.get_backend()
     qibo.set_backend(backend)
     if "numpy" in K.name:
@@ -34,8 +32,6 @@ def test_variable_backpropagation(backend):
 
 
 def test_two_variables_backpropagation(backend):
-    if backend == "custom":
-        pytest.skip("Custom gates do not support automatic differentiation.")
     original_backend = qibo.get_backend()
     qibo.set_backend(backend)
     if "numpy" in K.name:
@@ -266,3 +266,42 @@ def test_variable_theta(backend):
     target_state = c()
     np.testing.assert_allclose(final_state, target_state)
     qibo.set_backend(original_backend)
+
+
+def test_set_parameters_after_execution(backend):
+    """Check that updates after an execution are applied by later executions."""
+    original_backend = qibo.get_backend()
+    qibo.set_backend(backend)
+
+    def create_circuit(params, extra_gate=False):
+        c = Circuit(3)
+        c.add(gates.H(0))
+        c.add(gates.RX(1, theta=params[0]))
+        c.add(gates.CNOT(0, 1))
+        c.add(gates.RY(2, theta=params[1]))
+        c.add(gates.fSim(0, 2, theta=params[2], phi=params[3]))
+        if extra_gate:
+            c.add(gates.CU1(2, 1, theta=0.789))
+        return c
+
+    params = np.random.random(4)
+    c = create_circuit(params)
+    np.testing.assert_allclose(c(), create_circuit(params)())
+    gate_info = None
+    if c._serialized_queue is not None:
+        gate_info = c._serialized_queue["gate_info"]
+
+    # the serialized queue is reused with the new parameter values
+    params = np.random.random(4)
+    c.set_parameters(params)
+    np.testing.assert_allclose(c(), create_circuit(params)())
+    if gate_info is not None:
+        assert c._serialized_queue["gate_info"] is gate_info
+    params[0] = 0.5
+    c.queue[1].parameters = params[0]
+    np.testing.assert_allclose(c(), create_circuit(params)())
+
+    # the queue is serialized again when gates are added
+    c.add(gates.CU1(2, 1, theta=0.789))
+    np.testing.assert_allclose(c(), create_circuit(params, True)())
+    qibo.set_backend(original_backend)
@@ -330,7 +330,7 @@ def test_toffoli(backend, applyx):
     qibo.set_backend(original_backend)
 
 
-@pytest.mark.parametrize("nqubits", [2, 3])
+@pytest.mark.parametrize("nqubits", [2, 3, 4, 6])
 def test_unitary(backend, nqubits):
     original_backend = qibo.get_backend()
     qibo.set_backend(backend)
@@ -356,8 +356,9 @@ def test_unitary_initialization(backend):
     with pytest.raises(TypeError):
         gate = gates.Unitary("abc", 0, 1)
     if backend == "custom":
+        matrix = np.random.random((64, 64))
         with pytest.raises(NotImplementedError):
-            gate = gates.Unitary(matrix, 0, 1, 2)
+            gate = gates.Unitary(matrix, *range(6))
     qibo.set_backend(original_backend)
 
 
@@ -140,7 +140,7 @@ def test_toffoli_gate(backend):
     qibo.set_backend(original_backend)
 
 
-@pytest.mark.parametrize("nqubits", [1, 2, 3])
+@pytest.mark.parametrize("nqubits", [1, 2, 3, 6])
 def test_unitary_gate(backend, nqubits):
     """Check applying `gates.Unitary` to density matrix."""
     original_backend = qibo.get_backend()
@@ -148,7 +148,7 @@ def test_unitary_gate(backend, nqubits):
     shape = 2 * (2 ** nqubits,)
     matrix = np.random.random(shape) + 1j * np.random.random(shape)
     initial_rho = random_density_matrix(nqubits)
-    if backend == "custom" and nqubits > 2:
+    if backend == "custom" and nqubits > 5:
         with pytest.raises(NotImplementedError):
             gate = gates.Unitary(matrix, *range(nqubits))
     else:
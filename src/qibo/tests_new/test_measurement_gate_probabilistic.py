@@ -1,5 +1,6 @@
 """Test :class:`qibo.abstractions.gates.M` when results are probabilistic."""
 import sys
+import itertools
 import pytest
 import numpy as np
 import qibo
@@ -105,6 +106,81 @@ def test_measurements_with_probabilistic_noise(backend):
     qibo.set_backend(original_backend)
 
 
+def test_measurements_with_noise_trajectories(backend):
+    """Check measurements of noisy circuits sampled with trajectories."""
+    if backend != "custom":
+        pytest.skip("Trajectories are sampled only by the custom backend.")
+    original_backend = qibo.get_backend()
+    qibo.set_backend(backend)
+    thetas = np.random.random(3)
+    a1, a2 = np.sqrt(0.3) * np.array([[0, 1], [1, 0]]), np.sqrt(0.7) * np.eye(2)
+    channel = [((1,), a1), ((1,), a2)]
+    def circuit(density_matrix=False):
+        c = models.Circuit(3, density_matrix=density_matrix)
+        c.add((gates.RX(i, t) for i, t in enumerate(thetas)))
+        c.add(gates.CNOT(0, 1))
+        c.add(gates.PauliNoiseChannel(0, px=0.1, py=0.2, pz=0.3))
+        c.add(gates.KrausChannel(channel))
+        c.add(gates.SWAP(1, 2))
+        return c
+
+    c = circuit()
+    c.add(gates.M(2, 0))
+    nshots = 10000
+    frequencies = c.execute(nshots=nshots, trajectories=True).frequencies(binary=True)
+    target_probs = circuit(density_matrix=True)().probabilities(qubits=[0, 2])
+    target_probs = np.transpose(np.array(target_probs))
+    for i, j in itertools.product(range(2), repeat=2):
+        key = "{}{}".format(i, j)
+        np.testing.assert_allclose(frequencies[key] / nshots,
+                                   target_probs[i, j], atol=2e-2)
+    qibo.set_backend(original_backend)
+
+
+def test_measurements_with_noise_trajectories_repeated(backend):
+    """Check that trajectories agree with repeated execution and are opt-in."""
+    original_backend = qibo.get_backend()
+    qibo.set_backend(backend)
+    def circuit(seed=None):
+        c = models.Circuit(2)
+        c.add(gates.H(0))
+        c.add(gates.PauliNoiseChannel(0, px=0.3, seed=seed))
+        c.add(gates.CNOT(0, 1))
+        c.add(gates.M(0, 1))
+        return c
+
+    nshots = 2000
+    if backend != "custom":
+        with pytest.raises(NotImplementedError):
+            circuit().execute(nshots=nshots, trajectories=True)
+        qibo.set_backend(original_backend)
+        return
+    # a channel with a single unitary gives the same noise in both cases
+    frequencies = circuit()(nshots=nshots).frequencies(binary=True)
+    target_frequencies = circuit().execute(
+        nshots=nshots, trajectories=True).frequencies(binary=True)
+    for key in ["00", "11"]:
+        np.testing.assert_allclose(frequencies[key] / nshots,
+                                   target_frequencies[key] / nshots, atol=5e-2)
+    # seeded channels give reproducible trajectories
+    frequencies = [circuit(seed=123).execute(
+        nshots=nshots, trajectories=True).frequencies() for _ in range(2)]
+    assert frequencies[0] == frequencies[1]
+    # circuits with general channels are not sampled without the flag
+    c = models.Circuit(1)
+    c.add(gates.KrausChannel([((0,), np.eye(2))]))
+    c.add(gates.M(0))
+    with pytest.raises(ValueError):
+        c(nshots=nshots)
+    # unsupported circuits raise instead of changing the simulation method
+    c = models.Circuit(3)
+    c.add(gates.Unitary(np.eye(8), 0, 1, 2))
+    c.add(gates.M(0))
+    with pytest.raises(ValueError):
+        c.execute(nshots=nshots, trajectories=True)
+    qibo.set_backend(original_backend)
+
+
 @pytest.mark.parametrize("i,probs", [(0, [0.0, 0.0, 0.0]),
                                      (1, [0.1, 0.3, 0.2]),
                                      (2, [0.5, 0.5, 0.5])])
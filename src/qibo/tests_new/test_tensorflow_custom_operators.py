@@ -41,6 +41,188 @@ def test_initial_state(dtype, compile):
   np.testing.assert_allclose(final_state, exact_state)
 
 
+@pytest.mark.parametrize("nbatch", [1, 3])
+@pytest.mark.parametrize("is_matrix", [False, True])
+def test_initial_state_batched(nbatch, is_matrix):
+    """Check that batched ``initial_state`` sets the first element of each state."""
+    state = K.op.initial_state(nqubits=3, dtype=np.complex128,
+                               is_matrix=is_matrix, nbatch=nbatch,
+                               omp_num_threads=get_threads())
+    target_state = np.zeros((8, 8) if is_matrix else (8,), dtype=np.complex128)
+    target_state[(0,) * target_state.ndim] = 1
+    target_state = np.stack(nbatch * [target_state])
+    np.testing.assert_allclose(state, target_state)
+
+
+@pytest.mark.parametrize("index", [0, 5, 7])
+@pytest.mark.parametrize("is_matrix", [False, True])
+def test_basis_state(index, is_matrix):
+    """Check that ``basis_state`` sets only the given basis element."""
+    state = K.op.basis_state(3, index, np.complex128, is_matrix=is_matrix,
+                             omp_num_threads=get_threads())
+    target_state = np.zeros(8, dtype=np.complex128)
+    target_state[index] = 1
+    if is_matrix:
+        target_state = np.outer(target_state, target_state)
+    np.testing.assert_allclose(state, target_state)
+
+
+@pytest.mark.parametrize("nqubits", [1, 4, 7])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+def test_product_state(nqubits, dtype):
+    """Check that ``product_state`` agrees with the Kronecker product."""
+    amplitudes = random_complex((nqubits, 2), dtype=dtype)
+    state = K.op.product_state(amplitudes, get_threads())
+    target_state = np.ones(1, dtype=dtype)
+    for a in amplitudes.numpy():
+        target_state = np.kron(target_state, a)
+    tol = 1e-5 if dtype == np.complex64 else 1e-12
+    np.testing.assert_allclose(state, target_state, rtol=tol, atol=tol)
+
+@pytest.mark.parametrize("nbatch", [0, 3])
+@pytest.mark.parametrize("is_matrix", [False, True])
+def test_reset_state(nbatch, is_matrix):
+    """Check that ``reset_state`` agrees with ``initial_state``."""
+    shape = (8, 8) if is_matrix else (8,)
+    if nbatch:
+        shape = (nbatch,) + shape
+    state = random_complex(shape)
+    initial_state = state.numpy()
+    final_state = K.op.reset_state(state, 3, is_matrix, get_threads())
+    target_state = K.op.initial_state(nqubits=3, dtype=np.complex128,
+                                      is_matrix=is_matrix, nbatch=nbatch,
+                                      omp_num_threads=get_threads())
+    np.testing.assert_allclose(final_state, target_state)
+    # the buffer of ``state`` is shared so it is copied by default
+    np.testing.assert_allclose(state, initial_state)
+    K.op.set_copy_shared_states(False)
+    try:
+        final_state = K.op.reset_state(state, 3, is_matrix, get_threads())
+    finally:
+        K.op.set_copy_shared_states(True)
+    np.testing.assert_allclose(state, target_state)
+
+
+def test_state_pool_reuse():
+    """Check that initial states are forwarded and scratch buffers pooled."""
+    K.op.clear_state_pool()
+    kwargs = dict(nqubits=4, dtype=np.complex128, is_matrix=False,
+                  omp_num_threads=get_threads())
+
+    @K.compile
+    def apply_operators():
+        state = K.op.initial_state(**kwargs)
+        return K.op.apply_x(state, qubits_tensor(4, [0]), 4, 0, get_threads())
+
+    # the initial state is not held by the pool so the first gate runs
+    # in-place even though shared states are copied by default
+    assert K.op.copy_shared_states()
+    K.op.state_buffer_counters(reset=True)
+    state = apply_operators()
+    counters = K.op.state_buffer_counters(reset=True)
+    assert counters["forwarded"] == 1
+    assert counters["copies"] == 0
+    target_state = np.zeros(16, dtype=np.complex128)
+    target_state[8] = 1
+    np.testing.assert_allclose(state, target_state)
+
+    # states that are still used are never overwritten by new states
+    other_state = K.op.initial_state(**kwargs)
+    np.testing.assert_allclose(state, target_state)
+    np.testing.assert_allclose(other_state, np.roll(target_state, 8))
+
+    # the scratch probabilities of the measurement are reused after the
+    # first measurement and released once
+    for _ in range(2):
+        frequencies = K.op.measure_state(
+            np.zeros(2, dtype=np.int64), state, qubits_tensor(4, [0]),
+            nshots=10, nqubits=4, seed=1234, omp_num_threads=get_threads())
+        np.testing.assert_allclose(frequencies, [0, 10])
+    assert K.op.clear_state_pool() > 0
+    assert K.op.clear_state_pool() == 0
+
+
+def dense_gate_matrix(nqubits, matrix, targets, controls=[]):
+    """Matrix of ``matrix`` acting on ``targets`` of ``nqubits`` qubits."""
+    ntargets = len(targets)
+    full = np.zeros(2 * (2 ** nqubits,), dtype=matrix.dtype)
+    for i in range(2 ** nqubits):
+        bits = [(i >> (nqubits - q - 1)) & 1 for q in range(nqubits)]
+        if not all(bits[q] for q in controls):
+            full[i, i] = 1
+            continue
+        a = sum(bits[q] << (ntargets - it - 1) for it, q in enumerate(targets))
+        for b in range(2 ** ntargets):
+            newbits = list(bits)
+            for it, q in enumerate(targets):
+                newbits[q] = (b >> (ntargets - it - 1)) & 1
+            j = sum(x << (nqubits - q - 1) for q, x in enumerate(newbits))
+            full[j, i] = matrix[b, a]
+    return full
+
+
+@pytest.mark.parametrize(("nqubits", "targets", "controls"),
+                         [(3, [1], []), (4, [2], [0]), (4, [3, 1], []),
+                          (5, [0, 4], [2]), (3, [2, 0], [])])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+def test_apply_density_matrix_gate(nqubits, targets, controls, dtype):
+    """Check ``apply_density_matrix_gate`` against ``U rho U^dagger``."""
+    matrix = random_complex(2 * (2 ** len(targets),), dtype=dtype).numpy()
+    rho = random_complex(2 * (2 ** nqubits,), dtype=dtype)
+    full = dense_gate_matrix(nqubits, matrix, targets, controls)
+    target_rho = full.dot(rho.numpy()).dot(full.conj().T)
+    qubits = qubits_tensor(nqubits, targets, controls)
+    rho = K.op.apply_density_matrix_gate(rho, matrix, qubits, nqubits,
+                                         targets, get_threads())
+    tol = 1e-5 if dtype == np.complex64 else 1e-12
+    np.testing.assert_allclose(rho, target_rho, rtol=tol, atol=tol)
+
+
+@pytest.mark.parametrize(("nqubits", "targets", "controls"),
+                         [(3, [1], []), (4, [2], [0, 3]), (4, [0, 2], [])])
+def test_apply_density_matrix_diagonal_gate(nqubits, targets, controls):
+    """Check ``apply_density_matrix_diagonal_gate`` against the full gate."""
+    diagonal = random_complex((2 ** len(targets),)).numpy()
+    rho = random_complex(2 * (2 ** nqubits,))
+    full = dense_gate_matrix(nqubits, np.diag(diagonal), targets, controls)
+    target_rho = full.dot(rho.numpy()).dot(full.conj().T)
+    qubits = qubits_tensor(nqubits, targets, controls)
+    rho = K.op.apply_density_matrix_diagonal_gate(rho, diagonal, qubits,
+                                                  nqubits, targets,
+                                                  get_threads())
+    np.testing.assert_allclose(rho, target_rho, atol=_atol)
+
+
+@pytest.mark.parametrize(("nqubits", "targets", "controls"),
+                         [(3, [0, 2], []), (4, [3, 1], [0])])
+def test_apply_density_matrix_swap(nqubits, targets, controls):
+    """Check ``apply_density_matrix_swap`` against the full SWAP gate."""
+    swap = np.array([[1, 0, 0, 0], [0, 0, 1, 0], [0, 1, 0, 0], [0, 0, 0, 1]],
+                    dtype=np.complex128)
+    rho = random_complex(2 * (2 ** nqubits,))
+    full = dense_gate_matrix(nqubits, swap, targets, controls)
+    target_rho = full.dot(rho.numpy()).dot(full.T)
+    qubits = qubits_tensor(nqubits, targets, controls)
+    rho = K.op.apply_density_matrix_swap(rho, qubits, nqubits, targets,
+                                         get_threads())
+    np.testing.assert_allclose(rho, target_rho, atol=_atol)
+
+
+@pytest.mark.parametrize(("nqubits", "targets", "nops"),
+                         [(3, [1], 2), (4, [0], 4), (4, [3, 1], 3)])
+def test_apply_kraus_channel(nqubits, targets, nops):
+    """Check ``apply_kraus_channel`` against ``sum_k K_k rho K_k^dagger``."""
+    shape = (nops,) + 2 * (2 ** len(targets),)
+    ops = random_complex(shape).numpy()
+    rho = random_complex(2 * (2 ** nqubits,))
+    target_rho = np.zeros_like(rho.numpy())
+    for op in ops:
+        full = dense_gate_matrix(nqubits, op, targets)
+        target_rho += full.dot(rho.numpy()).dot(full.conj().T)
+    rho = K.op.apply_kraus_channel(rho, ops, nqubits, targets, get_threads())
+    np.testing.assert_allclose(rho, target_rho, atol=_atol)
+
+
 @pytest.mark.parametrize(("nqubits", "target", "dtype", "compile", "einsum_str"),
                          [(5, 4, np.complex64, False, "abcde,Ee->abcdE"),
                           (4, 2, np.complex64, True, "abcd,Cc->abCd"),
@@ -304,6 +486,243 @@ def test_apply_swap_general(nqubits, targets, controls, compile):
     np.testing.assert_allclose(target_state.ravel(), state.numpy())
 
 
+@pytest.mark.parametrize(("nqubits", "targets", "controls"),
+                         [(3, [0, 1, 2], []), (5, [4, 1, 2], []),
+                          (5, [0, 2, 3], [1]), (6, [5, 0, 2, 3], []),
+                          (7, [1, 6, 2, 4], [0, 3]), (6, [0, 1, 2, 3, 4], []),
+                          (8, [7, 5, 3, 1, 0], [2, 6])])
+@pytest.mark.parametrize("compile", [False, True])
+def test_apply_multi_qubit_gate(nqubits, targets, controls, compile):
+    """Check ``K.op.apply_multi_qubit_gate`` for random gates."""
+    ntargets = len(targets)
+    state = random_complex((2 ** nqubits,))
+    gate = random_complex(2 * (2 ** ntargets,))
+
+    target_state = state.numpy().reshape(nqubits * (2,))
+    slicer = tuple(1 if q in controls else slice(None) for q in range(nqubits))
+    reduced_targets = [t - len([c for c in controls if c < t]) for t in targets]
+    reduced_state = np.tensordot(gate.numpy().reshape(2 * ntargets * (2,)),
+                                 target_state[slicer],
+                                 axes=(list(range(ntargets, 2 * ntargets)),
+                                       reduced_targets))
+    target_state[slicer] = np.moveaxis(reduced_state, list(range(ntargets)),
+                                       reduced_targets)
+    target_state = target_state.ravel()
+
+    def apply_operator(state):
+      qubits = qubits_tensor(nqubits, targets, controls)
+      return K.op.apply_multi_qubit_gate(state, gate, qubits, nqubits, targets,
+                                         get_threads())
+    if compile:
+        apply_operator = K.compile(apply_operator)
+
+    state = apply_operator(state)
+    np.testing.assert_allclose(target_state, state.numpy())
+
+
+@pytest.mark.parametrize("nqubits", [4, 8, 16, 17])
+@pytest.mark.parametrize("ngates", [1, 10, 30])
+def test_apply_gate_sequence(nqubits, ngates):
+    """Check ``apply_gate_sequence`` against applying gates one by one."""
+    state = random_complex((2 ** nqubits,))
+    target_state = K.cast(np.copy(state.numpy()))
+    matrices, qubits, gate_info = [], [], []
+    for _ in range(ngates):
+        ntargets = np.random.randint(1, 3)
+        ncontrols = np.random.randint(0, 3)
+        # bias the qubits towards the local (high id) qubits
+        weights = 2.0 ** np.arange(nqubits)
+        gate_qubits = np.random.choice(nqubits, ntargets + ncontrols,
+                                       replace=False, p=weights / weights.sum())
+        targets = [int(q) for q in gate_qubits[:ntargets]]
+        controls = [int(q) for q in gate_qubits[ntargets:]]
+        gate = random_complex(2 * (2 ** ntargets,))
+        gate_qubits = qubits_tensor(nqubits, targets, controls)
+        if ntargets == 1:
+            target_state = K.op.apply_gate(target_state, gate, gate_qubits,
+                                           nqubits, targets[0], get_threads())
+            gate_info.append([1, ncontrols, targets[0], -1])
+        else:
+            target_state = K.op.apply_two_qubit_gate(
+                target_state, gate, gate_qubits, nqubits, *targets, get_threads())
+            gate_info.append([2, ncontrols, targets[0], targets[1]])
+        matrices.append(K.reshape(gate, (-1,)))
+        qubits.extend(gate_qubits)
+
+    matrices = K.concatenate(matrices, axis=0)
+    qubits = K.cast(qubits, dtype="int32")
+    gate_info = K.cast(gate_info, dtype="int32")
+    state = K.op.apply_gate_sequence(state, matrices, qubits, gate_info,
+                                     nqubits, get_threads())
+    np.testing.assert_allclose(target_state.numpy(), state.numpy(), atol=_atol)
+
+
+@pytest.mark.parametrize("nqubits", [5, 10, 12, 16])
+@pytest.mark.parametrize("ngates", [1, 10, 40])
+def test_execute_circuit(nqubits, ngates):
+    """Check ``execute_circuit`` against applying gates one by one."""
+    # the gates are unitary so that the state stays normalized, the x, y, z
+    # and swap gates have no elements and the first matrix is shared by the
+    # one-qubit gates that pick it
+    def random_unitary(n):
+        u, _ = np.linalg.qr(random_complex((n, n)).numpy())
+        return K.cast(u)
+
+    state = random_complex((2 ** nqubits,)).numpy()
+    state = K.cast(state / np.sqrt(np.sum(np.abs(state) ** 2)))
+    target_state = K.cast(np.copy(state.numpy()))
+    shared = random_unitary(2)
+    matrices, qubits, gate_info, offset = [K.reshape(shared, (-1,))], [], [], 4
+    for _ in range(ngates):
+        gtype = np.random.randint(0, 7)
+        ntargets = {0: np.random.randint(1, 6), 5: 2, 6: 2}.get(gtype, 1)
+        ncontrols = np.random.randint(0, min(2, nqubits - ntargets) + 1)
+        # bias the qubits towards the local (high id) qubits
+        weights = 2.0 ** np.arange(nqubits)
+        gate_qubits = np.random.choice(nqubits, ntargets + ncontrols,
+                                       replace=False, p=weights / weights.sum())
+        targets = [int(q) for q in gate_qubits[:ntargets]]
+        controls = [int(q) for q in gate_qubits[ntargets:]]
+        gate_qubits = qubits_tensor(nqubits, targets, controls)
+        args = (nqubits, *targets, get_threads())
+        goffset = offset
+        if gtype == 0 and ntargets == 1 and np.random.random() < 0.5:
+            gate, goffset = shared, 0
+        elif gtype == 0:
+            gate = random_unitary(2 ** ntargets)
+        elif gtype == 4:
+            gate = K.cast(np.exp(1j * np.random.random()))
+        elif gtype == 5:
+            block = random_unitary(2).numpy().ravel()
+            gate = K.cast(np.append(block, np.exp(1j * np.random.random())))
+        else:
+            gate = None
+        if gtype == 0 and ntargets == 1:
+            target_state = K.op.apply_gate(target_state, gate, gate_qubits, *args)
+        elif gtype == 0 and ntargets == 2:
+            target_state = K.op.apply_two_qubit_gate(target_state, gate,
+                                                     gate_qubits, *args)
+        elif gtype == 0:
+            target_state = K.op.apply_multi_qubit_gate(
+                target_state, gate, gate_qubits, nqubits, targets, get_threads())
+        elif gtype == 4:
+            target_state = K.op.apply_z_pow(target_state, gate, gate_qubits, *args)
+        elif gtype == 5:
+            target_state = K.op.apply_fsim(target_state, gate, gate_qubits, *args)
+        else:
+            op = {1: K.op.apply_x, 2: K.op.apply_y, 3: K.op.apply_z,
+                  6: K.op.apply_swap}[gtype]
+            target_state = op(target_state, gate_qubits, *args)
+        if gate is not None and goffset == offset:
+            matrices.append(K.reshape(gate, (-1,)))
+            offset += int(np.prod(gate.shape))
+        gate_info.append([gtype, ntargets, ncontrols, goffset] + targets +
+                         (5 - ntargets) * [0])
+        qubits.extend(gate_qubits)
+
+    matrices = K.concatenate(matrices, axis=0)
+    qubits = K.cast(qubits, dtype="int32")
+    gate_info = K.cast(gate_info, dtype="int32")
+    state = K.op.execute_circuit(state, matrices, qubits, gate_info, nqubits,
+                                 get_threads())
+    np.testing.assert_allclose(target_state.numpy(), state.numpy(), atol=_atol)
+
+
+@pytest.mark.parametrize("density_matrix", [False, True])
+def test_gate_qubits_in_host_memory(density_matrix):
+    """Check that the qubits passed to the gate operators are on the host."""
+    from qibo import gates
+    from qibo.models import Circuit
+    c = Circuit(3, density_matrix=density_matrix)
+    c.add(gates.H(0))
+    c.add(gates.CNOT(0, 2))
+    c.add(gates.fSim(1, 2, theta=0.1, phi=0.2))
+    c()
+    for gate in c.queue:
+        assert "CPU" in gate.cache.qubits_tensor.device
+        if density_matrix:
+            assert "CPU" in gate.cache.qubits_tensor_dm.device
+    if c._serialized_queue is not None:
+        assert "CPU" in c._serialized_queue["qubits"].device
+        assert "CPU" in c._serialized_queue["gate_info"].device
+
+
+@pytest.mark.parametrize("nqubits", [3, 8, 15])
+@pytest.mark.parametrize("nterms", [1, 5, 20])
+def test_apply_diagonal_layer(nqubits, nterms):
+    """Check ``apply_diagonal_layer`` against multiplying each diagonal."""
+    state = random_complex((2 ** nqubits,))
+    target_state = np.copy(state.numpy()).reshape(nqubits * (2,))
+    phases, targets, ntargets = [], [], []
+    for _ in range(nterms):
+        nt = np.random.randint(1, 3)
+        qubits = [int(q) for q in np.random.choice(nqubits, nt, replace=False)]
+        diagonal = np.exp(1j * np.random.random(2 ** nt))
+        # broadcast the diagonal to the target axes of the state
+        shape = nqubits * [1]
+        for q in qubits:
+            shape[q] = 2
+        diagonal_tensor = diagonal.reshape(nt * (2,))
+        if nt == 2 and qubits[0] > qubits[1]:
+            diagonal_tensor = diagonal_tensor.T
+        target_state = target_state * diagonal_tensor.reshape(shape)
+        phases.extend(diagonal)
+        targets.extend(qubits)
+        ntargets.append(nt)
+
+    phases = K.cast(phases)
+    targets = K.cast(targets, dtype="int32")
+    ntargets = K.cast(ntargets, dtype="int32")
+    state = K.op.apply_diagonal_layer(state, phases, targets, ntargets,
+                                      nqubits, get_threads())
+    np.testing.assert_allclose(target_state.ravel(), state.numpy(), atol=_atol)
+
+
+@pytest.mark.parametrize("nqubits,target,controls",
+                         [(3, 0, []), (4, 3, []), (12, 1, []), (12, 7, [2]),
+                          (6, 2, [0, 5])])
+@pytest.mark.parametrize("nbatch", [1, 4])
+@pytest.mark.parametrize("shared", [False, True])
+def test_apply_gate_batched(nqubits, target, controls, nbatch, shared):
+    """Check ``apply_gate`` on batched states against applying it state by state."""
+    states = random_complex((nbatch, 2 ** nqubits))
+    gates = random_complex((2, 2) if shared else (nbatch, 2, 2))
+    qubits = qubits_tensor(nqubits, [target], controls)
+    target_states = []
+    for i in range(nbatch):
+        gate = gates if shared else gates[i]
+        state = K.op.apply_gate(K.copy(states[i]), gate, qubits, nqubits,
+                                target, get_threads())
+        target_states.append(state.numpy())
+    states = K.op.apply_gate(states, gates, qubits, nqubits, target,
+                             get_threads())
+    np.testing.assert_allclose(states, np.stack(target_states), atol=_atol)
+
+
+@pytest.mark.parametrize("nqubits,targets,controls",
+                         [(3, [0, 1], []), (12, [2, 11], []),
+                          (12, [0, 10], [4]), (7, [3, 1], [0, 6])])
+@pytest.mark.parametrize("nbatch", [1, 3])
+@pytest.mark.parametrize("shared", [False, True])
+def test_apply_two_qubit_gate_batched(nqubits, targets, controls, nbatch, shared):
+    """Check two-qubit gates on batched states against applying them state by state."""
+    states = random_complex((nbatch, 2 ** nqubits))
+    gates = random_complex((4, 4) if shared else (nbatch, 4, 4))
+    qubits = qubits_tensor(nqubits, targets, controls)
+    target_states = []
+    for i in range(nbatch):
+        gate = gates if shared else gates[i]
+        state = K.op.apply_two_qubit_gate(K.copy(states[i]), gate, qubits,
+                                          nqubits, *targets, get_threads())
+        state = K.op.apply_swap(state, qubits, nqubits, *targets,
+                                get_threads())
+        target_states.append(state.numpy())
+    states = K.op.apply_two_qubit_gate(states, gates, qubits, nqubits,
+                                       *targets, get_threads())
+    states = K.op.apply_swap(states, qubits, nqubits, *targets, get_threads())
+    np.testing.assert_allclose(states, np.stack(target_states), atol=_atol)
+
+
 @pytest.mark.parametrize("nqubits,targets,results",
                          [(2, [0], [1]), (2, [1], [0]), (3, [1], [1]),
                           (4, [1, 3], [1, 0]), (5, [1, 2, 4], [0, 1, 1]),
@@ -330,6 +749,172 @@ def test_collapse_state(nqubits, targets, results, dtype):
     np.testing.assert_allclose(state, target_state, atol=atol)
 
 
+@pytest.mark.parametrize("nqubits,targets", [(3, [1]), (10, [0, 4, 9])])
+@pytest.mark.parametrize("nbatch", [1, 5])
+@pytest.mark.parametrize("shared", [False, True])
+def test_collapse_state_batched(nqubits, targets, nbatch, shared):
+    """Check ``collapse_state`` on batched states against collapsing them one by one."""
+    states = random_complex((nbatch, 2 ** nqubits), dtype=np.complex128)
+    qubits = sorted(nqubits - np.array(targets) - 1)
+    nresults = 1 if shared else nbatch
+    results = np.random.randint(0, 2 ** len(targets), size=(nresults,))
+    target_states = []
+    for i in range(nbatch):
+        result = results[0] if shared else results[i]
+        state = K.op.collapse_state(K.copy(states[i]), qubits, result, nqubits)
+        target_states.append(state.numpy())
+    states = K.op.collapse_state(states, qubits, results, nqubits)
+    np.testing.assert_allclose(states, np.stack(target_states), atol=1e-14)
+
+
+@pytest.mark.parametrize("nqubits,targets", [(3, [1]), (12, [0, 4, 11])])
+@pytest.mark.parametrize("nbatch", [1, 3])
+@pytest.mark.parametrize("normalize", [False, True])
+def test_collapse_state_probability(nqubits, targets, nbatch, normalize):
+    """Check the probability of the measured result returned by ``collapse_state``."""
+    states = random_complex((nbatch, 2 ** nqubits)).numpy()
+    results = np.random.randint(0, 2 ** len(targets), size=(nbatch,))
+    target_probabilities = []
+    for state, result in zip(states, results):
+        state = np.reshape(state, nqubits * (2,))
+        bits = np.unpackbits(np.array([result], dtype=np.uint8))[-len(targets):]
+        slicer = nqubits * [slice(None)]
+        for t, r in zip(targets, bits):
+            slicer[t] = r
+        target_probabilities.append(np.sum(np.abs(state[tuple(slicer)]) ** 2))
+
+    qubits = sorted(nqubits - np.array(targets) - 1)
+    states = K.cast(np.squeeze(states, axis=0) if nbatch == 1 else states)
+    states, probabilities = K.op.collapse_state(
+        states, qubits, results if nbatch > 1 else results[0], nqubits,
+        normalize=normalize, return_probability=True)
+    np.testing.assert_allclose(probabilities, target_probabilities)
+    norms = np.sqrt(np.sum(np.abs(np.reshape(states, (nbatch, -1))) ** 2,
+                           axis=1))
+    if normalize:
+        np.testing.assert_allclose(norms, nbatch * [1])
+    else:
+        np.testing.assert_allclose(norms, np.sqrt(target_probabilities))
+
+
+
+@pytest.mark.parametrize("nqubits,targets", [(3, [1]), (10, [0, 4, 9])])
+@pytest.mark.parametrize("nbatch", [1, 3])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+def test_collapse_state_compact(nqubits, targets, nbatch, dtype):
+    """Check ``collapse_state_compact`` against slicing the measured result."""
+    atol = 1e-6 if dtype == np.complex64 else 1e-14
+    states = random_complex((nbatch, 2 ** nqubits), dtype=dtype).numpy()
+    results = np.random.randint(0, 2 ** len(targets), size=(nbatch,))
+    target_states, target_probabilities = [], []
+    for state, result in zip(states, results):
+        state = np.reshape(state, nqubits * (2,))
+        bits = np.unpackbits(np.array([result], dtype=np.uint8))[-len(targets):]
+        slicer = nqubits * [slice(None)]
+        for t, r in zip(targets, bits):
+            slicer[t] = r
+        substate = state[tuple(slicer)].ravel()
+        probability = np.sum(np.abs(substate) ** 2)
+        target_states.append(substate / np.sqrt(probability))
+        target_probabilities.append(probability)
+
+    qubits = sorted(nqubits - np.array(targets) - 1)
+    if nbatch == 1:
+        states, results = states[0], results[0]
+        target_states = target_states[0]
+    states, probabilities = K.op.collapse_state_compact(
+        states, qubits, results, nqubits, return_probability=True)
+    np.testing.assert_allclose(states, target_states, atol=atol)
+    np.testing.assert_allclose(probabilities, target_probabilities,
+                               rtol=1e-5 if dtype == np.complex64 else 1e-7)
+
+
+def test_initial_state_half():
+    """Check ``initial_state`` and ``reset_state`` for half precision states."""
+    state = K.op.initial_state(nqubits=4, dtype=np.float16, is_matrix=False,
+                               omp_num_threads=get_threads())
+    assert tuple(state.shape) == (16, 2)
+    target_state = np.array([1] + [0] * 15, dtype=np.complex64)
+    np.testing.assert_allclose(K.op.from_half_precision(state), target_state)
+    state = K.op.to_half_precision(random_complex((3, 16)))
+    state = K.op.reset_state(state, 4, omp_num_threads=get_threads())
+    np.testing.assert_allclose(K.op.from_half_precision(state),
+                               np.stack(3 * [target_state]))
+
+
+@pytest.mark.parametrize("nqubits,target,controls",
+                         [(3, 0, []), (10, 3, []), (10, 7, [2]),
+                          (6, 2, [0, 5])])
+def test_apply_gate_half(nqubits, target, controls):
+    """Check ``apply_gate`` on half precision states against ``complex64``."""
+    state = random_complex((2 ** nqubits,), dtype=np.complex64)
+    gate = random_complex((2, 2), dtype=np.complex64)
+    qubits = qubits_tensor(nqubits, [target], controls)
+    half_state = K.op.to_half_precision(state)
+    target_state = K.op.apply_gate(state, gate, qubits, nqubits, target,
+                                   get_threads())
+    half_state = K.op.apply_gate(half_state, K.op.to_half_precision(gate),
+                                 qubits, nqubits, target, get_threads())
+    assert half_state.dtype == np.float16
+    np.testing.assert_allclose(K.op.from_half_precision(half_state),
+                               target_state, rtol=1e-2, atol=1e-2)
+
+
+@pytest.mark.parametrize("nqubits,targets,controls",
+                         [(3, [0, 1], []), (10, [2, 9], []),
+                          (10, [0, 8], [4])])
+def test_apply_two_qubit_gate_half(nqubits, targets, controls):
+    """Check two-qubit gates on half precision states against ``complex64``."""
+    state = random_complex((2 ** nqubits,), dtype=np.complex64)
+    gate = random_complex((4, 4), dtype=np.complex64)
+    qubits = qubits_tensor(nqubits, targets, controls)
+    half_state = K.op.to_half_precision(state)
+    target_state = K.op.apply_two_qubit_gate(state, gate, qubits, nqubits,
+                                             *targets, get_threads())
+    half_state = K.op.apply_two_qubit_gate(
+        half_state, K.op.to_half_precision(gate), qubits, nqubits, *targets,
+        get_threads())
+    np.testing.assert_allclose(K.op.from_half_precision(half_state),
+                               target_state, rtol=1e-2, atol=1e-2)
+
+
+@pytest.mark.parametrize("nqubits,targets", [(3, [1]), (10, [0, 4, 9])])
+def test_collapse_state_half(nqubits, targets):
+    """Check ``collapse_state`` and ``renormalize_state`` for half precision states."""
+    state = random_complex((2 ** nqubits,), dtype=np.complex64)
+    qubits = sorted(nqubits - np.array(targets) - 1)
+    result = np.random.randint(0, 2 ** len(targets))
+    target_state = K.op.collapse_state(K.copy(state), qubits, result, nqubits)
+    half_state = K.op.collapse_state(K.op.to_half_precision(state), qubits,
+                                     result, nqubits)
+    half_state = K.op.from_half_precision(half_state)
+    np.testing.assert_allclose(half_state, target_state, atol=1e-3)
+
+    state = K.op.to_half_precision(random_complex((2 ** nqubits,)))
+    state = K.op.renormalize_state(state, nqubits)
+    norm = np.sum(np.abs(K.op.from_half_precision(state)) ** 2)
+    np.testing.assert_allclose(norm, 1, atol=1e-2)
+
+
+def test_measure_state_half():
+    """Check ``measure_state`` on half precision states against ``complex64``."""
+    nqubits, targets = 6, [0, 2, 5]
+    state = random_complex((2 ** nqubits,), dtype=np.complex64)
+    state = state / np.sqrt(np.sum(np.abs(state) ** 2))
+    qubits = qubits_tensor(nqubits, targets)
+    frequencies = K.op.measure_state(np.zeros(2 ** len(targets), dtype=np.int64),
+                                     K.op.to_half_precision(K.cast(state)),
+                                     qubits, nshots=100000, nqubits=nqubits,
+                                     seed=1234, omp_num_threads=get_threads())
+    target_frequencies = K.op.measure_state(
+        np.zeros(2 ** len(targets), dtype=np.int64), K.cast(state), qubits,
+        nshots=100000, nqubits=nqubits, seed=1234,
+        omp_num_threads=get_threads())
+    np.testing.assert_allclose(np.array(frequencies) / 100000,
+                               np.array(target_frequencies) / 100000,
+                               atol=1e-2)
+
+
 # this test fails when compiling due to in-place updates of the state
 @pytest.mark.parametrize("gate", ["h", "x", "z", "swap"])
 @pytest.mark.parametrize("compile", [False])
@@ -381,12 +966,32 @@ def test_custom_op_toy_callback(gate, compile):
     np.testing.assert_allclose(target_callback, callback.numpy())
 
 
-def check_unimplemented_error(func, *args): # pragma: no cover
-    # method not tested by GitHub workflows because it requires GPU
-    from tensorflow.python.framework import errors_impl # pylint: disable=no-name-in-module
-    error = errors_impl.UnimplementedError
-    with pytest.raises(error):
-        func(*args)
+@pytest.mark.parametrize("copy", [False, True])
+def test_shared_state_buffers(copy):
+    """Check the in-place and copy policies for shared state buffers."""
+    state = random_complex((2 ** 3,))
+    target_state = state.numpy()
+    qubits = qubits_tensor(3, [1])
+    K.op.state_buffer_counters(reset=True)
+    K.op.set_copy_shared_states(copy)
+    try:
+        final_state = K.op.apply_x(state, qubits, 3, 1, get_threads())
+    finally:
+        K.op.set_copy_shared_states(True)
+    counters = K.op.state_buffer_counters(reset=True)
+
+    target_final = np.reshape(target_state, (2, 2, 2))[:, ::-1].flatten()
+    np.testing.assert_allclose(final_state, target_final)
+    # the eager input is shared with ``state`` so it cannot be forwarded
+    assert counters["forwarded"] == 0
+    if copy:
+        np.testing.assert_allclose(state, target_state)
+        assert counters["copies"] == 1
+        assert counters["copied_bytes"] == target_state.nbytes
+    else:
+        np.testing.assert_allclose(state, target_final)
+        assert counters["shared"] == 1
+        assert counters["copies"] == 0
 
 
 @pytest.mark.parametrize("nqubits", [3, 4, 7, 8, 9, 10])
@@ -406,13 +1011,8 @@ def test_transpose_state(nqubits, ndevices):
         shape = (ndevices, int(state.shape[0]) // ndevices)
         state = K.reshape(state, shape)
         pieces = [state[i] for i in range(ndevices)]
-        if K.gpu_devices: # pragma: no cover
-            # case not tested by GitHub workflows because it requires GPU
-            check_unimplemented_error(K.op.transpose_state,
-                                      pieces, new_state, nqubits, qubit_order, get_threads())
-        else:
-            new_state = K.op.transpose_state(pieces, new_state, nqubits, qubit_order, get_threads())
-            np.testing.assert_allclose(target_state, new_state.numpy())
+        new_state = K.op.transpose_state(pieces, new_state, nqubits, qubit_order, get_threads())
+        np.testing.assert_allclose(target_state, new_state.numpy())
 
 
 @pytest.mark.parametrize("nqubits", [4, 5, 7, 8, 9, 10])
@@ -430,14 +1030,9 @@ def test_swap_pieces_zero_global(nqubits):
         target_state = K.reshape(target_state, shape)
 
         piece0, piece1 = state[0], state[1]
-        if K.gpu_devices: # pragma: no cover
-            # case not tested by GitHub workflows because it requires GPU
-            check_unimplemented_error(K.op.swap_pieces,
-                                      piece0, piece1, local - 1, nqubits - 1, get_threads())
-        else:
-            K.op.swap_pieces(piece0, piece1, local - 1, nqubits - 1, get_threads())
-            np.testing.assert_allclose(target_state[0], piece0.numpy())
-            np.testing.assert_allclose(target_state[1], piece1.numpy())
+        K.op.swap_pieces(piece0, piece1, local - 1, nqubits - 1, get_threads())
+        np.testing.assert_allclose(target_state[0], piece0.numpy())
+        np.testing.assert_allclose(target_state[1], piece1.numpy())
 
 
 @pytest.mark.parametrize("nqubits", [5, 7, 8, 9, 10])
@@ -465,16 +1060,11 @@ def test_swap_pieces(nqubits):
         state = K.transpose(state, transpose_order)
         state = K.reshape(state, shape)
         piece0, piece1 = state[0], state[1]
-        if K.gpu_devices: # pragma: no cover
-            # case not tested by GitHub workflows because it requires GPU
-            check_unimplemented_error(K.op.swap_pieces,
-                                      piece0, piece1, local_qubit - 1, nqubits - 1, get_threads())
-        else:
-            K.op.swap_pieces(piece0, piece1,
-                           local_qubit - int(global_qubit < local_qubit),
-                           nqubits - 1, get_threads())
-            np.testing.assert_allclose(target_state[0], piece0.numpy())
-            np.testing.assert_allclose(target_state[1], piece1.numpy())
+        K.op.swap_pieces(piece0, piece1,
+                         local_qubit - int(global_qubit < local_qubit),
+                         nqubits - 1, get_threads())
+        np.testing.assert_allclose(target_state[0], piece0.numpy())
+        np.testing.assert_allclose(target_state[1], piece1.numpy())
 
 
 @pytest.mark.skip("tf.tensor_scatter_nd_update bug on GPU (tensorflow#42581)")
@@ -503,15 +1093,171 @@ def test_initial_state_gradient(dtype, compile): # pragma: no cover
     np.testing.assert_allclose(grad_reference, grad_custom_op)
 
 
+@pytest.mark.parametrize("nqubits", [3, 5])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+@pytest.mark.parametrize("copy", [True, False])
+def test_gate_gradients(nqubits, dtype, copy):
+    """Check adjoint gradients of the gate operators against ``tensordot`` autodiff."""
+    tf = K.backend
+    hamiltonian = random_complex((4, 4)).numpy()
+    hamiltonian = (hamiltonian + hamiltonian.conj().T).astype(dtype)
+    target_state = random_complex((2 ** nqubits,)).numpy().astype(dtype)
+
+    def matrices(theta):
+        cos = tf.cast(tf.cos(theta), dtype=dtype)
+        isin = tf.cast(tf.sin(theta), dtype=dtype) * 1j
+        rx = tf.reshape(tf.stack([cos[0], -isin[0], -isin[0], cos[0]]), (2, 2))
+        phase = tf.exp(1j * tf.cast(theta[1], dtype=dtype))
+        unitary = tf.linalg.expm(-1j * tf.cast(theta[2], dtype=dtype) *
+                                 hamiltonian)
+        fsim = tf.stack([cos[3], -isin[3], -isin[3], cos[3],
+                         tf.math.conj(phase)])
+        return rx, phase, unitary, fsim
+
+    def apply_matrix(state, matrix, targets, controls=[]):
+        k = len(targets) + len(controls)
+        if controls:
+            eye = tf.eye(2 ** k - int(matrix.shape[0]), dtype=dtype)
+            matrix = tf.linalg.LinearOperatorBlockDiag(
+                [tf.linalg.LinearOperatorFullMatrix(eye),
+                 tf.linalg.LinearOperatorFullMatrix(matrix)]).to_dense()
+        qubits = list(controls) + list(targets)
+        state = tf.reshape(state, nqubits * (2,))
+        matrix = tf.reshape(matrix, 2 * k * (2,))
+        state = tf.tensordot(matrix, state, [list(range(k, 2 * k)), qubits])
+        order = qubits + [q for q in range(nqubits) if q not in qubits]
+        state = tf.transpose(state, [order.index(q) for q in range(nqubits)])
+        return tf.reshape(state, (2 ** nqubits,))
+
+    def circuit(theta, custom):
+        rx, phase, unitary, fsim = matrices(theta)
+        state = K.op.initial_state(nqubits=nqubits, dtype=dtype,
+                                   is_matrix=False,
+                                   omp_num_threads=get_threads())
+        if custom:
+            q = lambda t, c=[]: qubits_tensor(nqubits, t, c)
+            state = K.op.apply_gate(state, rx, q([0]), nqubits, 0,
+                                    get_threads())
+            state = K.op.apply_x(state, q([1], [0]), nqubits, 1, get_threads())
+            state = K.op.apply_z_pow(state, phase, q([2], [1]), nqubits, 2,
+                                     get_threads())
+            state = K.op.apply_two_qubit_gate(state, unitary, q([2, 0]),
+                                              nqubits, 2, 0, get_threads())
+            state = K.op.apply_fsim(state, fsim, q([0, 1], [2]), nqubits,
+                                    0, 1, get_threads())
+            state = K.op.apply_gate(state, rx, q([1]), nqubits, 1,
+                                    get_threads())
+        else:
+            x = np.array([[0, 1], [1, 0]], dtype=dtype)
+            one, zero = tf.ones_like(phase), tf.zeros_like(phase)
+            zpow = tf.linalg.diag(tf.stack([one, phase]))
+            fsim = tf.reshape(tf.stack([one, zero, zero, zero,
+                                        zero, fsim[0], fsim[1], zero,
+                                        zero, fsim[2], fsim[3], zero,
+                                        zero, zero, zero, fsim[4]]), (4, 4))
+            state = apply_matrix(state, rx, [0])
+            state = apply_matrix(state, x, [1], [0])
+            state = apply_matrix(state, zpow, [2], [1])
+            state = apply_matrix(state, unitary, [2, 0])
+            state = apply_matrix(state, fsim, [0, 1], [2])
+            state = apply_matrix(state, rx, [1])
+        overlap = tf.reduce_sum(tf.math.conj(target_state) * state)
+        return tf.math.real(overlap * tf.math.conj(overlap)), state
+
+    theta = K.optimization.Variable(np.random.random(4))
+    results = []
+    for custom in [False, True]:
+        K.op.set_copy_shared_states(copy or not custom)
+        try:
+            with K.optimization.GradientTape() as tape:
+                loss, state = circuit(theta, custom)
+            final_state = state.numpy()
+            results.append((loss, tape.gradient(loss, theta)))
+        finally:
+            K.op.set_copy_shared_states(True)
+        if copy:
+            # the backward pass does not modify the final state
+            np.testing.assert_allclose(state, final_state)
+    atol = 1e-5 if dtype == np.complex64 else 1e-10
+    np.testing.assert_allclose(results[1][0], results[0][0], atol=atol)
+    np.testing.assert_allclose(results[1][1], results[0][1], atol=atol)
+    if not copy:
+        # persistent tapes require copies of the shared states
+        return
+
+    # repeated gradients of a persistent tape agree
+    with K.optimization.GradientTape(persistent=True) as tape:
+        loss, state = circuit(theta, True)
+    final_state = state.numpy()
+    gradients = [tape.gradient(loss, theta) for _ in range(2)]
+    del tape
+    np.testing.assert_allclose(state, final_state)
+    for gradient in gradients:
+        np.testing.assert_allclose(gradient, results[0][1], atol=atol)
+
+
+@pytest.mark.parametrize("copy", [True, False])
+def test_gate_gradients_non_unitary(copy):
+    """Check gradients of non-unitary gates, which require copies of the states."""
+    tf = K.backend
+    theta = K.optimization.Variable(0.3, dtype=tf.float64)
+    qubits = qubits_tensor(2, [0])
+    K.op.set_copy_shared_states(copy)
+    try:
+        with K.optimization.GradientTape() as tape:
+            matrix = tf.cast(theta, dtype=tf.complex128) * tf.eye(2, dtype=tf.complex128)
+            state = K.op.initial_state(nqubits=2, dtype=np.complex128,
+                                       is_matrix=False,
+                                       omp_num_threads=get_threads())
+            state = K.op.apply_gate(state, matrix, qubits, 2, 0, get_threads())
+            loss = tf.math.real(tf.reduce_sum(state))
+        if copy:
+            # the state before the gate is the input, so no undo is needed
+            np.testing.assert_allclose(tape.gradient(loss, theta), 1.0)
+        else:
+            with pytest.raises(tf.errors.InvalidArgumentError):
+                tape.gradient(loss, theta)
+    finally:
+        K.op.set_copy_shared_states(True)
+
+
+def test_gate_gradients_inplace_compiled():
+    """Check that compiled gradients with in-place shared states raise an error."""
+    tf = K.backend
+    theta = K.optimization.Variable(0.3, dtype=tf.float64)
+    qubits = qubits_tensor(2, [0])
+
+    @tf.function
+    def gradient():
+        phase = tf.exp(1j * tf.cast(theta, dtype=tf.complex128))
+        with K.optimization.GradientTape() as tape:
+            state = K.op.initial_state(nqubits=2, dtype=np.complex128,
+                                       is_matrix=False,
+                                       omp_num_threads=get_threads())
+            state = K.op.apply_z_pow(state, phase, qubits, 2, 0,
+                                     get_threads())
+            loss = tf.math.real(tf.reduce_sum(state))
+        return tape.gradient(loss, theta)
+
+    K.op.set_copy_shared_states(False)
+    try:
+        with pytest.raises(RuntimeError):
+            gradient()
+    finally:
+        K.op.set_copy_shared_states(True)
+
+
 @pytest.mark.parametrize("dtype", [np.float32, np.float64])
 @pytest.mark.parametrize("inttype", [np.int32, np.int64])
 def test_measure_frequencies(dtype, inttype):
     import sys
     probs = np.ones(16, dtype=dtype) / 16
     frequencies = np.zeros(16, dtype=inttype)
-    frequencies = K.op.measure_frequencies(frequencies, probs, nshots=1000,
-                                           nqubits=4, omp_num_threads=1,
-                                           seed=1234)
+    # the Metropolis sampler is only available on CPU
+    with K.device(K.get_cpu()):
+        frequencies = K.op.measure_frequencies(frequencies, probs, nshots=1000,
+                                               nqubits=4, omp_num_threads=1,
+                                               seed=1234)
     if sys.platform == "linux":
         target_frequencies = [60, 50, 68, 64, 53, 53, 67, 54, 64, 53, 67,
                               69, 76, 57, 64, 81]
@@ -522,6 +1268,147 @@ def test_measure_frequencies(dtype, inttype):
     np.testing.assert_allclose(frequencies, target_frequencies)
 
 
+def test_measure_frequencies_batched():
+    """Check that each state of a batch is sampled with its own seed."""
+    probs = np.random.random((3, 16))
+    probs = probs / np.sum(probs, axis=1)[:, np.newaxis]
+    frequencies = np.zeros((3, 16), dtype=np.int64)
+    frequencies = K.op.measure_frequencies(frequencies, probs, nshots=1000,
+                                           nqubits=4, omp_num_threads=1,
+                                           seed=1234)
+    for i in range(3):
+        target_frequencies = K.op.measure_frequencies(
+            np.zeros(16, dtype=np.int64), probs[i], nshots=1000, nqubits=4,
+            omp_num_threads=1, seed=1234 + i)
+        np.testing.assert_allclose(frequencies[i], target_frequencies)
+    np.testing.assert_allclose(np.sum(frequencies, axis=1), 3 * [1000])
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.float64])
+@pytest.mark.parametrize("inttype", [np.int32, np.int64])
+def test_measure_frequencies_exact(dtype, inttype):
+    probs = np.random.random(32).astype(dtype)
+    probs[[3, 10, 17]] = 0
+    nshots = 100000
+    kwargs = dict(nshots=nshots, nqubits=5, seed=1234, exact=True)
+    frequencies = K.op.measure_frequencies(np.zeros(32, dtype=inttype), probs,
+                                           omp_num_threads=get_threads(),
+                                           **kwargs)
+    assert np.sum(frequencies) == nshots
+    np.testing.assert_allclose(np.array(frequencies)[[3, 10, 17]], 0)
+    np.testing.assert_allclose(np.array(frequencies) / nshots,
+                               probs / np.sum(probs), atol=1e-2)
+    # the result does not depend on the number of threads
+    target_frequencies = K.op.measure_frequencies(
+        np.zeros(32, dtype=inttype), probs, omp_num_threads=1, **kwargs)
+    np.testing.assert_allclose(frequencies, target_frequencies)
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.float64])
+def test_measure_frequencies_sparse(dtype):
+    probs = np.random.random(64).astype(dtype)
+    probs[::3] = 0
+    # the sparse sampler is only available on CPU
+    with K.device(K.get_cpu()):
+        frequencies = K.op.measure_frequencies(
+            np.zeros(64, dtype=np.int64), probs, nshots=1000, nqubits=6,
+            seed=123, omp_num_threads=get_threads(), exact=True)
+    states, counts = K.op.measure_frequencies_sparse(
+        probs, nshots=1000, nqubits=6, seed=123, omp_num_threads=get_threads())
+    target_states = np.nonzero(frequencies)[0]
+    np.testing.assert_allclose(states, target_states)
+    np.testing.assert_allclose(counts, np.array(frequencies)[target_states])
+
+
+@pytest.mark.parametrize("nqubits,targets", [(4, [1]), (6, [0, 2, 5]),
+                                             (10, [3, 4, 7, 8, 9])])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+@pytest.mark.parametrize("inttype", [np.int32, np.int64])
+def test_measure_state(nqubits, targets, dtype, inttype):
+    """Check ``measure_state`` against sampling the marginal probabilities."""
+    state = np.random.random(2 ** nqubits) + 1j * np.random.random(2 ** nqubits)
+    state = np.reshape(state / np.sqrt(np.sum(np.abs(state) ** 2)),
+                       nqubits * (2,))
+    # first measured result has zero probability
+    state[tuple(0 if q in targets else slice(None) for q in range(nqubits))] = 0
+    unmeasured = tuple(q for q in range(nqubits) if q not in targets)
+    probs = np.sum(np.abs(state) ** 2, axis=unmeasured).ravel()
+
+    nshots = 100000
+    qubits = qubits_tensor(nqubits, targets)
+    frequencies = K.op.measure_state(np.zeros(2 ** len(targets), dtype=inttype),
+                                     K.cast(state.ravel().astype(dtype)),
+                                     qubits, nshots=nshots, nqubits=nqubits,
+                                     seed=1234, omp_num_threads=get_threads())
+    frequencies = np.array(frequencies)
+    assert np.sum(frequencies) == nshots
+    assert frequencies[0] == 0
+    np.testing.assert_allclose(frequencies / nshots, probs, atol=1e-2)
+    if dtype == np.complex128:
+        target_frequencies = K.op.measure_frequencies(
+            np.zeros(2 ** len(targets), dtype=inttype), probs, nshots=nshots,
+            nqubits=len(targets), seed=1234, omp_num_threads=get_threads(),
+            exact=True)
+        np.testing.assert_allclose(frequencies, target_frequencies)
+
+
+@pytest.mark.parametrize("nqubits", [3, 4, 8])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+def test_pauli_expectation(nqubits, dtype):
+    """Check ``pauli_expectation`` against dense Pauli string matrices."""
+    from qibo import matrices
+    atol = 1e-5 if dtype == np.complex64 else 1e-12
+    paulis = [matrices.I, matrices.X, matrices.Y, matrices.Z]
+    state = random_complex((2 ** nqubits,)).numpy()
+    state = state / np.sqrt(np.sum(np.abs(state) ** 2))
+    # include strings with the same flips so that they are grouped
+    codes = np.random.randint(0, 4, size=(40, nqubits))
+    codes[20:] = codes[:20] ^ 3 * (codes[:20] % 2 == 0)
+    codes[-1] = 0
+    target_values = []
+    for code in codes:
+        matrix = np.eye(1)
+        for c in code:
+            matrix = np.kron(matrix, paulis[c])
+        target_values.append(np.real(np.conj(state).dot(matrix.dot(state))))
+
+    values = K.op.pauli_expectation(state.astype(dtype), codes, nqubits,
+                                    omp_num_threads=get_threads())
+    np.testing.assert_allclose(values, target_values, atol=atol)
+    coefficients = np.random.random(len(codes))
+    value = K.op.pauli_expectation(state.astype(dtype), codes, nqubits,
+                                   coefficients=coefficients,
+                                   omp_num_threads=get_threads())
+    np.testing.assert_allclose(value, coefficients.dot(target_values),
+                               atol=10 * atol)
+
+
+def test_pauli_expectation_symbolic_hamiltonian():
+    """Check ``pauli_expectation`` with the strings of a symbolic Hamiltonian."""
+    import sympy
+    from qibo import matrices
+    from qibo.core.hamiltonians import SymbolicHamiltonian
+    nqubits = 5
+    x = sympy.symbols(" ".join(f"X{i}" for i in range(nqubits)))
+    y = sympy.symbols(" ".join(f"Y{i}" for i in range(nqubits)))
+    z = sympy.symbols(" ".join(f"Z{i}" for i in range(nqubits)))
+    symmap = {s: (i, matrices.X) for i, s in enumerate(x)}
+    symmap.update({s: (i, matrices.Y) for i, s in enumerate(y)})
+    symmap.update({s: (i, matrices.Z) for i, s in enumerate(z)})
+    symham = sum(x[i] * x[i + 1] + 0.5 * y[i] * y[i + 1] - z[i] * z[i + 1]
+                 for i in range(nqubits - 1))
+    symham += 0.3 * sum(x) + 2
+    symham = SymbolicHamiltonian(symham, symmap)
+    codes, coefficients, constant = symham.pauli_strings()
+    state = random_complex((2 ** nqubits,)).numpy()
+    state = state / np.sqrt(np.sum(np.abs(state) ** 2))
+    value = K.op.pauli_expectation(state, codes, nqubits, coefficients,
+                                   omp_num_threads=get_threads())
+    matrix = symham.dense_matrix()
+    target_value = np.real(np.conj(state).dot(matrix.dot(state)))
+    np.testing.assert_allclose(value + np.real(constant), target_value)
+
+
 NONZERO = list(itertools.combinations(range(8), r=1))
 NONZERO.extend(itertools.combinations(range(8), r=2))
 NONZERO.extend(itertools.combinations(range(8), r=3))
@@ -545,14 +1432,186 @@ def test_measure_frequencies_sparse_probabilities(nonzero):
             assert freq == 0
 
 
-def test_backend_sample_frequencies_seed():
+@pytest.mark.parametrize("exact", [False, True])
+def test_backend_sample_frequencies_seed(exact):
     """Check that frequencies generated using custom operator are different in each call."""
     from qibo import K
     from qibo.config import SHOT_CUSTOM_OP_THREASHOLD
     nshots = SHOT_CUSTOM_OP_THREASHOLD + 1
     probs = np.random.random(8)
     probs = probs / np.sum(probs)
-    frequencies1 = K.sample_frequencies(probs, nshots)
-    frequencies2 = K.sample_frequencies(probs, nshots)
+    frequencies1 = K.sample_frequencies(probs, nshots, exact=exact)
+    frequencies2 = K.sample_frequencies(probs, nshots, exact=exact)
+    assert np.sum(frequencies1) == nshots
     np.testing.assert_raises(AssertionError, np.testing.assert_allclose,
                              frequencies1, frequencies2)
+
+
+def trajectory_circuit(nqubits, ngates, channels=True):
+    """Random gates and channels in the format of ``simulate_trajectories``.
+
+    Returns the inputs of the operator and the final density matrix.
+    """
+    state = np.random.random(2 ** nqubits) + 1j * np.random.random(2 ** nqubits)
+    state = state / np.sqrt(np.sum(np.abs(state) ** 2))
+    rho = np.outer(state, state.conj())
+    matrices, qubits, gate_info = [], [], []
+    for i in range(ngates):
+        ntargets = np.random.randint(1, 3)
+        targets = [int(q) for q in np.random.choice(nqubits, ntargets,
+                                                    replace=False)]
+        if channels and i % 2:
+            # channel with random unitaries and probabilities
+            nops = np.random.randint(2, 4)
+            probs = np.random.random(nops)
+            probs = probs / np.sum(probs)
+            ops = []
+            for p in probs:
+                u, _ = np.linalg.qr(random_complex(2 * (2 ** ntargets,)).numpy())
+                ops.append(np.sqrt(p) * u)
+            full = [dense_gate_matrix(nqubits, op, targets) for op in ops]
+            rho = sum(f.dot(rho).dot(f.conj().T) for f in full)
+            matrices.append(np.reshape(ops, (-1,)))
+            gate_info.append([nops, ntargets, 0, targets[0], targets[-1]])
+            qubits.extend(qubits_tensor(nqubits, targets))
+        else:
+            controls = [int(q) for q in range(nqubits)
+                        if q not in targets][:np.random.randint(0, 2)]
+            u, _ = np.linalg.qr(random_complex(2 * (2 ** ntargets,)).numpy())
+            full = dense_gate_matrix(nqubits, u, targets, controls)
+            rho = full.dot(rho).dot(full.conj().T)
+            matrices.append(np.reshape(u, (-1,)))
+            gate_info.append([0, ntargets, len(controls), targets[0],
+                              targets[-1]])
+            qubits.extend(qubits_tensor(nqubits, targets, controls))
+    inputs = (K.cast(state), K.cast(np.concatenate(matrices)),
+              K.cast(qubits, dtype="int32"), K.cast(gate_info, dtype="int32"))
+    return inputs, rho
+
+
+@pytest.mark.parametrize("nqubits,measured", [(3, [1]), (4, [0, 2]),
+                                              (5, [4, 1, 3])])
+@pytest.mark.parametrize("channels", [False, True])
+def test_simulate_trajectories(nqubits, measured, channels):
+    """Check ``simulate_trajectories`` against the density matrix probabilities."""
+    inputs, rho = trajectory_circuit(nqubits, 6, channels)
+    probs = np.reshape(np.real(np.diag(rho)), nqubits * (2,))
+    unmeasured = tuple(q for q in range(nqubits) if q not in measured)
+    # the operator orders the results by qubit id
+    probs = np.sum(probs, axis=unmeasured).ravel()
+    ntrajectories = 20000
+    frequencies = K.op.simulate_trajectories(
+        *inputs, qubits_tensor(nqubits, measured), nqubits=nqubits,
+        ntrajectories=ntrajectories, seed=1234, omp_num_threads=get_threads())
+    frequencies = np.array(frequencies)
+    assert np.sum(frequencies) == ntrajectories
+    np.testing.assert_allclose(frequencies / ntrajectories, probs, atol=2e-2)
+
+
+def test_simulate_trajectories_seed():
+    """Check that trajectories with the same seed do not depend on the threads."""
+    nqubits = 4
+    inputs, _ = trajectory_circuit(nqubits, 8)
+    measured = qubits_tensor(nqubits, [0, 1, 3])
+    frequencies = [K.op.simulate_trajectories(
+        *inputs, measured, nqubits=nqubits, ntrajectories=1000, seed=123,
+        omp_num_threads=threads) for threads in [1, get_threads()]]
+    np.testing.assert_allclose(frequencies[0], frequencies[1])
+    other_frequencies = K.op.simulate_trajectories(
+        *inputs, measured, nqubits=nqubits, ntrajectories=1000, seed=321,
+        omp_num_threads=get_threads())
+    np.testing.assert_raises(AssertionError, np.testing.assert_allclose,
+                             frequencies[0], other_frequencies)
+
+
+@pytest.mark.parametrize("targets", [(0, 3), (1, 1), (-1, 0)])
+def test_simulate_trajectories_invalid_targets(targets):
+    """Check that ``simulate_trajectories`` rejects invalid target qubits."""
+    nqubits = 3
+    state = K.cast(np.eye(2 ** nqubits)[0])
+    gate = K.cast(np.eye(4).ravel())
+    qubits = K.cast([0, 1], dtype="int32")
+    gate_info = K.cast([[0, 2, 0, targets[0], targets[1]]], dtype="int32")
+    with pytest.raises(K.backend.errors.InvalidArgumentError):
+        K.op.simulate_trajectories(state, gate, qubits, gate_info,
+                                   qubits_tensor(nqubits, [0]), nqubits=nqubits,
+                                   ntrajectories=10, seed=123,
+                                   omp_num_threads=get_threads())
+
+
+@pytest.mark.parametrize("npieces", [1, 4])
+@pytest.mark.parametrize("mmap", [False, True])
+@pytest.mark.parametrize("dtype", [np.complex64, np.complex128])
+def test_save_load_state(npieces, mmap, dtype, tmp_path):
+    """Check that ``load_state`` restores the pieces written by ``save_state``."""
+    filename = str(tmp_path / "state.bin")
+    pieces = [random_complex((2 ** 10,), dtype=dtype) for _ in range(npieces)]
+    if npieces > 1:
+        # zero chunks are not stored
+        pieces[1] = K.cast(np.zeros(2 ** 10, dtype=dtype))
+        pieces[2] = K.cast(np.concatenate([np.zeros(2 ** 9, dtype=dtype),
+                                           pieces[2].numpy()[2 ** 9:]]))
+    state = pieces if npieces > 1 else pieces[0]
+    size = K.op.save_state(filename, state, chunk_size=2 ** 7,
+                           omp_num_threads=get_threads())
+    assert (tmp_path / "state.bin").stat().st_size == size
+    assert not (tmp_path / "state.bin.tmp").exists()
+    if npieces > 1:
+        dense_pieces = [random_complex((2 ** 10,), dtype=dtype)
+                        for _ in range(npieces)]
+        dense_size = K.op.save_state(str(tmp_path / "dense.bin"),
+                                     dense_pieces, chunk_size=2 ** 7)
+        assert size < dense_size
+
+    loaded = K.op.load_state(filename, dtype, npieces=npieces, mmap=mmap,
+                             omp_num_threads=get_threads())
+    if npieces == 1:
+        loaded = [loaded]
+    for piece, target_piece in zip(loaded, pieces):
+        np.testing.assert_allclose(piece, target_piece)
+    # mapped pieces are not modified by in-place updates of the loaded state
+    state = K.op.apply_gate(loaded[0], random_complex((2, 2), dtype=dtype),
+                            [9], 10, 0, get_threads())
+    loaded = K.op.load_state(filename, dtype, npieces=npieces)
+    np.testing.assert_allclose(loaded if npieces == 1 else loaded[0],
+                               pieces[0])
+
+
+def test_save_state_threshold(tmp_path):
+    """Check that chunks of small norm are dropped when ``threshold`` is given."""
+    filename = str(tmp_path / "state.bin")
+    state = np.random.random(2 ** 8) + 1j * np.random.random(2 ** 8)
+    state[:2 ** 6] *= 1e-6
+    state = K.cast(state)
+    exact_size = K.op.save_state(filename, state, chunk_size=2 ** 6)
+    size = K.op.save_state(filename, state, chunk_size=2 ** 6, threshold=1e-8)
+    assert size < exact_size
+    target_state = state.numpy()
+    target_state[:2 ** 6] = 0
+    np.testing.assert_allclose(K.op.load_state(filename, np.complex128),
+                               target_state)
+    with pytest.raises(Exception):
+        K.op.load_state(filename, np.complex64)
+    with pytest.raises(Exception):
+        K.op.load_state(filename, np.complex128, npieces=2)
+
+
+@pytest.mark.parametrize("mmap", [False, True])
+def test_load_state_corrupted(mmap, tmp_path):
+    """Check that ``load_state`` rejects truncated and corrupted files."""
+    import os
+    import struct
+    filename = str(tmp_path / "state.bin")
+    state = random_complex((2 ** 10,))
+    size = K.op.save_state(filename, state, chunk_size=2 ** 7)
+    os.truncate(filename, size - 100)
+    with pytest.raises(K.backend.errors.DataLossError):
+        K.op.load_state(filename, np.complex128, mmap=mmap)
+    # the ``piece_size`` field follows the magic, version, dtype and npieces
+    for piece_size in [0, -2 ** 7, 2 ** 60]:
+        K.op.save_state(filename, state, chunk_size=2 ** 7)
+        with open(filename, "r+b") as file:
+            file.seek(24)
+            file.write(struct.pack("q", piece_size))
+        with pytest.raises(K.backend.errors.DataLossError):
+            K.op.load_state(filename, np.complex128, mmap=mmap)